@@ -0,0 +1,190 @@
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "VgmFile.h"
+
+// VGM header
+#define VGM_VERSION			0x00000151	//!< version 1.51 (first with the YM2203 clock)
+#define VGM_HEADER_SIZE		0x80		//!< header size of version 1.51
+#define VGM_EOF_OFFSET		0x04		//!< offset of (file size - 4)
+#define VGM_VERSION_OFFSET	0x08		//!< offset of version
+#define VGM_TOTAL_SAMPLES	0x18		//!< offset of total samples
+#define VGM_DATA_OFFSET		0x34		//!< offset of (data offset - 0x34)
+#define VGM_YM2203_CLOCK	0x44		//!< offset of YM2203 clock
+
+// VGM commands
+#define VGM_CMD_YM2203		0x55		//!< write a YM2203 register (aa dd)
+#define VGM_CMD_WAIT		0x61		//!< wait n samples (nnnn)
+#define VGM_CMD_WAIT_60HZ	0x62		//!< wait 735 samples
+#define VGM_CMD_WAIT_50HZ	0x63		//!< wait 882 samples
+#define VGM_CMD_END			0x66		//!< end of data
+#define VGM_CMD_WAIT_SHORT	0x70		//!< wait n+1 samples (0x70 - 0x7F)
+
+/**
+ * store a 32bit little endian value.
+ */
+static void storeLE(uint8_t *p, uint32_t value)
+{
+	int i;
+	for(i=0; i<4; i++){
+		p[i] = (uint8_t)((value >> (i * 8)) & 0xFF);
+	}
+}
+
+/**
+ * constructor.
+ */
+VgmFile::VgmFile()
+{
+	m_fp = NULL;
+	m_clock = 0;
+	m_samples = 0;
+	m_writes = 0;
+	m_size = 0;
+}
+
+/**
+ * destructor. (closes the file)
+ */
+VgmFile::~VgmFile()
+{
+	this->close();
+}
+
+/**
+ * create a VGM file.
+ *
+ * @param path file path
+ * @param clock master clock of YM2203 [Hz]
+ * @return true if succeeded
+ */
+bool VgmFile::open(const char* path, uint32_t clock)
+{
+	this->close();
+	m_fp = fopen(path, "wb");
+	if(m_fp == NULL) return false;
+	m_clock = clock;
+	m_samples = 0;
+	m_writes = 0;
+	m_size = VGM_HEADER_SIZE;
+	this->writeHeader();
+	return true;
+}
+
+/**
+ * append a register write.
+ * (writes must be appended in time order)
+ *
+ * @param time time of the write [1/VGM_SAMPLE_RATE sec]
+ * @param addr register address
+ * @param data register value
+ */
+void VgmFile::write(uint32_t time, uint8_t addr, uint8_t data)
+{
+	if(m_fp == NULL) return;
+	this->waitUntil(time);
+	this->putByte(VGM_CMD_YM2203);
+	this->putByte(addr);
+	this->putByte(data);
+	m_writes++;
+}
+
+/**
+ * append waits until the time.
+ *
+ * @param time time [1/VGM_SAMPLE_RATE sec]
+ */
+void VgmFile::waitUntil(uint32_t time)
+{
+	uint32_t wait;
+
+	if(m_fp == NULL) return;
+	while(time > m_samples){
+		wait = time - m_samples;
+		if(wait > 0xFFFF) wait = 0xFFFF;
+		if(wait <= 16){
+			this->putByte((uint8_t)(VGM_CMD_WAIT_SHORT + wait - 1));
+		}else if(wait == 735){
+			this->putByte(VGM_CMD_WAIT_60HZ);
+		}else if(wait == 882){
+			this->putByte(VGM_CMD_WAIT_50HZ);
+		}else{
+			this->putByte(VGM_CMD_WAIT);
+			this->putByte((uint8_t)(wait & 0xFF));
+			this->putByte((uint8_t)(wait >> 8));
+		}
+		m_samples += wait;
+	}
+}
+
+/**
+ * finish the header and close.
+ */
+void VgmFile::close(void)
+{
+	if(m_fp == NULL) return;
+	this->putByte(VGM_CMD_END);
+	fseek(m_fp, 0, SEEK_SET);
+	this->writeHeader();
+	fclose(m_fp);
+	m_fp = NULL;
+}
+
+/**
+ * length of the data.
+ *
+ * @return samples [1/VGM_SAMPLE_RATE sec]
+ */
+uint32_t VgmFile::getSamples(void)
+{
+	return m_samples;
+}
+
+/**
+ * number of register writes.
+ *
+ * @return number of writes
+ */
+uint32_t VgmFile::getWrites(void)
+{
+	return m_writes;
+}
+
+/**
+ * append a byte.
+ */
+void VgmFile::putByte(uint8_t data)
+{
+	fputc(data, m_fp);
+	m_size++;
+}
+
+/**
+ * write the VGM header. (unused fields are 0)
+ */
+void VgmFile::writeHeader(void)
+{
+	uint8_t header[VGM_HEADER_SIZE] = {0};
+
+	header[0] = 'V'; header[1] = 'g'; header[2] = 'm'; header[3] = ' ';
+	storeLE(&header[VGM_EOF_OFFSET], m_size - VGM_EOF_OFFSET);
+	storeLE(&header[VGM_VERSION_OFFSET], VGM_VERSION);
+	storeLE(&header[VGM_TOTAL_SAMPLES], m_samples);
+	storeLE(&header[VGM_DATA_OFFSET], VGM_HEADER_SIZE - VGM_DATA_OFFSET);
+	storeLE(&header[VGM_YM2203_CLOCK], m_clock);
+	fwrite(header, 1, VGM_HEADER_SIZE, m_fp);
+}
@@ -0,0 +1,55 @@
+#ifndef __VGM_FILE_H_
+#define __VGM_FILE_H_
+
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// VGM file writer for PC
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define VGM_SAMPLE_RATE		44100	//!< time base of VGM files [Hz]
+
+/**
+ * VGM file writer class. (version 1.51, a YM2203 only)
+ */
+class VgmFile
+{
+public:
+	VgmFile();					//!< constructor.
+	~VgmFile();					//!< destructor. (closes the file)
+
+	bool open(const char* path, uint32_t clock);			//!< create a VGM file.
+	void write(uint32_t time, uint8_t addr, uint8_t data);	//!< append a register write.
+	void waitUntil(uint32_t time);							//!< append waits until the time.
+	void close(void);										//!< finish the header and close.
+	uint32_t getSamples(void);								//!< length of the data [samples].
+	uint32_t getWrites(void);								//!< number of register writes.
+
+private:
+	FILE *m_fp;					//!< file
+	uint32_t m_clock;			//!< master clock of YM2203 [Hz]
+	uint32_t m_samples;			//!< time of the end of the data [samples]
+	uint32_t m_writes;			//!< number of register writes
+	uint32_t m_size;			//!< file size [byte]
+
+	void putByte(uint8_t data);	//!< append a byte.
+	void writeHeader(void);		//!< write the VGM header.
+};
+
+#endif
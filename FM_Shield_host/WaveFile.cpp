@@ -0,0 +1,124 @@
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "WaveFile.h"
+
+/**
+ * write a little endian value.
+ */
+static void putLE(FILE *fp, uint32_t value, int bytes)
+{
+	int i;
+	for(i=0; i<bytes; i++){
+		fputc((int)((value >> (i * 8)) & 0xFF), fp);
+	}
+}
+
+/**
+ * constructor.
+ */
+WaveFile::WaveFile()
+{
+	m_fp = NULL;
+	m_sampleRate = 0;
+	m_samples = 0;
+}
+
+/**
+ * destructor. (closes the file)
+ */
+WaveFile::~WaveFile()
+{
+	this->close();
+}
+
+/**
+ * create a WAV file.
+ *
+ * @param path file path
+ * @param sampleRate sample rate [Hz]
+ * @return true if succeeded
+ */
+bool WaveFile::open(const char* path, uint32_t sampleRate)
+{
+	this->close();
+	m_fp = fopen(path, "wb");
+	if(m_fp == NULL) return false;
+	m_sampleRate = sampleRate;
+	m_samples = 0;
+	this->writeHeader();
+	return true;
+}
+
+/**
+ * append samples.
+ *
+ * @param samples 16bit mono samples
+ * @param num number of samples
+ */
+void WaveFile::write(const int16_t *samples, int num)
+{
+	int i;
+	if(m_fp == NULL) return;
+	for(i=0; i<num; i++){
+		putLE(m_fp, (uint16_t)samples[i], 2);
+	}
+	m_samples += num;
+}
+
+/**
+ * finish the header and close.
+ */
+void WaveFile::close(void)
+{
+	if(m_fp == NULL) return;
+	fseek(m_fp, 0, SEEK_SET);
+	this->writeHeader();
+	fclose(m_fp);
+	m_fp = NULL;
+}
+
+/**
+ * number of samples written.
+ *
+ * @return number of samples
+ */
+uint32_t WaveFile::getSamples(void)
+{
+	return m_samples;
+}
+
+/**
+ * write the RIFF header.
+ */
+void WaveFile::writeHeader(void)
+{
+	uint32_t dataSize = m_samples * 2;
+
+	fwrite("RIFF", 1, 4, m_fp);
+	putLE(m_fp, 36 + dataSize, 4);
+	fwrite("WAVEfmt ", 1, 8, m_fp);
+	putLE(m_fp, 16, 4);					// fmt chunk size
+	putLE(m_fp, 1, 2);					// PCM
+	putLE(m_fp, 1, 2);					// mono
+	putLE(m_fp, m_sampleRate, 4);
+	putLE(m_fp, m_sampleRate * 2, 4);	// bytes per second
+	putLE(m_fp, 2, 2);					// block align
+	putLE(m_fp, 16, 2);					// bits per sample
+	fwrite("data", 1, 4, m_fp);
+	putLE(m_fp, dataSize, 4);
+}
@@ -0,0 +1,48 @@
+#ifndef __WAVE_FILE_H_
+#define __WAVE_FILE_H_
+
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// WAV file writer for PC
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * 16bit mono WAV file writer class.
+ */
+class WaveFile
+{
+public:
+	WaveFile();					//!< constructor.
+	~WaveFile();				//!< destructor. (closes the file)
+
+	bool open(const char* path, uint32_t sampleRate);	//!< create a WAV file.
+	void write(const int16_t *samples, int num);		//!< append samples.
+	void close(void);									//!< finish the header and close.
+	uint32_t getSamples(void);							//!< number of samples written.
+
+private:
+	FILE *m_fp;					//!< file
+	uint32_t m_sampleRate;		//!< sample rate [Hz]
+	uint32_t m_samples;			//!< number of samples written
+
+	void writeHeader(void);		//!< write the RIFF header.
+};
+
+#endif
@@ -0,0 +1,144 @@
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <thread>
+#include <vector>
+#include "WorkStealingPool.h"
+
+/**
+ * constructor.
+ *
+ * @param workers number of worker threads (0: number of cores)
+ */
+WorkStealingPool::WorkStealingPool(int workers)
+{
+	if(workers <= 0){
+		workers = (int)std::thread::hardware_concurrency();
+		if(workers <= 0) workers = 1;
+	}
+	if(workers > POOL_WORKER_MAX) workers = POOL_WORKER_MAX;
+	m_workers = workers;
+	m_steals = 0;
+	m_func = NULL;
+	m_context = NULL;
+}
+
+/**
+ * destructor.
+ */
+WorkStealingPool::~WorkStealingPool()
+{
+	// nothing to do
+}
+
+/**
+ * number of workers.
+ */
+int WorkStealingPool::getWorkers(void)
+{
+	return m_workers;
+}
+
+/**
+ * number of stolen jobs in the last run().
+ */
+uint32_t WorkStealingPool::getSteals(void)
+{
+	return m_steals;
+}
+
+/**
+ * run jobs and wait for all of them.
+ * no job is added while running, so a worker quits when it finds
+ * all queues empty.
+ *
+ * @param jobs number of jobs (job numbers are 0 to jobs-1)
+ * @param func job function (called from the worker threads)
+ * @param context argument for the job function
+ */
+void WorkStealingPool::run(int jobs, WorkStealingJob func, void* context)
+{
+	std::vector<std::thread> threads;
+	int i;
+
+	m_func = func;
+	m_context = context;
+	m_steals = 0;
+
+	// deal the jobs to the workers
+	for(i=0; i<jobs; i++){
+		m_queue[i % m_workers].jobs.push_back(i);
+	}
+
+	for(i=1; i<m_workers; i++){
+		threads.push_back(std::thread(&WorkStealingPool::workerMain, this, i));
+	}
+	this->workerMain(0);
+	for(i=0; i<(int)threads.size(); i++){
+		threads[i].join();
+	}
+}
+
+/**
+ * take a job from the own queue or steal one.
+ *
+ * @param worker worker number
+ * @param index job number (out)
+ * @return false if no job is left
+ */
+bool WorkStealingPool::takeJob(int worker, int *index)
+{
+	int i;
+	Queue *q = &m_queue[worker];
+
+	// own queue (front)
+	{
+		std::lock_guard<std::mutex> guard(q->lock);
+		if(!q->jobs.empty()){
+			*index = q->jobs.front();
+			q->jobs.pop_front();
+			return true;
+		}
+	}
+
+	// steal from the other queues (back)
+	for(i=1; i<m_workers; i++){
+		q = &m_queue[(worker + i) % m_workers];
+		std::lock_guard<std::mutex> guard(q->lock);
+		if(!q->jobs.empty()){
+			*index = q->jobs.back();
+			q->jobs.pop_back();
+			m_steals++;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * worker thread.
+ *
+ * @param worker worker number
+ */
+void WorkStealingPool::workerMain(int worker)
+{
+	int index;
+
+	while(this->takeJob(worker, &index)){
+		m_func(m_context, index, worker);
+	}
+}
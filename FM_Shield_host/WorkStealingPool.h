@@ -0,0 +1,67 @@
+#ifndef __WORK_STEALING_POOL_H_
+#define __WORK_STEALING_POOL_H_
+
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// work-stealing thread pool for PC tools
+
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <atomic>
+
+#define POOL_WORKER_MAX		64		//!< maximum number of workers
+
+//! job function. (index: job number, worker: worker number)
+typedef void (*WorkStealingJob)(void* context, int index, int worker);
+
+/**
+ * work-stealing thread pool class.
+ * jobs are dealt to the queue of each worker. a worker takes jobs from
+ * the front of its own queue, and steals from the back of the other
+ * queues when its own queue is empty, so long jobs don't leave cores idle.
+ */
+class WorkStealingPool
+{
+public:
+	WorkStealingPool(int workers = 0);	//!< constructor. (0: number of cores)
+	~WorkStealingPool();				//!< destructor.
+
+	void run(int jobs, WorkStealingJob func, void* context);	//!< run jobs and wait for all of them.
+	int getWorkers(void);				//!< number of workers.
+	uint32_t getSteals(void);			//!< number of stolen jobs in the last run().
+
+private:
+	//! job queue of a worker
+	struct Queue
+	{
+		std::mutex lock;			//!< lock of the queue
+		std::deque<int> jobs;		//!< job numbers
+	};
+
+	int m_workers;					//!< number of workers
+	Queue m_queue[POOL_WORKER_MAX];	//!< job queue of each worker
+	std::atomic<uint32_t> m_steals;	//!< number of stolen jobs
+	WorkStealingJob m_func;			//!< job function
+	void* m_context;				//!< argument for the job function
+
+	bool takeJob(int worker, int *index);	//!< take a job from the own queue or steal one.
+	void workerMain(int worker);			//!< worker thread.
+};
+
+#endif
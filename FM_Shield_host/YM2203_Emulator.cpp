@@ -0,0 +1,1075 @@
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "YM2203_Emulator.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define EMU_SIMD_NAME	"AVX2"
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#define EMU_SIMD_NAME	"SSE4.1"
+#endif
+
+// envelope state
+#define EG_ATTACK		0
+#define EG_DECAY		1
+#define EG_SUSTAIN		2
+#define EG_RELEASE		3
+#define EG_OFF			4
+
+#define EG_MAX			1023	//!< silent attenuation
+#define FM_OUT_MAX		8191	//!< FM channel output limit (14bit)
+#define SSG_LEVEL_MAX	2600	//!< SSG channel output at level 15
+
+//! operator of each register slot (offset 0x00, 0x04, 0x08, 0x0c)
+static const uint8_t SLOT_TO_OP[EMU_OP_NUM] = {0, 2, 1, 3};
+
+//! detune table [dt&3][key code] (phase increment)
+static const uint8_t DT_TABLE[4][32] = {
+	{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2,
+	  2, 3, 3, 3, 4, 4, 4, 5, 5, 6, 6, 7, 8, 8, 8, 8 },
+	{ 1, 1, 1, 1, 2, 2, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5,
+	  5, 6, 6, 7, 8, 8, 9,10,11,12,13,14,16,16,16,16 },
+	{ 2, 2, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5, 5, 6, 6, 7,
+	  8, 8, 9,10,11,12,13,14,16,17,19,20,22,22,22,22 }
+};
+
+//! key code of F-Number upper bits
+static const uint8_t FN_TO_KEY[16] = {0,0,0,0,0,0,0,1,2,3,3,3,3,3,3,3};
+
+//! envelope increment table [row*8 + cycle]
+static const uint8_t EG_INC[19*8] = {
+	0,1, 0,1, 0,1, 0,1,		// rates 00..47 (rate&3 = 0)
+	0,1, 0,1, 1,1, 0,1,		// rates 00..47 (rate&3 = 1)
+	0,1, 1,1, 0,1, 1,1,		// rates 00..47 (rate&3 = 2)
+	0,1, 1,1, 1,1, 1,1,		// rates 00..47 (rate&3 = 3)
+	1,1, 1,1, 1,1, 1,1,		// rate 48
+	1,1, 1,2, 1,1, 1,2,		// rate 49
+	1,2, 1,2, 1,2, 1,2,		// rate 50
+	1,2, 2,2, 1,2, 2,2,		// rate 51
+	2,2, 2,2, 2,2, 2,2,		// rate 52
+	2,2, 2,4, 2,2, 2,4,		// rate 53
+	2,4, 2,4, 2,4, 2,4,		// rate 54
+	2,4, 4,4, 2,4, 4,4,		// rate 55
+	4,4, 4,4, 4,4, 4,4,		// rate 56
+	4,4, 4,8, 4,4, 4,8,		// rate 57
+	4,8, 4,8, 4,8, 4,8,		// rate 58
+	4,8, 8,8, 4,8, 8,8,		// rate 59
+	8,8, 8,8, 8,8, 8,8,		// rates 60..63
+	16,16,16,16,16,16,16,16,// (unused)
+	0,0, 0,0, 0,0, 0,0		// rate 0 (infinite)
+};
+
+//! operators feeding each operator [algorithm][operator] (bit mask of OPERATOR_1 - OPERATOR_4)
+static const uint8_t ALG_INPUT[8][EMU_OP_NUM] = {
+	{0x00, 0x01, 0x02, 0x04},	// 1->2->3->4
+	{0x00, 0x00, 0x03, 0x04},	// (1+2)->3->4
+	{0x00, 0x00, 0x02, 0x05},	// (1+(2->3))->4
+	{0x00, 0x01, 0x00, 0x06},	// ((1->2)+3)->4
+	{0x00, 0x01, 0x00, 0x04},	// (1->2)+(3->4)
+	{0x00, 0x01, 0x01, 0x01},	// 1->(2+3+4)
+	{0x00, 0x01, 0x00, 0x00},	// (1->2)+3+4
+	{0x00, 0x00, 0x00, 0x00}	// 1+2+3+4
+};
+
+//! carrier operators of each algorithm (bit mask)
+static const uint8_t ALG_CARRIER[8] = {0x08, 0x08, 0x08, 0x08, 0x0A, 0x0E, 0x0E, 0x0F};
+
+/**
+ * lookup tables (built once at startup)
+ */
+static struct EmulatorTables
+{
+	int32_t  logSin[256];	//!< -log2(sin) of quarter wave (x256)
+	int32_t  exp[256];		//!< 2^x fraction (x1024)
+	int16_t  ssgLevel[16];	//!< SSG output of each level
+
+	EmulatorTables()
+	{
+		int i;
+		for(i=0; i<256; i++){
+			double s = sin(((double)i * 2 + 1) * M_PI / 1024.0);
+			logSin[i] = (int32_t)floor(-log(s) / log(2.0) * 256.0 + 0.5);
+			exp[i] = (int32_t)floor((pow(2.0, (double)i / 256.0) - 1.0) * 1024.0 + 0.5);
+		}
+		// 3dB per level
+		ssgLevel[0] = 0;
+		for(i=1; i<16; i++){
+			ssgLevel[i] = (int16_t)floor(SSG_LEVEL_MAX * pow(2.0, (double)(i - 15) / 2.0) + 0.5);
+		}
+	}
+} s_table;
+
+/**
+ * increment row and counter shift of an envelope rate.
+ *
+ * @param rate envelope rate (0-63)
+ * @param row row of EG_INC (out)
+ * @return counter shift
+ */
+static inline int rateShift(int rate, int *row)
+{
+	if(rate <= 0){
+		*row = 18;
+		return 0;
+	}
+	if(rate < 48){
+		*row = rate & 3;
+		return 11 - (rate >> 2);
+	}
+	if(rate < 60){
+		*row = 4 + (rate - 48);
+		return 0;
+	}
+	*row = 16;
+	return 0;
+}
+
+/**
+ * calculate an operator output.
+ *
+ * @param phase phase (20bit)
+ * @param volume envelope attenuation (including total level)
+ * @param pm phase modulation (10bit phase units)
+ * @return output (14bit signed)
+ */
+static inline int32_t calcOperator(uint32_t phase, int32_t volume, int32_t pm)
+{
+	uint32_t index = ((phase >> 10) + (uint32_t)pm) & 0x3FF;
+	uint32_t quarter = (index & 0x100) ? (~index & 0xFF) : (index & 0xFF);
+	uint32_t att = s_table.logSin[quarter] + ((uint32_t)volume << 2);
+	int32_t out;
+
+	if(att >= (13 << 8)) return 0;
+	out = (int32_t)(((s_table.exp[(att & 0xFF) ^ 0xFF] | 0x400) << 2) >> (att >> 8));
+	return (index & 0x200) ? -out : out;
+}
+
+/**
+ * scalar reference FM kernel.
+ *
+ * @param k operator state
+ * @param volume attenuation of each operator per sample (0-1023)
+ * @param out output of each sample (sum of FM channels)
+ * @param samples number of samples
+ */
+static void kernelScalar(YM2203_FMKernel *k, const int32_t (*volume)[EMU_OP_NUM][EMU_LANES],
+                         int32_t *out, int samples)
+{
+	int n, i, j, c;
+	int32_t op[EMU_OP_NUM][EMU_LANES];
+	int32_t pm, sum, total;
+
+	for(n=0; n<samples; n++){
+		total = 0;
+		for(c=0; c<EMU_LANES; c++){
+			sum = 0;
+			for(i=0; i<EMU_OP_NUM; i++){
+				// phase modulation by the connected operators (or feedback)
+				if(i == 0){
+					pm = ((k->fbOut[0][c] + k->fbOut[1][c]) >> k->fbShift[c]) & k->fbMask[c];
+				}else{
+					pm = 0;
+					for(j=0; j<i; j++){
+						pm += op[j][c] & k->input[i][j][c];
+					}
+					pm >>= 1;
+				}
+				op[i][c] = calcOperator((uint32_t)k->phase[i][c], volume[n][i][c], pm);
+				k->phase[i][c] = (k->phase[i][c] + k->phaseInc[i][c]) & 0xFFFFF;
+				sum += op[i][c] & k->carrier[i][c];
+			}
+			k->fbOut[1][c] = k->fbOut[0][c];
+			k->fbOut[0][c] = op[0][c];
+			if(sum >  FM_OUT_MAX) sum =  FM_OUT_MAX;
+			if(sum < -FM_OUT_MAX) sum = -FM_OUT_MAX;
+			total += sum;
+		}
+		out[n] = total;
+	}
+}
+
+#ifdef EMU_SIMD_NAME
+
+#ifdef __AVX2__
+//! table lookup of 4 lanes
+#define LOOKUP(table, index)	_mm_i32gather_epi32((table), (index), 4)
+//! logical right shift of each lane by its own count
+#define SRLV(x, count)			_mm_srlv_epi32((x), (count))
+//! arithmetic right shift of each lane by its own count
+#define SRAV(x, count)			_mm_srav_epi32((x), (count))
+#else
+//! all bits of the lane set if bit (31 - n) of count is set
+#define BIT_MASK(count, n)		_mm_srai_epi32(_mm_slli_epi32((count), (n)), 31)
+
+/**
+ * table lookup of 4 lanes. (no gather in SSE4.1)
+ */
+static inline __m128i LOOKUP(const int32_t *table, __m128i index)
+{
+	return _mm_set_epi32(table[_mm_extract_epi32(index, 3)], table[_mm_extract_epi32(index, 2)],
+	                     table[_mm_extract_epi32(index, 1)], table[_mm_extract_epi32(index, 0)]);
+}
+
+/**
+ * logical right shift of each lane by its own count (0-15).
+ * (no variable shift in SSE4.1, so shift by each bit of the count)
+ */
+static inline __m128i SRLV(__m128i x, __m128i count)
+{
+	x = _mm_blendv_epi8(x, _mm_srli_epi32(x, 1), BIT_MASK(count, 31));
+	x = _mm_blendv_epi8(x, _mm_srli_epi32(x, 2), BIT_MASK(count, 30));
+	x = _mm_blendv_epi8(x, _mm_srli_epi32(x, 4), BIT_MASK(count, 29));
+	x = _mm_blendv_epi8(x, _mm_srli_epi32(x, 8), BIT_MASK(count, 28));
+	return x;
+}
+
+/**
+ * arithmetic right shift of each lane by its own count (0-15).
+ */
+static inline __m128i SRAV(__m128i x, __m128i count)
+{
+	x = _mm_blendv_epi8(x, _mm_srai_epi32(x, 1), BIT_MASK(count, 31));
+	x = _mm_blendv_epi8(x, _mm_srai_epi32(x, 2), BIT_MASK(count, 30));
+	x = _mm_blendv_epi8(x, _mm_srai_epi32(x, 4), BIT_MASK(count, 29));
+	x = _mm_blendv_epi8(x, _mm_srai_epi32(x, 8), BIT_MASK(count, 28));
+	return x;
+}
+#endif
+
+/**
+ * SIMD FM kernel. computes the operators of all FM channels at once.
+ * (bit exact with kernelScalar())
+ *
+ * @param k operator state
+ * @param volume attenuation of each operator per sample (0-1023)
+ * @param out output of each sample (sum of FM channels)
+ * @param samples number of samples
+ */
+static void kernelSIMD(YM2203_FMKernel *k, const int32_t (*volume)[EMU_OP_NUM][EMU_LANES],
+                       int32_t *out, int samples)
+{
+	int n, i, j;
+	__m128i phase[EMU_OP_NUM], inc[EMU_OP_NUM], carrier[EMU_OP_NUM];
+	__m128i input[EMU_OP_NUM][EMU_OP_NUM];
+	__m128i op[EMU_OP_NUM];
+	__m128i fb0, fb1, fbShift, fbMask;
+	__m128i pm, index, mirror, sign, att, x, sum;
+	const __m128i mask20  = _mm_set1_epi32(0xFFFFF);
+	const __m128i mask10  = _mm_set1_epi32(0x3FF);
+	const __m128i maskFF  = _mm_set1_epi32(0xFF);
+	const __m128i bit8    = _mm_set1_epi32(0x100);
+	const __m128i bit9    = _mm_set1_epi32(0x200);
+	const __m128i bit10   = _mm_set1_epi32(0x400);
+	const __m128i attMax  = _mm_set1_epi32((13 << 8) - 1);
+	const __m128i outMax  = _mm_set1_epi32( FM_OUT_MAX);
+	const __m128i outMin  = _mm_set1_epi32(-FM_OUT_MAX);
+	int32_t lanes[EMU_LANES] __attribute__((aligned(16)));
+
+	for(i=0; i<EMU_OP_NUM; i++){
+		phase[i]   = _mm_load_si128((const __m128i*)k->phase[i]);
+		inc[i]     = _mm_load_si128((const __m128i*)k->phaseInc[i]);
+		carrier[i] = _mm_load_si128((const __m128i*)k->carrier[i]);
+		for(j=0; j<i; j++){
+			input[i][j] = _mm_load_si128((const __m128i*)k->input[i][j]);
+		}
+	}
+	fb0     = _mm_load_si128((const __m128i*)k->fbOut[0]);
+	fb1     = _mm_load_si128((const __m128i*)k->fbOut[1]);
+	fbShift = _mm_load_si128((const __m128i*)k->fbShift);
+	fbMask  = _mm_load_si128((const __m128i*)k->fbMask);
+
+	for(n=0; n<samples; n++){
+		sum = _mm_setzero_si128();
+		for(i=0; i<EMU_OP_NUM; i++){
+			// phase modulation by the connected operators (or feedback)
+			if(i == 0){
+				pm = _mm_and_si128(SRAV(_mm_add_epi32(fb0, fb1), fbShift), fbMask);
+			}else{
+				pm = _mm_and_si128(op[0], input[i][0]);
+				for(j=1; j<i; j++){
+					pm = _mm_add_epi32(pm, _mm_and_si128(op[j], input[i][j]));
+				}
+				pm = _mm_srai_epi32(pm, 1);
+			}
+
+			// log-sin lookup of the quarter wave
+			index  = _mm_and_si128(_mm_add_epi32(_mm_srli_epi32(phase[i], 10), pm), mask10);
+			mirror = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(index, bit8), bit8), maskFF);
+			att = LOOKUP(s_table.logSin, _mm_and_si128(_mm_xor_si128(index, mirror), maskFF));
+			att = _mm_add_epi32(att, _mm_slli_epi32(
+			          _mm_load_si128((const __m128i*)volume[n][i]), 2));
+
+			// exponential lookup and shift by the integer part
+			x = LOOKUP(s_table.exp, _mm_xor_si128(_mm_and_si128(att, maskFF), maskFF));
+			x = _mm_slli_epi32(_mm_or_si128(x, bit10), 2);
+			x = SRLV(x, _mm_srli_epi32(_mm_min_epi32(att, attMax), 8));
+			x = _mm_andnot_si128(_mm_cmpgt_epi32(att, attMax), x);
+
+			// sign of the wave
+			sign = _mm_cmpeq_epi32(_mm_and_si128(index, bit9), bit9);
+			op[i] = _mm_sub_epi32(_mm_xor_si128(x, sign), sign);
+
+			phase[i] = _mm_and_si128(_mm_add_epi32(phase[i], inc[i]), mask20);
+			sum = _mm_add_epi32(sum, _mm_and_si128(op[i], carrier[i]));
+		}
+		fb1 = fb0;
+		fb0 = op[0];
+		sum = _mm_max_epi32(_mm_min_epi32(sum, outMax), outMin);
+
+		// sum of the lanes
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+		out[n] = _mm_cvtsi128_si32(sum);
+	}
+
+	for(i=0; i<EMU_OP_NUM; i++){
+		_mm_store_si128((__m128i*)lanes, phase[i]);
+		memcpy(k->phase[i], lanes, sizeof(lanes));
+	}
+	_mm_store_si128((__m128i*)k->fbOut[0], fb0);
+	_mm_store_si128((__m128i*)k->fbOut[1], fb1);
+}
+
+#endif
+
+/**
+ * constructor.
+ *
+ * @param clock master clock [Hz]
+ */
+YM2203_Emulator::YM2203_Emulator(uint32_t clock)
+{
+	m_clock = clock;
+#ifdef EMU_SIMD_NAME
+	m_kernelType = EMU_KERNEL_SIMD;
+#else
+	m_kernelType = EMU_KERNEL_SCALAR;
+#endif
+	m_ssgType = EMU_SSG_BLOCK;
+	this->reset();
+}
+
+/**
+ * destructor.
+ */
+YM2203_Emulator::~YM2203_Emulator()
+{
+	// nothing to do
+}
+
+/**
+ * reset the device.
+ */
+void YM2203_Emulator::reset(void)
+{
+	int ch, op;
+
+	memset(m_reg, 0, sizeof(m_reg));
+	memset(m_ch, 0, sizeof(m_ch));
+	memset(m_tone, 0, sizeof(m_tone));
+	memset(&m_kernel, 0, sizeof(m_kernel));
+	m_kernelDirty = true;
+	for(ch=0; ch<EMU_FM_CH_NUM; ch++){
+		for(op=0; op<EMU_OP_NUM; op++){
+			m_ch[ch].op[op].volume = EG_MAX;
+			m_ch[ch].op[op].state = EG_OFF;
+		}
+	}
+	m_fnumLatch = 0;
+	m_egCounter = 0;
+	m_egTimer = 0;
+	m_noisePeriod = 0;
+	m_noiseCount = 0;
+	m_noiseShift = 1;
+	m_envPeriod = 0;
+	m_envCount = 0;
+	m_envStep = 0;
+	m_envAttack = 0;
+	m_envHold = true;
+	m_envAlternate = false;
+	m_envHolding = true;
+	m_ssgClock = 0;
+	m_timeRest = 0;
+	m_reg[0x07] = 0xFF;
+}
+
+/**
+ * hook for YM2203_simBus.
+ *
+ * @param context pointer to YM2203_Emulator
+ * @param addr register address
+ * @param data value written
+ */
+void YM2203_Emulator::busHook(void* context, uint8_t addr, uint8_t data)
+{
+	((YM2203_Emulator*)context)->write(addr, data);
+}
+
+/**
+ * write a register value.
+ *
+ * @param addr register address
+ * @param data value to write
+ */
+void YM2203_Emulator::write(uint8_t addr, uint8_t data)
+{
+	m_reg[addr] = data;
+	if(addr < 0x10){
+		this->writeSSG(addr, data);
+	}else{
+		this->writeFM(addr, data);
+	}
+}
+
+/**
+ * read a register value. (SSG registers are readable)
+ *
+ * @param addr register address
+ * @return register value
+ */
+uint8_t YM2203_Emulator::read(uint8_t addr)
+{
+	return (addr < 0x10) ? m_reg[addr] : 0x00;
+}
+
+/**
+ * read status. (timers are not emulated, never busy)
+ *
+ * @return status
+ */
+uint8_t YM2203_Emulator::readStatus(void)
+{
+	return 0x00;
+}
+
+/**
+ * output sample rate.
+ *
+ * @return sample rate [Hz]
+ */
+uint32_t YM2203_Emulator::getSampleRate(void)
+{
+	return m_clock / 72;
+}
+
+/**
+ * number of samples for an interval.
+ * the fraction is carried over to the next call.
+ *
+ * @param interval interval [ns]
+ * @return number of samples
+ */
+int YM2203_Emulator::samplesFor(uint32_t interval)
+{
+	uint64_t total = m_timeRest + (uint64_t)interval * this->getSampleRate();
+	int samples = (int)(total / 1000000000ULL);
+
+	m_timeRest = total % 1000000000ULL;
+	return samples;
+}
+
+/**
+ * write a SSG register.
+ */
+void YM2203_Emulator::writeSSG(uint8_t addr, uint8_t data)
+{
+	int ch;
+
+	switch(addr){
+	case 0x00: case 0x01: case 0x02: case 0x03: case 0x04: case 0x05:
+		ch = addr >> 1;
+		m_tone[ch].period = (uint16_t)(m_reg[ch*2] | ((m_reg[ch*2+1] & 0x0F) << 8));
+		break;
+	case 0x06:
+		m_noisePeriod = data & 0x1F;
+		break;
+	case 0x08: case 0x09: case 0x0A:
+		m_tone[addr - 0x08].level = data & 0x1F;
+		break;
+	case 0x0B: case 0x0C:
+		m_envPeriod = m_reg[0x0B] | (m_reg[0x0C] << 8);
+		break;
+	case 0x0D:
+		// writing the shape restarts the envelope
+		m_envAttack = (data & 0x04) ? 0x0F : 0x00;
+		if(data & 0x08){
+			m_envHold = (data & 0x01) != 0;
+			m_envAlternate = (data & 0x02) != 0;
+		}else{
+			m_envHold = true;
+			m_envAlternate = (m_envAttack != 0);
+		}
+		m_envStep = 15;
+		m_envCount = 0;
+		m_envHolding = false;
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * write a FM register.
+ */
+void YM2203_Emulator::writeFM(uint8_t addr, uint8_t data)
+{
+	Channel *ch;
+	Operator *op;
+	int c;
+
+	// key on/off
+	if(addr == 0x28){
+		c = data & 0x03;
+		if(c < EMU_FM_CH_NUM) this->keyOn(&m_ch[c], data >> 4);
+		return;
+	}
+	if(addr < 0x30) return;		// timers, prescalers and test
+
+	c = addr & 0x03;
+	if(c >= EMU_FM_CH_NUM) return;
+	ch = &m_ch[c];
+
+	// F-Number, block and algorithm
+	if(addr >= 0xA0){
+		switch(addr & 0xFC){
+		case 0xA4:
+			m_fnumLatch = data & 0x3F;
+			break;
+		case 0xA0:
+			ch->fnum  = (uint16_t)(((m_fnumLatch & 0x07) << 8) | data);
+			ch->block = (m_fnumLatch >> 3) & 0x07;
+			ch->keyCode = (uint8_t)((ch->block << 2) | FN_TO_KEY[ch->fnum >> 7]);
+			this->updatePhase(ch);
+			break;
+		case 0xB0:
+			ch->algorithm = data & 0x07;
+			ch->feedback  = (data >> 3) & 0x07;
+			m_kernelDirty = true;
+			break;
+		}
+		return;
+	}
+
+	// operator parameters
+	op = &ch->op[SLOT_TO_OP[(addr >> 2) & 0x03]];
+	switch(addr & 0xF0){
+	case 0x30:
+		op->dt  = (data >> 4) & 0x07;
+		op->mul = data & 0x0F;
+		this->updatePhase(ch);
+		break;
+	case 0x40:
+		op->tl = data & 0x7F;
+		break;
+	case 0x50:
+		op->ks = (data >> 6) & 0x03;
+		op->ar = data & 0x1F;
+		this->updatePhase(ch);
+		break;
+	case 0x60:
+		op->dr = data & 0x1F;
+		break;
+	case 0x70:
+		op->sr = data & 0x1F;
+		break;
+	case 0x80:
+		op->sl = (data >> 4) & 0x0F;
+		op->rr = data & 0x0F;
+		break;
+	}
+}
+
+/**
+ * key on/off operators of a channel.
+ *
+ * @param ch channel
+ * @param mask key-on operators (bit0-3: OPERATOR_1 - OPERATOR_4)
+ */
+void YM2203_Emulator::keyOn(Channel *ch, uint8_t mask)
+{
+	int i;
+	Operator *op;
+
+	for(i=0; i<EMU_OP_NUM; i++){
+		op = &ch->op[i];
+		if(mask & (1 << i)){
+			if((op->state == EG_RELEASE) || (op->state == EG_OFF)){
+				m_kernel.phase[i][ch - m_ch] = 0;
+				op->state = EG_ATTACK;
+				// too fast attack rate finishes at once
+				if((op->ar * 2 + op->keyScaleRate) >= 62){
+					op->volume = 0;
+					op->state = EG_DECAY;
+				}
+			}
+		}else{
+			if(op->state != EG_OFF) op->state = EG_RELEASE;
+		}
+	}
+}
+
+/**
+ * update phase increments and key scale rates of a channel.
+ *
+ * @param ch channel
+ */
+void YM2203_Emulator::updatePhase(Channel *ch)
+{
+	int i;
+	Operator *op;
+	int32_t base = (int32_t)((ch->fnum << ch->block) >> 1);
+	int32_t inc;
+
+	for(i=0; i<EMU_OP_NUM; i++){
+		op = &ch->op[i];
+		inc = DT_TABLE[op->dt & 0x03][ch->keyCode];
+		inc = (op->dt & 0x04) ? base - inc : base + inc;
+		inc &= 0x1FFFF;
+		op->phaseInc = (op->mul == 0) ? (uint32_t)inc >> 1 : (uint32_t)inc * op->mul;
+		op->keyScaleRate = ch->keyCode >> (3 - op->ks);
+	}
+	m_kernelDirty = true;
+}
+
+/**
+ * copy the FM channel parameters to the kernel state.
+ */
+void YM2203_Emulator::updateKernel(void)
+{
+	int c, i, j;
+	Channel *ch;
+
+	for(c=0; c<EMU_FM_CH_NUM; c++){
+		ch = &m_ch[c];
+		for(i=0; i<EMU_OP_NUM; i++){
+			m_kernel.phaseInc[i][c] = (int32_t)ch->op[i].phaseInc;
+			m_kernel.carrier[i][c] = (ALG_CARRIER[ch->algorithm] & (1 << i)) ? -1 : 0;
+			for(j=0; j<EMU_OP_NUM; j++){
+				m_kernel.input[i][j][c] = (ALG_INPUT[ch->algorithm][i] & (1 << j)) ? -1 : 0;
+			}
+		}
+		m_kernel.fbShift[c] = 10 - ch->feedback;
+		m_kernel.fbMask[c] = ch->feedback ? -1 : 0;
+	}
+	m_kernelDirty = false;
+}
+
+/**
+ * select the FM kernel.
+ *
+ * @param kernel EMU_KERNEL_SCALAR or EMU_KERNEL_SIMD
+ */
+void YM2203_Emulator::setKernel(int kernel)
+{
+	const char *name;
+
+	// without the SIMD kernel compiled in, the scalar kernel is always used
+	m_kernelType = this->getSimdKernelName(&name) ? kernel : EMU_KERNEL_SCALAR;
+}
+
+/**
+ * select the SSG generator.
+ *
+ * @param kernel EMU_SSG_STEP or EMU_SSG_BLOCK
+ */
+void YM2203_Emulator::setSSGKernel(int kernel)
+{
+	m_ssgType = kernel;
+}
+
+/**
+ * SIMD instruction set compiled in.
+ *
+ * @param name name of the instruction set (out)
+ * @return true if a SIMD kernel is available
+ */
+int YM2203_Emulator::getSimdKernelName(const char** name)
+{
+#ifdef EMU_SIMD_NAME
+	*name = EMU_SIMD_NAME;
+	return true;
+#else
+	*name = "none";
+	return false;
+#endif
+}
+
+/**
+ * clock the envelope generators. (every 3 samples)
+ */
+void YM2203_Emulator::clockEnvelope(void)
+{
+	int c, i, rate, row, shift;
+	Operator *op;
+	int32_t sl;
+
+	m_egCounter++;
+	for(c=0; c<EMU_FM_CH_NUM; c++){
+		for(i=0; i<EMU_OP_NUM; i++){
+			op = &m_ch[c].op[i];
+			switch(op->state){
+			case EG_ATTACK:	rate = op->ar ? op->ar * 2 + op->keyScaleRate : 0;	break;
+			case EG_DECAY:	rate = op->dr ? op->dr * 2 + op->keyScaleRate : 0;	break;
+			case EG_SUSTAIN:rate = op->sr ? op->sr * 2 + op->keyScaleRate : 0;	break;
+			case EG_RELEASE:rate = op->rr * 4 + 2 + op->keyScaleRate;			break;
+			default:		continue;
+			}
+			if(rate > 63) rate = 63;
+			shift = rateShift(rate, &row);
+			if(m_egCounter & ((1 << shift) - 1)) continue;
+			rate = EG_INC[row * 8 + ((m_egCounter >> shift) & 7)];
+
+			switch(op->state){
+			case EG_ATTACK:
+				op->volume += (~op->volume * rate) >> 4;
+				if(op->volume <= 0){
+					op->volume = 0;
+					op->state = EG_DECAY;
+				}
+				break;
+			case EG_DECAY:
+				sl = (op->sl == 15) ? (31 << 5) : (op->sl << 5);
+				op->volume += rate;
+				if(op->volume >= sl) op->state = EG_SUSTAIN;
+				break;
+			case EG_SUSTAIN:
+				op->volume += rate;
+				if(op->volume > EG_MAX) op->volume = EG_MAX;
+				break;
+			case EG_RELEASE:
+				op->volume += rate;
+				if(op->volume >= EG_MAX){
+					op->volume = EG_MAX;
+					op->state = EG_OFF;
+				}
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * clock the SSG generators once. (master clock / 16)
+ */
+void YM2203_Emulator::clockSSG(void)
+{
+	int ch;
+	uint32_t period;
+
+	// tone generators
+	for(ch=0; ch<EMU_SSG_CH_NUM; ch++){
+		Tone *t = &m_tone[ch];
+		if(++t->count >= (t->period ? t->period : 1)){
+			t->count = 0;
+			t->output ^= 1;
+		}
+	}
+
+	// noise generator (17bit LFSR)
+	if(++m_noiseCount >= (uint16_t)((m_noisePeriod ? m_noisePeriod : 1) * 2)){
+		m_noiseCount = 0;
+		m_noiseShift = (m_noiseShift >> 1) |
+		               (((m_noiseShift ^ (m_noiseShift >> 3)) & 1) << 16);
+	}
+
+	// envelope generator (16 steps)
+	period = (m_envPeriod ? m_envPeriod : 1) * 16;
+	if(!m_envHolding && (++m_envCount >= period)){
+		m_envCount = 0;
+		if(--m_envStep < 0){
+			if(m_envHold){
+				if(m_envAlternate) m_envAttack ^= 0x0F;
+				m_envHolding = true;
+				m_envStep = 0;
+			}else{
+				if(m_envAlternate) m_envAttack ^= 0x0F;
+				m_envStep = 15;
+			}
+		}
+	}
+}
+
+/**
+ * advance a tone or noise counter by several SSG clocks.
+ *
+ * @param count counter (in/out)
+ * @param period period [SSG clocks] (1 or more)
+ * @param steps SSG clocks
+ * @return number of the periods which ended (output toggles)
+ */
+static inline uint32_t skipCounter(uint16_t *count, uint32_t period, uint32_t steps)
+{
+	uint32_t c = *count;
+	uint32_t ends = 0;
+
+	if(steps == 0) return 0;
+	// the counter is over a shortened period: it ends at the next clock
+	if(c >= period){
+		c = 0;
+		ends = 1;
+		steps--;
+	}
+	if(steps < period - c){
+		*count = (uint16_t)(c + steps);
+		return ends;
+	}
+	steps -= period - c;
+	*count = (uint16_t)(steps % period);
+	return ends + 1 + steps / period;
+}
+
+/**
+ * clock the SSG generators several times at once.
+ * the envelope must not step in them. (see nextSSGChange)
+ *
+ * @param steps SSG clocks
+ */
+void YM2203_Emulator::skipSSG(uint32_t steps)
+{
+	int ch;
+	uint32_t ends;
+
+	if(steps == 0) return;
+	for(ch=0; ch<EMU_SSG_CH_NUM; ch++){
+		Tone *t = &m_tone[ch];
+		ends = skipCounter(&t->count, t->period ? t->period : 1, steps);
+		t->output ^= (uint8_t)(ends & 1);
+	}
+	ends = skipCounter(&m_noiseCount, (m_noisePeriod ? m_noisePeriod : 1) * 2, steps);
+	
+	// the LFSR shifts in (bit0 ^ bit3) at bit16, so up to 14 shifts only use the old bits
+	for(; ends >= 12; ends -= 12){
+		m_noiseShift = (m_noiseShift >> 12) |
+		               (((m_noiseShift ^ (m_noiseShift >> 3)) & 0xFFF) << 5);
+	}
+	while(ends-- > 0){
+		m_noiseShift = (m_noiseShift >> 1) |
+		               (((m_noiseShift ^ (m_noiseShift >> 3)) & 1) << 16);
+	}
+	if(!m_envHolding) m_envCount += steps;
+}
+
+/**
+ * SSG clocks until the output of the mixer may change.
+ * (the next toggle of an audible tone or noise, or the next step of the envelope)
+ *
+ * @param audible bit 0-2: tone A-C, bit 3: noise
+ * @return SSG clocks (1: at the next clock)
+ */
+uint32_t YM2203_Emulator::nextSSGChange(uint8_t audible)
+{
+	int ch;
+	uint32_t wait = 0xFFFFFFFF;
+	uint32_t period, next;
+
+	for(ch=0; ch<EMU_SSG_CH_NUM; ch++){
+		if((audible & (0x01 << ch)) == 0) continue;
+		period = m_tone[ch].period ? m_tone[ch].period : 1;
+		next = (m_tone[ch].count < period) ? period - m_tone[ch].count : 1;
+		if(next < wait) wait = next;
+	}
+	if(audible & 0x08){
+		period = (m_noisePeriod ? m_noisePeriod : 1) * 2;
+		next = (m_noiseCount < period) ? period - m_noiseCount : 1;
+		if(next < wait) wait = next;
+	}
+	if(!m_envHolding){
+		period = (m_envPeriod ? m_envPeriod : 1) * 16;
+		next = (m_envCount < period) ? period - m_envCount : 1;
+		if(next < wait) wait = next;
+	}
+	return wait;
+}
+
+/**
+ * output of the SSG mixer at an SSG clock.
+ *
+ * @return output
+ */
+int32_t YM2203_Emulator::mixSSG(void)
+{
+	int ch;
+	int32_t sum = 0;
+	uint8_t mix = m_reg[0x07];
+	uint8_t level, on;
+
+	for(ch=0; ch<EMU_SSG_CH_NUM; ch++){
+		bool toneOff  = (mix & (0x01 << ch)) != 0;
+		bool noiseOff = (mix & (0x08 << ch)) != 0;
+		if(toneOff && noiseOff) continue;
+		on = (toneOff || m_tone[ch].output) && (noiseOff || (m_noiseShift & 1));
+		level = m_tone[ch].level;
+		level = (level & 0x10) ? (uint8_t)((m_envStep ^ m_envAttack) & 0x0F) : (level & 0x0F);
+		sum += on ? s_table.ssgLevel[level] : -s_table.ssgLevel[level];
+	}
+	return sum;
+}
+
+/**
+ * calculate one sample of the SSG channels. (reference generator)
+ * the SSG runs at (master clock / 16), so several steps are averaged.
+ *
+ * @return output
+ */
+int32_t YM2203_Emulator::calcSSG(void)
+{
+	int steps = 0;
+	int32_t sum = 0;
+
+	m_ssgClock += 72;
+	while(m_ssgClock >= 16){
+		m_ssgClock -= 16;
+		steps++;
+		this->clockSSG();
+		sum += this->mixSSG();
+	}
+	return steps ? sum / steps : 0;
+}
+
+/**
+ * add a block of samples of the SSG channels. (bit exact with calcSSG())
+ * the mixer output holds between the changes of the audible generators,
+ * so the SSG clocks up to the next change are summed at once.
+ * the silent tones and noise are clocked in closed form at the next change.
+ *
+ * @param out output to add the samples to
+ * @param samples number of samples
+ */
+void YM2203_Emulator::calcSSGBlock(int32_t *out, int samples)
+{
+	int n, ch;
+	uint32_t steps, total, run, wait;
+	uint32_t lazy = 0;				// SSG clocks summed but not clocked yet
+	uint8_t mix = m_reg[0x07];
+	uint8_t audible = 0;
+	int32_t value, sum;
+
+	// a channel at level 0 outputs nothing whatever its tone and noise
+	for(ch=0; ch<EMU_SSG_CH_NUM; ch++){
+		if((m_tone[ch].level & 0x1F) == 0) continue;
+		if((mix & (0x01 << ch)) == 0) audible |= (uint8_t)(0x01 << ch);
+		if((mix & (0x08 << ch)) == 0) audible |= 0x08;
+	}
+	value = this->mixSSG();
+	wait = this->nextSSGChange(audible);
+
+	for(n=0; n<samples; n++){
+		m_ssgClock += 72;
+		total = steps = m_ssgClock >> 4;
+		m_ssgClock &= 0x0F;
+		sum = 0;
+		while(steps > 0){
+			if(wait > 1){
+				// no change: the same output
+				run = (steps < wait - 1) ? steps : wait - 1;
+				sum += value * (int32_t)run;
+				lazy += run;
+				steps -= run;
+				wait -= run;
+			}else{
+				// an audible change at this clock
+				this->skipSSG(lazy);
+				lazy = 0;
+				this->clockSSG();
+				value = this->mixSSG();
+				sum += value;
+				steps--;
+				wait = this->nextSSGChange(audible);
+			}
+		}
+		out[n] += sum / (int32_t)total;
+	}
+	this->skipSSG(lazy);
+}
+
+/**
+ * render PCM samples.
+ *
+ * @param buffer output buffer (16bit mono)
+ * @param samples number of samples
+ */
+void YM2203_Emulator::render(int16_t *buffer, int samples)
+{
+	int32_t volume[EMU_BLOCK][EMU_OP_NUM][EMU_LANES] __attribute__((aligned(16)));
+	int32_t current[EMU_OP_NUM][EMU_LANES];
+	int32_t fm[EMU_BLOCK];
+	int block, n, c, i;
+	int32_t out, vol;
+	bool updated = true;
+
+	// the padding lane is always silent
+	for(i=0; i<EMU_OP_NUM; i++){
+		for(c=EMU_FM_CH_NUM; c<EMU_LANES; c++) current[i][c] = EG_MAX;
+	}
+
+	if(m_kernelDirty) this->updateKernel();
+
+	while(samples > 0){
+		block = (samples < EMU_BLOCK) ? samples : EMU_BLOCK;
+
+		// envelope generators run at 1/3 of the sample rate
+		for(n=0; n<block; n++){
+			if(++m_egTimer >= 3){
+				m_egTimer = 0;
+				this->clockEnvelope();
+				updated = true;
+			}
+			if(updated){
+				for(c=0; c<EMU_FM_CH_NUM; c++){
+					for(i=0; i<EMU_OP_NUM; i++){
+						vol = m_ch[c].op[i].volume + (m_ch[c].op[i].tl << 3);
+						current[i][c] = (vol > EG_MAX) ? EG_MAX : vol;
+					}
+				}
+				updated = false;
+			}
+			memcpy(volume[n], current, sizeof(current));
+		}
+
+		// operators of all FM channels
+#ifdef EMU_SIMD_NAME
+		if(m_kernelType == EMU_KERNEL_SIMD){
+			kernelSIMD(&m_kernel, volume, fm, block);
+		}else
+#endif
+		{
+			kernelScalar(&m_kernel, volume, fm, block);
+		}
+
+		// SSG channels
+		if(m_ssgType == EMU_SSG_BLOCK){
+			this->calcSSGBlock(fm, block);
+		}else{
+			for(n=0; n<block; n++) fm[n] += this->calcSSG();
+		}
+
+		for(n=0; n<block; n++){
+			out = fm[n];
+			if(out >  32767) out =  32767;
+			if(out < -32768) out = -32768;
+			buffer[n] = (int16_t)out;
+		}
+		buffer += block;
+		samples -= block;
+	}
+}
@@ -0,0 +1,154 @@
+#ifndef __YM2203_EMULATOR_H_
+#define __YM2203_EMULATOR_H_
+
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// software YM2203 for PC (PC_DEBUG build only)
+
+#include <stdint.h>
+
+#define EMU_FM_CH_NUM		3		//!< FM channels
+#define EMU_OP_NUM			4		//!< operators per FM channel
+#define EMU_SSG_CH_NUM		3		//!< SSG channels
+#define EMU_LANES			4		//!< SIMD lanes of the FM kernel (FM channels + padding)
+#define EMU_BLOCK			64		//!< samples rendered by the FM kernel at once
+
+// FM kernel
+#define EMU_KERNEL_SCALAR	0		//!< scalar reference kernel
+#define EMU_KERNEL_SIMD		1		//!< SIMD kernel (AVX2 or SSE4.1, if compiled in)
+
+// SSG generator
+#define EMU_SSG_STEP		0		//!< reference generator (every SSG clock)
+#define EMU_SSG_BLOCK		1		//!< block generator (skips the SSG clocks without an audible change)
+
+/**
+ * FM operator state of all channels in structure-of-arrays layout.
+ * lane n is FM channel n, the last lane is padding (always silent).
+ */
+struct YM2203_FMKernel
+{
+	int32_t phase   [EMU_OP_NUM][EMU_LANES];	//!< phase (20bit, 1 cycle = 2^20)
+	int32_t phaseInc[EMU_OP_NUM][EMU_LANES];	//!< phase increment per sample
+	int32_t input   [EMU_OP_NUM][EMU_OP_NUM][EMU_LANES];	//!< -1 if operator [j] feeds operator [i]
+	int32_t carrier [EMU_OP_NUM][EMU_LANES];	//!< -1 if the operator is a carrier
+	int32_t fbOut   [2][EMU_LANES];				//!< last two outputs of operator 1
+	int32_t fbShift [EMU_LANES];				//!< feedback shift (10 - feedback)
+	int32_t fbMask  [EMU_LANES];				//!< -1 if feedback is enabled
+} __attribute__((aligned(16)));
+
+/**
+ * software YM2203 class.
+ * renders FM and SSG output as 16bit mono PCM at (master clock / 72) Hz.
+ */
+class YM2203_Emulator
+{
+public:
+	YM2203_Emulator(uint32_t clock = 4000000);	//!< constructor.
+	~YM2203_Emulator();							//!< destructor.
+
+	void reset(void);							//!< reset the device.
+	void write(uint8_t addr, uint8_t data);		//!< write a register value.
+	uint8_t read(uint8_t addr);					//!< read a register value.
+	uint8_t readStatus(void);					//!< read status.
+	void render(int16_t *buffer, int samples);	//!< render PCM samples.
+	void setKernel(int kernel);					//!< select the FM kernel.
+	void setSSGKernel(int kernel);				//!< select the SSG generator.
+	static int getSimdKernelName(const char** name);	//!< SIMD instruction set compiled in.
+	int samplesFor(uint32_t interval);			//!< number of samples for an interval [ns].
+	uint32_t getSampleRate(void);				//!< output sample rate [Hz].
+
+	static void busHook(void* context, uint8_t addr, uint8_t data);	//!< hook for YM2203_simBus.
+
+private:
+	//! FM operator
+	struct Operator
+	{
+		uint32_t phaseInc;	//!< phase increment per sample
+		int32_t  volume;	//!< envelope attenuation (0:max - 1023:silent)
+		uint8_t  state;		//!< envelope state
+		uint8_t  dt;		//!< detune (3bit)
+		uint8_t  mul;		//!< multiple
+		uint8_t  tl;		//!< total level
+		uint8_t  ks;		//!< key scale
+		uint8_t  ar;		//!< attack rate
+		uint8_t  dr;		//!< decay rate
+		uint8_t  sr;		//!< sustain rate
+		uint8_t  sl;		//!< sustain level
+		uint8_t  rr;		//!< release rate
+		uint8_t  keyScaleRate;	//!< rate offset by key code
+	};
+
+	//! FM channel
+	struct Channel
+	{
+		Operator op[EMU_OP_NUM];	//!< operators (OPERATOR_1 - OPERATOR_4)
+		uint16_t fnum;		//!< F-Number
+		uint8_t  block;		//!< block
+		uint8_t  keyCode;	//!< key code
+		uint8_t  algorithm;	//!< algorithm
+		uint8_t  feedback;	//!< feedback
+	};
+
+	//! SSG channel
+	struct Tone
+	{
+		uint16_t period;	//!< tone period
+		uint16_t count;		//!< tone counter
+		uint8_t  output;	//!< tone output (0/1)
+		uint8_t  level;		//!< level and envelope mode
+	};
+
+	uint32_t m_clock;				//!< master clock [Hz]
+	uint8_t  m_reg[256];			//!< register values
+	uint8_t  m_fnumLatch;			//!< latch of FREQ_H (shared by channels)
+	Channel  m_ch[EMU_FM_CH_NUM];	//!< FM channels
+	YM2203_FMKernel m_kernel;		//!< FM operator state for the kernel
+	bool     m_kernelDirty;			//!< FM parameters changed since the last render
+	int      m_kernelType;			//!< EMU_KERNEL_SCALAR or EMU_KERNEL_SIMD
+	int      m_ssgType;				//!< EMU_SSG_STEP or EMU_SSG_BLOCK
+	uint32_t m_egCounter;			//!< envelope generator counter
+	uint8_t  m_egTimer;				//!< envelope generator clock divider
+	Tone     m_tone[EMU_SSG_CH_NUM];	//!< SSG tone channels
+	uint16_t m_noisePeriod;			//!< noise period
+	uint16_t m_noiseCount;			//!< noise counter
+	uint32_t m_noiseShift;			//!< noise LFSR (17bit)
+	uint32_t m_envPeriod;			//!< SSG envelope period
+	uint32_t m_envCount;			//!< SSG envelope counter
+	int8_t   m_envStep;				//!< SSG envelope step (15 - 0)
+	uint8_t  m_envAttack;			//!< SSG envelope attack mask (0x00/0x0F)
+	bool     m_envHold;				//!< SSG envelope hold
+	bool     m_envAlternate;		//!< SSG envelope alternate
+	bool     m_envHolding;			//!< SSG envelope is holding
+	uint32_t m_ssgClock;			//!< SSG clock remainder
+	uint64_t m_timeRest;			//!< remainder of samplesFor() [ns * sample rate]
+
+	void writeFM(uint8_t addr, uint8_t data);
+	void writeSSG(uint8_t addr, uint8_t data);
+	void keyOn(Channel *ch, uint8_t mask);
+	void updatePhase(Channel *ch);
+	void clockEnvelope(void);
+	void updateKernel(void);
+	void clockSSG(void);
+	void skipSSG(uint32_t steps);
+	uint32_t nextSSGChange(uint8_t audible);
+	int32_t mixSSG(void);
+	int32_t calcSSG(void);
+	void calcSSGBlock(int32_t *out, int samples);
+};
+
+#endif
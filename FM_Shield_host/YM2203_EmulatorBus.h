@@ -0,0 +1,64 @@
+#ifndef __YM2203_EMULATOR_BUS_H_
+#define __YM2203_EMULATOR_BUS_H_
+
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// bus policy to drive the software YM2203 directly (PC_DEBUG build only)
+
+#include "YM2203.h"
+#include "YM2203_Emulator.h"
+
+/**
+ * emulator bus. the driver writes to a YM2203_Emulator without the
+ * simulated bus timing. (usage: YM2203_Driver<YM2203_EmulatorBus>)
+ */
+class YM2203_EmulatorBus
+{
+public:
+	YM2203_EmulatorBus() : m_emulator(NULL), m_addr(0), m_time(0), m_ticks(0) {}
+
+	//! set the emulator.
+	void attach(YM2203_Emulator *emulator) { m_emulator = emulator; }
+
+	//! no device to select. (each device has its own emulator)
+	void setChip(int chip) { (void)chip; }
+
+	//! reset the emulator.
+	void begin(void) { m_emulator->reset(); }
+
+	//! latch a register address.
+	inline void writeAddress(uint8_t addr) { m_addr = addr; }
+	//! write a register value to the emulator.
+	inline void writeData(uint8_t data) { m_emulator->write(m_addr, data); }
+	//! read a register value from the emulator.
+	inline uint8_t readData(void) { return m_emulator->read(m_addr); }
+	//! read status from the emulator.
+	inline uint8_t readStatus(void) { return m_emulator->readStatus(); }
+	//! no wait. (the time is only counted)
+	inline void delayMicroseconds(uint32_t us) { m_time += us; }
+	//! counted clock. (advances 256 ticks on each call, more than any cycle budget, so the waits end)
+	inline uint16_t ticks(void) { return m_ticks += 256; }
+
+private:
+	YM2203_Emulator *m_emulator;	//!< emulator
+	uint8_t m_addr;					//!< latched register address
+	uint32_t m_time;				//!< counted time [us]
+	uint16_t m_ticks;				//!< counted clock [ticks]
+};
+
+#endif
@@ -0,0 +1,490 @@
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * render MML song files (or VGM or MIDI files) to WAV files or register traces on all cores.
+ * each song is rendered by its own MML player, YM2203 simulated bus
+ * and emulator, on a work-stealing thread pool.
+ *
+ * build:
+ *   g++ -O2 -std=gnu++11 -pthread -DPC_DEBUG -DPC_DEBUG_QUIET -I. -I../FM_Shield_src \
+ *       batch_render.cpp WorkStealingPool.cpp YM2203_Emulator.cpp WaveFile.cpp VgmFile.cpp \
+ *       ../FM_Shield_src/YM2203.cpp ../FM_Shield_src/YM2203_Timbre.cpp ../FM_Shield_src/YM2203_TimbreBank.cpp \
+ *       ../FM_Shield_src/YM2203_MMLplayer.cpp ../FM_Shield_src/YM2203_VGMplayer.cpp \
+ *       ../FM_Shield_src/YM2203_VoiceAllocator.cpp ../FM_Shield_src/YM2203_MIDIin.cpp \
+ *       ../FM_Shield_src/YM2203_SMFplayer.cpp -o batch_render
+ *
+ * usage:
+ *   batch_render [-j workers] [-o dir] [--trace] [--vgm] [-b bank.ymtb] [-l list.txt] song.mml ...
+ *     -j      : number of worker threads (default: number of cores)
+ *     -o      : output directory (default: current directory)
+ *     --trace : write register traces (song.trace) instead of WAV files (song.wav)
+ *     --vgm   : also write VGM files (song.vgm) of the recorded register writes (MML songs only)
+ *     -b      : timbre bank of "@n" and the program change (default: the preset timbres)
+ *               the bank file is mapped to the memory, and shared by all songs.
+ *     -l      : read song file names from a list file (one per line)
+ *
+ * song file (text, one command per line, '#' starts a comment):
+ *   tempo <bpm>                 set tempo
+ *   timbre <ch> <al> <fb> <AR x4> <DR x4> <SR x4> <RR x4> <SL x4> <TL x4> <KS x4> <ML x4> <DT x4>
+ *                               set timbre to a FM channel (ch: 1-3)
+ *   <ch> <MML>                  append MML to a channel (ch: 1-3 FM, 4-6 SSG)
+ *   play                        play the channels, and wait for the end
+ *   (MML left at the end of the file is played, too)
+ *
+ * files named *.vgm are played by the VGM player instead. (streamed from the file)
+ * files named *.mid are played by the SMF player, with the timbre table of the MML player.
+ *
+ * register trace (text, one write per line):
+ *   <time [ns]> <address> <data>   (address and data in hex)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "YM2203_MMLplayer.h"
+#include "YM2203_VGMplayer.h"
+#include "YM2203_SMFplayer.h"
+#include "YM2203_Emulator.h"
+#include "WaveFile.h"
+#include "VgmFile.h"
+#include "WorkStealingPool.h"
+
+#define RENDER_BUFFER_SIZE	4096
+#define SONG_LINE_MAX		4096	//!< maximum length of a line of song files
+#define TIMBRE_PARAM_NUM	38		//!< number of parameters of timbre command
+#define RECORD_BUFFER_SIZE	1024	//!< ring buffer size of the register write record (power of 2)
+
+/**
+ * batch render settings and results.
+ */
+struct BatchJob
+{
+	std::vector<std::string> songs;		//!< song files
+	std::string outDir;					//!< output directory
+	bool trace;							//!< write register traces
+	bool vgm;							//!< write VGM files
+	const uint8_t *bank;				//!< timbre bank (mapped file, NULL: the preset timbres)
+	uint32_t bankSize;					//!< size of the timbre bank
+	std::vector<double> audio;			//!< length of each song [sec]
+	std::vector<double> seconds;		//!< render time of each song [sec]
+	std::vector<std::string> error;		//!< error of each song (empty if none)
+};
+
+/**
+ * render context of a song. (one for each worker)
+ */
+struct SongContext
+{
+	YM2203_SimBus bus;					//!< simulated bus of the player
+	YM2203_Emulator emulator;			//!< emulator behind the bus
+	YM2203_MMLplayer player;			//!< MML player
+	YM2203_VGMplayer vgmPlayer;			//!< VGM player (for VGM files)
+	YM2203_SMFplayer smfPlayer;			//!< SMF player (for MIDI files)
+	YM2203_Timbre timbre[FM_CH_NUM];	//!< timbres set by the song
+	YM2203_Timbre program[TIMBRE_MAX];	//!< timbre table of the program change (copied from the bank)
+	WaveFile wave;						//!< WAV output
+	FILE *trace;						//!< register trace output
+	VgmFile vgm;						//!< VGM output
+	YM2203_RecordEntry record[RECORD_BUFFER_SIZE];	//!< ring buffer of the register write record
+	uint64_t time;						//!< elapsed time of the song [ns]
+};
+
+/**
+ * write a register to the trace file.
+ */
+static void onTraceWrite(void* context, uint8_t addr, uint8_t data)
+{
+	SongContext *song = (SongContext*)context;
+
+	fprintf(song->trace, "%llu %02x %02x\n", (unsigned long long)song->time, addr, data);
+}
+
+/**
+ * move the recorded register writes to the VGM file.
+ */
+static void flushRecord(SongContext *song)
+{
+	YM2203_RecordEntry entries[RENDER_BUFFER_SIZE / 4];
+	int i, num;
+
+	do{
+		num = song->player.readRecord(entries, RENDER_BUFFER_SIZE / 4);
+		for(i=0; i<num; i++){
+			song->vgm.write(entries[i].time, entries[i].addr, entries[i].data);
+		}
+	}while(num > 0);
+}
+
+/**
+ * render the elapsed timer interval.
+ */
+static void onHostTimer(void* context, uint32_t interval)
+{
+	SongContext *song = (SongContext*)context;
+	int16_t buffer[RENDER_BUFFER_SIZE];
+	int samples, num;
+
+	song->time += interval;
+	flushRecord(song);
+	if(song->trace != NULL) return;
+
+	samples = song->emulator.samplesFor(interval);
+	while(samples > 0){
+		num = (samples < RENDER_BUFFER_SIZE) ? samples : RENDER_BUFFER_SIZE;
+		song->emulator.render(buffer, num);
+		song->wave.write(buffer, num);
+		samples -= num;
+	}
+}
+
+/**
+ * set MML to all channels and play.
+ */
+static void playSection(SongContext *song, std::string *mml)
+{
+	int ch;
+
+	for(ch=0; ch<ALL_CH_NUM; ch++){
+		song->player.setNote(ch, mml[ch].c_str());
+	}
+	song->player.playAndWait();
+	for(ch=0; ch<ALL_CH_NUM; ch++){
+		mml[ch].clear();
+	}
+}
+
+/**
+ * play a song file.
+ *
+ * @param song render context
+ * @param fp song file
+ * @param error error message (out)
+ * @return false on syntax error
+ */
+static bool playSong(SongContext *song, FILE *fp, std::string *error)
+{
+	char line[SONG_LINE_MAX];
+	char message[64];
+	std::string mml[ALL_CH_NUM];
+	int param[TIMBRE_PARAM_NUM];
+	YM2203_Timbre *t;
+	char *p, *end;
+	bool pending = false;
+	int lineNo = 0;
+	int ch, i;
+
+	while(fgets(line, sizeof(line), fp) != NULL){
+		lineNo++;
+		// strip the comment and the newline
+		p = strpbrk(line, "#\r\n");
+		if(p != NULL) *p = '\0';
+		p = line + strspn(line, " \t");
+		if(*p == '\0') continue;
+
+		if(strncmp(p, "tempo", 5) == 0){
+			song->player.setTempo(atoi(p + 5));
+		}else if(strncmp(p, "play", 4) == 0){
+			playSection(song, mml);
+			pending = false;
+		}else if(strncmp(p, "timbre", 6) == 0){
+			ch = (int)strtol(p + 6, &end, 10) - 1;
+			for(i=0; i<TIMBRE_PARAM_NUM; i++){
+				param[i] = (int)strtol(end, &end, 10);
+			}
+			if((ch < FM_CH1) || (ch > FM_CH3)){
+				snprintf(message, sizeof(message), "line %d: bad FM channel", lineNo);
+				*error = message;
+				return false;
+			}
+			t = &song->timbre[ch];
+			t->setAlgorithm(param[0]);
+			t->setFeedback(param[1]);
+			t->setOpMask(MASK_ALL);
+			t->setAR(param[ 2], param[ 3], param[ 4], param[ 5]);
+			t->setDR(param[ 6], param[ 7], param[ 8], param[ 9]);
+			t->setSR(param[10], param[11], param[12], param[13]);
+			t->setRR(param[14], param[15], param[16], param[17]);
+			t->setSL(param[18], param[19], param[20], param[21]);
+			t->setTL(param[22], param[23], param[24], param[25]);
+			t->setKS(param[26], param[27], param[28], param[29]);
+			t->setML(param[30], param[31], param[32], param[33]);
+			t->setDT(param[34], param[35], param[36], param[37]);
+			song->player.setTimbre(ch, t);
+		}else if((*p >= '1') && (*p <= '6')){
+			ch = *p - '1';
+			mml[ch] += p + 1 + strspn(p + 1, " \t");
+			pending = true;
+		}else{
+			snprintf(message, sizeof(message), "line %d: unknown command", lineNo);
+			*error = message;
+			return false;
+		}
+	}
+	if(pending) playSection(song, mml);
+	return true;
+}
+
+/**
+ * output file name of a song. (output directory + base name + extension)
+ */
+static std::string outputPath(const BatchJob *job, const std::string &song)
+{
+	std::string name = song;
+	size_t pos;
+
+	pos = name.find_last_of('/');
+	if(pos != std::string::npos) name = name.substr(pos + 1);
+	pos = name.find_last_of('.');
+	if(pos != std::string::npos) name = name.substr(0, pos);
+
+	return job->outDir + "/" + name + (job->trace ? ".trace" : ".wav");
+}
+
+/**
+ * reader of a VGM file for the VGM player. (and of a MIDI file for the SMF player)
+ */
+static int readVgmFile(void* context, uint32_t offset, uint8_t *buffer, int size)
+{
+	FILE *fp = (FILE*)context;
+
+	if(fseek(fp, (long)offset, SEEK_SET) != 0) return 0;
+	return (int)fread(buffer, 1, size, fp);
+}
+
+/**
+ * whether the file is a VGM file. (by the extension)
+ */
+static bool isVgmFile(const std::string &path)
+{
+	return (path.size() > 4) && (path.compare(path.size() - 4, 4, ".vgm") == 0);
+}
+
+/**
+ * whether the file is a MIDI file. (by the extension)
+ */
+static bool isMidiFile(const std::string &path)
+{
+	return (path.size() > 4) && (path.compare(path.size() - 4, 4, ".mid") == 0);
+}
+
+/**
+ * render a song. (job function of the pool)
+ * the song has its own player and emulator, so the worker doesn't matter.
+ */
+static void renderSong(void* context, int index, int)
+{
+	BatchJob *job = (BatchJob*)context;
+	const std::string &path = job->songs[index];
+	std::string out = outputPath(job, path);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	SongContext *song = new SongContext();
+	FILE *fp;
+	int n;
+
+	// connect the player, the bus and the emulator (or the trace)
+	memset(&song->bus, 0, sizeof(song->bus));
+	song->trace = NULL;
+	song->time = 0;
+	if(job->trace){
+		song->trace = fopen(out.c_str(), "w");
+		if(song->trace == NULL) job->error[index] = "cannot open " + out;
+		song->bus.hook = onTraceWrite;
+		song->bus.context = song;
+	}else{
+		if(!song->wave.open(out.c_str(), song->emulator.getSampleRate())){
+			job->error[index] = "cannot open " + out;
+		}
+		song->bus.hook = YM2203_Emulator::busHook;
+		song->bus.context = &song->emulator;
+	}
+	song->player.setSimBus(&song->bus);
+	song->player.setHostTimer(onHostTimer, song);
+	song->vgmPlayer.setSimBus(&song->bus);
+	song->vgmPlayer.setHostTimer(onHostTimer, song);
+	song->smfPlayer.setSimBus(&song->bus);
+	song->smfPlayer.setHostTimer(onHostTimer, song);
+	if(job->vgm && !isVgmFile(path) && !isMidiFile(path) && job->error[index].empty()){
+		std::string vgm = out.substr(0, out.find_last_of('.')) + ".vgm";
+		if(!song->vgm.open(vgm.c_str(), YM2203_MASTER_CLOCK)){
+			job->error[index] = "cannot open " + vgm;
+		}
+		song->player.setRecordBuffer(song->record, RECORD_BUFFER_SIZE);
+	}
+
+	if(job->error[index].empty()){
+		fp = fopen(path.c_str(), (isVgmFile(path) || isMidiFile(path)) ? "rb" : "r");
+		if(fp == NULL){
+			job->error[index] = "cannot open " + path;
+		}else if(isVgmFile(path)){
+			song->vgmPlayer.begin();
+			if(song->vgmPlayer.open(readVgmFile, fp)){
+				song->vgmPlayer.playAndWait();
+			}else{
+				job->error[index] = "not a VGM file for YM2203";
+			}
+			fclose(fp);
+		}else if(isMidiFile(path)){
+			song->player.begin();
+			song->player.setTimbreBank(job->bank, job->bankSize);
+			for(n=0; n<TIMBRE_MAX; n++){
+				song->program[n] = *song->player.getTimbre(n);
+			}
+			song->smfPlayer.begin(song->program);
+			if(song->smfPlayer.open(readVgmFile, fp)){
+				song->smfPlayer.playAndWait();
+			}else{
+				job->error[index] = "not a MIDI file (format 0 or 1)";
+			}
+			fclose(fp);
+		}else{
+			song->player.begin();
+			song->player.setTimbreBank(job->bank, job->bankSize);
+			playSong(song, fp, &job->error[index]);
+			fclose(fp);
+		}
+	}
+
+	if(song->trace != NULL) fclose(song->trace);
+	song->wave.close();
+	flushRecord(song);
+	if(song->player.getRecordDropped() != 0){
+		job->error[index] = "register writes lost in the record";
+	}
+	song->vgm.waitUntil(song->player.getRecordTime());
+	song->vgm.close();
+	job->audio[index] = (double)song->time / 1e9;
+	job->seconds[index] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	delete song;
+}
+
+/**
+ * map a timbre bank file to the memory. (read only, shared by the workers)
+ */
+static bool mapBank(const char* path, BatchJob *job)
+{
+	struct stat st;
+	void *data;
+	int fd = open(path, O_RDONLY);
+
+	if(fd < 0) return false;
+	if( (fstat(fd, &st) != 0) || (st.st_size == 0) ){
+		close(fd);
+		return false;
+	}
+	data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) return false;
+
+	job->bank = (const uint8_t*)data;
+	job->bankSize = (uint32_t)st.st_size;
+	return true;
+}
+
+/**
+ * read song file names from a list file.
+ */
+static bool readList(const char* path, std::vector<std::string> *songs)
+{
+	char line[SONG_LINE_MAX];
+	char *p;
+	FILE *fp = fopen(path, "r");
+
+	if(fp == NULL) return false;
+	while(fgets(line, sizeof(line), fp) != NULL){
+		p = strpbrk(line, "#\r\n");
+		if(p != NULL) *p = '\0';
+		if(line[0] != '\0') songs->push_back(line);
+	}
+	fclose(fp);
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	BatchJob job;
+	int workers = 0;
+	int i, failed = 0;
+	double total = 0, audio = 0, wall;
+	std::chrono::steady_clock::time_point start;
+
+	job.outDir = ".";
+	job.trace = false;
+	job.vgm = false;
+	job.bank = NULL;
+	job.bankSize = 0;
+	for(i=1; i<argc; i++){
+		if((strcmp(argv[i], "-j") == 0) && (i + 1 < argc)){
+			workers = atoi(argv[++i]);
+		}else if((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)){
+			job.outDir = argv[++i];
+		}else if(strcmp(argv[i], "--trace") == 0){
+			job.trace = true;
+		}else if(strcmp(argv[i], "--vgm") == 0){
+			job.vgm = true;
+		}else if((strcmp(argv[i], "-b") == 0) && (i + 1 < argc)){
+			if(!mapBank(argv[++i], &job)){
+				fprintf(stderr, "cannot open %s\n", argv[i]);
+				return 1;
+			}
+		}else if((strcmp(argv[i], "-l") == 0) && (i + 1 < argc)){
+			if(!readList(argv[++i], &job.songs)){
+				fprintf(stderr, "cannot open %s\n", argv[i]);
+				return 1;
+			}
+		}else{
+			job.songs.push_back(argv[i]);
+		}
+	}
+	if(job.songs.empty()){
+		fprintf(stderr, "usage: %s [-j workers] [-o dir] [--trace] [--vgm] [-b bank.ymtb] [-l list.txt] song.mml ...\n", argv[0]);
+		return 1;
+	}
+	job.audio.resize(job.songs.size());
+	job.seconds.resize(job.songs.size());
+	job.error.resize(job.songs.size());
+
+	WorkStealingPool pool(workers);
+	start = std::chrono::steady_clock::now();
+	pool.run((int)job.songs.size(), renderSong, &job);
+	wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// per-song report
+	for(i=0; i<(int)job.songs.size(); i++){
+		if(!job.error[i].empty()){
+			printf("%s: ERROR %s\n", job.songs[i].c_str(), job.error[i].c_str());
+			failed++;
+			continue;
+		}
+		printf("%s: %.2f sec audio, %.3f sec render (x%.1f real time)\n",
+		       job.songs[i].c_str(), job.audio[i], job.seconds[i],
+		       (job.seconds[i] > 0) ? job.audio[i] / job.seconds[i] : 0.0);
+		audio += job.audio[i];
+		total += job.seconds[i];
+	}
+	printf("%d songs, %d failed, %d workers, %u steals: %.2f sec audio, %.3f sec wall (x%.1f real time, x%.2f parallel)\n",
+	       (int)job.songs.size(), failed, pool.getWorkers(), pool.getSteals(), audio, wall,
+	       (wall > 0) ? audio / wall : 0.0, (wall > 0) ? total / wall : 0.0);
+	return (failed == 0) ? 0 : 2;
+}
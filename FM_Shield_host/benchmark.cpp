@@ -0,0 +1,577 @@
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * microbenchmarks of the MML parser and the register write path on PC.
+ * the host time is measured with the monotonic clock, and the time on
+ * GR-SAKURA is estimated by the simulated bus (the waits of YM2203::write()).
+ *
+ * build:
+ *   g++ -O2 -std=gnu++11 -DPC_DEBUG -DPC_DEBUG_QUIET -I. -I../FM_Shield_src \
+ *       benchmark.cpp YM2203_Emulator.cpp ../FM_Shield_src/YM2203.cpp \
+ *       ../FM_Shield_src/YM2203_Timbre.cpp ../FM_Shield_src/YM2203_MMLplayer.cpp \
+ *       ../FM_Shield_src/YM2203_TimbreBank.cpp ../FM_Shield_src/YM2203_VoiceAllocator.cpp -o benchmark
+ *
+ * usage:
+ *   benchmark [--quick] [filter]
+ *     --quick : short measurement (for smoke tests)
+ *     filter  : run only the benchmarks whose name contains the string
+ *
+ * output (one JSON object per line):
+ *   {"name":..., "calls":..., "ns_per_call":..., "calls_per_sec":...,
+ *    "bus_ns_per_call":..., "writes_per_call":..., "suppressed_per_call":...}
+ *   calls are MML commands for the parser benchmarks, timer procedures
+ *   for the playback benchmarks and API calls for the others.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "YM2203_MMLplayer.h"
+#include "YM2203_EmulatorBus.h"
+#include "YM2203_Chips.h"
+#include "YM2203_VoiceAllocator.h"
+
+#define BENCH_EVENT_MAX		4096	//!< event buffer size of the compile benchmarks
+#define BENCH_REPEAT		64		//!< repeat count of the synthetic MML patterns
+#define BENCH_TRACE_MAX		1024	//!< trace buffer size of the backend benchmarks
+#define BENCH_HELD_MAX		8		//!< notes held at once in the voice benchmarks
+
+static double s_minSeconds = 0.5;	//!< minimum measurement time of a benchmark
+static const char* s_filter = NULL;	//!< benchmark name filter
+
+//! Jingle Bells, verse & bridge (from gr_sketch.cpp)
+static const char* JINGLE_BELLS[ALL_CH_NUM] = {
+	"V14Q7O4DBAGD4RDDBAGE4REE>C<BAF+4R>DDDC<AB4RDDBAGD4RDDBADE4REE>C<BA>DDDDEDC<AGR>D4",
+	"V13Q4O5RRRRRD16C+16D16C+16DRRRRRE16D+16E16D+16ERRRRRF+16F16F+16F16F+RRRRR"
+	"D16D+16E16D+16DRRRRRD16C+16D16C+16DRRRRRE16D+16E16D+16ERRRRRF+16F16F+16F16F+RRRRRRD4",
+	"O4G4D4G4D4G4AB>C4<G4>C4<G4A4D4A4D4GDEF+G4D4G4D4G4AB>C4<G4>C4<G4A4D4ADEF+G4D4",
+	"V11Q4O5RDRDRDRDRDRDRERFRERERDRDRDRDRDRDRDRDRDRDRDRDRERERERERDRDRDRDDV12Q6RD4",
+	"V11Q4O4RBRBRBRBRBRB>RCRCRCRC<RARARARARBRBRBRBRBRBRBRB>RCRCRCRC<RARARARABV12Q6RA4",
+	"V11Q4O4RGRGRGRGRGRGRGRGRGRGRF+RF+RF+RF+RGRGRGRGRGRGRGRGRGRGRGRGRF+RF+RF+RF+GV12Q6RF+&F+",
+};
+
+//! synthetic worst case: dense 32nd notes
+static const char* PATTERN_DENSE = "CDEFGAB>C<BAGFEDC";
+//! synthetic worst case: timbre and volume change on every note (FM only)
+static const char* PATTERN_CHANGE = "@0V15C@13V8D@24V12E@25V10F@0V9G@13V15A";
+
+/**
+ * result of a benchmark.
+ */
+struct BenchResult
+{
+	uint64_t calls;			//!< number of calls
+	double seconds;			//!< host time
+	uint64_t busTime;		//!< simulated bus time [ns]
+	uint64_t writes;		//!< register writes issued
+	uint64_t suppressed;	//!< register writes skipped
+};
+
+/**
+ * print a result as a JSON line.
+ */
+static void report(const char* name, const BenchResult *r)
+{
+	double calls = (r->calls > 0) ? (double)r->calls : 1.0;
+
+	printf("{\"name\":\"%s\",\"calls\":%llu,\"ns_per_call\":%.2f,\"calls_per_sec\":%.0f,"
+	       "\"bus_ns_per_call\":%.1f,\"writes_per_call\":%.3f,\"suppressed_per_call\":%.3f}\n",
+	       name, (unsigned long long)r->calls, r->seconds * 1e9 / calls,
+	       (r->seconds > 0) ? r->calls / r->seconds : 0.0,
+	       r->busTime / calls, r->writes / calls, r->suppressed / calls);
+	fflush(stdout);
+}
+
+/**
+ * whether the benchmark is selected by the filter.
+ */
+static bool selected(const char* name)
+{
+	return (s_filter == NULL) || (strstr(name, s_filter) != NULL);
+}
+
+/**
+ * elapsed time from start [sec].
+ */
+static double elapsed(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * number of MML commands in a string. (a command starts with a letter or a symbol)
+ */
+static int countCommands(const char* note)
+{
+	int num = 0;
+
+	for(; *note != '\0'; note++){
+		if( ((*note >= 'A') && (*note <= 'Z')) || (strchr("<>&@", *note) != NULL) ) num++;
+	}
+	return num;
+}
+
+/**
+ * repeat a MML pattern.
+ */
+static void repeatPattern(char* buffer, const char* head, const char* pattern, int count)
+{
+	int i;
+
+	strcpy(buffer, head);
+	for(i=0; i<count; i++) strcat(buffer, pattern);
+}
+
+/**
+ * a YM2203 object on its own simulated bus.
+ */
+struct BenchDevice
+{
+	YM2203_SimBus bus;
+	YM2203 ym2203;
+
+	BenchDevice()
+	{
+		memset(&bus, 0, sizeof(bus));
+		ym2203.getBus()->attach(&bus);
+		ym2203.begin();
+	}
+
+	void start(BenchResult *r)
+	{
+		memset(r, 0, sizeof(*r));
+		ym2203.clearWriteCounters();
+		bus.time = 0;
+	}
+
+	void stop(BenchResult *r, std::chrono::steady_clock::time_point start)
+	{
+		r->seconds = elapsed(start);
+		r->busTime = bus.time;
+		r->writes = ym2203.getIssuedWrites();
+		r->suppressed = ym2203.getSuppressedWrites();
+	}
+};
+
+/**
+ * MML parse throughput. (compile all channels, commands/sec)
+ */
+static void benchCompile(const char* name, const char* const* notes)
+{
+	static MML_Event events[BENCH_EVENT_MAX];
+	YM2203_MMLplayer *player;
+	std::chrono::steady_clock::time_point start;
+	BenchResult r;
+	int ch;
+
+	if(!selected(name)) return;
+	player = new YM2203_MMLplayer();
+	memset(&r, 0, sizeof(r));
+	start = std::chrono::steady_clock::now();
+	do{
+		for(ch=0; ch<ALL_CH_NUM; ch++){
+			if(notes[ch] == NULL) continue;
+			player->compile(ch, notes[ch], events, BENCH_EVENT_MAX);
+			r.calls += countCommands(notes[ch]);
+		}
+	}while(elapsed(start) < s_minSeconds);
+	r.seconds = elapsed(start);
+	report(name, &r);
+	delete player;
+}
+
+/**
+ * playback cost. (timer procedures until the end, interpreted or compiled)
+ */
+static void benchPlay(const char* name, const char* const* notes, bool compiled)
+{
+	static MML_Event events[ALL_CH_NUM][BENCH_EVENT_MAX];
+	YM2203_SimBus bus;
+	YM2203_MMLplayer *player;
+	std::chrono::steady_clock::time_point start;
+	BenchResult r;
+	double seconds = 0;
+	int ch;
+
+	if(!selected(name)) return;
+	memset(&bus, 0, sizeof(bus));
+	memset(&r, 0, sizeof(r));
+	player = new YM2203_MMLplayer();
+	player->setSimBus(&bus);
+	player->begin();
+	player->setTempo(120);
+
+	do{
+		for(ch=0; ch<ALL_CH_NUM; ch++){
+			if(compiled){
+				player->compile(ch, (notes[ch] != NULL) ? notes[ch] : "", events[ch], BENCH_EVENT_MAX);
+				player->setEvents(ch, events[ch]);
+			}else{
+				player->setNote(ch, (notes[ch] != NULL) ? notes[ch] : "");
+			}
+		}
+		player->play();
+		start = std::chrono::steady_clock::now();
+		while(player->isPlaying()){
+			player->onTimer();
+			r.calls++;
+		}
+		seconds += elapsed(start);
+	}while(seconds < s_minSeconds);
+	r.seconds = seconds;
+	r.busTime = bus.time;
+	r.writes = bus.writes;
+	report(name, &r);
+	delete player;
+}
+
+/**
+ * setTimbre cost.
+ *
+ * @param mode wait mode of the device
+ * @param delta switch between 2 similar timbres (false: full upload every time)
+ */
+static void benchSetTimbre(const char* name, int mode, bool delta)
+{
+	BenchDevice *dev;
+	YM2203_Timbre timbre[2];
+	std::chrono::steady_clock::time_point start;
+	BenchResult r;
+
+	if(!selected(name)) return;
+	dev = new BenchDevice();
+	dev->ym2203.setWaitMode(mode);
+
+	// Strings-like timbres which differ in a few parameters
+	timbre[0].setAlgorithm(2);
+	timbre[0].setFeedback(5);
+	timbre[0].setOpMask(MASK_ALL);
+	timbre[0].setAR(31, 18, 31, 20);
+	timbre[0].setDR( 8, 14, 16, 12);
+	timbre[0].setSR( 0,  6,  3,  5);
+	timbre[0].setRR( 0,  9,  0,  8);
+	timbre[0].setSL( 3,  2,  2,  2);
+	timbre[0].setTL(34, 42, 20,  0);
+	timbre[0].setKS( 0,  0,  0,  0);
+	timbre[0].setML( 1,  2,  1,  1);
+	timbre[0].setDT( 3,  0,  7,  0);
+	timbre[1] = timbre[0];
+	timbre[1].setTL(30, 42, 24,  0);
+	timbre[1].setRR( 0,  9,  0,  6);
+
+	dev->start(&r);
+	start = std::chrono::steady_clock::now();
+	do{
+		if(!delta) dev->ym2203.invalidateShadow();
+		dev->ym2203.setTimbre(FM_CH1, &timbre[r.calls & 1]);
+		r.calls++;
+	}while( ((r.calls & 0xFF) != 0) || (elapsed(start) < s_minSeconds) );
+	dev->stop(&r, start);
+	report(name, &r);
+	delete dev;
+}
+
+/**
+ * setVolume cost. (FM channel with 4 carriers, or SSG channel)
+ */
+static void benchSetVolume(const char* name, int ch)
+{
+	BenchDevice *dev;
+	YM2203_Timbre timbre;
+	std::chrono::steady_clock::time_point start;
+	BenchResult r;
+
+	if(!selected(name)) return;
+	dev = new BenchDevice();
+	timbre.setAlgorithm(ALGORITHM_7);
+	timbre.setOpMask(MASK_ALL);
+	if(ch <= FM_CH3) dev->ym2203.setTimbre(ch, &timbre);
+
+	dev->start(&r);
+	start = std::chrono::steady_clock::now();
+	do{
+		dev->ym2203.setVolume(ch, (int)(r.calls & 0x0F));
+		r.calls++;
+	}while( ((r.calls & 0xFF) != 0) || (elapsed(start) < s_minSeconds) );
+	dev->stop(&r, start);
+	report(name, &r);
+	delete dev;
+}
+
+/**
+ * setPitch cost. (walks up the keys of 8 octaves)
+ */
+static void benchSetPitch(const char* name, int ch)
+{
+	BenchDevice *dev;
+	std::chrono::steady_clock::time_point start;
+	BenchResult r;
+	int n;
+
+	if(!selected(name)) return;
+	dev = new BenchDevice();
+
+	dev->start(&r);
+	start = std::chrono::steady_clock::now();
+	do{
+		n = (int)(r.calls % (8 * KEY_NUM));
+		dev->ym2203.setPitch(ch, n / KEY_NUM, n % KEY_NUM);
+		r.calls++;
+	}while( ((r.calls & 0xFF) != 0) || (elapsed(start) < s_minSeconds) );
+	dev->stop(&r, start);
+	report(name, &r);
+	delete dev;
+}
+
+/**
+ * the same driver code on a bus policy. (a phrase of timbre, pitch and key on/off)
+ */
+template <class Bus>
+static void benchBackend(const char* name, YM2203_Driver<Bus> *dev)
+{
+	YM2203_Timbre timbre;
+	std::chrono::steady_clock::time_point start;
+	BenchResult r;
+	int n;
+
+	if(!selected(name)) return;
+	timbre.setAlgorithm(ALGORITHM_4);
+	timbre.setOpMask(MASK_ALL);
+	timbre.setAR(31, 31, 31, 31);
+	timbre.setTL(20, 0, 20, 0);
+
+	dev->begin();
+	memset(&r, 0, sizeof(r));
+	dev->clearWriteCounters();
+	start = std::chrono::steady_clock::now();
+	do{
+		n = (int)(r.calls % (8 * KEY_NUM));
+		if(n == 0){
+			dev->invalidateShadow();
+			dev->setTimbre(FM_CH1, &timbre);
+		}
+		dev->setPitch(FM_CH1, n / KEY_NUM, n % KEY_NUM);
+		dev->noteOn(FM_CH1);
+		dev->noteOff(FM_CH1);
+		r.calls++;
+	}while( ((r.calls & 0xFF) != 0) || (elapsed(start) < s_minSeconds) );
+	r.seconds = elapsed(start);
+	r.writes = dev->getIssuedWrites();
+	r.suppressed = dev->getSuppressedWrites();
+	report(name, &r);
+}
+
+/**
+ * bus time of N devices on a bus. (pitch and key-on of all channels)
+ * serial: each write waits the device. interleaved: the scheduler writes
+ * another device while the last one is busy.
+ */
+template <int N>
+static void benchChips(const char* name, bool interleaved)
+{
+	YM2203_Chips<YM2203_MockBus, N> *chips = new YM2203_Chips<YM2203_MockBus, N>();
+	YM2203_SimBus *bus = new YM2203_SimBus[N];
+	YM2203_Timbre timbre;
+	std::chrono::steady_clock::time_point start;
+	BenchResult r;
+	uint64_t busStart;
+	int chip, ch, n;
+
+	if(selected(name)){
+		memset(bus, 0, sizeof(YM2203_SimBus) * N);
+		for(chip=0; chip<N; chip++){
+			chips->getChip(chip)->getBus()->attach(&bus[chip]);
+			chips->getChip(chip)->getBus()->shareTime(&bus[0]);
+		}
+		chips->begin();
+		chips->setInterleaved(interleaved);
+		timbre.setAlgorithm(ALGORITHM_4);
+		timbre.setOpMask(MASK_ALL);
+		for(ch=0; ch<N * ALL_CH_NUM; ch++){
+			if(YM2203_LOCAL_CH(ch) <= FM_CH3) chips->setTimbre(ch, &timbre);
+		}
+		chips->flush();
+
+		memset(&r, 0, sizeof(r));
+		chips->clearWriteCounters();
+		busStart = bus[0].time;
+		start = std::chrono::steady_clock::now();
+		do{
+			n = (int)(r.calls % (8 * KEY_NUM));
+			for(ch=0; ch<N * ALL_CH_NUM; ch++){
+				chips->setPitch(ch, n / KEY_NUM, n % KEY_NUM);
+				chips->noteOn(ch);
+			}
+			chips->flush();
+			r.calls++;
+		}while( ((r.calls & 0xFF) != 0) || (elapsed(start) < s_minSeconds) );
+		r.seconds = elapsed(start);
+		r.busTime = bus[0].time - busStart;
+		r.writes = chips->getIssuedWrites();
+		r.suppressed = chips->getSuppressedWrites();
+		for(chip=0; chip<N; chip++){
+			if(bus[chip].violations != 0) fprintf(stderr, "%s: %u timing violations on device %d\n", name, bus[chip].violations, chip);
+		}
+		report(name, &r);
+	}
+	delete chips;
+	delete[] bus;
+}
+
+/**
+ * voice allocation. (note-on of 3 FM instruments and a SSG instrument,
+ * and note-off of the oldest note while BENCH_HELD_MAX notes are held,
+ * so the voices are stolen often)
+ */
+static void benchVoice(const char* name, int policy)
+{
+	YM2203_ChipSet *chips = new YM2203_ChipSet();
+	YM2203_VoiceAllocator *voices = new YM2203_VoiceAllocator();
+	YM2203_SimBus bus[YM2203_CHIP_NUM];
+	YM2203_Timbre timbre[3];
+	std::chrono::steady_clock::time_point start;
+	BenchResult r;
+	uint32_t seed = 1;
+	int heldInst[BENCH_HELD_MAX], heldNote[BENCH_HELD_MAX];
+	int chip, i, inst, note;
+
+	if(selected(name)){
+		memset(bus, 0, sizeof(bus));
+		for(chip=0; chip<YM2203_CHIP_NUM; chip++){
+			chips->getChip(chip)->getBus()->attach(&bus[chip]);
+			chips->getChip(chip)->getBus()->shareTime(&bus[0]);
+		}
+		chips->begin();
+		voices->begin(chips);
+		voices->setStealPolicy(policy);
+		for(i=0; i<3; i++){
+			timbre[i].setAlgorithm(ALGORITHM_4);
+			timbre[i].setOpMask(MASK_ALL);
+			timbre[i].setTL(20 + i, 0, 20, 0);
+			voices->setInstrument(i, &timbre[i]);
+		}
+		voices->setInstrument(3, NULL);
+
+		memset(&r, 0, sizeof(r));
+		chips->clearWriteCounters();
+		bus[0].time = 0;
+		start = std::chrono::steady_clock::now();
+		do{
+			i = (int)(r.calls % BENCH_HELD_MAX);
+			if(r.calls >= BENCH_HELD_MAX) voices->noteOff(heldInst[i], heldNote[i]);
+			seed = seed * 1103515245 + 12345;
+			inst = (seed >> 16) & 3;
+			note = 36 + ((seed >> 20) % 36);
+			voices->noteOn(inst, note, (seed >> 8) & 0x0F);
+			chips->flush();
+			heldInst[i] = inst;
+			heldNote[i] = note;
+			r.calls++;
+		}while( ((r.calls & 0xFF) != 0) || (elapsed(start) < s_minSeconds) );
+		r.seconds = elapsed(start);
+		r.busTime = bus[0].time;
+		r.writes = chips->getIssuedWrites();
+		r.suppressed = chips->getSuppressedWrites();
+		report(name, &r);
+	}
+	delete voices;
+	delete chips;
+}
+
+int main(int argc, char* argv[])
+{
+	static char dense[ALL_CH_NUM][2048];
+	static char change[FM_CH_NUM][4096];
+	const char* denseNotes[ALL_CH_NUM];
+	const char* changeNotes[ALL_CH_NUM];
+	int i, ch;
+
+	for(i=1; i<argc; i++){
+		if(strcmp(argv[i], "--quick") == 0){
+			s_minSeconds = 0.02;
+		}else{
+			s_filter = argv[i];
+		}
+	}
+
+	// synthetic workloads
+	for(ch=0; ch<ALL_CH_NUM; ch++){
+		repeatPattern(dense[ch], "L32Q6O4", PATTERN_DENSE, BENCH_REPEAT);
+		denseNotes[ch] = dense[ch];
+		changeNotes[ch] = NULL;
+	}
+	for(ch=0; ch<FM_CH_NUM; ch++){
+		repeatPattern(change[ch], "L32O4", PATTERN_CHANGE, BENCH_REPEAT);
+		changeNotes[ch] = change[ch];
+	}
+
+	benchCompile("parse/jingle_bells", JINGLE_BELLS);
+	benchCompile("parse/dense_32nd", denseNotes);
+	benchCompile("parse/timbre_volume_change", changeNotes);
+
+	benchPlay("play/jingle_bells", JINGLE_BELLS, false);
+	benchPlay("play/dense_32nd", denseNotes, false);
+	benchPlay("play/timbre_volume_change", changeNotes, false);
+	benchPlay("play_compiled/jingle_bells", JINGLE_BELLS, true);
+	benchPlay("play_compiled/dense_32nd", denseNotes, true);
+	benchPlay("play_compiled/timbre_volume_change", changeNotes, true);
+
+	benchSetTimbre("setTimbre/full/wait_fixed", WAIT_FIXED, false);
+	benchSetTimbre("setTimbre/full/wait_busy", WAIT_BUSY, false);
+	benchSetTimbre("setTimbre/full/wait_cycle", WAIT_CYCLE, false);
+	benchSetTimbre("setTimbre/delta/wait_fixed", WAIT_FIXED, true);
+	benchSetVolume("setVolume/fm_alg7", FM_CH1);
+	benchSetVolume("setVolume/ssg", SSG_CH_A);
+	benchSetPitch("setPitch/fm", FM_CH1);
+	benchSetPitch("setPitch/ssg", SSG_CH_A);
+
+	// bus policies
+	{
+		static YM2203_TraceEntry trace[BENCH_TRACE_MAX];
+		YM2203_SimBus bus;
+		YM2203_Emulator emulator;
+		YM2203 *mock = new YM2203();
+		YM2203_Driver<YM2203_TraceBus<YM2203_MockBus> > *tracer = new YM2203_Driver<YM2203_TraceBus<YM2203_MockBus> >();
+		YM2203_Driver<YM2203_EmulatorBus> *direct = new YM2203_Driver<YM2203_EmulatorBus>();
+
+		memset(&bus, 0, sizeof(bus));
+		mock->getBus()->attach(&bus);
+		tracer->getBus()->attach(&bus);
+		tracer->getBus()->setBuffer(trace, BENCH_TRACE_MAX);
+		direct->getBus()->attach(&emulator);
+		benchBackend("backend/mock", mock);
+		benchBackend("backend/trace", tracer);
+		benchBackend("backend/emulator", direct);
+		delete mock;
+		delete tracer;
+		delete direct;
+	}
+
+	// devices on a bus
+	benchChips<1>("chips/1/serial", false);
+	benchChips<2>("chips/2/serial", false);
+	benchChips<2>("chips/2/interleaved", true);
+	benchChips<4>("chips/4/serial", false);
+	benchChips<4>("chips/4/interleaved", true);
+
+	// voice allocation
+	benchVoice("voice/steal_oldest", STEAL_OLDEST);
+	benchVoice("voice/steal_quietest", STEAL_QUIETEST);
+
+	return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * play a raw MIDI byte stream (a file, a pipe or a raw MIDI device) on PC,
+ * and print the latency statistics of each kind of messages.
+ * the bytes are parsed as soon as they are read, and the emulator output
+ * follows the wall clock, so a live input is rendered in its timing.
+ *
+ * build:
+ *   g++ -O2 -std=gnu++11 -DPC_DEBUG -DPC_DEBUG_QUIET -I. -I../FM_Shield_src \
+ *       midi_input.cpp YM2203_Emulator.cpp WaveFile.cpp \
+ *       ../FM_Shield_src/YM2203.cpp ../FM_Shield_src/YM2203_Timbre.cpp ../FM_Shield_src/YM2203_TimbreBank.cpp \
+ *       ../FM_Shield_src/YM2203_MMLplayer.cpp ../FM_Shield_src/YM2203_VoiceAllocator.cpp \
+ *       ../FM_Shield_src/YM2203_MIDIin.cpp -o midi_input
+ *
+ * usage:
+ *   midi_input [-o output.wav] [--ssg ch] ... [input]
+ *     -o    : render the output to a WAV file
+ *     --ssg : play a MIDI channel (1-16) on the SSG channels
+ *     input : raw MIDI bytes (default: stdin). e.g. /dev/snd/midiC1D0
+ *
+ * the latency counts from the end of the read() of a byte to the end of
+ * the register writes. (including the rendering of the time before it)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "YM2203_MIDIin.h"
+#include "YM2203_Emulator.h"
+#include "WaveFile.h"
+
+#define RENDER_BUFFER_SIZE	4096
+#define READ_BUFFER_SIZE	256
+#define RENDER_TAIL			1000000UL		//!< time rendered after the end of the input [us]
+
+static YM2203_MIDIin s_midi;
+static YM2203_Emulator s_emulator;
+static WaveFile s_wave;
+static bool s_render = false;
+
+/**
+ * render an interval.
+ *
+ * @param interval interval [us] (the latency clock)
+ */
+static void render(uint32_t interval)
+{
+	int16_t buffer[RENDER_BUFFER_SIZE];
+	uint32_t part;
+	int samples, num;
+
+	// a second at a time. (samplesFor takes ns in 32 bits)
+	while(interval > 0){
+		part = (interval < 1000000UL) ? interval : 1000000UL;
+		samples = s_emulator.samplesFor(part * 1000);
+		interval -= part;
+		while(samples > 0){
+			num = (samples < RENDER_BUFFER_SIZE) ? samples : RENDER_BUFFER_SIZE;
+			s_emulator.render(buffer, num);
+			s_wave.write(buffer, num);
+			samples -= num;
+		}
+	}
+}
+
+/**
+ * print the latency statistics.
+ */
+static void printLatency(void)
+{
+	static const char* KIND_NAME[MIDI_MSG_NUM] = {
+		"note off", "note on", "key pressure", "control change",
+		"program change", "channel pressure", "pitch bend"
+	};
+	MIDI_Latency latency;
+	YM2203_VoiceAllocator *voices = s_midi.getVoices();
+	int kind, i;
+
+	for(kind=0; kind<MIDI_MSG_NUM; kind++){
+		s_midi.getLatency(kind, &latency);
+		if(latency.messages == 0) continue;
+		printf("%s: %u messages\n", KIND_NAME[kind], latency.messages);
+		printf("  latency [us]: min %u, avg %llu, max %u\n", latency.minTime,
+		       (unsigned long long)(latency.totalTime / latency.messages), latency.maxTime);
+		printf("  writes/message: avg %.2f, max %u\n",
+		       (double)latency.totalWrites / latency.messages, latency.maxWrites);
+		for(i=0; i<MIDI_LATENCY_BINS; i++){
+			if(latency.histogram[i] == 0) continue;
+			printf("  %6u - %6u us: %u\n", 1u << i, (2u << i) - 1, latency.histogram[i]);
+		}
+	}
+	printf("voices: %u timbre reuses, %u uploads, %u steals\n",
+	       voices->getReuses(), voices->getUploads(), voices->getSteals());
+	if(s_midi.getErrors() != 0) printf("%u data bytes without status\n", s_midi.getErrors());
+}
+
+int main(int argc, char* argv[])
+{
+	const char* input = NULL;
+	const char* output = NULL;
+	uint8_t buffer[READ_BUFFER_SIZE];
+	uint32_t last, arrival, now;
+	int fd, len, i;
+
+	for(i=1; i<argc; i++){
+		if( (strcmp(argv[i], "-o") == 0) && (i + 1 < argc) ){
+			output = argv[++i];
+		}else if( (strcmp(argv[i], "--ssg") == 0) && (i + 1 < argc) ){
+			s_midi.setSSG(atoi(argv[++i]) - 1, true);
+		}else{
+			input = argv[i];
+		}
+	}
+
+	if( (input == NULL) || (strcmp(input, "-") == 0) ){
+		fd = 0;
+	}else{
+		fd = open(input, O_RDONLY);
+		if(fd < 0){
+			fprintf(stderr, "cannot open %s\n", input);
+			return 1;
+		}
+	}
+	if(output != NULL){
+		if(!s_wave.open(output, s_emulator.getSampleRate())){
+			fprintf(stderr, "cannot open %s\n", output);
+			return 1;
+		}
+		YM2203_simBus.hook = YM2203_Emulator::busHook;
+		YM2203_simBus.context = &s_emulator;
+		s_render = true;
+	}
+
+	// the preset timbres of the MML player are the timbre table
+	MMLplayer.begin();
+	s_midi.begin();
+	s_midi.clearLatency();
+
+	last = YM2203_MIDIin::getClock();
+	while( (len = (int)read(fd, buffer, sizeof(buffer))) > 0 ){
+		// the bytes arrived now. render until now with the last state
+		arrival = YM2203_MIDIin::getClock();
+		if(s_render){
+			now = YM2203_MIDIin::getClock();
+			render(now - last);
+			last = now;
+		}
+		for(i=0; i<len; i++){
+			s_midi.receive(buffer[i], arrival);
+		}
+	}
+	if(fd != 0) close(fd);
+
+	s_midi.allNotesOff();
+	if(s_render){
+		render(YM2203_MIDIin::getClock() - last);
+		render(RENDER_TAIL);
+		printf("%s: %.2f sec audio\n", output, (double)s_wave.getSamples() / s_emulator.getSampleRate());
+		s_wave.close();
+	}
+	printLatency();
+	return 0;
+}
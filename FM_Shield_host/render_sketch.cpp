@@ -0,0 +1,166 @@
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * render the sample music of gr_sketch.cpp to a WAV file on PC.
+ *
+ * build:
+ *   g++ -O2 -std=gnu++11 -DPC_DEBUG -DPC_DEBUG_QUIET -I. -I../FM_Shield_src \
+ *       render_sketch.cpp YM2203_Emulator.cpp WaveFile.cpp \
+ *       ../FM_Shield_src/YM2203.cpp ../FM_Shield_src/YM2203_Timbre.cpp ../FM_Shield_src/YM2203_TimbreBank.cpp \
+ *       ../FM_Shield_src/YM2203_MMLplayer.cpp ../FM_Shield_src/gr_sketch.cpp \
+ *       -o render_sketch
+ *   (add -mavx2 or -msse4.1 for the SIMD FM kernel,
+ *    -DMML_PROFILE to print the statistics of the timer procedure)
+ *
+ * usage:
+ *   render_sketch [--scalar] [--check] [output.wav]
+ *     --scalar : use the reference kernels (scalar FM, SSG clocked step by step)
+ *     --check  : also render with the reference kernels and compare bit by bit
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "YM2203_MMLplayer.h"
+#include "YM2203_Emulator.h"
+#include "WaveFile.h"
+
+// in gr_sketch.cpp
+void setup();
+void music_JingleBells(void);
+
+#define RENDER_BUFFER_SIZE	4096
+
+static YM2203_Emulator s_emulator;
+static YM2203_Emulator s_reference;		//!< reference kernels for --check
+static bool s_check = false;
+static unsigned long s_mismatch = 0;	//!< samples differ from the reference
+static WaveFile s_wave;
+
+/**
+ * write to both emulators. (--check)
+ */
+static void checkBusHook(void*, uint8_t addr, uint8_t data)
+{
+	s_emulator.write(addr, data);
+	s_reference.write(addr, data);
+}
+
+/**
+ * render the elapsed timer interval.
+ */
+static void onHostTimer(void*, uint32_t interval)
+{
+	int16_t buffer[RENDER_BUFFER_SIZE];
+	int16_t reference[RENDER_BUFFER_SIZE];
+	int samples = s_emulator.samplesFor(interval);
+	int num, i;
+
+	while(samples > 0){
+		num = (samples < RENDER_BUFFER_SIZE) ? samples : RENDER_BUFFER_SIZE;
+		s_emulator.render(buffer, num);
+		if(s_check){
+			s_reference.render(reference, num);
+			for(i=0; i<num; i++){
+				if(buffer[i] != reference[i]) s_mismatch++;
+			}
+		}
+		s_wave.write(buffer, num);
+		samples -= num;
+	}
+}
+
+#ifdef MML_PROFILE
+/**
+ * print the statistics of the timer procedure.
+ */
+static void printProfile(void)
+{
+	MML_Profile profile;
+	int i;
+
+	MMLplayer.getProfile(&profile);
+	if(profile.calls == 0) return;
+	printf("onTimer: %u calls, %u overruns\n", profile.calls, profile.overruns);
+	printf("  time [ns]: min %u, avg %llu, max %u\n", profile.minTime,
+	       (unsigned long long)(profile.totalTime / profile.calls), profile.maxTime);
+	printf("  writes/call: avg %.2f, max %u\n", (double)profile.totalWrites / profile.calls, profile.maxWrites);
+	printf("  commands/call: avg %.2f, max %u\n", (double)profile.totalCommands / profile.calls, profile.maxCommands);
+	for(i=0; i<MML_PROFILE_BINS; i++){
+		if(profile.histogram[i] == 0) continue;
+		printf("  %6u - %6u ns: %u\n", 1u << i, (2u << i) - 1, profile.histogram[i]);
+	}
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+	const char* path = "jingle_bells.wav";
+	const char* simd;
+	clock_t start;
+	double seconds, audio;
+	int i;
+
+	for(i=1; i<argc; i++){
+		if(strcmp(argv[i], "--scalar") == 0){
+			s_emulator.setKernel(EMU_KERNEL_SCALAR);
+			s_emulator.setSSGKernel(EMU_SSG_STEP);
+		}else if(strcmp(argv[i], "--check") == 0){
+			s_check = true;
+		}else{
+			path = argv[i];
+		}
+	}
+	s_reference.setKernel(EMU_KERNEL_SCALAR);
+	s_reference.setSSGKernel(EMU_SSG_STEP);
+	if(!YM2203_Emulator::getSimdKernelName(&simd)){
+		fprintf(stderr, "SIMD FM kernel is not compiled in, using the scalar kernel\n");
+	}
+
+	if(!s_wave.open(path, s_emulator.getSampleRate())){
+		fprintf(stderr, "cannot open %s\n", path);
+		return 1;
+	}
+
+	// connect the emulator behind YM2203::write()
+	if(s_check){
+		YM2203_simBus.hook = checkBusHook;
+	}else{
+		YM2203_simBus.hook = YM2203_Emulator::busHook;
+		YM2203_simBus.context = &s_emulator;
+	}
+	MMLplayer.setHostTimer(onHostTimer, NULL);
+
+	start = clock();
+	setup();
+	music_JingleBells();
+	seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	audio = (double)s_wave.getSamples() / s_emulator.getSampleRate();
+	s_wave.close();
+	printf("%s: %.2f sec audio, %.3f sec render (x%.1f real time)\n",
+	       path, audio, seconds, (seconds > 0) ? audio / seconds : 0.0);
+#ifdef MML_PROFILE
+	printProfile();
+#endif
+	if(s_check){
+		printf("check (%s FM + block SSG vs reference): %lu samples differ\n", simd, s_mismatch);
+		return (s_mismatch == 0) ? 0 : 2;
+	}
+	return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef __RXDUINO_STUB_H_
+#define __RXDUINO_STUB_H_
+
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// minimum stub of the GR-SAKURA library to build sketches on PC
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define OUTPUT		1
+#define INPUT		0
+#define LOW			0
+#define HIGH		1
+#define PIN_LED0	100
+#define PIN_LED1	101
+#define PIN_LED2	102
+#define PIN_LED3	103
+
+#define pinMode(pin, mode)			;
+#define digitalWrite(pin, value)	;
+#define delay(ms)					;
+
+#endif
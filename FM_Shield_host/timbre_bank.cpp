@@ -0,0 +1,201 @@
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * make a timbre bank file from a voice list, or list the voices of a bank file.
+ * the bank file can be given to batch_render (-b), or converted to
+ * a const array (--c) to be kept in ROM on GR-SAKURA.
+ *
+ * build:
+ *   g++ -O2 -std=gnu++11 -DPC_DEBUG -I. -I../FM_Shield_src \
+ *       timbre_bank.cpp ../FM_Shield_src/YM2203_Timbre.cpp ../FM_Shield_src/YM2203_TimbreBank.cpp \
+ *       -o timbre_bank
+ *
+ * usage:
+ *   timbre_bank voices.txt bank.ymtb   make a bank file
+ *   timbre_bank bank.ymtb              list the voices of a bank file
+ *   timbre_bank --c bank.ymtb          print the bank file as a C array
+ *
+ * voice list (text, one voice per line, '#' starts a comment):
+ *   <num> <al> <fb> <AR x4> <DR x4> <SR x4> <RR x4> <SL x4> <TL x4> <KS x4> <ML x4> <DT x4>
+ *   (the same parameters as the timbre command of batch_render, num: voice number "@num")
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "YM2203_TimbreBank.h"
+
+#define VOICE_LINE_MAX		1024	//!< maximum length of a line of voice lists
+#define VOICE_PARAM_NUM		38		//!< number of parameters of a voice (without the number)
+#define VOICE_NUM_MAX		4096	//!< maximum voice number + 1
+
+/**
+ * read a voice list.
+ */
+static bool readVoices(const char* path, std::vector<YM2203_Timbre> *timbres, std::vector<bool> *valid)
+{
+	char line[VOICE_LINE_MAX];
+	int param[VOICE_PARAM_NUM];
+	YM2203_Timbre *t;
+	char *p, *end;
+	int lineNo = 0;
+	int num, i;
+	FILE *fp = fopen(path, "r");
+
+	if(fp == NULL){
+		fprintf(stderr, "cannot open %s\n", path);
+		return false;
+	}
+	while(fgets(line, sizeof(line), fp) != NULL){
+		lineNo++;
+		p = strpbrk(line, "#\r\n");
+		if(p != NULL) *p = '\0';
+		p = line + strspn(line, " \t");
+		if(*p == '\0') continue;
+
+		num = (int)strtol(p, &end, 10);
+		for(i=0; i<VOICE_PARAM_NUM; i++){
+			param[i] = (int)strtol(end, &end, 10);
+		}
+		if( (num < 0) || (num >= VOICE_NUM_MAX) ){
+			fprintf(stderr, "%s: line %d: bad voice number\n", path, lineNo);
+			fclose(fp);
+			return false;
+		}
+		if(num >= (int)timbres->size()){
+			timbres->resize(num + 1);
+			valid->resize(num + 1, false);
+		}
+		t = &(*timbres)[num];
+		t->setAlgorithm(param[0]);
+		t->setFeedback(param[1]);
+		t->setOpMask(MASK_ALL);
+		t->setAR(param[ 2], param[ 3], param[ 4], param[ 5]);
+		t->setDR(param[ 6], param[ 7], param[ 8], param[ 9]);
+		t->setSR(param[10], param[11], param[12], param[13]);
+		t->setRR(param[14], param[15], param[16], param[17]);
+		t->setSL(param[18], param[19], param[20], param[21]);
+		t->setTL(param[22], param[23], param[24], param[25]);
+		t->setKS(param[26], param[27], param[28], param[29]);
+		t->setML(param[30], param[31], param[32], param[33]);
+		t->setDT(param[34], param[35], param[36], param[37]);
+		(*valid)[num] = true;
+	}
+	fclose(fp);
+	return true;
+}
+
+/**
+ * make a bank file from a voice list.
+ */
+static int makeBank(const char* list, const char* path)
+{
+	std::vector<YM2203_Timbre> timbres;
+	std::vector<bool> valid;
+	std::vector<const YM2203_Timbre*> voices;
+	std::vector<uint8_t> image;
+	uint32_t size;
+	int num;
+	FILE *fp;
+
+	if(!readVoices(list, &timbres, &valid)) return 1;
+	for(num=0; num<(int)timbres.size(); num++){
+		voices.push_back(valid[num] ? &timbres[num] : NULL);
+	}
+	image.resize(YM2203_TimbreBank::getImageSize((int)voices.size(), (int)voices.size()));
+	size = YM2203_TimbreBank::make(voices.data(), (int)voices.size(), image.data(), (uint32_t)image.size());
+
+	fp = fopen(path, "wb");
+	if(fp == NULL){
+		fprintf(stderr, "cannot open %s\n", path);
+		return 1;
+	}
+	fwrite(image.data(), 1, size, fp);
+	fclose(fp);
+	printf("%s: %d voices, %u bytes\n", path, (int)voices.size(), size);
+	return 0;
+}
+
+/**
+ * list the voices of a bank file. (or print it as a C array)
+ */
+static int listBank(const char* path, bool cArray)
+{
+	YM2203_TimbreBank bank;
+	YM2203_Timbre t;
+	struct stat st;
+	const uint8_t *data;
+	int fd, num, i;
+
+	// the bank is read in place, as in ROM
+	fd = open(path, O_RDONLY);
+	if( (fd < 0) || (fstat(fd, &st) != 0) || (st.st_size == 0) ){
+		fprintf(stderr, "cannot open %s\n", path);
+		return 1;
+	}
+	data = (const uint8_t*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if( (data == MAP_FAILED) || !bank.open(data, (uint32_t)st.st_size) ){
+		fprintf(stderr, "%s: not a timbre bank\n", path);
+		return 1;
+	}
+
+	if(cArray){
+		printf("static const uint8_t TIMBRE_BANK[] = {");
+		for(i=0; i<(int)st.st_size; i++){
+			printf("%s0x%02X,", (i % 16 == 0) ? "\n\t" : " ", data[i]);
+		}
+		printf("\n};\n");
+		return 0;
+	}
+
+	printf("# %s: %d voices\n", path, bank.getVoiceNum());
+	printf("#num al fb   AR           DR           SR           RR           SL           TL           KS           ML           DT\n");
+	for(num=0; num<bank.getVoiceNum(); num++){
+		if(!bank.load(num, &t)) continue;
+		printf("%-4d %2d %2d  ", num, t.algorithm, t.feedback);
+		printf(" %2d %2d %2d %2d  ", t.ar[0], t.ar[1], t.ar[2], t.ar[3]);
+		printf(" %2d %2d %2d %2d  ", t.dr[0], t.dr[1], t.dr[2], t.dr[3]);
+		printf(" %2d %2d %2d %2d  ", t.sr[0], t.sr[1], t.sr[2], t.sr[3]);
+		printf(" %2d %2d %2d %2d  ", t.rr[0], t.rr[1], t.rr[2], t.rr[3]);
+		printf(" %2d %2d %2d %2d  ", t.sl[0], t.sl[1], t.sl[2], t.sl[3]);
+		printf(" %2d %2d %2d %2d  ", t.tl[0], t.tl[1], t.tl[2], t.tl[3]);
+		printf(" %2d %2d %2d %2d  ", t.keyScale[0], t.keyScale[1], t.keyScale[2], t.keyScale[3]);
+		printf(" %2d %2d %2d %2d  ", t.multiple[0], t.multiple[1], t.multiple[2], t.multiple[3]);
+		printf(" %2d %2d %2d %2d\n", t.detune[0], t.detune[1], t.detune[2], t.detune[3]);
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if( (argc == 3) && (strcmp(argv[1], "--c") == 0) ){
+		return listBank(argv[2], true);
+	}else if(argc == 3){
+		return makeBank(argv[1], argv[2]);
+	}else if(argc == 2){
+		return listBank(argv[1], false);
+	}
+	fprintf(stderr, "usage: %s voices.txt bank.ymtb | %s [--c] bank.ymtb\n", argv[0], argv[0]);
+	return 1;
+}
@@ -19,6 +19,7 @@
  */
 
 #include "YM2203_Timbre.h"
+#include "YM2203_Bus.h"
 
 // Number of channels
 #define FM_CH1			0	//!< FM channel 1
@@ -48,26 +49,61 @@
 #define KEY_B			11	//!< B
 #define KEY_NUM			12	//!< 12 keys in a octave
 
+// Note number (note = octave * 12 + key, see YM2203_Driver::setNotePitch)
+#define OCTAVE_NUM		9	//!< octave 0-8
+#define NOTE_NUM		(OCTAVE_NUM * KEY_NUM)	//!< number of notes in the pitch tables
+
+//! reference pitch: frequency of A of the octave 5 (A4 of the scientific pitch notation) [Hz]
+//! (can be given by the build flags, as well as YM2203_MASTER_CLOCK)
+#ifndef YM2203_PITCH_A4
+#define YM2203_PITCH_A4	440.0
+#endif
+
 // Tone/Noise mode of SSG channels
 #define TONE_MODE		0	//!< tone output mode (default)
 #define NOISE_MODE		1	//!< noise output mode
 #define TONE_NOISE_MODE	2	//!< tone & noise output mode
 
+// Wait mode of register accesses
+#define WAIT_FIXED		0	//!< fixed worst-case delay after each write (default)
+#define WAIT_BUSY		1	//!< poll the busy flag before the next access
+#define WAIT_CYCLE		2	//!< wait the cycle budget of the last write before the next access
+
+// Write queue (see YM2203_Driver::setQueued)
+#define YM2203_QUEUE_SIZE	32	//!< register writes held by the write queue (power of 2)
+
+// Recording of register writes (see YM2203_Driver::setRecordBuffer)
+#define YM2203_RECORD_RATE	44100	//!< time base of the record [Hz] (sample rate of VGM files)
+
 /**
- * YM2203 class
+ * register write of a record.
  */
-class YM2203
+struct YM2203_RecordEntry
+{
+	uint32_t time;			//!< time of the write [1/YM2203_RECORD_RATE sec]
+	uint8_t addr;			//!< register address
+	uint8_t data;			//!< register value
+};
+
+/**
+ * YM2203 driver class template.
+ * Bus is the bus policy (see YM2203_Bus.h), resolved at compile time.
+ */
+template <class Bus>
+class YM2203_Driver
 {
 public:
 	
-	YM2203();			//!< constructor.
-	~YM2203();			//!< destructor.
+	YM2203_Driver();	//!< constructor.
+	~YM2203_Driver();	//!< destructor.
 	
 	// Common APIs
 	void begin(void);								//!< initialize the YM2203 device.
 	void noteOn   (int ch);							//!< note-on a channel.
 	void noteOff  (int ch);							//!< note-off a channel.
 	void setPitch (int ch, int octave, int key);	//!< set pitch to a channel
+	void setPitch (int ch, int octave, int key, int cents);	//!< set pitch to a channel, with a detune.
+	void setNotePitch(int ch, int note, int cents = 0);	//!< set pitch of a note number to a channel.
 	void setVolume(int ch, int volume);				//!< set volume to a channel.
 	
 	// SSG APIs
@@ -75,27 +111,83 @@ public:
 	void setToneNoise(int ch, int mode);			//!< set tone/noise mode to a chennel.
 	
 	// FM APIs
-	void setTimbre(int ch, YM2203_Timbre *timbre);	//!< set timbre to a channel.
+	void setTimbre(int ch, const YM2203_Timbre *timbre);	//!< set timbre to a channel.
 	
 	// Low Level APIs
 	uint8_t	read(uint8_t addr);						//!< read a register value.
 	void write(uint8_t addr,uint8_t data);			//!< write a register value.
 	void writeAddress(uint8_t addr);				//!< only write a register address.
 	uint8_t readStatus(void);						//!< read status of YM2203.
+	
+	// Shadow register APIs
+	void invalidateShadow(void);					//!< forget all cached register values.
+	uint32_t getIssuedWrites(void);					//!< number of writes issued to the bus.
+	uint32_t getSuppressedWrites(void);				//!< number of writes skipped by the shadow.
+	void clearWriteCounters(void);					//!< clear the write counters.
+	void setWaitMode(int mode);						//!< set the wait mode of register accesses.
+	Bus* getBus(void);								//!< get the bus policy object.
+	
+	// Write queue APIs (for the scheduler of YM2203_Chips)
+	void setQueued(bool queued);					//!< hold the writes in the write queue or not.
+	int getQueued(void);							//!< number of writes in the write queue.
+	bool isReady(void);								//!< whether the device accepts an access without waiting.
+	bool issueQueued(void);							//!< issue the oldest write in the write queue.
+	
+	// Record APIs
+	void setRecordBuffer(YM2203_RecordEntry *entries, uint32_t size);	//!< start or stop recording the writes.
+	int readRecord(YM2203_RecordEntry *entries, int max);	//!< take out the recorded writes.
+	void setRecordTime(uint32_t time);				//!< set the time of the following writes.
+	uint32_t getRecordTime(void);					//!< get the time of the following writes.
+	uint32_t getRecordDropped(void);				//!< number of writes lost by the full buffer.
 
 private:
-	YM2203_Timbre *m_timbre[FM_CH_NUM];				//!< pointer to timble data of each FM channel
+	const YM2203_Timbre *m_timbre[FM_CH_NUM];			//!< pointer to timble data of each FM channel
 	uint8_t m_volume[FM_CH_NUM];					//!< volume of each FM channel
 	bool m_enveloped[SSG_CH_NUM];					//!< is each SSG channel enveloped?
 	uint8_t m_toneNoise[SSG_CH_NUM];				//!< mask of SSG channel mode (tone/noise)
 	uint8_t m_ssgKeyOn;								//!< status of SSG channels key-on/off
 	uint8_t m_ssgEnvelopeType;						//!< SSG envelope type
+	uint8_t m_shadow[256];							//!< shadow image of the written registers
+	uint8_t m_shadowValid[256/8];					//!< valid flag of each shadow register (1bit each)
+	uint32_t m_issuedWrites;						//!< number of writes issued to the bus
+	uint32_t m_suppressedWrites;					//!< number of writes skipped by the shadow
+	uint8_t m_waitMode;								//!< wait mode of register accesses
+	uint8_t m_pendingTicks;							//!< ticks to wait for the last write (0: none)
+	uint16_t m_writeTime;							//!< time of the last write [bus ticks]
+	bool m_addrPending;								//!< the address setup time is not waited yet
+	uint16_t m_addrTime;							//!< time of the last address write [bus ticks]
+	Bus m_bus;										//!< bus policy object
+	bool m_queued;									//!< hold the writes in the write queue
+	uint8_t m_queueHead;							//!< index of the oldest write in the write queue
+	uint8_t m_queueLen;								//!< number of writes in the write queue
+	uint8_t m_queue[YM2203_QUEUE_SIZE][2];			//!< write queue (address, value)
+	YM2203_RecordEntry *m_record;					//!< ring buffer of the record (NULL: not recording)
+	uint32_t m_recordMask;							//!< size of the ring buffer - 1
+	volatile uint32_t m_recordHead;					//!< write index of the ring buffer (by write())
+	volatile uint32_t m_recordTail;					//!< read index of the ring buffer (by readRecord())
+	uint32_t m_recordTime;							//!< time of the following writes
+	uint32_t m_recordDropped;						//!< number of writes lost by the full buffer
 	
-	static const uint16_t FM_PITCH_TABLE[KEY_NUM];	//!< pitch parameter table for FM channel
-	static const uint16_t SSG_PITCH_TABLE[KEY_NUM];	//!< pitch parameter table for SSG channel
+	static const uint16_t FM_PITCH_TABLE[NOTE_NUM];	//!< block and F-Number of each note for FM channel
+	static const uint16_t SSG_PITCH_TABLE[NOTE_NUM];	//!< tone period of each note for SSG channel
 	
-	void initExternalBus(void);		//!< initialize the external memory bus of RX63N.
-	void startMasterClock(void);	//!< start to supply mastar clock to the YM2203 device.
+	bool isShadowed(uint8_t addr, uint8_t data);	//!< whether the register already holds the value.
+	void waitReady(void);			//!< wait until the device is ready for the next access.
+	void waitAddress(void);			//!< wait the rest of the address setup time.
+	void writeFMPitch(int ch, uint16_t blockFnum);	//!< write the frequency registers of a FM channel.
+	void writeSSGPitch(int ch, uint16_t period);	//!< write the tone period registers of a SSG channel.
+	void issue(uint8_t addr, uint8_t data);	//!< write a register value to the bus.
+	void issueAddress(uint8_t addr);		//!< write a register address to the bus.
+	void issueData(uint8_t addr, uint8_t data);	//!< write a register value to the bus after the address.
 };
 
+//! YM2203 class (on the bus of FM-Shield, or the mock bus on PC)
+typedef YM2203_Driver<YM2203_DefaultBus> YM2203;
+
+// the YM2203 class is instantiated in YM2203.cpp
+extern template class YM2203_Driver<YM2203_DefaultBus>;
+
+// member functions (for the other bus policies)
+#include "YM2203_Driver.h"
+
 #endif
@@ -0,0 +1,303 @@
+#ifndef __YM2203_BUS_H_
+#define __YM2203_BUS_H_
+
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// bus policies of the YM2203 driver (see YM2203_Driver)
+//
+// a bus policy is a class with these members:
+//   void     setChip(int chip);            select the device of the driver (0 - YM2203_CHIP_NUM-1)
+//   void     begin(void);                  bring up the bus and reset the device
+//   void     writeAddress(uint8_t addr);   write a register address
+//   void     writeData(uint8_t data);      write a register value
+//   uint8_t  readData(void);               read a register value
+//   uint8_t  readStatus(void);             read status
+//   void     delayMicroseconds(uint32_t us);  wait
+//   uint16_t ticks(void);                  free-running clock for the cycle budget [1/YM2203_BUS_TICK_HZ sec]
+// the driver calls them directly, so they are resolved at compile time.
+
+#include <stdint.h>
+#include <stddef.h>
+
+//! master clock frequency of YM2203 [Hz] (supplied by YM2203_CS3Bus)
+#ifndef YM2203_MASTER_CLOCK
+#define YM2203_MASTER_CLOCK		4000000UL
+#endif
+//! convert master clocks to nanoseconds
+#define YM2203_CLOCK_TO_NS(clk)	((uint32_t)(clk) * (1000000000UL / YM2203_MASTER_CLOCK))
+//! clock of the bus ticks() [Hz] (PCLKB(48MHz) / 8 on GR-SAKURA. less than a master clock)
+#define YM2203_BUS_TICK_HZ		6000000UL
+//! convert master clocks to bus ticks (rounded up)
+#define YM2203_CLOCK_TO_TICKS(clk)	(((uint32_t)(clk) * YM2203_BUS_TICK_HZ + YM2203_MASTER_CLOCK - 1) / YM2203_MASTER_CLOCK)
+
+//! busy flag of the status register
+#define YM2203_STATUS_BUSY		0x80
+
+//! number of YM2203 devices on the bus (compile-time. see YM2203_Chips)
+#ifndef YM2203_CHIP_NUM
+#define YM2203_CHIP_NUM			1
+#endif
+#if (YM2203_CHIP_NUM < 1) || (YM2203_CHIP_NUM > 4)
+#error "YM2203_CHIP_NUM must be 1 - 4 (selected by A17,A18)"
+#endif
+
+// for real machine
+#ifndef PC_DEBUG
+#include <rxduino.h>
+#include <iodefine_gcc63n.h>
+
+//! read YM2203 status
+#define YM2203_STATUS   (*(volatile unsigned char*)0x05000000) // CS3,A16=0
+//! read YM2203 register address
+#define YM2203_REG_ADDR (*(volatile unsigned char*)0x05000000) // CS3,A16=0
+//! read/write YM2203 register value
+#define YM2203_REG_DATA (*(volatile unsigned char*)0x05010000) // CS3,A16=1
+
+//! address of the device n (selected by A17,A18. n=0: the FM-Shield)
+#define YM2203_CHIP_BASE(n)		(0x05000000UL + (uint32_t)(n) * 0x00020000UL)
+//! offset of the register value (A16=1)
+#define YM2203_DATA_OFFSET		0x00010000UL
+
+//! PCLK of GR-SAKURA [Hz] (the master clock is divided from it by MTU3)
+#define YM2203_PCLK				48000000UL
+//! PCLK cycles of a master clock cycle
+#define YM2203_MASTER_CLOCK_DIV	(YM2203_PCLK / YM2203_MASTER_CLOCK)
+#if (YM2203_PCLK % YM2203_MASTER_CLOCK) != 0 || (YM2203_MASTER_CLOCK_DIV < 2)
+#error "YM2203_MASTER_CLOCK must divide 48MHz (PCLK) evenly by 2 or more on GR-SAKURA"
+#endif
+
+/**
+ * memory-mapped bus of FM-Shield. (CS3 area of RX63N external bus)
+ * if YM2203_CHIP_NUM > 1, the devices are selected by A17,A18.
+ */
+class YM2203_CS3Bus
+{
+public:
+	YM2203_CS3Bus() : m_chip(0), m_base((volatile uint8_t*)YM2203_CHIP_BASE(0)) {}
+
+	//! select the device. (only the device 0 initializes the bus and resets the devices)
+	void setChip(int chip) { m_chip = chip; m_base = (volatile uint8_t*)YM2203_CHIP_BASE(chip); }
+
+	void begin(void);				//!< initialize the bus, start the master clock and reset the device.
+
+#if YM2203_CHIP_NUM > 1
+	//! write a register address to the bus.
+	inline void writeAddress(uint8_t addr) { m_base[0] = addr; }
+	//! write a register value to the bus.
+	inline void writeData(uint8_t data) { m_base[YM2203_DATA_OFFSET] = data; }
+	//! read a register value from the bus.
+	inline uint8_t readData(void) { return m_base[YM2203_DATA_OFFSET]; }
+	//! read status from the bus.
+	inline uint8_t readStatus(void) { return m_base[0]; }
+#else
+	//! write a register address to the bus.
+	inline void writeAddress(uint8_t addr) { YM2203_REG_ADDR = addr; }
+	//! write a register value to the bus.
+	inline void writeData(uint8_t data) { YM2203_REG_DATA = data; }
+	//! read a register value from the bus.
+	inline uint8_t readData(void) { return YM2203_REG_DATA; }
+	//! read status from the bus.
+	inline uint8_t readStatus(void) { return YM2203_STATUS; }
+#endif
+	//! wait.
+	inline void delayMicroseconds(uint32_t us) { ::delayMicroseconds(us); }
+	//! free-running clock [1/YM2203_BUS_TICK_HZ sec] (TMR2,3)
+	inline uint16_t ticks(void) { return TMR23.TCNT; }
+
+private:
+	int m_chip;						//!< device number
+	volatile uint8_t *m_base;		//!< address of the device
+
+	void initExternalBus(void);		//!< initialize the external memory bus of RX63N.
+	void startMasterClock(void);	//!< start to supply mastar clock to the YM2203 device.
+	void startTickClock(void);		//!< start the free-running clock of ticks().
+};
+
+//! bus of the YM2203 class
+typedef YM2203_CS3Bus YM2203_DefaultBus;
+
+// just for algorithm debug on PC
+#else
+
+//! simulated bus access time [ns]
+#define YM2203_SIM_ACCESS_NS	100
+
+/**
+ * simulated bus of YM2203 (for algorithm debug on PC)
+ */
+struct YM2203_SimBus
+{
+	uint64_t time;			//!< simulated time [ns]
+	uint64_t addrReadyAt;	//!< time when the data can be accessed [ns]
+	uint64_t busyUntil;		//!< time when the device becomes ready [ns]
+	uint32_t violations;	//!< number of accesses while the device is not ready
+	uint32_t writes;		//!< number of data writes
+	uint8_t addr;			//!< latched register address
+	uint8_t reg[256];		//!< register values
+	void (*hook)(void* context, uint8_t addr, uint8_t data);	//!< called on each data write (e.g. emulator)
+	void* context;			//!< argument for the hook
+};
+extern YM2203_SimBus YM2203_simBus;	//!< default bus of all YM2203 objects
+
+/**
+ * host mock bus. (accesses a YM2203_SimBus, and checks the access timing)
+ */
+class YM2203_MockBus
+{
+public:
+	YM2203_MockBus() : m_sim(&YM2203_simBus), m_time(&YM2203_simBus.time) {}
+
+	//! set the simulated bus. (NULL: the global YM2203_simBus)
+	void attach(YM2203_SimBus *sim) { m_sim = (sim != NULL) ? sim : &YM2203_simBus; m_time = &m_sim->time; }
+	//! get the simulated bus.
+	YM2203_SimBus* getSim(void) { return m_sim; }
+	//! use the time of another simulated bus. (devices on the same bus. call after attach)
+	void shareTime(YM2203_SimBus *clock) { m_time = &clock->time; }
+	//! no device to select on PC. (each device has its own YM2203_SimBus)
+	void setChip(int chip) { (void)chip; }
+
+	//! no bus to initialize on PC.
+	void begin(void) {}
+
+	//! write a register address to the simulated bus.
+	inline void writeAddress(uint8_t addr)
+	{
+		*m_time += YM2203_SIM_ACCESS_NS;
+		if(*m_time < m_sim->busyUntil) m_sim->violations++;
+		m_sim->addr = addr;
+		m_sim->addrReadyAt = *m_time + YM2203_CLOCK_TO_NS(17);
+	}
+
+	//! write a register value to the simulated bus.
+	inline void writeData(uint8_t data)
+	{
+		uint8_t addr = m_sim->addr;
+		uint32_t clocks;
+
+		*m_time += YM2203_SIM_ACCESS_NS;
+		if(*m_time < m_sim->addrReadyAt) m_sim->violations++;
+		m_sim->reg[addr] = data;
+		m_sim->writes++;
+		if(m_sim->hook != NULL){
+			m_sim->hook(m_sim->context, addr, data);
+		}
+
+		// the device is busy while processing the written data
+		if( addr >= 0xA0 ){
+			clocks = 47;
+		}else if( addr >= 0x28 ){
+			clocks = 83;
+		}else{
+			clocks = 17;
+		}
+		m_sim->busyUntil = *m_time + YM2203_CLOCK_TO_NS(clocks);
+	}
+
+	//! read a register value from the simulated bus.
+	inline uint8_t readData(void)
+	{
+		*m_time += YM2203_SIM_ACCESS_NS;
+		if(*m_time < m_sim->addrReadyAt) m_sim->violations++;
+		return m_sim->reg[m_sim->addr];
+	}
+
+	//! read status from the simulated bus.
+	inline uint8_t readStatus(void)
+	{
+		*m_time += YM2203_SIM_ACCESS_NS;
+		return (*m_time < m_sim->busyUntil) ? YM2203_STATUS_BUSY : 0x00;
+	}
+
+	//! advance the simulated time.
+	inline void delayMicroseconds(uint32_t us)
+	{
+		*m_time += (uint64_t)us * 1000;
+	}
+
+	//! read the simulated clock. (reading the clock takes a bus access time)
+	inline uint16_t ticks(void)
+	{
+		*m_time += YM2203_SIM_ACCESS_NS;
+		return (uint16_t)(*m_time * (YM2203_BUS_TICK_HZ / 1000000) / 1000);
+	}
+
+private:
+	YM2203_SimBus *m_sim;	//!< simulated bus
+	uint64_t *m_time;		//!< simulated time [ns] (of m_sim, or shared)
+};
+
+/**
+ * register write of a trace.
+ */
+struct YM2203_TraceEntry
+{
+	uint8_t addr;			//!< register address
+	uint8_t data;			//!< register value
+};
+
+/**
+ * trace recorder bus. records the register writes, and passes all
+ * accesses to the inner bus policy.
+ */
+template <class Inner>
+class YM2203_TraceBus : public Inner
+{
+public:
+	YM2203_TraceBus() : m_entries(NULL), m_size(0), m_count(0), m_addr(0) {}
+
+	//! set the buffer of the trace, and clear the trace.
+	void setBuffer(YM2203_TraceEntry *entries, uint32_t size)
+	{
+		m_entries = entries;
+		m_size = size;
+		m_count = 0;
+	}
+	//! number of writes. (may be more than the buffer size)
+	uint32_t getCount(void) { return m_count; }
+
+	//! write a register address.
+	inline void writeAddress(uint8_t addr)
+	{
+		m_addr = addr;
+		Inner::writeAddress(addr);
+	}
+
+	//! write a register value, and record it.
+	inline void writeData(uint8_t data)
+	{
+		if(m_count < m_size){
+			m_entries[m_count].addr = m_addr;
+			m_entries[m_count].data = data;
+		}
+		m_count++;
+		Inner::writeData(data);
+	}
+
+private:
+	YM2203_TraceEntry *m_entries;	//!< buffer of the trace
+	uint32_t m_size;				//!< size of the buffer
+	uint32_t m_count;				//!< number of writes
+	uint8_t m_addr;					//!< latched register address
+};
+
+//! bus of the YM2203 class
+typedef YM2203_MockBus YM2203_DefaultBus;
+
+#endif
+
+#endif
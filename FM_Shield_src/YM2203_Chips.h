@@ -0,0 +1,363 @@
+#ifndef __YM2203_CHIPS_H_
+#define __YM2203_CHIPS_H_
+
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// YM2203 devices on a bus, with global channel numbers
+
+#include "YM2203.h"
+
+//! device of a global channel number
+#define YM2203_CHIP_OF(ch)		((ch) / ALL_CH_NUM)
+//! channel number in the device of a global channel number (FM_CH1 - SSG_CH_C)
+#define YM2203_LOCAL_CH(ch)		((ch) % ALL_CH_NUM)
+
+/**
+ * YM2203 devices on a bus.
+ * channel n is the channel (n % 6) of the device (n / 6).
+ * if interleaved, the writes are held in the write queue of each device
+ * and flush() issues them in turn, so a write to a device is done
+ * while another device is still busy with the last write.
+ */
+template <class Bus, int N>
+class YM2203_Chips
+{
+public:
+	YM2203_Chips();		//!< constructor.
+
+	void begin(void);								//!< initialize the YM2203 devices.
+	void noteOn   (int ch);							//!< note-on a channel.
+	void noteOff  (int ch);							//!< note-off a channel.
+	void setPitch (int ch, int octave, int key);	//!< set pitch to a channel
+	void setPitch (int ch, int octave, int key, int cents);	//!< set pitch to a channel, with a detune.
+	void setNotePitch(int ch, int note, int cents = 0);	//!< set pitch of a note number to a channel.
+	void setVolume(int ch, int volume);				//!< set volume to a channel.
+	void setEnvelope(int ch, int type, uint16_t interval);	//!< set envelope to a channel. (SSG)
+	void setToneNoise(int ch, int mode);			//!< set tone/noise mode to a chennel. (SSG)
+	void setTimbre(int ch, const YM2203_Timbre *timbre);	//!< set timbre to a channel. (FM)
+	void write(int chip, uint8_t addr, uint8_t data);	//!< write a register value of a device.
+
+	void setInterleaved(bool interleaved);			//!< interleave the writes of the devices or not.
+	void flush(void);								//!< issue the queued writes of all devices.
+	YM2203_Driver<Bus>* getChip(int chip);			//!< get the driver of a device.
+	void invalidateShadow(void);					//!< forget all cached register values.
+	uint32_t getIssuedWrites(void);					//!< number of writes issued to the bus.
+	uint32_t getSuppressedWrites(void);				//!< number of writes skipped by the shadow.
+	void clearWriteCounters(void);					//!< clear the write counters.
+
+private:
+	YM2203_Driver<Bus> m_chip[N];					//!< driver of each device
+	bool m_interleaved;								//!< interleave the writes
+};
+
+/**
+ * constructor.
+ */
+template <class Bus, int N>
+YM2203_Chips<Bus, N>::YM2203_Chips()
+{
+	int chip;
+
+	for(chip=0; chip<N; chip++){
+		m_chip[chip].getBus()->setChip(chip);
+	}
+	m_interleaved = false;
+}
+
+/**
+ * initialize the YM2203 devices.
+ * (the device 0 initializes the bus and resets all devices, so it goes first)
+ * the writes are interleaved if there are 2 or more devices.
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::begin(void)
+{
+	int chip;
+
+	for(chip=0; chip<N; chip++){
+		m_chip[chip].begin();
+	}
+	this->setInterleaved(N > 1);
+}
+
+/**
+ * note-on a channel.
+ *
+ * @param ch global channel number
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::noteOn(int ch)
+{
+	if( (ch < 0) || (ch >= N * ALL_CH_NUM) ) return;
+	m_chip[YM2203_CHIP_OF(ch)].noteOn(YM2203_LOCAL_CH(ch));
+}
+
+/**
+ * note-off a channel.
+ *
+ * @param ch global channel number
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::noteOff(int ch)
+{
+	if( (ch < 0) || (ch >= N * ALL_CH_NUM) ) return;
+	m_chip[YM2203_CHIP_OF(ch)].noteOff(YM2203_LOCAL_CH(ch));
+}
+
+/**
+ * set pitch to a channel.
+ *
+ * @param ch global channel number
+ * @param octave octave (0-8)
+ * @param key key (0-11 or KEY_C ... KEY_B)
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::setPitch(int ch, int octave, int key)
+{
+	if( (ch < 0) || (ch >= N * ALL_CH_NUM) ) return;
+	m_chip[YM2203_CHIP_OF(ch)].setPitch(YM2203_LOCAL_CH(ch), octave, key);
+}
+
+/**
+ * set pitch to a channel, with a detune.
+ *
+ * @param ch global channel number
+ * @param octave octave (0-8)
+ * @param key key (0-11 or KEY_C ... KEY_B)
+ * @param cents detune in cents (1/100 of a key)
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::setPitch(int ch, int octave, int key, int cents)
+{
+	if( (ch < 0) || (ch >= N * ALL_CH_NUM) ) return;
+	m_chip[YM2203_CHIP_OF(ch)].setPitch(YM2203_LOCAL_CH(ch), octave, key, cents);
+}
+
+/**
+ * set pitch of a note number to a channel.
+ *
+ * @param ch global channel number
+ * @param note note number (octave * 12 + key, 0 - NOTE_NUM-1)
+ * @param cents detune in cents (1/100 of a key)
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::setNotePitch(int ch, int note, int cents)
+{
+	if( (ch < 0) || (ch >= N * ALL_CH_NUM) ) return;
+	m_chip[YM2203_CHIP_OF(ch)].setNotePitch(YM2203_LOCAL_CH(ch), note, cents);
+}
+
+/**
+ * set volume to a channel.
+ *
+ * @param ch global channel number
+ * @param volume volume (0-15)
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::setVolume(int ch, int volume)
+{
+	if( (ch < 0) || (ch >= N * ALL_CH_NUM) ) return;
+	m_chip[YM2203_CHIP_OF(ch)].setVolume(YM2203_LOCAL_CH(ch), volume);
+}
+
+/**
+ * set envelope to a channel. (SSG)
+ * (the envelope generator is shared by the SSG channels of a device)
+ *
+ * @param ch global channel number
+ * @param type envelope type (0-15)
+ * @param interval envelope interval
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::setEnvelope(int ch, int type, uint16_t interval)
+{
+	if( (ch < 0) || (ch >= N * ALL_CH_NUM) ) return;
+	m_chip[YM2203_CHIP_OF(ch)].setEnvelope(YM2203_LOCAL_CH(ch), type, interval);
+}
+
+/**
+ * set tone/noise mode to a channel. (SSG)
+ *
+ * @param ch global channel number
+ * @param mode TONE_MODE, NOISE_MODE or TONE_NOISE_MODE
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::setToneNoise(int ch, int mode)
+{
+	if( (ch < 0) || (ch >= N * ALL_CH_NUM) ) return;
+	m_chip[YM2203_CHIP_OF(ch)].setToneNoise(YM2203_LOCAL_CH(ch), mode);
+}
+
+/**
+ * set timbre to a channel. (FM)
+ *
+ * @param ch global channel number
+ * @param timbre timbre
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::setTimbre(int ch, const YM2203_Timbre *timbre)
+{
+	if( (ch < 0) || (ch >= N * ALL_CH_NUM) ) return;
+	m_chip[YM2203_CHIP_OF(ch)].setTimbre(YM2203_LOCAL_CH(ch), timbre);
+}
+
+/**
+ * write a register value of a device.
+ *
+ * @param chip device number
+ * @param addr YM2203 register address
+ * @param data value to write to the register
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::write(int chip, uint8_t addr, uint8_t data)
+{
+	if( (chip < 0) || (chip >= N) ) return;
+	m_chip[chip].write(addr, data);
+}
+
+/**
+ * interleave the writes of the devices or not.
+ * interleaved writes are held until flush(), and use the cycle budget
+ * wait (WAIT_CYCLE) so that the busy time of a device is not waited
+ * while the other devices are written.
+ *
+ * @param interleaved true to interleave
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::setInterleaved(bool interleaved)
+{
+	int chip;
+
+	for(chip=0; chip<N; chip++){
+		m_chip[chip].setQueued(interleaved);
+		m_chip[chip].setWaitMode(interleaved ? WAIT_CYCLE : WAIT_FIXED);
+	}
+	m_interleaved = interleaved;
+}
+
+/**
+ * issue the queued writes of all devices.
+ * the devices are visited in turn and a ready device gets its next write.
+ * only if no device is ready, the scheduler waits for one.
+ * (the order of the writes to a device is kept)
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::flush(void)
+{
+	int chip, pending;
+	bool issued;
+
+	if( !m_interleaved ) return;
+
+	do{
+		pending = 0;
+		issued = false;
+		for(chip=0; chip<N; chip++){
+			if( m_chip[chip].getQueued() == 0 ) continue;
+			pending++;
+			if( m_chip[chip].isReady() ){
+				m_chip[chip].issueQueued();
+				issued = true;
+			}
+		}
+		// all devices are busy. wait for the first one.
+		if( (pending > 0) && !issued ){
+			for(chip=0; m_chip[chip].getQueued() == 0; chip++){
+				;
+			}
+			m_chip[chip].issueQueued();
+		}
+	}while(pending > 0);
+}
+
+/**
+ * get the driver of a device.
+ *
+ * @param chip device number
+ * @return driver of the device
+ */
+template <class Bus, int N>
+YM2203_Driver<Bus>* YM2203_Chips<Bus, N>::getChip(int chip)
+{
+	return &m_chip[chip];
+}
+
+/**
+ * forget all cached register values of all devices.
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::invalidateShadow(void)
+{
+	int chip;
+
+	for(chip=0; chip<N; chip++){
+		m_chip[chip].invalidateShadow();
+	}
+}
+
+/**
+ * number of writes issued to the bus. (all devices)
+ *
+ * @return number of writes
+ */
+template <class Bus, int N>
+uint32_t YM2203_Chips<Bus, N>::getIssuedWrites(void)
+{
+	uint32_t writes = 0;
+	int chip;
+
+	for(chip=0; chip<N; chip++){
+		writes += m_chip[chip].getIssuedWrites();
+	}
+	return writes;
+}
+
+/**
+ * number of writes skipped by the shadow. (all devices)
+ *
+ * @return number of writes
+ */
+template <class Bus, int N>
+uint32_t YM2203_Chips<Bus, N>::getSuppressedWrites(void)
+{
+	uint32_t writes = 0;
+	int chip;
+
+	for(chip=0; chip<N; chip++){
+		writes += m_chip[chip].getSuppressedWrites();
+	}
+	return writes;
+}
+
+/**
+ * clear the write counters of all devices.
+ */
+template <class Bus, int N>
+void YM2203_Chips<Bus, N>::clearWriteCounters(void)
+{
+	int chip;
+
+	for(chip=0; chip<N; chip++){
+		m_chip[chip].clearWriteCounters();
+	}
+}
+
+//! YM2203 devices of the MML player (YM2203_CHIP_NUM devices on the default bus)
+typedef YM2203_Chips<YM2203_DefaultBus, YM2203_CHIP_NUM> YM2203_ChipSet;
+
+#endif
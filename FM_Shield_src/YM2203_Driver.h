@@ -0,0 +1,1057 @@
+#ifndef __YM2203_DRIVER_H_
+#define __YM2203_DRIVER_H_
+
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// member functions of YM2203_Driver (included by YM2203.h)
+
+#include <string.h>
+
+// just for algorithm debug on PC
+#if defined(PC_DEBUG) && !defined(PC_DEBUG_QUIET)
+#include <stdio.h>
+#define YM2203_DEBUG_PRINT(fmt, ...)	printf(fmt, ##__VA_ARGS__)
+#else
+#define YM2203_DEBUG_PRINT(fmt, ...)	;
+#endif
+
+//! limit of busy flag polling (in case of no device)
+#define BUSY_POLL_MAX		256
+
+// register address (SSG)
+#define ADDR_SSG_TONE_FREQ_L	0x00
+#define ADDR_SSG_TONE_FREQ_H	0x01
+#define ADDR_SSG_NOISE_FREQ		0x06
+#define ADDR_SSG_MIXING			0x07
+#define ADDR_SSG_LEVEL_ENV		0x08
+#define ADDR_SSG_ENV_FREQ_L		0x0B
+#define ADDR_SSG_ENV_FREQ_H		0x0C
+#define ADDR_SSG_ENV_TYPE		0x0D
+
+// register address (FM)
+#define ADDR_FM_TIMER_CTRL		0x27
+#define ADDR_FM_KEYON			0x28
+#define ADDR_FM_PRESCALER_1		0x2D
+#define ADDR_FM_PRESCALER_2		0x2E
+#define ADDR_FM_PRESCALER_3		0x2F
+#define ADDR_FM_DETUNE_MULTI	0x30
+#define ADDR_FM_TL				0x40
+#define ADDR_FM_AR_KEYSCALE		0x50
+#define ADDR_FM_DR				0x60
+#define ADDR_FM_SR				0x70
+#define ADDR_FM_SL_RR			0x80
+#define ADDR_FM_FREQ_L			0xA0
+#define ADDR_FM_FREQ_H			0xA4
+#define ADDR_FM_FB_ALGORITHM	0xB0
+
+//! register address of each byte of the timbre image (+ channel)
+//! operator 1 to 4 are at the offset 0x00, 0x08, 0x04, 0x0C.
+static const uint8_t TIMBRE_REG_ADDR[TIMBRE_REG_NUM]={
+	ADDR_FM_DETUNE_MULTI + 0x00, ADDR_FM_TL + 0x00, ADDR_FM_AR_KEYSCALE + 0x00, ADDR_FM_DR + 0x00, ADDR_FM_SR + 0x00, ADDR_FM_SL_RR + 0x00,
+	ADDR_FM_DETUNE_MULTI + 0x08, ADDR_FM_TL + 0x08, ADDR_FM_AR_KEYSCALE + 0x08, ADDR_FM_DR + 0x08, ADDR_FM_SR + 0x08, ADDR_FM_SL_RR + 0x08,
+	ADDR_FM_DETUNE_MULTI + 0x04, ADDR_FM_TL + 0x04, ADDR_FM_AR_KEYSCALE + 0x04, ADDR_FM_DR + 0x04, ADDR_FM_SR + 0x04, ADDR_FM_SL_RR + 0x04,
+	ADDR_FM_DETUNE_MULTI + 0x0C, ADDR_FM_TL + 0x0C, ADDR_FM_AR_KEYSCALE + 0x0C, ADDR_FM_DR + 0x0C, ADDR_FM_SR + 0x0C, ADDR_FM_SL_RR + 0x0C,
+	ADDR_FM_FB_ALGORITHM
+};
+
+//! index of TL in the register image of an operator
+#define TIMBRE_REG_TL		1
+
+//! frequency ratio of a semitone (2^(1/12))
+#define PITCH_SEMITONE		1.0594630943592953
+//! note number of the reference pitch (YM2203_PITCH_A4)
+#define PITCH_NOTE_A4		(5 * KEY_NUM + KEY_A)
+//! F-Number of a FM channel at the block 0 for 1Hz (prescaler 1/6: fnum = 144 * freq * 2^21 / fM)
+#define PITCH_FNUM_1HZ		(144.0 * 2097152.0 / YM2203_MASTER_CLOCK)
+//! tone period of a SSG channel for 1Hz (prescaler 1/4: period = fM / (64 * freq))
+#define PITCH_PERIOD_1HZ	(YM2203_MASTER_CLOCK / 64.0)
+//! 1/100 in 16bit fixed point (to split and interpolate the detune in cents)
+#define PITCH_CENT_RECIPROCAL	655
+
+/**
+ * frequency ratio of a pitch to the reference pitch. (2^(semitones/12))
+ *
+ * @param semitones pitch from the reference pitch [semitone]
+ * @return frequency ratio
+ */
+static constexpr double pitchRatio(int semitones)
+{
+	return (semitones <  0)       ? pitchRatio(semitones + KEY_NUM) / 2.0 :
+	       (semitones >= KEY_NUM) ? pitchRatio(semitones - KEY_NUM) * 2.0 :
+	       (semitones == 0)       ? 1.0 : pitchRatio(semitones - 1) * PITCH_SEMITONE;
+}
+
+/**
+ * frequency of a note.
+ *
+ * @param note note number (octave * 12 + key)
+ * @return frequency [Hz]
+ */
+static constexpr double pitchFrequency(int note)
+{
+	return YM2203_PITCH_A4 * pitchRatio(note - PITCH_NOTE_A4);
+}
+
+/**
+ * block and F-Number of a FM channel. (FREQ_H and FREQ_L registers)
+ * the F-Number over 11bit is clipped. (only at the octave 8)
+ *
+ * @param block block (0-7)
+ * @param fnum F-Number (not rounded)
+ * @return block << 11 | F-Number
+ */
+static constexpr uint16_t pitchBlockFnum(int block, double fnum)
+{
+	return (uint16_t)((block << 11) | ((fnum + 0.5 >= 2047.0) ? 2047 : (uint16_t)(fnum + 0.5)));
+}
+
+/**
+ * pitch parameter of a note for FM channel.
+ * the block is the octave, so the key scaling is the same in any tuning.
+ *
+ * @param note note number (octave * 12 + key)
+ * @return block << 11 | F-Number
+ */
+static constexpr uint16_t pitchFM(int note)
+{
+	return pitchBlockFnum((note / KEY_NUM < 7) ? note / KEY_NUM : 7,
+	                      pitchFrequency(note) * PITCH_FNUM_1HZ / (double)(1 << ((note / KEY_NUM < 7) ? note / KEY_NUM : 7)));
+}
+
+/**
+ * pitch parameter of a note for SSG channel.
+ * the period over 12bit is clipped. (only at the octave 0)
+ *
+ * @param note note number (octave * 12 + key)
+ * @return tone period
+ */
+static constexpr uint16_t pitchSSG(int note)
+{
+	return (PITCH_PERIOD_1HZ / pitchFrequency(note) + 0.5 >= 4095.0) ? 4095 :
+	       (uint16_t)(PITCH_PERIOD_1HZ / pitchFrequency(note) + 0.5);
+}
+
+//! pitch parameters of the 12 keys of an octave
+#define PITCH_OCTAVE(pitch, octave) \
+	pitch((octave) * KEY_NUM +  0), pitch((octave) * KEY_NUM +  1), pitch((octave) * KEY_NUM +  2), \
+	pitch((octave) * KEY_NUM +  3), pitch((octave) * KEY_NUM +  4), pitch((octave) * KEY_NUM +  5), \
+	pitch((octave) * KEY_NUM +  6), pitch((octave) * KEY_NUM +  7), pitch((octave) * KEY_NUM +  8), \
+	pitch((octave) * KEY_NUM +  9), pitch((octave) * KEY_NUM + 10), pitch((octave) * KEY_NUM + 11)
+
+//! pitch parameter table for FM channel (computed at compile time)
+template <class Bus>
+const uint16_t YM2203_Driver<Bus>::FM_PITCH_TABLE[NOTE_NUM]={
+	PITCH_OCTAVE(pitchFM, 0), PITCH_OCTAVE(pitchFM, 1), PITCH_OCTAVE(pitchFM, 2),
+	PITCH_OCTAVE(pitchFM, 3), PITCH_OCTAVE(pitchFM, 4), PITCH_OCTAVE(pitchFM, 5),
+	PITCH_OCTAVE(pitchFM, 6), PITCH_OCTAVE(pitchFM, 7), PITCH_OCTAVE(pitchFM, 8)
+};
+
+//! pitch parameter table for SSG channel (computed at compile time)
+template <class Bus>
+const uint16_t YM2203_Driver<Bus>::SSG_PITCH_TABLE[NOTE_NUM]={
+	PITCH_OCTAVE(pitchSSG, 0), PITCH_OCTAVE(pitchSSG, 1), PITCH_OCTAVE(pitchSSG, 2),
+	PITCH_OCTAVE(pitchSSG, 3), PITCH_OCTAVE(pitchSSG, 4), PITCH_OCTAVE(pitchSSG, 5),
+	PITCH_OCTAVE(pitchSSG, 6), PITCH_OCTAVE(pitchSSG, 7), PITCH_OCTAVE(pitchSSG, 8)
+};
+
+/**
+ * constructor
+ */
+template <class Bus>
+YM2203_Driver<Bus>::YM2203_Driver()
+{
+	// initial value
+	m_timbre[FM_CH1] = NULL;
+	m_timbre[FM_CH2] = NULL;
+	m_timbre[FM_CH3] = NULL;
+	m_volume[FM_CH1] = 0;
+	m_volume[FM_CH2] = 0;
+	m_volume[FM_CH3] = 0;
+	m_enveloped[SSG_CH_A - SSG_CH_A] = false;
+	m_enveloped[SSG_CH_B - SSG_CH_A] = false;
+	m_enveloped[SSG_CH_C - SSG_CH_A] = false;
+	m_toneNoise[SSG_CH_A - SSG_CH_A] = 0x01;
+	m_toneNoise[SSG_CH_B - SSG_CH_A] = 0x02;
+	m_toneNoise[SSG_CH_C - SSG_CH_A] = 0x04;
+	m_waitMode = WAIT_FIXED;
+	m_pendingTicks = 0;
+	m_writeTime = 0;
+	m_addrPending = false;
+	m_addrTime = 0;
+	m_queued = false;
+	m_queueHead = 0;
+	m_queueLen = 0;
+	m_record = NULL;
+	m_recordMask = 0;
+	m_recordHead = 0;
+	m_recordTail = 0;
+	m_recordTime = 0;
+	m_recordDropped = 0;
+	this->invalidateShadow();
+	this->clearWriteCounters();
+}
+
+/**
+ * destructor.
+ */
+template <class Bus>
+YM2203_Driver<Bus>::~YM2203_Driver()
+{
+	// nothing to do
+}
+
+/**
+ * initialize the YM2203 device.
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::begin(void)
+{
+	uint8_t data;
+	uint8_t addr;
+	
+	// initialize the bus, and reset the YM2203 device
+	m_bus.begin();
+	
+	// the registers are unknown after reset
+	this->invalidateShadow();
+
+	// key-off all SSG channel tone and noise
+	m_ssgKeyOn = 0x3F;
+	data = m_ssgKeyOn;
+	addr = ADDR_SSG_MIXING;
+	write(addr,data);
+}
+
+/**
+ * note-on a channel.
+ *
+ * @param ch channel. 0-2:FM, 3-5:SSG. or FM_CH1,FM_CH2,FM_CH3,SSG_CH_A,SSG_CH_B,SSG_CH_C
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::noteOn(int ch)
+{
+	uint8_t data;
+	uint8_t addr;
+
+	YM2203_DEBUG_PRINT("noteOn(%d)\n",ch);
+	
+	// FM channel
+	if( (FM_CH1<=ch) && (ch<=FM_CH3) )
+	{
+		if(m_timbre[ch] == NULL)return;
+		data = (m_timbre[ch]->opMask << 4) | ch;
+		addr = ADDR_FM_KEYON;
+		write(addr,data);
+	}
+	
+	// SSG channel
+	else if( (SSG_CH_A<=ch) && (ch<=SSG_CH_C) )
+	{
+		m_ssgKeyOn &= ~m_toneNoise[ch-SSG_CH_A];
+		data = m_ssgKeyOn;
+		addr = ADDR_SSG_MIXING;
+		write(addr,data);
+		
+		// if on-shot type envelope, set it again.
+		if(m_enveloped[ch-SSG_CH_A]){
+			if( (m_ssgEnvelopeType == 9) || (m_ssgEnvelopeType == 15)){
+				addr = ADDR_SSG_ENV_TYPE;
+				data = m_ssgEnvelopeType;
+				write(addr,data);
+			}
+		}
+	}
+}
+
+/**
+ * note-off a channel.
+ *
+ * @param ch channel. 0-2:FM, 3-5:SSG. or FM_CH1,FM_CH2,FM_CH3,SSG_CH_A,SSG_CH_B,SSG_CH_C
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::noteOff(int ch)
+{
+	uint8_t data;
+	uint8_t addr;
+	
+	YM2203_DEBUG_PRINT("noteOff(%d)\n",ch);
+
+	// FM channel
+	if( (FM_CH1<=ch) && (ch<=FM_CH3) )
+	{
+		data = 0 | ch;
+		addr = ADDR_FM_KEYON;
+		write(addr,data);
+	}
+	
+	// SSG channel
+	else if( (SSG_CH_A<=ch) && (ch<=SSG_CH_C) )
+	{
+		m_ssgKeyOn |= m_toneNoise[ch-SSG_CH_A];
+		data = m_ssgKeyOn;
+		addr = ADDR_SSG_MIXING;
+		write(addr,data);
+	}
+}
+
+/**
+ * set pitch to a channel
+ *
+ * @param ch channel. 0-2:FM, 3-5:SSG. or FM_CH1,FM_CH2,FM_CH3,SSG_CH_A,SSG_CH_B,SSG_CH_C
+ * @param octave octave number (0-8). 0 is the lowest, and 8 is the highest.
+ * @param key pitch in the octave. 0-11 is for C,C#,D,D#,E,F,F#,G,G#,A,A#,B.
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::setPitch (int ch, int octave, int key)
+{
+	this->setNotePitch(ch, octave * KEY_NUM + key, 0);
+}
+
+/**
+ * set pitch to a channel, with a detune in cents.
+ *
+ * @param ch channel. 0-2:FM, 3-5:SSG. or FM_CH1,FM_CH2,FM_CH3,SSG_CH_A,SSG_CH_B,SSG_CH_C
+ * @param octave octave number (0-8)
+ * @param key pitch in the octave (0-11)
+ * @param cents detune in cents (1/100 of a key). it may exceed a key, or be negative.
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::setPitch (int ch, int octave, int key, int cents)
+{
+	this->setNotePitch(ch, octave * KEY_NUM + key, cents);
+}
+
+/**
+ * set pitch of a note number to a channel.
+ * the pitch parameters of all notes are in the tables, so a note is
+ * just looked up. a detune is interpolated linearly between the notes.
+ * (the error is less than 1 cent)
+ *
+ * @param ch channel. 0-2:FM, 3-5:SSG. or FM_CH1,FM_CH2,FM_CH3,SSG_CH_A,SSG_CH_B,SSG_CH_C
+ * @param note note number (octave * 12 + key, 0 - NOTE_NUM-1)
+ * @param cents detune in cents (1/100 of a key). it may exceed a key, or be negative.
+ *        (the pitch is clipped into the tables)
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::setNotePitch(int ch, int note, int cents)
+{
+	int keys;
+	uint16_t lower, upper, next;
+
+	YM2203_DEBUG_PRINT("setNotePitch(%d, %d, %d)\n",ch,note,cents);
+
+	if(cents != 0){
+		// move whole keys into the note, and leave 0-99 cents. (no division)
+		// (the reciprocal is a bit less than 1/100, so the keys may be one off. the loops correct it)
+		keys = (int)(((int32_t)cents * PITCH_CENT_RECIPROCAL) >> 16);
+		note  += keys;
+		cents -= keys * 100;
+		while(cents <    0){ cents += 100; note--; }
+		while(cents >= 100){ cents -= 100; note++; }
+		
+		// clip the pitch into the tables
+		if(note < 0){ note = 0; cents = 0; }
+		if(note >= NOTE_NUM - 1){ note = NOTE_NUM - 1; cents = 0; }
+	}
+	
+	// parameter check
+	if( (note < 0) || (note >= NOTE_NUM) ) return;
+	
+	// FM channel (F-Number is proportional to the frequency)
+	if( (FM_CH1<=ch) && (ch<=FM_CH3) )
+	{
+		lower = FM_PITCH_TABLE[note];
+		if(cents != 0){
+			next  = FM_PITCH_TABLE[note + 1];
+			upper = next & 0x07FF;
+			// the next note is in the next block (at the key B)
+			if( (next ^ lower) & 0x3800 ) upper <<= 1;
+			lower += (uint16_t)(((uint32_t)(upper - (lower & 0x07FF)) * cents * PITCH_CENT_RECIPROCAL + 0x8000) >> 16);
+		}
+		writeFMPitch(ch, lower);
+	}
+	
+	// SSG channel (tone period is inversely proportional to the frequency)
+	else if( (SSG_CH_A<=ch) && (ch<=SSG_CH_C) )
+	{
+		lower = SSG_PITCH_TABLE[note];
+		if(cents != 0){
+			upper = SSG_PITCH_TABLE[note + 1];
+			lower -= (uint16_t)(((uint32_t)(lower - upper) * cents * PITCH_CENT_RECIPROCAL + 0x8000) >> 16);
+		}
+		writeSSGPitch(ch, lower);
+	}
+}
+
+/**
+ * set volume to a channel.
+ * @param ch channel. 0-2:FM, 3-5:SSG. or FM_CH1,FM_CH2,FM_CH3,SSG_CH_A,SSG_CH_B,SSG_CH_C
+ * @param volume 0(min)-15(max).
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::setVolume(int ch, int volume)
+{
+	uint8_t data;
+	uint8_t addr;
+	uint8_t carrier;
+	uint8_t attenate;
+	uint8_t work[TIMBRE_REG_NUM];
+	const uint8_t *image;
+	int n;
+
+	YM2203_DEBUG_PRINT("setVolume(%d,%d)\n",ch,volume);
+	
+	// parameter check
+	if(volume<0 || volume>15) return;
+	
+	// FM channel
+	if( (FM_CH1<=ch) && (ch<=FM_CH3) )
+	{
+		if(m_timbre[ch] == NULL) return;
+		
+		carrier = m_timbre[ch]->getCarrier();
+		image = m_timbre[ch]->getImage(work);
+		attenate = (uint8_t)(15 - volume) * 3;
+		
+		// attenate TL of the carriers
+		for(n = TIMBRE_REG_TL; carrier != 0; carrier >>= 1, n += TIMBRE_OP_REG_NUM)
+		{
+			if((carrier & 0x01) == 0) continue;
+			data = (image[n] + attenate) & 0x7F;
+			this->write(TIMBRE_REG_ADDR[n] + (uint8_t)ch, data);
+		}
+	}
+	
+	// SSG channel
+	else if( (SSG_CH_A<=ch) && (ch<=SSG_CH_C) )
+	{
+		addr = ADDR_SSG_LEVEL_ENV + (ch - SSG_CH_A);
+		data = (uint8_t)volume & 0x0F;
+		this->write(addr,data);
+		
+		// volume setting and envelope setting are exclusive.
+		this->m_enveloped[ch - SSG_CH_A] = false;
+	}
+}
+
+/**
+ * set envelope to a channel.
+ *
+ * @param ch channel. 3-5 or SSG_CH_A,SSG_CH_B,SSG_CH_C (SSG channel only)
+ * @param type envelope type (8-15)
+ * @param interval envelope interval (0-65535) * 1024/1000 [ms]
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::setEnvelope(int ch, int type, uint16_t interval)
+{
+	uint8_t data;
+	uint8_t addr;
+
+	YM2203_DEBUG_PRINT("setEnvelope(%d, %d, %d)\n",ch,type,interval);
+	
+	// parameter check;
+	if( (ch<SSG_CH_A) || (ch>SSG_CH_C) ) return;
+	//if( (type<8) || (type>15) ) return;
+	
+	// enable envelope
+	// volume setting and envelope setting are exclusive.
+	addr = ADDR_SSG_LEVEL_ENV + (ch - SSG_CH_A);
+	data = 0x10;
+	this->write(addr,data);
+	this->m_enveloped[ch - SSG_CH_A] = true;
+	
+	// envelope type
+	addr = ADDR_SSG_ENV_TYPE;
+	data = (uint8_t)type & 0x0F;
+	write(addr,data);
+	m_ssgEnvelopeType = data;
+	
+	// envelope frequency
+	addr = ADDR_SSG_ENV_FREQ_L;
+	data = (uint8_t)(interval & 0xFF);
+	write(addr,data);
+	
+	addr = ADDR_SSG_ENV_FREQ_H;
+	data = (uint8_t)((interval >> 8) & 0xFF);
+	write(addr,data);
+}
+
+/**
+ * set tone/noise mode to a chennel.
+ *
+ * @param ch channel. 3-5 or SSG_CH_A,SSG_CH_B,SSG_CH_C (SSG channel only)
+ * @param mode noise mode (TONE_MODE, NOISE_MODE, TONE_NOISE_MODE)
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::setToneNoise(int ch, int mode)
+{
+	const uint8_t TONE_MASK [3]={0x01, 0x02, 0x04};
+	const uint8_t NOISE_MASK[3]={0x08, 0x10, 0x20};
+	
+	// parameter check;
+	if( (ch<SSG_CH_A) || (ch>SSG_CH_C) ) return;
+	ch -= SSG_CH_A;
+	
+	switch(mode){
+	case TONE_MODE:
+		m_toneNoise[ch] = TONE_MASK[ch];
+		break;
+	case NOISE_MODE:
+		m_toneNoise[ch] = NOISE_MASK[ch];
+		break;
+	case TONE_NOISE_MODE:
+		m_toneNoise[ch] = TONE_MASK[ch] + NOISE_MASK[ch];
+		break;
+	}
+}
+
+/**
+ * set timbre to a channel.
+ * only the registers which differ from the shadow are written, so switching
+ * between similar timbres is cheap. (the shadow also follows the raw writes)
+ *
+ * @param ch channel. 0-2 or FM_CH1,FM_CH2,FM_CH3 (FM channel only)
+ * @param timbre pointer to the timbre structure.
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::setTimbre(int ch, const YM2203_Timbre *timbre)
+{
+	uint8_t work[TIMBRE_REG_NUM];
+	const uint8_t *image;
+	int n;
+
+	YM2203_DEBUG_PRINT("setTimbre(%d, ****)\n",ch);
+	
+	// parameter check
+	if( ch < 0 || ch >= FM_CH_NUM) return;
+	
+	image = timbre->getImage(work);
+	
+	// envelop parameters for each operator, then algorithm and feedback
+	// (write() skips the registers which already hold the value)
+	for(n=0; n<TIMBRE_REG_NUM; n++)
+	{
+		this->write(TIMBRE_REG_ADDR[n] + (uint8_t)ch, image[n]);
+	}
+	
+	m_timbre[ch] = timbre;
+}
+
+/**
+ * read a register value.
+ *
+ * @param addr YM2203 register address
+ * @return value read from the register
+ */
+template <class Bus>
+uint8_t YM2203_Driver<Bus>::read(uint8_t addr)
+{
+	uint8_t data;
+	
+	// serve from the shadow if the register has been written
+	if( m_shadowValid[addr >> 3] & (1 << (addr & 0x07)) ){
+		return m_shadow[addr];
+	}
+	
+	// the queued writes go first
+	while( this->issueQueued() ){
+		;
+	}
+	this->issueAddress(addr);
+	this->waitAddress();
+	
+	data = m_bus.readData();
+	
+	return data;
+}
+
+/**
+ * write a register value.
+ *
+ * @param addr YM2203 register address
+ * @param data value to write to the register
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::write(uint8_t addr,uint8_t data)
+{
+	// skip the bus access if the register already holds the value.
+	// key-on, SSG envelope type, timer control and F-Number registers
+	// have side effects on write, so they always go through.
+	if( (addr != ADDR_FM_KEYON) && (addr != ADDR_SSG_ENV_TYPE) &&
+	    (addr != ADDR_FM_TIMER_CTRL) &&
+	    ((addr & 0xF0) != ADDR_FM_FREQ_L) )
+	{
+		if( isShadowed(addr, data) ){
+			m_suppressedWrites++;
+			return;
+		}
+	}
+	m_shadow[addr] = data;
+	m_shadowValid[addr >> 3] |= (1 << (addr & 0x07));
+	m_issuedWrites++;
+	
+	// the address goes out first, so its setup time overlaps with the record
+	if( !m_queued ){
+		this->issueAddress(addr);
+	}
+	
+	// record the write. (if the buffer is full, the write is lost)
+	if( m_record != NULL ){
+		uint32_t head = m_recordHead;
+		if( head - m_recordTail <= m_recordMask ){
+			m_record[head & m_recordMask].time = m_recordTime;
+			m_record[head & m_recordMask].addr = addr;
+			m_record[head & m_recordMask].data = data;
+			m_recordHead = head + 1;
+		}else{
+			m_recordDropped++;
+		}
+	}
+	
+	// hold the write for the scheduler. (if the queue is full, the oldest goes out)
+	if( m_queued ){
+		if( m_queueLen == YM2203_QUEUE_SIZE ) this->issueQueued();
+		m_queue[(m_queueHead + m_queueLen) & (YM2203_QUEUE_SIZE - 1)][0] = addr;
+		m_queue[(m_queueHead + m_queueLen) & (YM2203_QUEUE_SIZE - 1)][1] = data;
+		m_queueLen++;
+		return;
+	}
+	
+	this->issueData(addr, data);
+}
+
+/**
+ * write a register value to the bus. (after the shadow and the queue)
+ *
+ * @param addr YM2203 register address
+ * @param data value to write to the register
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::issue(uint8_t addr, uint8_t data)
+{
+	this->issueAddress(addr);
+	this->issueData(addr, data);
+}
+
+/**
+ * write a register address to the bus.
+ * except WAIT_FIXED, the address setup time is waited by the next data
+ * access, so it overlaps with the work before it.
+ *
+ * @param addr YM2203 register address
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::issueAddress(uint8_t addr)
+{
+	// wait for the previous write (WAIT_BUSY, WAIT_CYCLE)
+	this->waitReady();
+	
+	m_bus.writeAddress(addr);
+	
+	if( m_waitMode == WAIT_FIXED ){
+		m_bus.delayMicroseconds(5);		// wait more than 17 clock
+	}else{
+		m_addrTime = m_bus.ticks();
+		m_addrPending = true;
+	}
+}
+
+/**
+ * write a register value to the bus. (after issueAddress)
+ *
+ * @param addr YM2203 register address (to know the busy time)
+ * @param data value to write to the register
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::issueData(uint8_t addr, uint8_t data)
+{
+	// the rest of the address setup time (WAIT_BUSY, WAIT_CYCLE)
+	this->waitAddress();
+	
+	m_bus.writeData(data);
+	
+	if( m_waitMode == WAIT_FIXED ){
+		if( addr >= ADDR_FM_FREQ_L){
+			m_bus.delayMicroseconds(12);	// wait more than 47 clock
+		}else if( addr >= ADDR_FM_KEYON ){
+			m_bus.delayMicroseconds(21);	// wait more than 83 clock
+		}else{
+			m_bus.delayMicroseconds(5);	// wait more than 17 clock
+		}
+	}else{
+		// the wait is deferred to the next access,
+		// so it overlaps with preparing the next write.
+		if( addr >= ADDR_FM_FREQ_L){
+			m_pendingTicks = YM2203_CLOCK_TO_TICKS(47);
+		}else if( addr >= ADDR_FM_KEYON ){
+			m_pendingTicks = YM2203_CLOCK_TO_TICKS(83);
+		}else{
+			m_pendingTicks = YM2203_CLOCK_TO_TICKS(17);
+		}
+		m_writeTime = m_bus.ticks();
+	}
+}
+
+/**
+ * only write a register address. (for some special registers)
+ *
+ * @param addr YM2203 register address
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::writeAddress(uint8_t addr)
+{
+	// the queued writes go first
+	while( this->issueQueued() ){
+		;
+	}
+	this->issueAddress(addr);
+	this->waitAddress();
+}
+
+/**
+ * read status of YM2203.
+ */
+template <class Bus>
+uint8_t YM2203_Driver<Bus>::readStatus(void)
+{
+	uint8_t data;
+	
+	data = m_bus.readStatus();
+	
+	return data;
+}
+
+/**
+ * set the wait mode of register accesses.
+ *
+ * @param mode WAIT_FIXED, WAIT_BUSY or WAIT_CYCLE
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::setWaitMode(int mode)
+{
+	// parameter check
+	if( (mode != WAIT_FIXED) && (mode != WAIT_BUSY) && (mode != WAIT_CYCLE) ) return;
+	
+	// finish the pending write in the current mode
+	this->waitReady();
+	
+	m_waitMode = (uint8_t)mode;
+}
+
+/**
+ * get the bus policy object.
+ * (e.g. to attach a simulated bus on PC)
+ *
+ * @return bus policy object of this driver
+ */
+template <class Bus>
+Bus* YM2203_Driver<Bus>::getBus(void)
+{
+	return &m_bus;
+}
+
+/**
+ * hold the writes in the write queue or not.
+ * the queued writes are issued by issueQueued(), so the scheduler of
+ * YM2203_Chips can write another device while this device is busy.
+ * (when disabled, the queued writes are issued at once)
+ *
+ * @param queued true to hold the writes
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::setQueued(bool queued)
+{
+	if( !queued ){
+		while( this->issueQueued() ){
+			;
+		}
+	}
+	m_queued = queued;
+}
+
+/**
+ * number of writes in the write queue.
+ *
+ * @return number of writes
+ */
+template <class Bus>
+int YM2203_Driver<Bus>::getQueued(void)
+{
+	return m_queueLen;
+}
+
+/**
+ * whether the device accepts an access without waiting.
+ * (WAIT_FIXED always waits after the write, so it is always ready)
+ *
+ * @return true if the last write has been processed
+ */
+template <class Bus>
+bool YM2203_Driver<Bus>::isReady(void)
+{
+	if(m_pendingTicks == 0) return true;
+	
+	switch(m_waitMode){
+	case WAIT_BUSY:
+		if( (m_bus.readStatus() & YM2203_STATUS_BUSY) != 0 ) return false;
+		break;
+	case WAIT_CYCLE:
+		if( (uint16_t)(m_bus.ticks() - m_writeTime) < m_pendingTicks ) return false;
+		break;
+	}
+	m_pendingTicks = 0;
+	return true;
+}
+
+/**
+ * issue the oldest write in the write queue.
+ * (waits until the device is ready)
+ *
+ * @return false if the write queue is empty
+ */
+template <class Bus>
+bool YM2203_Driver<Bus>::issueQueued(void)
+{
+	uint8_t addr, data;
+	
+	if( m_queueLen == 0 ) return false;
+	addr = m_queue[m_queueHead][0];
+	data = m_queue[m_queueHead][1];
+	m_queueHead = (m_queueHead + 1) & (YM2203_QUEUE_SIZE - 1);
+	m_queueLen--;
+	this->issue(addr, data);
+	
+	return true;
+}
+
+/**
+ * start or stop recording the register writes.
+ * each write issued to the bus is stored in the ring buffer with the
+ * record time, so an interrupt only pays for a few stores.
+ * the main loop takes them out with readRecord() before the buffer is full.
+ *
+ * @param entries ring buffer. NULL to stop recording.
+ * @param size number of entries (power of 2)
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::setRecordBuffer(YM2203_RecordEntry *entries, uint32_t size)
+{
+	m_record = NULL;
+	m_recordHead = 0;
+	m_recordTail = 0;
+	m_recordDropped = 0;
+	if( (entries == NULL) || (size == 0) || ((size & (size - 1)) != 0) ) return;
+	m_recordMask = size - 1;
+	m_record = entries;
+}
+
+/**
+ * take out the recorded writes. (oldest first)
+ *
+ * @param entries buffer to copy the writes
+ * @param max size of the buffer
+ * @return number of writes copied
+ */
+template <class Bus>
+int YM2203_Driver<Bus>::readRecord(YM2203_RecordEntry *entries, int max)
+{
+	uint32_t tail = m_recordTail;
+	uint32_t head = m_recordHead;
+	int num = 0;
+	
+	if( m_record == NULL ) return 0;
+	while( (tail != head) && (num < max) ){
+		entries[num++] = m_record[tail & m_recordMask];
+		tail++;
+	}
+	m_recordTail = tail;
+	
+	return num;
+}
+
+/**
+ * set the time of the following writes.
+ * (the MML player advances it by the timer interval)
+ *
+ * @param time time [1/YM2203_RECORD_RATE sec]
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::setRecordTime(uint32_t time)
+{
+	m_recordTime = time;
+}
+
+/**
+ * get the time of the following writes.
+ *
+ * @return time [1/YM2203_RECORD_RATE sec]
+ */
+template <class Bus>
+uint32_t YM2203_Driver<Bus>::getRecordTime(void)
+{
+	return m_recordTime;
+}
+
+/**
+ * number of writes lost by the full buffer since setRecordBuffer().
+ *
+ * @return number of writes
+ */
+template <class Bus>
+uint32_t YM2203_Driver<Bus>::getRecordDropped(void)
+{
+	return m_recordDropped;
+}
+
+/**
+ * wait until the device is ready for the next access.
+ * (for WAIT_BUSY and WAIT_CYCLE. the previous write has not been waited.)
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::waitReady(void)
+{
+	int i;
+	
+	if(m_pendingTicks == 0) return;
+	
+	switch(m_waitMode){
+	// poll the busy flag
+	case WAIT_BUSY:
+		for(i=0; i<BUSY_POLL_MAX; i++){
+			if( (m_bus.readStatus() & YM2203_STATUS_BUSY) == 0 ) break;
+		}
+		break;
+	// wait the rest of the cycle budget
+	case WAIT_CYCLE:
+		while( (uint16_t)(m_bus.ticks() - m_writeTime) < m_pendingTicks ){
+			;
+		}
+		break;
+	}
+	m_pendingTicks = 0;
+}
+
+/**
+ * wait the rest of the address setup time. (17 clocks)
+ * (for WAIT_BUSY and WAIT_CYCLE. the busy flag doesn't cover it.)
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::waitAddress(void)
+{
+	if( !m_addrPending ) return;
+	
+	while( (uint16_t)(m_bus.ticks() - m_addrTime) < YM2203_CLOCK_TO_TICKS(17) ){
+		;
+	}
+	m_addrPending = false;
+}
+
+/**
+ * write the frequency registers of a FM channel.
+ *
+ * @param ch FM channel (FM_CH1 - FM_CH3)
+ * @param blockFnum block << 11 | F-Number (FM_PITCH_TABLE)
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::writeFMPitch(int ch, uint16_t blockFnum)
+{
+	uint8_t freq_h = (uint8_t)(blockFnum >> 8) & 0x3F;
+	uint8_t freq_l = (uint8_t)(blockFnum & 0x00FF);
+	
+	// FREQ_H is latched until FREQ_L is written,
+	// so the pair can be skipped only as a whole.
+	if( isShadowed(ADDR_FM_FREQ_H + ch, freq_h) &&
+	    isShadowed(ADDR_FM_FREQ_L + ch, freq_l) ){
+		m_suppressedWrites += 2;
+		return;
+	}
+	
+	write(ADDR_FM_FREQ_H + ch, freq_h);
+	write(ADDR_FM_FREQ_L + ch, freq_l);
+}
+
+/**
+ * write the tone period registers of a SSG channel.
+ *
+ * @param ch SSG channel (SSG_CH_A - SSG_CH_C)
+ * @param period tone period (SSG_PITCH_TABLE)
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::writeSSGPitch(int ch, uint16_t period)
+{
+	write(ADDR_SSG_TONE_FREQ_L + (ch - SSG_CH_A) * 2, (uint8_t)(period & 0x00FF));
+	write(ADDR_SSG_TONE_FREQ_H + (ch - SSG_CH_A) * 2, (uint8_t)(period >> 8) & 0x0F);
+}
+
+/**
+ * whether the register already holds the value.
+ *
+ * @param addr YM2203 register address
+ * @param data value to compare
+ * @return true if the shadow of the register is valid and equals to data
+ */
+template <class Bus>
+bool YM2203_Driver<Bus>::isShadowed(uint8_t addr, uint8_t data)
+{
+	return ( (m_shadowValid[addr >> 3] & (1 << (addr & 0x07))) != 0 ) &&
+	       ( m_shadow[addr] == data );
+}
+
+/**
+ * forget all cached register values.
+ * (call this if the device is written without this class)
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::invalidateShadow(void)
+{
+	memset(m_shadowValid, 0, sizeof(m_shadowValid));
+}
+
+/**
+ * number of writes issued to the bus.
+ *
+ * @return counter value
+ */
+template <class Bus>
+uint32_t YM2203_Driver<Bus>::getIssuedWrites(void)
+{
+	return m_issuedWrites;
+}
+
+/**
+ * number of writes skipped by the shadow.
+ *
+ * @return counter value
+ */
+template <class Bus>
+uint32_t YM2203_Driver<Bus>::getSuppressedWrites(void)
+{
+	return m_suppressedWrites;
+}
+
+/**
+ * clear the write counters.
+ */
+template <class Bus>
+void YM2203_Driver<Bus>::clearWriteCounters(void)
+{
+	m_issuedWrites = 0;
+	m_suppressedWrites = 0;
+}
+
+#endif
@@ -0,0 +1,423 @@
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+// just for algorithm debug on PC
+#ifdef PC_DEBUG
+#include <time.h>
+
+// for real machine
+#else
+#include <rxduino.h>
+#endif
+
+#include "YM2203_MIDIin.h"
+
+// Control change numbers
+#define MIDI_CC_VOLUME			7	//!< channel volume
+#define MIDI_CC_SOUND_OFF		120	//!< all sound off
+#define MIDI_CC_RESET			121	//!< reset all controllers
+#define MIDI_CC_NOTES_OFF		123	//!< all notes off
+
+#define MIDI_VOLUME_DEFAULT		100	//!< initial channel volume
+#define MIDI_BEND_CENTER		8192	//!< pitch bend value of no bend
+
+/**
+ * constructor.
+ */
+YM2203_MIDIin::YM2203_MIDIin()
+{
+	int midiCh;
+
+	m_bank = NULL;
+	m_bankSize = 0;
+	m_status = 0;
+	m_dataCount = 0;
+	m_ignoring = false;
+	m_errors = 0;
+	for(midiCh=0; midiCh<MIDI_CH_NUM; midiCh++){
+		m_program  [midiCh] = 0;
+		m_volume   [midiCh] = MIDI_VOLUME_DEFAULT;
+		m_bend     [midiCh] = 0;
+		m_bendRange[midiCh] = MIDI_BEND_RANGE;
+		m_ssg      [midiCh] = false;
+	}
+	memset(m_velocity, 0, sizeof(m_velocity));
+	this->clearLatency();
+}
+
+/**
+ * initialize the devices and the MIDI state.
+ * (the SSG setting and the pitch bend range of each MIDI channel are kept)
+ *
+ * @param bank timbre table for the program change.
+ *             NULL for the preset timbres of MMLplayer.
+ * @param num size of the timbre table (program n selects the timbre n % num)
+ */
+void YM2203_MIDIin::begin(const YM2203_Timbre *bank, int num)
+{
+	int midiCh;
+
+	if(bank == NULL){
+		bank = MMLplayer.getPresetTable();
+		num = TIMBRE_MAX;
+	}
+	m_bank = bank;
+	m_bankSize = (num > 0) ? num : 1;
+
+	m_ym2203.begin();
+	m_voices.begin(&m_ym2203);
+	m_status = 0;
+	m_dataCount = 0;
+	m_ignoring = false;
+	for(midiCh=0; midiCh<MIDI_CH_NUM; midiCh++){
+		m_program[midiCh] = 0;
+		m_volume [midiCh] = MIDI_VOLUME_DEFAULT;
+		m_bend   [midiCh] = 0;
+		m_voices.setInstrument(midiCh, m_ssg[midiCh] ? NULL : &m_bank[0]);
+	}
+}
+
+/**
+ * play a MIDI channel on SSG channels or not.
+ * (the program change is ignored on SSG)
+ *
+ * @param midiCh MIDI channel (0-15)
+ * @param ssg true for SSG, false for FM (default)
+ */
+void YM2203_MIDIin::setSSG(int midiCh, bool ssg)
+{
+	if( (midiCh < 0) || (midiCh >= MIDI_CH_NUM) ) return;
+	m_ssg[midiCh] = ssg;
+	if(m_bank == NULL) return;
+	m_voices.setInstrument(midiCh, ssg ? NULL : &m_bank[m_program[midiCh] % m_bankSize]);
+}
+
+/**
+ * set the pitch bend range of a MIDI channel.
+ *
+ * @param midiCh MIDI channel (0-15)
+ * @param keys range (1-24 keys. default MIDI_BEND_RANGE)
+ */
+void YM2203_MIDIin::setBendRange(int midiCh, int keys)
+{
+	if( (midiCh < 0) || (midiCh >= MIDI_CH_NUM) ) return;
+	if( (keys < 1) || (keys > 24) ) return;
+	m_bendRange[midiCh] = (uint8_t)keys;
+}
+
+/**
+ * parse a received byte, with its arrival time.
+ * call it with every byte received. the arrival time is read by getClock()
+ * when the byte is received (in the UART receive interrupt, or by the reader
+ * of the stream), not when it is parsed.
+ * a complete message is executed at once, and its latency is counted.
+ *
+ * @param data received byte
+ * @param arrival latency clock at the arrival of the byte (see getClock)
+ */
+void YM2203_MIDIin::receive(uint8_t data, uint32_t arrival)
+{
+	uint32_t writes;
+	int kind;
+
+	// real time message: doesn't break the running status
+	if(data >= 0xF8) return;
+
+	// status byte
+	if(data & 0x80){
+		if(data < 0xF0){
+			m_status = data;
+			m_ignoring = false;
+		}else{
+			// system exclusive or common message cancels the running status
+			m_status = 0;
+			m_ignoring = true;
+		}
+		m_dataCount = 0;
+		return;
+	}
+
+	// data byte
+	if(m_ignoring) return;
+	if(m_status == 0){
+		m_errors++;
+		return;
+	}
+	m_data[m_dataCount++] = data;
+	kind = (m_status >> 4) - 8;
+	if( (kind != MIDI_MSG_PROGRAM) && (kind != MIDI_MSG_CH_PRESSURE) && (m_dataCount < 2) ) return;
+	m_dataCount = 0;
+
+	// complete message (the status is kept for the running status)
+	writes = m_ym2203.getIssuedWrites();
+	kind = this->execMessage(m_status, m_data[0], m_data[1]);
+	m_ym2203.flush();
+	this->addLatency(kind, arrival, m_ym2203.getIssuedWrites() - writes);
+}
+
+/**
+ * execute a channel message. (e.g. an event of a MIDI file)
+ * the running status and the latency statistics are not changed.
+ *
+ * @param status status byte (0x80 - 0xEF)
+ * @param data1 first data byte
+ * @param data2 second data byte (0 if none)
+ */
+void YM2203_MIDIin::execute(uint8_t status, uint8_t data1, uint8_t data2)
+{
+	if( (status < 0x80) || (status >= 0xF0) ) return;
+	this->execMessage(status, data1 & 0x7F, data2 & 0x7F);
+	m_ym2203.flush();
+}
+
+/**
+ * note-off all voices.
+ */
+void YM2203_MIDIin::allNotesOff(void)
+{
+	m_voices.allNotesOff();
+	m_ym2203.flush();
+}
+
+/**
+ * number of data bytes received without a status.
+ *
+ * @return number of bytes
+ */
+uint32_t YM2203_MIDIin::getErrors(void)
+{
+	return m_errors;
+}
+
+/**
+ * get the latency statistics of a kind of messages.
+ *
+ * @param kind kind of messages (MIDI_MSG_NOTE_OFF ... MIDI_MSG_PITCH_BEND)
+ * @param latency statistics (out)
+ */
+void YM2203_MIDIin::getLatency(int kind, MIDI_Latency *latency)
+{
+	if( (kind < 0) || (kind >= MIDI_MSG_NUM) ) return;
+	*latency = m_latency[kind];
+}
+
+/**
+ * clear the latency statistics.
+ */
+void YM2203_MIDIin::clearLatency(void)
+{
+	int kind;
+
+	memset(m_latency, 0, sizeof(m_latency));
+	for(kind=0; kind<MIDI_MSG_NUM; kind++){
+		m_latency[kind].minTime = 0xFFFFFFFF;
+	}
+}
+
+/**
+ * get the voice allocator.
+ *
+ * @return voice allocator of this MIDI input
+ */
+YM2203_VoiceAllocator* YM2203_MIDIin::getVoices(void)
+{
+	return &m_voices;
+}
+
+/**
+ * read the latency clock.
+ *
+ * @return clock (MIDI_LATENCY_CLOCK counts, wraps around)
+ */
+uint32_t YM2203_MIDIin::getClock(void)
+{
+#ifdef PC_DEBUG
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+#else
+	return (uint32_t)micros();
+#endif
+}
+
+#ifdef PC_DEBUG
+/**
+ * set the simulated bus of a YM2203 device. (for algorithm debug on PC)
+ *
+ * @param bus simulated bus (NULL: the global YM2203_simBus)
+ * @param chip device number (0 - YM2203_CHIP_NUM-1)
+ */
+void YM2203_MIDIin::setSimBus(YM2203_SimBus *bus, int chip)
+{
+	m_ym2203.getChip(chip)->getBus()->attach(bus);
+}
+#endif
+
+/**
+ * execute a complete message.
+ *
+ * @param status status byte
+ * @param data1 first data byte
+ * @param data2 second data byte
+ * @return kind of the message (a note on with velocity 0 is MIDI_MSG_NOTE_OFF)
+ */
+int YM2203_MIDIin::execMessage(uint8_t status, uint8_t data1, uint8_t data2)
+{
+	int midiCh = status & 0x0F;
+	int kind = (status >> 4) - 8;
+	int ch, value;
+
+	switch(kind)
+	{
+	case MIDI_MSG_NOTE_ON:
+		if(data2 != 0){
+			ch = m_voices.noteOn(midiCh, data1 - MIDI_NOTE_OFFSET,
+			                     toVolume(data2, m_volume[midiCh]), m_bend[midiCh]);
+			if(ch != VOICE_NONE) m_velocity[ch] = data2;
+			break;
+		}
+		kind = MIDI_MSG_NOTE_OFF;
+		// fall through
+	case MIDI_MSG_NOTE_OFF:
+		m_voices.noteOff(midiCh, data1 - MIDI_NOTE_OFFSET);
+		break;
+	case MIDI_MSG_CONTROL:
+		this->controlChange(midiCh, data1, data2);
+		break;
+	case MIDI_MSG_PROGRAM:
+		if(m_program[midiCh] == data1) break;
+		m_program[midiCh] = data1;
+		if(!m_ssg[midiCh]){
+			m_voices.setInstrument(midiCh, &m_bank[data1 % m_bankSize]);
+		}
+		break;
+	case MIDI_MSG_PITCH_BEND:
+		value = ((int)data2 << 7) | data1;
+		m_bend[midiCh] = (int16_t)((value - MIDI_BEND_CENTER) * m_bendRange[midiCh] * 100 / MIDI_BEND_CENTER);
+		this->updatePitch(midiCh);
+		break;
+	default:
+		// key pressure and channel pressure are ignored
+		break;
+	}
+	return kind;
+}
+
+/**
+ * execute a control change.
+ *
+ * @param midiCh MIDI channel
+ * @param control control number
+ * @param value value (0-127)
+ */
+void YM2203_MIDIin::controlChange(int midiCh, int control, int value)
+{
+	int ch;
+
+	switch(control)
+	{
+	case MIDI_CC_VOLUME:
+		m_volume[midiCh] = (uint8_t)value;
+		this->updateVolume(midiCh);
+		break;
+	case MIDI_CC_RESET:
+		m_bend[midiCh] = 0;
+		this->updatePitch(midiCh);
+		break;
+	case MIDI_CC_SOUND_OFF:
+	case MIDI_CC_NOTES_OFF:
+		for(ch=0; ch<VOICE_CH_NUM; ch++){
+			if(m_voices.getInstrument(ch) == midiCh){
+				m_voices.noteOff(midiCh, m_voices.getNote(ch));
+			}
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * apply the volume to the voices of a MIDI channel.
+ *
+ * @param midiCh MIDI channel
+ */
+void YM2203_MIDIin::updateVolume(int midiCh)
+{
+	int ch;
+
+	for(ch=0; ch<VOICE_CH_NUM; ch++){
+		if(m_voices.getInstrument(ch) != midiCh) continue;
+		m_voices.setVolume(ch, toVolume(m_velocity[ch], m_volume[midiCh]));
+	}
+}
+
+/**
+ * apply the pitch bend to the voices of a MIDI channel.
+ *
+ * @param midiCh MIDI channel
+ */
+void YM2203_MIDIin::updatePitch(int midiCh)
+{
+	int ch, note;
+
+	for(ch=0; ch<VOICE_CH_NUM; ch++){
+		if(m_voices.getInstrument(ch) != midiCh) continue;
+		note = m_voices.getNote(ch);
+		m_ym2203.setNotePitch(ch, note, m_bend[midiCh]);
+	}
+}
+
+/**
+ * add a message to the latency statistics.
+ *
+ * @param kind kind of the message
+ * @param arrival latency clock at the arrival of the last byte
+ * @param writes register writes issued for the message
+ */
+void YM2203_MIDIin::addLatency(int kind, uint32_t arrival, uint32_t writes)
+{
+	MIDI_Latency *latency = &m_latency[kind];
+	uint32_t time = getClock() - arrival;
+	int bin;
+
+	latency->messages++;
+	if(time < latency->minTime) latency->minTime = time;
+	if(time > latency->maxTime) latency->maxTime = time;
+	latency->totalTime += time;
+	for(bin=0; (bin < MIDI_LATENCY_BINS - 1) && (time >> (bin + 1)); bin++){
+		;
+	}
+	latency->histogram[bin]++;
+
+	if(writes > latency->maxWrites) latency->maxWrites = writes;
+	latency->totalWrites += writes;
+}
+
+/**
+ * volume of the device from the velocity and the channel volume.
+ *
+ * @param velocity velocity (0-127)
+ * @param volume channel volume (0-127)
+ * @return volume (0-15)
+ */
+int YM2203_MIDIin::toVolume(int velocity, int volume)
+{
+	return (velocity * volume) >> 10;
+}
@@ -0,0 +1,113 @@
+#ifndef __YM2203_MIDI_IN_H_
+#define __YM2203_MIDI_IN_H_
+
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "YM2203_MMLplayer.h"
+#include "YM2203_VoiceAllocator.h"
+
+#define MIDI_CH_NUM			16		//!< MIDI channels
+#define MIDI_NOTE_OFFSET	12		//!< MIDI note number of octave 0, key C (MIDI note 60 = O4C)
+#define MIDI_BEND_RANGE		2		//!< default pitch bend range [keys]
+#define MIDI_LATENCY_BINS	16		//!< histogram bins (bin n: 2^n <= latency < 2^(n+1) [us])
+#define MIDI_LATENCY_CLOCK	1000000UL	//!< latency clock [Hz] (micros(), or the monotonic clock on PC)
+
+// Kind of MIDI messages (status >> 4) - 8
+#define MIDI_MSG_NOTE_OFF		0	//!< note off (and note on with velocity 0)
+#define MIDI_MSG_NOTE_ON		1	//!< note on
+#define MIDI_MSG_KEY_PRESSURE	2	//!< polyphonic key pressure (ignored)
+#define MIDI_MSG_CONTROL		3	//!< control change
+#define MIDI_MSG_PROGRAM		4	//!< program change
+#define MIDI_MSG_CH_PRESSURE	5	//!< channel pressure (ignored)
+#define MIDI_MSG_PITCH_BEND		6	//!< pitch bend
+#define MIDI_MSG_NUM			7	//!< kinds of messages
+
+/**
+ * latency statistics of a kind of MIDI messages. times are in MIDI_LATENCY_CLOCK counts.
+ * the latency is from the arrival of the last byte of a message
+ * to the end of its register writes (e.g. the key-on).
+ */
+struct MIDI_Latency
+{
+	uint32_t messages;		//!< number of messages
+	uint32_t minTime;		//!< minimum latency
+	uint32_t maxTime;		//!< maximum latency
+	uint64_t totalTime;		//!< total latency of all messages (average = totalTime / messages)
+	uint32_t histogram[MIDI_LATENCY_BINS];	//!< number of messages by latency
+	uint32_t maxWrites;		//!< maximum register writes issued for a message
+	uint32_t totalWrites;	//!< total register writes issued
+};
+
+/**
+ * YM2203 MIDI input class
+ * parses a MIDI byte stream (running status, note on/off, program change,
+ * control change 7/120/121/123 and pitch bend) and plays the notes
+ * with the voice allocator at once. each MIDI channel is an instrument,
+ * whose timbre is chosen from the timbre table by the program change.
+ * receive() can be called from the UART receive interrupt on GR-SAKURA,
+ * or with the bytes of a stream or pipe on PC. the arrival time is read
+ * with getClock() where the byte is received (the interrupt or the reader),
+ * so the time in a buffer before parsing is counted in the latency.
+ */
+class YM2203_MIDIin
+{
+public:
+	YM2203_MIDIin();			//!< constructor.
+
+	void begin(const YM2203_Timbre *bank = NULL, int num = TIMBRE_MAX);	//!< initialize the devices and the MIDI state.
+	void setSSG(int midiCh, bool ssg);			//!< play a MIDI channel on SSG channels or not.
+	void setBendRange(int midiCh, int keys);	//!< set the pitch bend range of a MIDI channel.
+	void receive(uint8_t data, uint32_t arrival);	//!< parse a received byte, with its arrival time.
+	void execute(uint8_t status, uint8_t data1, uint8_t data2);	//!< execute a channel message. (already parsed)
+	void allNotesOff(void);						//!< note-off all voices.
+	uint32_t getErrors(void);					//!< number of data bytes without a status.
+	void getLatency(int kind, MIDI_Latency *latency);	//!< get the latency statistics of a kind of messages.
+	void clearLatency(void);					//!< clear the latency statistics.
+	YM2203_VoiceAllocator* getVoices(void);		//!< get the voice allocator.
+	static uint32_t getClock(void);				//!< read the latency clock.
+#ifdef PC_DEBUG
+	void setSimBus(YM2203_SimBus *bus, int chip = 0);	//!< set the simulated bus of a YM2203 device.
+#endif
+
+private:
+	YM2203_ChipSet m_ym2203;					//!< YM2203 devices
+	YM2203_VoiceAllocator m_voices;				//!< voice allocator
+	const YM2203_Timbre *m_bank;					//!< timbre table for the program change
+	int m_bankSize;								//!< size of the timbre table
+	uint8_t m_status;							//!< running status (0: none)
+	uint8_t m_data[2];							//!< data bytes of the message
+	uint8_t m_dataCount;						//!< data bytes received
+	bool m_ignoring;							//!< ignoring data bytes (system exclusive or common message)
+	uint32_t m_errors;							//!< data bytes without a status
+	uint8_t m_program [MIDI_CH_NUM];			//!< program of each MIDI channel
+	uint8_t m_volume  [MIDI_CH_NUM];			//!< volume (CC7) of each MIDI channel
+	int16_t m_bend    [MIDI_CH_NUM];			//!< pitch bend of each MIDI channel [cents]
+	uint8_t m_bendRange[MIDI_CH_NUM];			//!< pitch bend range of each MIDI channel [keys]
+	bool    m_ssg     [MIDI_CH_NUM];			//!< each MIDI channel plays on SSG channels
+	uint8_t m_velocity[VOICE_CH_NUM];			//!< velocity of the note on each voice
+	MIDI_Latency m_latency[MIDI_MSG_NUM];		//!< latency statistics of each kind of messages
+
+	int  execMessage(uint8_t status, uint8_t data1, uint8_t data2);	//!< execute a complete message.
+	void controlChange(int midiCh, int control, int value);	//!< execute a control change.
+	void updateVolume(int midiCh);				//!< apply the volume to the voices of a MIDI channel.
+	void updatePitch(int midiCh);				//!< apply the pitch bend to the voices of a MIDI channel.
+	void addLatency(int kind, uint32_t arrival, uint32_t writes);	//!< add a message to the statistics.
+	static int toVolume(int velocity, int volume);	//!< volume of the device (0-15).
+};
+
+#endif
@@ -22,7 +22,11 @@
 #include <stdint.h>
 #include <stdio.h>
 #define delay(i)				;
-#define DEBUG_PRINT(fmt, ...)	printf(fmt, __VA_ARGS__)
+#ifdef PC_DEBUG_QUIET
+#define DEBUG_PRINT(fmt, ...)	;
+#else
+#define DEBUG_PRINT(fmt, ...)	printf(fmt, ##__VA_ARGS__)
+#endif
 
 // for real machine
 #else
@@ -34,6 +38,157 @@
 #define _YM2203_MML_PLAYER_C_
 #include "YM2203_MMLplayer.h"
 
+//! clock of TMR0,1 counter [Hz] (48MHz / 64)
+#define TMR_CLOCK			750000UL
+//! common divisor of TMR_CLOCK and YM2203_RECORD_RATE (to keep the record time in 32bit)
+#define RECORD_TIME_GCD		300
+
+//! procedure of the TMR0 interrupt (NULL: MMLplayer.onTimer)
+static YM2203_TimerHandler s_timerHandler = NULL;
+//! argument for the procedure of the TMR0 interrupt
+static void* s_timerContext = NULL;
+
+//! preset timbres (constexpr data in ROM. the rest up to TIMBRE_MAX are empty)
+//! each timbre: algorithm, feedback, operator mask, AR, DR, SR, RR, SL, TL, KS, ML and DT of operator 1-4
+static constexpr YM2203_Timbre PRESET_TIMBRE[TIMBRE_MAX] = {
+	// @0 ?
+	YM2203_Timbre(2, 12, MASK_ALL,
+		{31, 31, 31, 31}, {24, 15, 24, 19}, { 0, 17,  0, 17}, { 8, 12,  8, 12}, {11,  2, 11,  2},
+		{12, 17, 19,  0}, { 0,  0,  0,  0}, { 0,  0,  0,  0}, { 0,  0,  0,  0}),
+	// @1-12 (empty)
+	YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(),
+	YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(),
+	// @13 Piano
+	YM2203_Timbre(4, 5, MASK_ALL,
+		{31, 20, 31, 31}, { 5, 10,  3, 12}, { 0,  3,  0,  3}, { 0,  7,  0,  7}, { 0,  8,  0, 10},
+		{23,  0, 25,  2}, { 1,  1,  1,  1}, { 1,  1,  1,  1}, { 3,  3,  7,  7}),
+	// @14-22 (empty)
+	YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(),
+	YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(),
+	// @23 Trumpet
+	YM2203_Timbre(2, 7, MASK_ALL,
+		{13, 15, 21, 18}, { 6,  8,  7,  4}, { 0,  0,  0,  0}, { 8,  8,  8,  8}, { 1,  1,  2,  2},
+		{25, 32, 42,  0}, { 2,  1,  0,  1}, { 2,  6,  2,  2}, { 3,  7,  3,  0}),
+	// @24 Strings1
+	YM2203_Timbre(2, 7, MASK_ALL,
+		{25, 25, 28, 14}, {10, 11, 13,  4}, { 0,  0,  0,  0}, { 5,  8,  6,  6}, { 1,  5,  2,  0},
+		{29, 15, 45,  0}, { 1,  1,  1,  1}, { 1,  5,  1,  1}, { 1,  1,  0,  0}),
+	// @25 Strings2
+	YM2203_Timbre(2, 0, MASK_ALL,
+		{21, 20, 16, 14}, { 7, 11,  8,  5}, { 0,  0,  0,  0}, { 7, 12, 12, 12}, { 3,  3,  3,  1},
+		{37, 15, 45,  0}, { 1,  1,  1,  1}, { 1,  5,  1,  1}, { 3,  7,  0,  0}),
+	// @26 (empty)
+	YM2203_Timbre(),
+	// @27 E.Piano
+	YM2203_Timbre(4, 6, MASK_ALL,
+		{22, 16, 20, 17}, { 5,  8,  5,  8}, { 0,  8,  0,  7}, { 3,  7,  3,  7}, { 5,  2,  5,  2},
+		{30,  0, 34,  0}, { 0,  1,  0,  1}, { 2,  2,  4,  2}, { 3,  3,  7,  7}),
+	// @28-29 (empty)
+	YM2203_Timbre(), YM2203_Timbre(),
+	// @30 E.BASS1
+	YM2203_Timbre(2, 5, MASK_ALL,
+		{31, 31, 31, 31}, { 8, 14, 16, 12}, { 0,  6,  3,  5}, { 0,  9,  0,  8}, { 3,  2,  2,  2},
+		{34, 42, 20,  0}, { 0,  0,  0,  0}, { 0,  8,  0,  1}, { 3,  0,  7,  0}),
+	// @31 E.BASS2
+	YM2203_Timbre(0, 7, MASK_ALL,
+		{31, 28, 31, 28}, { 8, 18,  7,  9}, { 0,  5,  7,  6}, { 6,  6,  6,  6}, {10, 13,  8,  1},
+		{38, 47, 23,  0}, { 1,  1,  2,  2}, { 1, 10,  0,  0}, { 3,  7,  2,  0}),
+	// @32-38 (empty)
+	YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(),
+	YM2203_Timbre(),
+	// @39 Clarinet
+	YM2203_Timbre(3, 7, MASK_ALL,
+		{31, 20, 20, 20}, { 7, 10, 10, 15}, { 0,  0,  0,  0}, { 5, 11,  6,  7}, { 0,  5, 10,  0},
+		{40, 50, 40,  0}, { 1,  1,  1,  1}, { 2,  3,  4,  1}, { 0,  0,  0,  0}),
+	// @40-43 (empty)
+	YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(), YM2203_Timbre(),
+	// @44 Zitar
+	YM2203_Timbre(0, 6, MASK_ALL,
+		{18, 31, 31, 31}, { 5,  5,  5, 10}, { 3,  4,  3,  2}, { 1,  1,  3,  5}, { 2,  1,  2,  4},
+		{30, 28, 35,  0}, { 1,  1,  1,  0}, { 3,  2,  1,  1}, { 7,  0,  0,  3}),
+	// @45 Clav
+	YM2203_Timbre(2, 6, MASK_ALL,
+		{31, 31, 31, 31}, {15,  6,  6,  6}, { 8,  2,  2,  6}, { 6,  6,  6,  7}, { 2,  2,  1,  4},
+		{35, 32, 32,  0}, { 0,  0,  0,  0}, {12,  3,  1,  2}, { 3,  0,  7,  0}),
+	// @46 Harpsic
+	YM2203_Timbre(2, 5, MASK_ALL,
+		{31, 31, 31, 31}, {13, 11,  2,  6}, { 0,  2,  0,  6}, {15,  0,  0,  7}, {10,  3,  1,  1},
+		{30, 32, 30,  0}, { 1,  1,  0,  1}, { 0,  7,  0,  4}, { 3,  3,  7,  7}),
+};
+
+// clock for ISR profiling
+#ifdef MML_PROFILE
+#ifdef PC_DEBUG
+#include <time.h>
+//! read the profile clock. (host monotonic clock [ns])
+static inline uint32_t profileClock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+//! whether the timer interval elapsed during the call.
+#define profileOverrun(time, interval)	((time) > (interval))
+#else
+//! read the profile clock. (TMR0,1 counter, cleared at each interrupt)
+#define profileClock()					((uint32_t)TMR01.TCNT)
+//! whether the timer interval elapsed during the call. (the next compare match is pending)
+#define profileOverrun(time, interval)	(IR(TMR0, CMIA0) != 0)
+#endif
+//! count a MML command executed
+#define PROFILE_COMMAND()	(m_profCommands++)
+#else
+#define PROFILE_COMMAND()
+#endif
+
+//! quarter of the sine wave for the vibrato (127 * sin(n/64 * PI/2), n = 0-64)
+static const int8_t VIBRATO_SINE_TABLE[65] = {
+	  0,   3,   6,   9,  12,  16,  19,  22,  25,  28,  31,  34,  37,  40,  43,  46,
+	 49,  51,  54,  57,  60,  63,  65,  68,  71,  73,  76,  78,  81,  83,  85,  88,
+	 90,  92,  94,  96,  98, 100, 102, 104, 106, 107, 109, 111, 112, 113, 115, 116,
+	117, 118, 120, 121, 122, 122, 123, 124, 125, 125, 126, 126, 126, 127, 127, 127,
+	127
+};
+
+// level steps of the preset envelope macros (see PRESET_ENV_MACRO)
+static const uint8_t ENV_LEVEL_PIANO[]   = { 15, 14, 13, 12, 11, 10,  9,  8,  6,  4,  2,  0 };
+static const uint8_t ENV_LEVEL_ORGAN[]   = { 10, 13, 15, 12,  8,  4,  0 };
+static const uint8_t ENV_LEVEL_TREMOLO[] = { 15, 14, 13, 12, 13, 14,  8,  4,  0 };
+static const uint8_t ENV_LEVEL_PLUCK[]   = { 15, 12, 10,  8,  6,  5,  4,  3,  2,  1,  0 };
+
+//! preset envelope macros of the S command (S1-S4)
+static const MML_EnvelopeMacro PRESET_ENV_MACRO[] = {
+	//  level              length                      loop            release speed
+	{ ENV_LEVEL_PIANO,   sizeof(ENV_LEVEL_PIANO),   ENV_MACRO_HOLD, 8, 4 },	// S1: decay to 8, release
+	{ ENV_LEVEL_ORGAN,   sizeof(ENV_LEVEL_ORGAN),   ENV_MACRO_HOLD, 3, 2 },	// S2: attack to 15, release
+	{ ENV_LEVEL_TREMOLO, sizeof(ENV_LEVEL_TREMOLO), 0,              6, 3 },	// S3: tremolo, release
+	{ ENV_LEVEL_PLUCK,   sizeof(ENV_LEVEL_PLUCK),   ENV_MACRO_HOLD, sizeof(ENV_LEVEL_PLUCK), 6 },	// S4: decay to 0
+};
+
+/**
+ * vibrato wave.
+ *
+ * @param wave VIBRATO_TRIANGLE or VIBRATO_SINE
+ * @param phase phase [1/65536 cycle]
+ * @return value of the wave (-127 to 127)
+ */
+static int vibratoWave(uint8_t wave, uint16_t phase)
+{
+	uint8_t pos = (uint8_t)(phase >> 8);	// 256 steps in a cycle
+	uint8_t quarter = pos & 0x3F;
+	int value;
+	
+	// the 2nd and 4th quarters go back
+	if(pos & 0x40) quarter = 64 - quarter;
+	if(wave == VIBRATO_SINE){
+		value = VIBRATO_SINE_TABLE[quarter];
+	}else{
+		value = (quarter < 64) ? quarter * 2 : 127;
+	}
+	// the 2nd half is negative
+	return (pos & 0x80) ? -value : value;
+}
+
 /**
  * MML error trap (for Debug)
  *
@@ -54,14 +209,52 @@ YM2203_MMLplayer::YM2203_MMLplayer()
 {
 	int ch;
 	
-	for(ch=0; ch<ALL_CH_NUM; ch++){
+	for(ch=0; ch<MML_CH_NUM; ch++){
 		m_noteTop [ch] = NULL;
 		m_note    [ch] = NULL;
+		m_eventTop[ch] = NULL;
+		m_event   [ch] = NULL;
 		m_octave  [ch] = 4;
 		m_length  [ch] = 24;    // 24 is for quarter note
 		m_gateTime[ch] = 7;
+		m_stepCnt [ch] = 0;
+		m_gateCnt [ch] = 0;
+		m_isEnd   [ch] = true;
+		m_isTied  [ch] = false;
+		m_loopDepth[ch] = 0;
+		m_section [ch] = 0;
 	}
+	m_sequence = NULL;
+	m_sequenceNum = 0;
+	m_sequenceLoop = -1;
+	memset(m_mod, 0, sizeof(m_mod));
+	m_modActive = 0;
+	for(ch=0; ch<MML_CH_NUM; ch++){
+		m_env[ch].macro    = NULL;
+		m_env[ch].step     = 0;
+		m_env[ch].volume   = 15;
+		m_env[ch].level    = 0xFF;
+		m_env[ch].released = true;	// no note to release
+		m_env[ch].wait     = 0;
+	}
+	m_envActive = 0;
+	m_envTable = PRESET_ENV_MACRO;
+	m_envTableNum = sizeof(PRESET_ENV_MACRO) / sizeof(PRESET_ENV_MACRO[0]);
 	m_isPlaying = false;
+	m_tmrCompare = 0;
+	m_tmrTempo = 0;
+	m_tmrTicks = 1;
+	m_recordRest = 0;
+	this->clearTimbreCache();
+#ifdef MML_PROFILE
+	memset(&m_profile, 0, sizeof(m_profile));
+	m_profile.minTime = 0xFFFFFFFF;
+	m_profCommands = 0;
+#endif
+#ifdef PC_DEBUG
+	m_hostTimer = NULL;
+	m_hostContext = NULL;
+#endif
 }
 
 /**
@@ -83,8 +276,9 @@ void YM2203_MMLplayer::begin()
 	// initialize timers
 	this->initTMR();
 	
-	// initialize timbre table
-	this->setPresetTimbre();
+	// the preset timbres are in ROM. (nothing to set up)
+	m_bank.close();
+	this->clearTimbreCache();
 }
 
 /**
@@ -92,6 +286,15 @@ void YM2203_MMLplayer::begin()
  */
 void YM2203_MMLplayer::initTMR(void)
 {
+	// default BPM = 80 (80 quarter notes in 1 nimute)
+	// tick interval = 1/8 * 96th note interval
+	//               = 60sec / (BPM*24*8)
+	// compare match = 60 * 1,000,000us / (BPM*24*8) * (48MHz / 64)
+	// (the interrupt comes every m_tmrTicks ticks. see onTimer())
+	m_tmrCompare = (uint16_t)((60000000UL * 48) / (80*24*8*64));
+	m_tmrTempo = m_tmrCompare;
+	m_tmrTicks = 1;
+	
 #ifndef PC_DEBUG
 	// TMR0(8bit) + TMR1(8bit) cascaded 16bit timer mode
 	// TMR0: upper 8 bits / TMR1: lower 8 bits
@@ -113,11 +316,7 @@ void YM2203_MMLplayer::initTMR(void)
 	TMR1.TCCR.BIT.CSS = 0x01;		// TMR1 clocked by PCLKB / prescaler
 	TMR1.TCCR.BIT.CKS = 0x04;		// 1/64  prescaler for TMR1
 
-	// default BPM = 80 (80 quarter notes in 1 nimute)
-	// interrupt interval = 1/8 * 96th note interval
-	//                    = 60sec / (BPM*24*8)
-	// compare match = 60 * 1,000,000us / (BPM*24*8) * (48MHz / 64)
-	TMR01.TCORA = (uint16_t)((60000000UL * 48) / (80*24*8*64));
+	TMR01.TCORA = m_tmrCompare;
 
 	TMR0.TCR.BIT.CCLR = 0x01;		// set counter clear by compare match A
 	TMR0.TCR.BIT.CMIEA = 0x01;		// enable compare match A interrupt
@@ -131,32 +330,26 @@ void YM2203_MMLplayer::initTMR(void)
 
 /**
  * set temo.
+ * the interval in flight keeps its ticks in the old tempo, and the new tempo
+ * is used from the next interrupt. (the counter is not cleared, so no time is lost)
+ * the compare match is limited to 1 - 0xFFFF. (BPM 4 to 234375)
  *
  * @param bpm beat per minute (how many quarter notes in 1 nimute)
  */
 void YM2203_MMLplayer::setTempo(int bpm)
 {
-#ifndef PC_DEBUG
-	// GR-SAKURA has external 12MHz clock, 
-	// PLLCR.STC=16   (x16 multiple),
-	// PLLCR.PLIDIV=0 (1/1 prescale),
-	// SCKCR.PCKB=2   (1/4 prescale)
-	// -> PCLK = 12MHz*16/4 = 48MHz
-
-	int slot_per_minute;
+	uint32_t compare;
 	
-	IEN(TMR0, CMIA0) = 0;			// disable compare match A interrupt
-
-	// default BPM = 80 (80 quarter notes in 1 nimute)
-	// interrupt interval = 1/8 * 96th note interval
-	//                    = 60sec / (BPM*24*8)
+	// tick interval = 1/8 * 96th note interval
+	//               = 60sec / (BPM*24*8)
 	// compare match = 60 * 1,000,000us / (BPM*24*8) * (48MHz / 64)
-	TMR01.TCORA = (uint16_t)((60000000UL * 48) / ((uint32_t)bpm*24*8*64));
-
-	TMR01.TCNT = 0x0000;			// clear the counter
-	IR (TMR0, CMIA0) = 0;			// clear interrupt
-	IEN(TMR0, CMIA0) = 1;			// enable compare match A interrupt
-#endif
+	// (PCLKB = 48MHz. see initTMR)
+	if(bpm < 1) bpm = 1;
+	compare = ((60000000UL * 48) / (24*8*64)) / (uint32_t)bpm;
+	
+	if(compare < 1) compare = 1;
+	if(compare > 0xFFFF) compare = 0xFFFF;
+	m_tmrTempo = (uint16_t)compare;
 }
 
 /**
@@ -167,7 +360,12 @@ void YM2203_MMLplayer::setTempo(int bpm)
  */
 void YM2203_MMLplayer::setVolume(int ch, int volume)
 {
-	m_ym2203.setVolume(ch, volume);	
+	// parameter check
+	if(ch<0 || ch>=MML_CH_NUM) return;
+	if(volume<0 || volume>15) return;
+	
+	this->changeVolume(ch, volume);
+	m_ym2203.flush();
 } 
 
 /**
@@ -180,6 +378,7 @@ void YM2203_MMLplayer::setVolume(int ch, int volume)
 void YM2203_MMLplayer::setEnvelope(int ch, int type, int interval)
 {
 	m_ym2203.setEnvelope(ch, type, interval);
+	m_ym2203.flush();
 }
 
 /**
@@ -191,6 +390,7 @@ void YM2203_MMLplayer::setEnvelope(int ch, int type, int interval)
 void YM2203_MMLplayer::setToneNoise(int ch, int mode)
 {
 	m_ym2203.setToneNoise(ch, mode);	
+	m_ym2203.flush();
 }
 	
 /**
@@ -199,9 +399,11 @@ void YM2203_MMLplayer::setToneNoise(int ch, int mode)
  * @param ch channel. 0-2 or FM_CH1,FM_CH2,FM_CH3 (FM channel only)
  * @param timbre pointer to the timbre structure.
  */
-void YM2203_MMLplayer::setTimbre(int ch, YM2203_Timbre *timbre)
+void YM2203_MMLplayer::setTimbre(int ch, const YM2203_Timbre *timbre)
 {
+	if( (0 <= ch) && (ch < MML_CH_NUM) ) m_cacheEntry[ch] = -1;
 	m_ym2203.setTimbre(ch, timbre);
+	m_ym2203.flush();
 }
 
 /**
@@ -213,12 +415,107 @@ void YM2203_MMLplayer::setTimbre(int ch, YM2203_Timbre *timbre)
 void YM2203_MMLplayer::setGateTime(int ch, int gateTime)
 {
 	// parameter check
-	if(ch<0 || ch>=ALL_CH_NUM) return;
+	if(ch<0 || ch>=MML_CH_NUM) return;
 	if(gateTime<1 || gateTime>8) return;
 	
 	m_gateTime[ch] = gateTime;
 }
 
+/**
+ * set pitch bend to a channel.
+ * the sounding note is bent at once, and the following notes are bent as well.
+ *
+ * @param ch channel. 0-2:FM, 3-5:SSG. or FM_CH1,FM_CH2,FM_CH3,SSG_CH_A,SSG_CH_B,SSG_CH_C
+ * @param cents pitch bend in cents (-MML_BEND_MAX to MML_BEND_MAX)
+ */
+void YM2203_MMLplayer::setPitchBend(int ch, int cents)
+{
+	// parameter check
+	if(ch<0 || ch>=MML_CH_NUM) return;
+	if(cents < -MML_BEND_MAX) cents = -MML_BEND_MAX;
+	if(cents >  MML_BEND_MAX) cents =  MML_BEND_MAX;
+	
+	m_mod[ch].bend = (int16_t)cents;
+	this->modulate(ch, 0);
+	m_ym2203.flush();
+}
+
+/**
+ * set portamento glide time to a channel.
+ * each note glides from the pitch of the last note.
+ *
+ * @param ch channel. 0-2:FM, 3-5:SSG. or FM_CH1,FM_CH2,FM_CH3,SSG_CH_A,SSG_CH_B,SSG_CH_C
+ * @param length glide time in 96th notes (0-255, 0: off)
+ */
+void YM2203_MMLplayer::setPortamento(int ch, int length)
+{
+	// parameter check
+	if(ch<0 || ch>=MML_CH_NUM) return;
+	if(length<0 || length>255) return;
+	
+	m_mod[ch].portamento = (uint8_t)length;
+}
+
+/**
+ * set vibrato to a channel. (from the next note)
+ * at 120 BPM (384 ticks per second), the speed 16 is 1.5Hz and 64 is 6Hz.
+ *
+ * @param ch channel. 0-2:FM, 3-5:SSG. or FM_CH1,FM_CH2,FM_CH3,SSG_CH_A,SSG_CH_B,SSG_CH_C
+ * @param depth depth in cents (0-127, 0: off)
+ * @param speed phase step in 1/4096 cycle per tick (0-255)
+ * @param delay delay from note-on in 96th notes (0-255)
+ * @param wave VIBRATO_TRIANGLE or VIBRATO_SINE
+ */
+void YM2203_MMLplayer::setVibrato(int ch, int depth, int speed, int delay, int wave)
+{
+	// parameter check
+	if(ch<0 || ch>=MML_CH_NUM) return;
+	if(depth<0 || depth>127 || speed<0 || speed>255 || delay<0 || delay>255) return;
+	
+	m_mod[ch].vibDepth = (uint8_t)depth;
+	m_mod[ch].vibSpeed = (uint8_t)speed;
+	m_mod[ch].vibDelay = (uint8_t)delay;
+	m_mod[ch].vibWave  = (wave == VIBRATO_SINE) ? VIBRATO_SINE : VIBRATO_TRIANGLE;
+}
+
+/**
+ * set a software envelope macro to a channel. (SSG)
+ * the level of the channel follows the macro from each note-on,
+ * attenuated by the volume. (the hardware envelope is off)
+ *
+ * @param ch channel. 3-5 or SSG_CH_A,SSG_CH_B,SSG_CH_C (SSG channel only)
+ * @param macro envelope macro. it must stay while used. (NULL: off)
+ */
+void YM2203_MMLplayer::setEnvelopeMacro(int ch, const MML_EnvelopeMacro *macro)
+{
+	// parameter check
+	if(ch<0 || ch>=MML_CH_NUM) return;
+	if( YM2203_LOCAL_CH(ch) < SSG_CH_A ) return;
+	if( (macro != NULL) && ((macro->length == 0) || (macro->release == 0) || (macro->release > macro->length) ||
+	    (macro->speed == 0) || ((macro->loop != ENV_MACRO_HOLD) && (macro->loop >= macro->release))) ) return;
+	
+	this->selectEnvelope(ch, macro);
+	m_ym2203.flush();
+}
+
+/**
+ * set the envelope macros of the S command. (S1 is table[0])
+ * the preset macros are replaced. each macro must be valid as of setEnvelopeMacro.
+ *
+ * @param table envelope macros. it must stay while used. (NULL: the preset macros)
+ * @param num number of the macros (up to 255)
+ */
+void YM2203_MMLplayer::setEnvelopeMacroTable(const MML_EnvelopeMacro *table, int num)
+{
+	if( (table == NULL) || (num < 0) || (num > 255) ){
+		m_envTable = PRESET_ENV_MACRO;
+		m_envTableNum = sizeof(PRESET_ENV_MACRO) / sizeof(PRESET_ENV_MACRO[0]);
+	}else{
+		m_envTable = table;
+		m_envTableNum = num;
+	}
+}
+
 /**
  * set note to a channel.
  *
@@ -227,11 +524,52 @@ void YM2203_MMLplayer::setGateTime(int ch, int gateTime)
  */
 void YM2203_MMLplayer::setNote(int ch, const char* note)
 {
-	int len;
-	
 //	this->stop();
 	
+	m_sequence = NULL;
 	m_noteTop[ch] = note;
+	m_eventTop[ch] = NULL;
+}
+
+/**
+ * set compiled events to a channel.
+ *
+ * @param ch channel. 0-2:FM, 3-5:SSG. or FM_CH1,FM_CH2,FM_CH3,SSG_CH_A,SSG_CH_B,SSG_CH_C
+ * @param events pointer to events made by compile(), terminated with MML_EV_END
+ */
+void YM2203_MMLplayer::setEvents(int ch, const MML_Event* events)
+{
+	m_sequence = NULL;
+	m_noteTop[ch] = NULL;
+	m_eventTop[ch] = events;
+}
+
+/**
+ * set the sections of a song to play in order. (instead of setNote)
+ * when the pattern of a channel ends, the pattern of the next section
+ * goes on in the same tick by the timer procedure. so the song plays
+ * without a gap between the sections, and without the main loop.
+ * setNote() or setEvents() cancels the sequence.
+ *
+ * @param sections sections of the song. it must stay while playing.
+ * @param num number of the sections
+ * @param loop section to go back to after the last one (-1: the song ends)
+ */
+void YM2203_MMLplayer::setSequence(const MML_Section *sections, int num, int loop)
+{
+	int ch;
+	
+	// parameter check
+	if( (sections == NULL) || (num <= 0) ) return;
+	if( (loop < -1) || (loop >= num) ) loop = -1;
+	
+	m_sequence = sections;
+	m_sequenceNum = num;
+	m_sequenceLoop = loop;
+	for(ch=0; ch<MML_CH_NUM; ch++){
+		m_noteTop [ch] = sections[0].note[ch];
+		m_eventTop[ch] = NULL;
+	}
 }
 
 /**
@@ -241,13 +579,23 @@ void YM2203_MMLplayer::play(void)
 {
 	int ch;
 	
-	for(ch=0; ch<ALL_CH_NUM; ch++)
+	for(ch=0; ch<MML_CH_NUM; ch++)
 	{
 		m_note   [ch] = m_noteTop[ch];	// top of note.
+		m_event  [ch] = m_eventTop[ch];	// top of compiled events.
 		m_stepCnt[ch] = 1;	// ready to play the first note
-		m_isEnd[ch] = false;
+		m_gateCnt[ch] = 0;	// no note sounding (it may be left by stop())
+		m_isEnd[ch] = (m_note[ch] == NULL) && (m_event[ch] == NULL);	// no part
 		m_isTied[ch] = false;
+		m_loopDepth[ch] = 0;
+		m_section[ch] = 0;
+		m_mod[ch].hasNote = false;	// no portamento to the first note
+		m_mod[ch].glide = 0;
+		m_env[ch].level = 0xFF;
+		m_env[ch].released = true;
 	}
+	m_modActive = 0;
+	m_envActive = 0;
 	m_isPlaying = true;
 }
 
@@ -260,9 +608,162 @@ void YM2203_MMLplayer::playAndWait(void)
 	
 	while(m_isPlaying)
 	{
+#ifdef PC_DEBUG
+		// no timer interrupt on PC. run the timer procedure here.
+		this->onTimer();
+		if(m_hostTimer != NULL){
+			m_hostTimer(m_hostContext, this->getTimerInterval());
+		}
+#else
 		delay(1);
+#endif
+	}
+}
+
+/**
+ * get the interval of the timer interrupt.
+ * (until the next interrupt, which is set by onTimer())
+ *
+ * @return interval [ns]
+ */
+uint32_t YM2203_MMLplayer::getTimerInterval(void)
+{
+	// TMR1 is clocked at 48MHz / 64
+	return (uint32_t)m_tmrCompare * m_tmrTicks * 4000 / 3;
+}
+
+/**
+ * start or stop recording the register writes. (e.g. to make a VGM file)
+ * the writes are stamped with the time of the timer interrupts.
+ * (only the device 0 is recorded)
+ *
+ * @param entries ring buffer. NULL to stop recording.
+ * @param size number of entries (power of 2)
+ */
+void YM2203_MMLplayer::setRecordBuffer(YM2203_RecordEntry *entries, uint32_t size)
+{
+	m_ym2203.getChip(0)->setRecordBuffer(entries, size);
+}
+
+/**
+ * take out the recorded register writes. (oldest first)
+ * call it often enough in the main loop so that the ring buffer isn't full.
+ *
+ * @param entries buffer to copy the writes
+ * @param max size of the buffer
+ * @return number of writes copied
+ */
+int YM2203_MMLplayer::readRecord(YM2203_RecordEntry *entries, int max)
+{
+	return m_ym2203.getChip(0)->readRecord(entries, max);
+}
+
+/**
+ * get the time of the record. (time of the next timer interrupt)
+ *
+ * @return time [1/YM2203_RECORD_RATE sec]
+ */
+uint32_t YM2203_MMLplayer::getRecordTime(void)
+{
+	return m_ym2203.getChip(0)->getRecordTime();
+}
+
+/**
+ * number of register writes lost by the full ring buffer.
+ *
+ * @return number of writes
+ */
+uint32_t YM2203_MMLplayer::getRecordDropped(void)
+{
+	return m_ym2203.getChip(0)->getRecordDropped();
+}
+
+/**
+ * get a YM2203 device. (to share it with another player)
+ * the players must write through the same object,
+ * so that the shadow registers stay true.
+ *
+ * @param chip device number (0 - YM2203_CHIP_NUM-1)
+ * @return YM2203 device of this player
+ */
+YM2203* YM2203_MMLplayer::getDevice(int chip)
+{
+	return m_ym2203.getChip(chip);
+}
+
+/**
+ * set the timbre bank of the timbre table. (call it while not playing)
+ * the voice n of the bank is the timbre of "@n" in MML.
+ * the voices are loaded on use into a cache of TIMBRE_CACHE_NUM entries,
+ * and the bank stays in place.
+ * (e.g. const data in ROM, or a file mapped to the memory on PC)
+ * begin() sets the preset timbres.
+ *
+ * @param data bank image (see YM2203_TimbreBank). NULL for the preset timbres.
+ * @param size size of the image [byte]
+ * @return true if the image is a timbre bank (or NULL)
+ */
+bool YM2203_MMLplayer::setTimbreBank(const uint8_t *data, uint32_t size)
+{
+	this->clearTimbreCache();
+	if(data == NULL){
+		m_bank.close();
+		return true;
 	}
+	return m_bank.open(data, size);
+}
+
+/**
+ * get a timbre of the timbre table. (the timbre of "@num" in MML)
+ * a voice of the timbre bank is loaded into the cache, and the entry may be
+ * replaced by the next voices loaded. (copy it to keep it)
+ *
+ * @param num timbre number (0 - TIMBRE_MAX-1)
+ * @return timbre (NULL if out of range)
+ */
+const YM2203_Timbre* YM2203_MMLplayer::getTimbre(int num)
+{
+	if( (num < 0) || (num >= TIMBRE_MAX) ) return NULL;
+	return this->findTimbre(num);
+}
+
+/**
+ * get the table of the preset timbres. (e.g. the table for the program change of MIDI)
+ * the voices of the timbre bank are not in a table. (copy them with getTimbre)
+ *
+ * @return preset timbre table in ROM (TIMBRE_MAX timbres)
+ */
+const YM2203_Timbre* YM2203_MMLplayer::getPresetTable(void)
+{
+	return PRESET_TIMBRE;
+}
+
+#ifdef PC_DEBUG
+/**
+ * set the host timer callback. (for algorithm debug on PC)
+ * playAndWait() calls it after each timer procedure,
+ * so the host can render the elapsed interval.
+ *
+ * @param func callback function. NULL to remove.
+ * @param context argument for the callback
+ */
+void YM2203_MMLplayer::setHostTimer(YM2203_HostTimer func, void* context)
+{
+	m_hostTimer = func;
+	m_hostContext = context;
+}
+
+/**
+ * set the simulated bus of a YM2203 device. (for algorithm debug on PC)
+ *
+ * @param bus simulated bus (NULL: the global YM2203_simBus)
+ * @param chip device number (0 - YM2203_CHIP_NUM-1)
+ */
+void YM2203_MMLplayer::setSimBus(YM2203_SimBus *bus, int chip)
+{
+	m_ym2203.getChip(chip)->getBus()->attach(bus);
 }
+#endif
 
 /**
  * stop playing note, and clear note.
@@ -272,34 +773,62 @@ void YM2203_MMLplayer::stop(void)
 	int ch;
 	
 	// note off all channels.
-	for(ch=0; ch<ALL_CH_NUM; ch++)
+	for(ch=0; ch<MML_CH_NUM; ch++)
 	{
 		m_ym2203.noteOff(ch);
 	}
+	m_ym2203.flush();
 	
 	m_isPlaying = false;
+	
+	// wait for play() at the tick rate
+	this->setTimerTicks(1);
 }
 
 /**
  * interval procedure for playing music.
+ * the interrupt comes at the next gate or step boundary of all channels,
+ * so the counters advance by the ticks of the elapsed interval.
  */
 void YM2203_MMLplayer::onTimer(void)
 {
 	int ch;
+	int ticks = m_tmrTicks;
+#ifdef MML_PROFILE
+	uint32_t profStart = profileClock();
+	uint32_t profWrites = m_ym2203.getIssuedWrites();
+#ifdef PC_DEBUG
+	uint32_t profInterval = this->getTimerInterval();
+#else
+	uint32_t profInterval = (uint32_t)m_tmrCompare * m_tmrTicks;
+#endif
+	m_profCommands = 0;
+#endif
 	
 	if(m_isPlaying)
 	{
 		// for each channel
-		for(ch=0; ch<ALL_CH_NUM; ch++)
+		for(ch=0; ch<MML_CH_NUM; ch++)
 		{
+			// move the level of the sounding note (even after the end, for the release)
+			if( m_envActive & ((uint32_t)1 << ch) ){
+				this->stepEnvelope(ch, ticks);
+			}
+			
 			if(!m_isEnd[ch])
 			{
+				// move the pitch of the sounding note
+				if( m_modActive & ((uint32_t)1 << ch) ){
+					this->modulate(ch, ticks);
+				}
+				
 				// gate time elapsed => note off
 				if(m_gateCnt[ch]>0){
-					m_gateCnt[ch]--;
+					m_gateCnt[ch] -= ticks;
 					if( m_gateCnt[ch] <= 0){
 						// if tie or slur, don't note off
-						if(!m_isTied[ch]){
+						// (with the release part of the envelope, note off at its end)
+						if( !m_isTied[ch] && !this->releaseEnvelope(ch) ){
 							m_ym2203.noteOff(ch);
 						}
 					}
@@ -307,210 +836,488 @@ void YM2203_MMLplayer::onTimer(void)
 			
 				// step time elapsed => next note
 				if(m_stepCnt[ch]>0){
-					m_stepCnt[ch]--;
+					m_stepCnt[ch] -= ticks;
 					if( m_stepCnt[ch] <= 0){
-						this->MMLparser(ch);
+						if(m_event[ch] != NULL){
+							this->eventPlayer(ch);
+						}else{
+							this->MMLparser(ch);
+						}
 					}
 				}
 			}
 		}
 		
 		// when all channel notes are terminated, stop playing.
-		if( m_isEnd[FM_CH1] && m_isEnd[FM_CH2] && m_isEnd[FM_CH3] && 
-		    m_isEnd[SSG_CH_A] && m_isEnd[SSG_CH_B] && m_isEnd[SSG_CH_C] )
+		for(ch=0; (ch<MML_CH_NUM) && m_isEnd[ch]; ch++){
+			;
+		}
+		if( ch == MML_CH_NUM )
 		{
 			this->stop();
 		}
+		else
+		{
+			// sleep until the next event
+			this->setTimerTicks(this->nextEventTicks());
+		}
 	}
+	
+	// issue the writes to the devices in turn (if more than one)
+	m_ym2203.flush();
+	
+	// the writes of the next interrupt are recorded at its time
+	this->advanceRecordTime();
+	
+#ifdef MML_PROFILE
+	this->profileCall(profStart, profInterval, m_ym2203.getIssuedWrites() - profWrites);
+#endif
 }
 
 /**
- * MML parser. (execute one note.)
+ * ticks until the next gate or step boundary of all channels.
+ * (or the next step of the pitch modulation or the envelope)
  *
- * @param ch channel
+ * @return ticks (1 - the limit of the 16bit compare match)
  */
-void YM2203_MMLplayer::MMLparser(int ch)
+int YM2203_MMLplayer::nextEventTicks(void)
 {
-	char mml;
-	char nxt;
-	int key;
-	int volume;
-	int gateTime;
-	bool note_on = false;
-	int timbre_num;
+	int ch;
+	int ticks = 0xFFFF / m_tmrTempo;
 	
-	// until one note(C,D,E,F,G,A,B or R) executed
-	while( !note_on )
+	for(ch=0; ch<MML_CH_NUM; ch++)
 	{
-		mml = *m_note[ch];
-		m_note[ch]++;
-		
-		// a-z => A-Z
-		if( mml >= 'a' && mml <= 'z' )
-		{
-			mml -= 0x20;
+		// the envelope is moving: at its next step
+		if( m_envActive & ((uint32_t)1 << ch) ){
+			if(m_env[ch].wait < ticks) ticks = m_env[ch].wait;
 		}
 		
-		// MML command
-		switch(mml){
-			// O: set octave (1-8)
-			case 'O':
-				nxt = *m_note[ch];
-				if( (nxt >= '1') && (nxt <= '8') ){
-					m_note[ch]++;
-					m_octave[ch] = (int)(nxt - '0');
-					DEBUG_PRINT("Command O (%d, %d)\n",ch,(int)(nxt - '0'));
-				}else{
-					DEBUG_PRINT("ERROR!:Command O NG (%d, %c)\n",ch, nxt);
-					onError('O');
-				}
-				break;
-			// >: up octave
-			case '>':
-				DEBUG_PRINT("Command > (%d)\n",ch);
-				if(m_octave[ch] < 8) m_octave[ch]++;
-				break;
-			// <: down octave
-			case '<':
-				DEBUG_PRINT("Command < (%d)\n",ch);
-				if(m_octave[ch] > 1) m_octave[ch]--;
-				break;
-			// L: set default note length (1,2,4,8,16)
-			case 'L':
-				nxt = *m_note[ch];
-				if( nxt == '1' ){
-					m_note[ch]++;
-					nxt = *m_note[ch];
-					if( nxt == '6' ){
-						m_note[ch]++;
-						m_length[ch] = 6;	// 16th note
-						DEBUG_PRINT("Command L16 (%d)\n",ch);
-					}else if( nxt == '2' ){
-						m_note[ch]++;
-						m_length[ch] = 8;	// 12th note
-						DEBUG_PRINT("Command L12 (%d)\n",ch);
-					}else{
-						m_length[ch] = 96;	// whole note
-						DEBUG_PRINT("Command L1 (%d)\n",ch);
-					}
-				}else if( nxt == '2' ){
-					m_note[ch]++;
-					nxt = *m_note[ch];
-					if( nxt == '4' ){
-						m_note[ch]++;
-						m_length[ch] = 4;	// 24th note
-						DEBUG_PRINT("Command L24 (%d)\n",ch);
-					}else{
-						m_length[ch] = 48;	// half note
-						DEBUG_PRINT("Command L2 (%d)\n",ch);
-					}
-				}else if( nxt == '4' ){
-					m_note[ch]++;
-					m_length[ch] = 24;		// quarter note
-					DEBUG_PRINT("Command L4 (%d)\n",ch);
-				}else if( nxt == '8' ){
-					m_note[ch]++;
-					m_length[ch] = 12;		// 8th note
-					DEBUG_PRINT("Command L8 (%d)\n",ch);
-				}else if( nxt == '3' ){
-					m_note[ch]++;
-					nxt = *m_note[ch];
-					if( nxt == '2' ){
-						m_note[ch]++;
-						m_length[ch] = 3;	// 32th note
-						DEBUG_PRINT("Command L32 (%d)\n",ch);
-					}else{
-						m_length[ch] = 32;	// 3rd note
-						DEBUG_PRINT("Command L3 (%d)\n",ch);
-					}
-				}else if( nxt == '6' ){
-					m_note[ch]++;
-					m_length[ch] = 16;		// 6th note
-					DEBUG_PRINT("Command L6 (%d)\n",ch);
-				}else{
-					DEBUG_PRINT("ERROR!:Command L (%d,%c)\n",ch,nxt);
-					onError('L');
-				}
-				break;
-			// @: set timbre
-			case '@':
-				if( ch >  FM_CH3){
-					DEBUG_PRINT("ERROR!:Command @ is unavailable for SSG ch.\n");
-					break;
-				}
-				nxt = *m_note[ch];
-				if( (nxt >= '0') && (nxt <='9') ){
-					m_note[ch]++;
-					timbre_num = (int)(nxt - '0');
-					nxt = *m_note[ch];
-					if( (nxt >= '0') && (nxt <='9') ){
-						m_note[ch]++;
-						timbre_num = timbre_num * 10 + (int)(nxt - '0');
-					}
-					if( timbre_num < 0 || timbre_num >= TIMBRE_MAX ){
-						DEBUG_PRINT("ERROR!:Command @ unavailable timbre (%d,%d)\n",ch,timbre_num);
-						onError('@');
-						break;
-					}
-					m_ym2203.setTimbre(ch, &m_timbre[timbre_num]);
-					DEBUG_PRINT("Command @ (%d,%d)\n",ch,timbre_num);
-				}else{
-					DEBUG_PRINT("ERROR!:Command @ (%d,%c)\n",ch,nxt);
-					onError('@');
-				}
-				break;
-			// V: set volume (0-15)
-			case 'V':
-				nxt = *m_note[ch];
-				if( (nxt >= '0') && (nxt <='9') ){
-					m_note[ch]++;
-					volume = (int)(nxt - '0');
-					nxt = *m_note[ch];
-					if( (volume == 1) && (nxt >= '0') && (nxt <='5') ){
-						m_note[ch]++;
-						volume = 10 + (int)(nxt - '0');
-					}
-					m_ym2203.setVolume(ch, volume);
-					DEBUG_PRINT("Command V (%d,%d)\n",ch,volume);
-				}else{
-					DEBUG_PRINT("ERROR!:Command V (%d,%c)\n",ch,nxt);
-					onError('V');
+		if(m_isEnd[ch]) continue;
+		if( (m_gateCnt[ch] > 0) && (m_gateCnt[ch] < ticks) ) ticks = m_gateCnt[ch];
+		if( (m_stepCnt[ch] > 0) && (m_stepCnt[ch] < ticks) ) ticks = m_stepCnt[ch];
+		
+		// the pitch is moving: every MML_MOD_TICKS (or at the end of the vibrato delay)
+		if( m_modActive & ((uint32_t)1 << ch) ){
+			if( (m_mod[ch].glide == 0) && (m_mod[ch].vibWait > MML_MOD_TICKS) ){
+				if(m_mod[ch].vibWait < ticks) ticks = m_mod[ch].vibWait;
+			}else if(MML_MOD_TICKS < ticks){
+				ticks = MML_MOD_TICKS;
+			}
+		}
+	}
+	if(ticks < 1) ticks = 1;
+	
+	return ticks;
+}
+
+/**
+ * set ticks until the next timer interrupt, in the tempo set by setTempo().
+ * (the counter is cleared by the compare match,
+ *  so the new compare value is used from the next interval.)
+ *
+ * @param ticks ticks (1 - 0xFFFF / m_tmrTempo)
+ */
+void YM2203_MMLplayer::setTimerTicks(int ticks)
+{
+	m_tmrCompare = m_tmrTempo;
+	m_tmrTicks = (uint16_t)ticks;
+	
+#ifndef PC_DEBUG
+	TMR01.TCORA = m_tmrCompare * m_tmrTicks;
+#endif
+}
+
+/**
+ * advance the record time by the interval until the next timer interrupt.
+ * (the remainder is carried, so the record time doesn't drift)
+ */
+void YM2203_MMLplayer::advanceRecordTime(void)
+{
+	uint32_t rest;
+	
+	rest = (uint32_t)m_tmrCompare * m_tmrTicks * (YM2203_RECORD_RATE / RECORD_TIME_GCD) + m_recordRest;
+	m_ym2203.getChip(0)->setRecordTime(m_ym2203.getChip(0)->getRecordTime() + rest / (TMR_CLOCK / RECORD_TIME_GCD));
+	m_recordRest = (uint16_t)(rest % (TMR_CLOCK / RECORD_TIME_GCD));
+}
+
+#ifdef MML_PROFILE
+/**
+ * add a call of the timer procedure to the statistics.
+ *
+ * @param start profile clock at the start of the call
+ * @param interval timer interval of the call (in profile clock counts)
+ * @param writes register writes issued in the call
+ */
+void YM2203_MMLplayer::profileCall(uint32_t start, uint32_t interval, uint32_t writes)
+{
+	uint32_t time = profileClock() - start;
+	int bin;
+	
+	if( profileOverrun(time, interval) ){
+#ifndef PC_DEBUG
+		// the counter was cleared by the compare match
+		time = profileClock() + (interval + 1) - start;
+#endif
+		m_profile.overruns++;
+	}
+	
+	m_profile.calls++;
+	if(time < m_profile.minTime) m_profile.minTime = time;
+	if(time > m_profile.maxTime) m_profile.maxTime = time;
+	m_profile.totalTime += time;
+	for(bin=0; (bin < MML_PROFILE_BINS - 1) && (time >> (bin + 1)); bin++){
+		;
+	}
+	m_profile.histogram[bin]++;
+	
+	if(writes > m_profile.maxWrites) m_profile.maxWrites = writes;
+	m_profile.totalWrites += writes;
+	if(m_profCommands > m_profile.maxCommands) m_profile.maxCommands = m_profCommands;
+	m_profile.totalCommands += m_profCommands;
+}
+
+/**
+ * get the statistics of the timer procedure.
+ *
+ * @param profile statistics (out)
+ */
+void YM2203_MMLplayer::getProfile(MML_Profile *profile)
+{
+#ifndef PC_DEBUG
+	uint8_t ien = IEN(TMR0, CMIA0);
+	IEN(TMR0, CMIA0) = 0;			// disable compare match A interrupt
+#endif
+	*profile = m_profile;
+#ifndef PC_DEBUG
+	IEN(TMR0, CMIA0) = ien;			// restore compare match A interrupt
+#endif
+}
+
+/**
+ * clear the statistics of the timer procedure.
+ */
+void YM2203_MMLplayer::clearProfile(void)
+{
+#ifndef PC_DEBUG
+	uint8_t ien = IEN(TMR0, CMIA0);
+	IEN(TMR0, CMIA0) = 0;			// disable compare match A interrupt
+#endif
+	memset(&m_profile, 0, sizeof(m_profile));
+	m_profile.minTime = 0xFFFFFFFF;
+#ifndef PC_DEBUG
+	IEN(TMR0, CMIA0) = ien;			// restore compare match A interrupt
+#endif
+}
+#endif
+
+/**
+ * MML parser. (execute one note.)
+ *
+ * @param ch channel
+ */
+void YM2203_MMLplayer::MMLparser(int ch)
+{
+	MML_Event ev;
+	int patterns = 0;
+	
+	// until one note(C,D,E,F,G,A,B or R) executed
+	do{
+		this->parseCommand(ch, &ev);
+		
+		// end of the pattern => the next section goes on (in the same tick)
+		// (at most once around the song, not to spin on patterns without notes)
+		if( (ev.op == MML_EV_END) && (patterns < m_sequenceNum) && this->nextPattern(ch) ){
+			patterns++;
+			ev.op = MML_EV_NOP;
+			continue;
+		}
+		this->execEvent(ch, &ev);
+	}while( !MML_IS_NOTE_EVENT(ev.op) );
+}
+
+/**
+ * compiled event player. (execute one note.)
+ *
+ * @param ch channel
+ */
+void YM2203_MMLplayer::eventPlayer(int ch)
+{
+	const MML_Event *ev;
+	
+	// until one note or rest executed
+	do{
+		ev = m_event[ch];
+		m_event[ch]++;
+		this->execEvent(ch, ev);
+	}while( !MML_IS_NOTE_EVENT(ev->op) );
+}
+
+/**
+ * parse one MML command into an event.
+ *
+ * @param ch channel
+ * @param ev event parsed. (MML_EV_NOP if the command has no event)
+ */
+void YM2203_MMLplayer::parseCommand(int ch, MML_Event *ev)
+{
+	char mml;
+	char nxt;
+	int volume;
+	int gateTime;
+	int timbre_num;
+	int value;
+	int depth, speed, delay, wave;
+	
+	ev->op   = MML_EV_NOP;
+	ev->arg1 = 0;
+	ev->arg2 = 0;
+	ev->arg3 = 0;
+	
+	mml = *m_note[ch];
+	m_note[ch]++;
+	
+	// a-z => A-Z
+	if( mml >= 'a' && mml <= 'z' )
+	{
+		mml -= 0x20;
+	}
+	
+	// MML command
+	switch(mml){
+		// O: set octave (1-8)
+		case 'O':
+			nxt = *m_note[ch];
+			if( (nxt >= '1') && (nxt <= '8') ){
+				m_note[ch]++;
+				m_octave[ch] = (int)(nxt - '0');
+				DEBUG_PRINT("Command O (%d, %d)\n",ch,(int)(nxt - '0'));
+			}else{
+				DEBUG_PRINT("ERROR!:Command O NG (%d, %c)\n",ch, nxt);
+				onError('O');
+			}
+			break;
+		// >: up octave
+		case '>':
+			DEBUG_PRINT("Command > (%d)\n",ch);
+			if(m_octave[ch] < 8) m_octave[ch]++;
+			break;
+		// <: down octave
+		case '<':
+			DEBUG_PRINT("Command < (%d)\n",ch);
+			if(m_octave[ch] > 1) m_octave[ch]--;
+			break;
+		// L: set default note length (1,2,4,8,16)
+		case 'L':
+			nxt = *m_note[ch];
+			if( nxt == '1' ){
+				m_note[ch]++;
+				nxt = *m_note[ch];
+				if( nxt == '6' ){
+					m_note[ch]++;
+					m_length[ch] = 6;	// 16th note
+					DEBUG_PRINT("Command L16 (%d)\n",ch);
+				}else if( nxt == '2' ){
+					m_note[ch]++;
+					m_length[ch] = 8;	// 12th note
+					DEBUG_PRINT("Command L12 (%d)\n",ch);
+				}else{
+					m_length[ch] = 96;	// whole note
+					DEBUG_PRINT("Command L1 (%d)\n",ch);
 				}
-				break;
-			// Q: set gate time (1-8)
-			case 'Q':
+			}else if( nxt == '2' ){
+				m_note[ch]++;
 				nxt = *m_note[ch];
-				if( (nxt >= '1') && (nxt <='8') ){
+				if( nxt == '4' ){
 					m_note[ch]++;
-					gateTime = (int)(nxt - '0');
-					nxt = *m_note[ch];
-					setGateTime(ch, gateTime);
-					DEBUG_PRINT("Command Q (%d,%d)\n",ch,gateTime);
+					m_length[ch] = 4;	// 24th note
+					DEBUG_PRINT("Command L24 (%d)\n",ch);
 				}else{
-					DEBUG_PRINT("ERROR!:Command Q (%d,%c)\n",ch,nxt);
-					onError('Q');
+					m_length[ch] = 48;	// half note
+					DEBUG_PRINT("Command L2 (%d)\n",ch);
 				}
-				break;
-			// end of note string
-			case '\0':
-				DEBUG_PRINT("note %d end\n",ch);
-				m_isEnd[ch] = true;
-				note_on = true; // break this loop
-				break;
-				
-			default:
-				// C,D,E,F,G,A,B and R: play a note
-				if( (mml >= 'A' && mml <= 'G') || (mml == 'R') ){
-					commandCDEFGABR(ch, mml);
-					note_on = true; // break this loop
+			}else if( nxt == '4' ){
+				m_note[ch]++;
+				m_length[ch] = 24;		// quarter note
+				DEBUG_PRINT("Command L4 (%d)\n",ch);
+			}else if( nxt == '8' ){
+				m_note[ch]++;
+				m_length[ch] = 12;		// 8th note
+				DEBUG_PRINT("Command L8 (%d)\n",ch);
+			}else if( nxt == '3' ){
+				m_note[ch]++;
+				nxt = *m_note[ch];
+				if( nxt == '2' ){
+					m_note[ch]++;
+					m_length[ch] = 3;	// 32th note
+					DEBUG_PRINT("Command L32 (%d)\n",ch);
 				}else{
-					DEBUG_PRINT("ERROR!:Command Unknown (%d,%c)\n",ch,mml);
-					onError('U');
+					m_length[ch] = 32;	// 3rd note
+					DEBUG_PRINT("Command L3 (%d)\n",ch);
 				}
-				
-				// ignore any undefined command.
-				;
-		}
+			}else if( nxt == '6' ){
+				m_note[ch]++;
+				m_length[ch] = 16;		// 6th note
+				DEBUG_PRINT("Command L6 (%d)\n",ch);
+			}else{
+				DEBUG_PRINT("ERROR!:Command L (%d,%c)\n",ch,nxt);
+				onError('L');
+			}
+			break;
+		// @: set timbre
+		case '@':
+			if( YM2203_LOCAL_CH(ch) > FM_CH3 ){
+				DEBUG_PRINT("ERROR!:Command @ is unavailable for SSG ch.(%d)\n",ch);
+				break;
+			}
+			nxt = *m_note[ch];
+			if( (nxt >= '0') && (nxt <='9') ){
+				m_note[ch]++;
+				timbre_num = (int)(nxt - '0');
+				nxt = *m_note[ch];
+				if( (nxt >= '0') && (nxt <='9') ){
+					m_note[ch]++;
+					timbre_num = timbre_num * 10 + (int)(nxt - '0');
+				}
+				if( timbre_num < 0 || timbre_num >= TIMBRE_MAX ){
+					DEBUG_PRINT("ERROR!:Command @ unavailable timbre (%d,%d)\n",ch,timbre_num);
+					onError('@');
+					break;
+				}
+				ev->op   = MML_EV_TIMBRE;
+				ev->arg1 = (uint8_t)timbre_num;
+				DEBUG_PRINT("Command @ (%d,%d)\n",ch,timbre_num);
+			}else{
+				DEBUG_PRINT("ERROR!:Command @ (%d,%c)\n",ch,nxt);
+				onError('@');
+			}
+			break;
+		// V: set volume (0-15)
+		case 'V':
+			nxt = *m_note[ch];
+			if( (nxt >= '0') && (nxt <='9') ){
+				m_note[ch]++;
+				volume = (int)(nxt - '0');
+				nxt = *m_note[ch];
+				if( (volume == 1) && (nxt >= '0') && (nxt <='5') ){
+					m_note[ch]++;
+					volume = 10 + (int)(nxt - '0');
+				}
+				ev->op   = MML_EV_VOLUME;
+				ev->arg1 = (uint8_t)volume;
+				DEBUG_PRINT("Command V (%d,%d)\n",ch,volume);
+			}else{
+				DEBUG_PRINT("ERROR!:Command V (%d,%c)\n",ch,nxt);
+				onError('V');
+			}
+			break;
+		// Q: set gate time (1-8)
+		case 'Q':
+			nxt = *m_note[ch];
+			if( (nxt >= '1') && (nxt <='8') ){
+				m_note[ch]++;
+				gateTime = (int)(nxt - '0');
+				nxt = *m_note[ch];
+				setGateTime(ch, gateTime);
+				DEBUG_PRINT("Command Q (%d,%d)\n",ch,gateTime);
+			}else{
+				DEBUG_PRINT("ERROR!:Command Q (%d,%c)\n",ch,nxt);
+				onError('Q');
+			}
+			break;
+		// K: set pitch bend (-1200 to 1200 cents)
+		case 'K':
+			if( parseNumber(ch, &value) && (value >= -MML_BEND_MAX) && (value <= MML_BEND_MAX) ){
+				ev->op   = MML_EV_BEND;
+				ev->arg1 = (uint8_t)((uint16_t)value & 0xFF);
+				ev->arg2 = (uint8_t)((uint16_t)value >> 8);
+				DEBUG_PRINT("Command K (%d,%d)\n",ch,value);
+			}else{
+				DEBUG_PRINT("ERROR!:Command K (%d)\n",ch);
+				onError('K');
+			}
+			break;
+		// P: set portamento glide time (0-255 96th notes, 0: off)
+		case 'P':
+			if( parseNumber(ch, &value) && (value >= 0) && (value <= 255) ){
+				ev->op   = MML_EV_PORTAMENTO;
+				ev->arg1 = (uint8_t)value;
+				DEBUG_PRINT("Command P (%d,%d)\n",ch,value);
+			}else{
+				DEBUG_PRINT("ERROR!:Command P (%d)\n",ch);
+				onError('P');
+			}
+			break;
+		// M: set vibrato (depth 0-127 cents [,speed 0-255 [,delay 0-255 96th notes [,wave 0-1]]])
+		case 'M':
+			speed = delay = wave = 0;
+			if( !parseNumber(ch, &depth) || (depth < 0) || (depth > 127) ){
+				DEBUG_PRINT("ERROR!:Command M (%d)\n",ch);
+				onError('M');
+				break;
+			}
+			if( *m_note[ch] == ',' ){
+				m_note[ch]++;
+				if( !parseNumber(ch, &speed) ) speed = -1;
+			}
+			if( *m_note[ch] == ',' ){
+				m_note[ch]++;
+				if( !parseNumber(ch, &delay) ) delay = -1;
+			}
+			if( *m_note[ch] == ',' ){
+				m_note[ch]++;
+				if( !parseNumber(ch, &wave) ) wave = -1;
+			}
+			if( (speed < 0) || (speed > 255) || (delay < 0) || (delay > 255) ||
+			    ((wave != VIBRATO_TRIANGLE) && (wave != VIBRATO_SINE)) ){
+				DEBUG_PRINT("ERROR!:Command M (%d)\n",ch);
+				onError('M');
+				break;
+			}
+			ev->op   = MML_EV_VIBRATO;
+			ev->arg1 = (uint8_t)(depth | (wave << 7));
+			ev->arg2 = (uint8_t)speed;
+			ev->arg3 = (uint8_t)delay;
+			DEBUG_PRINT("Command M (%d,%d,%d,%d,%d)\n",ch,depth,speed,delay,wave);
+			break;
+		// S: set envelope macro (0: off, 1-: the macro table) (SSG)
+		case 'S':
+			if( YM2203_LOCAL_CH(ch) < SSG_CH_A ){
+				DEBUG_PRINT("ERROR!:Command S is unavailable for FM ch.(%d)\n",ch);
+				break;
+			}
+			if( parseNumber(ch, &value) && (value >= 0) && (value <= m_envTableNum) ){
+				ev->op   = MML_EV_ENVELOPE;
+				ev->arg1 = (uint8_t)value;
+				DEBUG_PRINT("Command S (%d,%d)\n",ch,value);
+			}else{
+				DEBUG_PRINT("ERROR!:Command S (%d)\n",ch);
+				onError('S');
+			}
+			break;
+		// [, ] and :: loop (]n: repeat n times), and leave it at the last repeat
+		case '[':
+		case ']':
+		case ':':
+			commandLoop(ch, mml);
+			break;
+		// end of note string
+		case '\0':
+			DEBUG_PRINT("note %d end\n",ch);
+			m_note[ch]--;	// stay on the terminator
+			ev->op = MML_EV_END;
+			break;
+			
+		default:
+			// C,D,E,F,G,A,B and R: play a note
+			if( (mml >= 'A' && mml <= 'G') || (mml == 'R') ){
+				commandCDEFGABR(ch, mml, ev);
+			}else{
+				DEBUG_PRINT("ERROR!:Command Unknown (%d,%c)\n",ch,mml);
+				onError('U');
+			}
+			
+			// ignore any undefined command.
+			;
 	}
 }
 
@@ -519,8 +1326,9 @@ void YM2203_MMLplayer::MMLparser(int ch)
  *
  * @param ch channel
  * @param key C,D,E,F,G,A,B or R
+ * @param ev note event parsed.
  */
-void YM2203_MMLplayer::commandCDEFGABR(int ch, char key)
+void YM2203_MMLplayer::commandCDEFGABR(int ch, char key, MML_Event *ev)
 {
 	// {C,D,E,F,G,A,B} -> {0,2,4,5,7,9,11} (order in octave)
 	const int TABLE_ABC_TO_12[7]=
@@ -531,7 +1339,7 @@ void YM2203_MMLplayer::commandCDEFGABR(int ch, char key)
 	
 	char nxt;
 	int len;
-	int octave = m_octave[ch];
+	int note = 0;
 	
 	// R is for rest
 	if(key == 'R')
@@ -541,33 +1349,25 @@ void YM2203_MMLplayer::commandCDEFGABR(int ch, char key)
 	// C,D,E,F,G,A,B
 	else
 	{
-		key = TABLE_ABC_TO_12[key - 'A'];
+		note = m_octave[ch] * KEY_NUM + TABLE_ABC_TO_12[key - 'A'];
 		
-		// Command #,+,- : sharp and flat
+		// Command #,+,- : sharp and flat (octave 1-8)
 		nxt = *m_note[ch];
 		if(nxt == '#' || nxt == '+'){
-			key++;
+			note++;
 			m_note[ch]++;
-			if(key==12){
-				key = 0;
-				octave++;
-				if(octave > 8){
-					DEBUG_PRINT("ERROR!:Too much high pitch (%d)\n",ch);
-					onError('#');
-					return;
-				}
+			if(note >= NOTE_NUM){
+				DEBUG_PRINT("ERROR!:Too much high pitch (%d)\n",ch);
+				onError('#');
+				return;
 			}
 		}else if(nxt == '-'){
-			key--;
+			note--;
 			m_note[ch]++;
-			if(key < 0){
-				key = 11;
-				octave--;
-				if(octave < 1){
-					DEBUG_PRINT("ERROR!:Too much low pitch (%d)\n",ch);
-					onError('-');
-					return;
-				}
+			if(note < KEY_NUM){
+				DEBUG_PRINT("ERROR!:Too much low pitch (%d)\n",ch);
+				onError('-');
+				return;
 			}
 		}
 	}
@@ -626,30 +1426,594 @@ void YM2203_MMLplayer::commandCDEFGABR(int ch, char key)
 	
 	// Command & : tie and slur
 	bool tied = m_isTied[ch];
-	int tiedKey = m_tiedKey[ch];
+	int tiedNote = m_tiedNote[ch];
 	nxt = *m_note[ch];
 	if( nxt == '&' ){
 		m_note[ch]++;
 		m_isTied[ch] = true;
-		m_tiedKey[ch] = key;
+		m_tiedNote[ch] = note;
 	}else{
 		m_isTied[ch] = false;
 	}
 	
-	// set step time, gate time and pitch. then key on.
+	// make a note event with resolved pitch, length and gate time.
 	DEBUG_PRINT("Length (%d,%d)\n",ch,len);
-	m_stepCnt[ch] = len * 8;
-	m_gateCnt[ch] = len * m_gateTime[ch];
-	if( key != REST){
-		if( tied && (key == tiedKey)){
-			// if tie, don't not on again.
-		}else{
-			m_ym2203.setPitch(ch, octave, key);
-			m_ym2203.noteOn(ch);
+	ev->op   = (key != REST) ? MML_EV_NOTE : MML_EV_REST;
+	ev->arg1 = (key != REST) ? (uint8_t)note : 0;
+	ev->arg2 = (uint8_t)len;
+	ev->arg3 = (uint8_t)m_gateTime[ch];
+	if( m_isTied[ch] ){
+		ev->op |= MML_EV_TIE;
+	}
+	if( (key != REST) && tied && (note == tiedNote) ){
+		ev->op |= MML_EV_LEGATO;
+	}
+}
+
+/**
+ * go on to the pattern of the next section on a channel.
+ * the parser state (octave, length, tie, ...) is carried over.
+ *
+ * @param ch channel
+ * @return true if the next pattern is set. false at the end of the song.
+ */
+bool YM2203_MMLplayer::nextPattern(int ch)
+{
+	const char* note;
+	
+	if(m_sequence == NULL) return false;
+	
+	m_section[ch]++;
+	if(m_section[ch] >= m_sequenceNum){
+		if(m_sequenceLoop < 0) return false;
+		m_section[ch] = m_sequenceLoop;
+	}
+	note = m_sequence[m_section[ch]].note[ch];
+	if(note == NULL) return false;
+	
+	DEBUG_PRINT("Section %d (%d)\n",m_section[ch],ch);
+	m_note[ch] = note;
+	m_loopDepth[ch] = 0;
+	return true;
+}
+
+/**
+ * MML parser sub routine. (Command [, ] and :)
+ * the loop stack points into the MML string, so the repeats are not
+ * expanded, and each repeat jumps back to the top at the same cost.
+ *
+ * @param ch channel
+ * @param mml [, ] or :
+ */
+void YM2203_MMLplayer::commandLoop(int ch, char mml)
+{
+	MML_Loop *loop;
+	
+	// [: push a loop
+	if( mml == '[' ){
+		if( m_loopDepth[ch] >= MML_LOOP_NEST ){
+			DEBUG_PRINT("ERROR!:Command [ too deep (%d)\n",ch);
+			onError('[');
+			return;
+		}
+		loop = &m_loop[ch][m_loopDepth[ch]];
+		m_loopDepth[ch]++;
+		loop->top   = m_note[ch];
+		loop->end   = NULL;
+		loop->times = 0;
+		loop->count = 0;
+		DEBUG_PRINT("Command [ (%d,%d)\n",ch,m_loopDepth[ch]);
+		return;
+	}
+	if( m_loopDepth[ch] == 0 ){
+		DEBUG_PRINT("ERROR!:Command %c without [ (%d)\n",mml,ch);
+		onError(mml);
+		return;
+	}
+	loop = &m_loop[ch][m_loopDepth[ch] - 1];
+	
+	// the repeat count is parsed at the first ] (or the first :)
+	if( loop->end == NULL ){
+		if( (mml == ']') ? !parseLoopEnd(ch, loop) : !findLoopEnd(ch, loop) ){
+			DEBUG_PRINT("ERROR!:Command %c (%d)\n",mml,ch);
+			onError(mml);
+			return;
+		}
+	}
+	
+	if( mml == ']' ){
+		// ]: back to the top, or pop the loop after the last repeat
+		loop->count++;
+		DEBUG_PRINT("Command ] (%d,%d/%d)\n",ch,loop->count,loop->times);
+		if( loop->count < loop->times ){
+			m_note[ch] = loop->top;
+			return;
 		}
 	}else{
-		DEBUG_PRINT("Rest (%d)\n",ch);
+		// :: leave the loop at the last repeat
+		DEBUG_PRINT("Command : (%d,%d/%d)\n",ch,loop->count + 1,loop->times);
+		if( loop->count + 1 < loop->times ) return;
 	}
+	m_note[ch] = loop->end;
+	m_loopDepth[ch]--;
+}
+
+/**
+ * parse the repeat count of a loop. (next of ']')
+ *
+ * @param ch channel
+ * @param loop loop on the stack (out: end and times)
+ * @return true if the count is valid (1-255, MML_LOOP_TIMES if omitted)
+ */
+bool YM2203_MMLplayer::parseLoopEnd(int ch, MML_Loop *loop)
+{
+	int times;
+	
+	if( !parseNumber(ch, &times) ) times = MML_LOOP_TIMES;
+	if( (times < 1) || (times > 255) ) return false;
+	loop->times = (uint8_t)times;
+	loop->end   = m_note[ch];
+	return true;
+}
+
+/**
+ * find the end of a loop ahead, and parse its repeat count.
+ * (only for : before the first ], once in a loop)
+ *
+ * @param ch channel
+ * @param loop loop on the stack (out: end and times)
+ * @return true if the end is found
+ */
+bool YM2203_MMLplayer::findLoopEnd(int ch, MML_Loop *loop)
+{
+	const char* saved = m_note[ch];
+	const char* p = saved;
+	int nest = 0;
+	bool found;
+	
+	// the matching ] (skip the nested loops)
+	for( ; *p != '\0'; p++){
+		if( *p == '[' ){
+			nest++;
+		}else if( *p == ']' ){
+			if( nest == 0 ) break;
+			nest--;
+		}
+	}
+	if( *p == '\0' ) return false;
+	
+	m_note[ch] = p + 1;
+	found = parseLoopEnd(ch, loop);
+	m_note[ch] = saved;
+	return found;
+}
+
+/**
+ * parse a decimal number of a MML command. (with an optional sign)
+ * the number is saturated at 9999.
+ *
+ * @param ch channel
+ * @param value number parsed (out)
+ * @return true if a number is parsed
+ */
+bool YM2203_MMLplayer::parseNumber(int ch, int *value)
+{
+	const char* p = m_note[ch];
+	bool minus = false;
+	int num = 0;
+	
+	if( (*p == '-') || (*p == '+') ){
+		minus = (*p == '-');
+		p++;
+	}
+	if( (*p < '0') || (*p > '9') ) return false;
+	while( (*p >= '0') && (*p <= '9') ){
+		num = num * 10 + (int)(*p - '0');
+		if(num > 9999) num = 9999;
+		p++;
+	}
+	m_note[ch] = p;
+	*value = minus ? -num : num;
+	return true;
+}
+
+/**
+ * set the pitch of a new note, and start the modulation.
+ * the portamento glides from the pitch of the last note,
+ * and the vibrato starts after the delay.
+ *
+ * @param ch channel
+ * @param note note number
+ */
+void YM2203_MMLplayer::startPitch(int ch, int note)
+{
+	MML_Modulation *mod = &m_mod[ch];
+	
+	// the offset from the new note to where the last note is (the only division per note)
+	if( (mod->portamento > 0) && mod->hasNote ){
+		mod->glide += ((int32_t)mod->note - note) * 100 * 256;
+		mod->glideStep = mod->glide / ((int32_t)mod->portamento * 8);
+		if(mod->glideStep == 0) mod->glideStep = (mod->glide > 0) ? 1 : -1;
+	}else{
+		mod->glide = 0;
+	}
+	mod->note = (uint8_t)note;
+	mod->hasNote = true;
+	mod->vibPhase = 0;
+	mod->vibWait = (int16_t)(mod->vibDelay * 8);
+	
+	// the vibrato starts at the phase 0 (no offset)
+	mod->cents = (int16_t)(mod->bend + (mod->glide >> 8));
+	m_ym2203.setNotePitch(ch, note, mod->cents);
+	
+	if( (mod->glide != 0) || ((mod->vibDepth > 0) && (mod->vibSpeed > 0)) ){
+		m_modActive |= ((uint32_t)1 << ch);
+	}else{
+		m_modActive &= ~((uint32_t)1 << ch);
+	}
+}
+
+/**
+ * advance the pitch modulation of a channel.
+ * the frequency registers are written only if the pitch is changed.
+ *
+ * @param ch channel
+ * @param ticks ticks elapsed (0: apply the pitch bend only)
+ */
+void YM2203_MMLplayer::modulate(int ch, int ticks)
+{
+	MML_Modulation *mod = &m_mod[ch];
+	int32_t cents;
+	
+	if(!mod->hasNote) return;
+	
+	// portamento: the offset goes to 0 (stops at 0)
+	if(mod->glide != 0){
+		mod->glide -= mod->glideStep * ticks;
+		if( (mod->glide ^ mod->glideStep) < 0 ) mod->glide = 0;
+	}
+	cents = mod->bend + (mod->glide >> 8);
+	
+	// vibrato: after the delay
+	if(mod->vibWait > 0){
+		mod->vibWait -= (int16_t)ticks;
+	}else{
+		mod->vibPhase += (uint16_t)(mod->vibSpeed * 16 * ticks);
+	}
+	if( (mod->vibWait <= 0) && (mod->vibDepth > 0) ){
+		cents += (mod->vibDepth * vibratoWave(mod->vibWave, mod->vibPhase)) >> 7;
+	}
+	
+	if(cents != mod->cents){
+		mod->cents = (int16_t)cents;
+		m_ym2203.setNotePitch(ch, mod->note, cents);
+	}
+	
+	// nothing moves any more
+	if( (mod->glide == 0) && ((mod->vibDepth == 0) || (mod->vibSpeed == 0)) ){
+		m_modActive &= ~((uint32_t)1 << ch);
+	}
+}
+
+/**
+ * set volume to a channel, through the envelope.
+ * with the envelope macro, the level of the current step is attenuated.
+ *
+ * @param ch channel
+ * @param volume 0(min)-15(max).
+ */
+void YM2203_MMLplayer::changeVolume(int ch, int volume)
+{
+	m_env[ch].volume = (uint8_t)volume;
+	if(m_env[ch].macro != NULL){
+		this->writeEnvelope(ch);
+	}else{
+		m_ym2203.setVolume(ch, volume);
+	}
+}
+
+/**
+ * select the envelope macro of a channel. (from the next note)
+ *
+ * @param ch channel
+ * @param macro envelope macro (NULL: off)
+ */
+void YM2203_MMLplayer::selectEnvelope(int ch, const MML_EnvelopeMacro *macro)
+{
+	MML_Envelope *env = &m_env[ch];
+	
+	env->macro = macro;
+	env->level = 0xFF;
+	env->released = true;
+	m_envActive &= ~((uint32_t)1 << ch);
+	if(macro == NULL){
+		// back to the static volume
+		m_ym2203.setVolume(ch, env->volume);
+	}
+}
+
+/**
+ * start the envelope macro of a channel at note-on.
+ *
+ * @param ch channel
+ */
+void YM2203_MMLplayer::startEnvelope(int ch)
+{
+	MML_Envelope *env = &m_env[ch];
+	
+	if(env->macro == NULL) return;
+	env->step = 0;
+	env->wait = env->macro->speed;
+	env->released = false;
+	this->writeEnvelope(ch);
+	m_envActive |= ((uint32_t)1 << ch);
+}
+
+/**
+ * start the release part of the envelope macro at note-off.
+ *
+ * @param ch channel
+ * @return true if the release part is started. (note off at its end)
+ *         false if no release part. (note off now)
+ *         true also if already released, as the note is off at its end.
+ */
+bool YM2203_MMLplayer::releaseEnvelope(int ch)
+{
+	MML_Envelope *env = &m_env[ch];
+	
+	if( (env->macro == NULL) || (env->macro->release >= env->macro->length) ) return false;
+	if(env->released) return true;	// the last note is already released
+	env->step = env->macro->release;
+	env->wait = env->macro->speed;
+	env->released = true;
+	this->writeEnvelope(ch);
+	m_envActive |= ((uint32_t)1 << ch);
+	return true;
+}
+
+/**
+ * advance the envelope macro of a channel.
+ * the interrupt comes at each step, so one step is taken at most.
+ *
+ * @param ch channel
+ * @param ticks ticks elapsed
+ */
+void YM2203_MMLplayer::stepEnvelope(int ch, int ticks)
+{
+	MML_Envelope *env = &m_env[ch];
+	const MML_EnvelopeMacro *macro = env->macro;
+	
+	env->wait -= (int16_t)ticks;
+	if(env->wait > 0) return;
+	env->wait = macro->speed;
+	env->step++;
+	
+	if(!env->released){
+		// the end of the key-on part: loop, or hold the last step
+		if(env->step >= macro->release){
+			if(macro->loop != ENV_MACRO_HOLD){
+				env->step = macro->loop;
+			}else{
+				env->step = macro->release - 1;
+				m_envActive &= ~((uint32_t)1 << ch);
+				return;
+			}
+		}
+	}else if(env->step >= macro->length){
+		// the end of the release part
+		env->step = macro->length - 1;
+		m_envActive &= ~((uint32_t)1 << ch);
+		m_ym2203.noteOff(ch);
+		return;
+	}
+	this->writeEnvelope(ch);
+}
+
+/**
+ * write the level of the envelope step to a channel.
+ * the level register is written only if the level is changed.
+ *
+ * @param ch channel
+ */
+void YM2203_MMLplayer::writeEnvelope(int ch)
+{
+	MML_Envelope *env = &m_env[ch];
+	int level = env->macro->level[env->step] + env->volume - 15;
+	
+	if(level < 0) level = 0;
+	if(level != env->level){
+		env->level = (uint8_t)level;
+		m_ym2203.setVolume(ch, level);
+	}
+}
+
+/**
+ * empty the cache of the bank voices.
+ */
+void YM2203_MMLplayer::clearTimbreCache(void)
+{
+	int i;
+	
+	for(i=0; i<TIMBRE_CACHE_NUM; i++){
+		m_cacheNum[i] = -1;
+		m_cacheOrder[i] = (uint8_t)i;
+	}
+	for(i=0; i<MML_CH_NUM; i++){
+		m_cacheEntry[i] = -1;
+	}
+}
+
+/**
+ * load a timbre from the bank into the cache, if not yet.
+ * (an empty voice of the bank is a silent timbre)
+ * a miss replaces the least recently used entry which is not set to a channel.
+ *
+ * @param num timbre number (0 - TIMBRE_MAX-1)
+ * @return cache entry of the timbre
+ */
+int YM2203_MMLplayer::loadTimbre(int num)
+{
+	int pos, ch;
+	uint8_t entry;
+	
+	// hit
+	for(pos=0; pos<TIMBRE_CACHE_NUM; pos++){
+		if(m_cacheNum[m_cacheOrder[pos]] == num) break;
+	}
+	// miss: from the least recently used, skip the entries in use
+	if(pos == TIMBRE_CACHE_NUM){
+		for(pos=TIMBRE_CACHE_NUM-1; pos>0; pos--){
+			for(ch=0; ch<MML_CH_NUM; ch++){
+				if(m_cacheEntry[ch] == m_cacheOrder[pos]) break;
+			}
+			if(ch == MML_CH_NUM) break;
+		}
+		entry = m_cacheOrder[pos];
+		m_bank.load(num, &m_timbreCache[entry]);
+		m_cacheNum[entry] = (int8_t)num;
+	}
+	// move to the most recently used
+	entry = m_cacheOrder[pos];
+	for(; pos>0; pos--){
+		m_cacheOrder[pos] = m_cacheOrder[pos - 1];
+	}
+	m_cacheOrder[0] = entry;
+	return entry;
+}
+
+/**
+ * get a timbre from ROM or the cache.
+ * without the bank, the preset timbre in ROM is used as it is.
+ *
+ * @param num timbre number (0 - TIMBRE_MAX-1)
+ * @return timbre
+ */
+const YM2203_Timbre* YM2203_MMLplayer::findTimbre(int num)
+{
+	if(!m_bank.isOpen()) return &PRESET_TIMBRE[num];
+	return &m_timbreCache[this->loadTimbre(num)];
+}
+
+/**
+ * execute an event.
+ *
+ * @param ch channel
+ * @param ev event to execute.
+ */
+void YM2203_MMLplayer::execEvent(int ch, const MML_Event *ev)
+{
+	int entry;
+	
+	PROFILE_COMMAND();
+	
+	switch(ev->op & MML_EV_OP_MASK){
+		// set timbre
+		case MML_EV_TIMBRE:
+			if(m_bank.isOpen()){
+				entry = this->loadTimbre(ev->arg1);
+				// keep the entry while set to the FM channel
+				if((ch % ALL_CH_NUM) < FM_CH_NUM) m_cacheEntry[ch] = (int8_t)entry;
+				m_ym2203.setTimbre(ch, &m_timbreCache[entry]);
+			}else{
+				m_ym2203.setTimbre(ch, &PRESET_TIMBRE[ev->arg1]);
+			}
+			break;
+		// set volume
+		case MML_EV_VOLUME:
+			this->changeVolume(ch, ev->arg1);
+			break;
+		// set envelope macro (from the next note)
+		case MML_EV_ENVELOPE:
+			this->selectEnvelope(ch, ((ev->arg1 > 0) && (ev->arg1 <= m_envTableNum)) ? &m_envTable[ev->arg1 - 1] : NULL);
+			break;
+		// set pitch bend (bend the sounding note at once)
+		case MML_EV_BEND:
+			m_mod[ch].bend = (int16_t)(ev->arg1 | ((uint16_t)ev->arg2 << 8));
+			this->modulate(ch, 0);
+			break;
+		// set portamento
+		case MML_EV_PORTAMENTO:
+			m_mod[ch].portamento = ev->arg1;
+			break;
+		// set vibrato (from the next note)
+		case MML_EV_VIBRATO:
+			m_mod[ch].vibDepth = ev->arg1 & 0x7F;
+			m_mod[ch].vibWave  = ev->arg1 >> 7;
+			m_mod[ch].vibSpeed = ev->arg2;
+			m_mod[ch].vibDelay = ev->arg3;
+			break;
+		// end of note
+		case MML_EV_END:
+			m_isEnd[ch] = true;
+			m_modActive &= ~((uint32_t)1 << ch);
+			break;
+		// set step time, gate time and pitch. then key on.
+		case MML_EV_NOTE:
+		case MML_EV_REST:
+			m_isTied [ch] = ((ev->op & MML_EV_TIE) != 0);
+			m_stepCnt[ch] = ev->arg2 * 8;
+			m_gateCnt[ch] = ev->arg2 * ev->arg3;
+			if( (ev->op & MML_EV_OP_MASK) == MML_EV_NOTE ){
+				if( ev->op & MML_EV_LEGATO ){
+					// if tie, don't not on again.
+				}else{
+					this->startPitch(ch, ev->arg1);
+					this->startEnvelope(ch);
+					m_ym2203.noteOn(ch);
+				}
+			}else{
+				DEBUG_PRINT("Rest (%d)\n",ch);
+				m_modActive &= ~((uint32_t)1 << ch);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * compile a MML string into events.
+ * the parser state (octave, length and gate time) of the channel is
+ * carried over as if the string were played, so compile sections in order.
+ * the loops [ ] are expanded into the events.
+ * don't call this while playing.
+ *
+ * @param ch channel. 0-2:FM, 3-5:SSG. or FM_CH1,FM_CH2,FM_CH3,SSG_CH_A,SSG_CH_B,SSG_CH_C
+ * @param note pointer to a MML string
+ * @param events buffer for compiled events
+ * @param size number of events the buffer can hold
+ * @return number of events (including MML_EV_END), or -1 if the buffer is too small.
+ */
+int YM2203_MMLplayer::compile(int ch, const char* note, MML_Event *events, int size)
+{
+	MML_Event ev;
+	const char* saved;
+	int num = 0;
+	
+	// parameter check
+	if(ch<0 || ch>=MML_CH_NUM) return -1;
+	if(m_isPlaying) return -1;
+	
+	saved = m_note[ch];
+	m_note[ch] = note;
+	m_isTied[ch] = false;
+	m_loopDepth[ch] = 0;	// the loops are expanded into the events
+	
+	do{
+		this->parseCommand(ch, &ev);
+		if(ev.op == MML_EV_NOP) continue;
+		if(num >= size){
+			num = -1;
+			break;
+		}
+		events[num] = ev;
+		num++;
+	}while(ev.op != MML_EV_END);
+	
+	m_note[ch] = saved;
+	m_loopDepth[ch] = 0;
+	
+	return num;
 }
 
 /**
@@ -664,179 +2028,23 @@ bool YM2203_MMLplayer::isPlaying(void)
 
 
 /**
- * set preset timbres to the table.
- */
-void YM2203_MMLplayer::setPresetTimbre(void)
-{
-	// TODO timbre data set
-	
-	// ?
-	m_timbre[0].algorithm = 2;
-	m_timbre[0].feedback  = 12;
-	m_timbre[0].opMask    = MASK_ALL;
-	m_timbre[0].setAR(31, 31, 31, 31);
-	m_timbre[0].setDR(24, 15, 24, 19);
-	m_timbre[0].setSR( 0, 17,  0, 17);
-	m_timbre[0].setRR( 8, 12,  8, 12);
-	m_timbre[0].setSL(11,  2, 11,  2);
-	m_timbre[0].setTL(12, 17, 19,  0);
-	m_timbre[0].setKS( 0,  0,  0,  0);
-	m_timbre[0].setML( 0,  0,  0,  0);
-	m_timbre[0].setDT( 0,  0,  0,  0);
-	
-	// Piano
-	m_timbre[13].algorithm = 4;
-	m_timbre[13].feedback  = 5;
-	m_timbre[13].opMask    = MASK_ALL;
-	m_timbre[13].setAR(31, 20, 31, 31);
-	m_timbre[13].setDR( 5, 10,  3, 12);
-	m_timbre[13].setSR( 0,  3,  0,  3);
-	m_timbre[13].setRR( 0,  7,  0,  7);
-	m_timbre[13].setSL( 0,  8,  0, 10);
-	m_timbre[13].setTL(23,  0, 25,  2);
-	m_timbre[13].setKS( 1,  1,  1,  1);
-	m_timbre[13].setML( 1,  1,  1,  1);
-	m_timbre[13].setDT( 3,  3,  7,  7);
-	
-	// Trumpet
-	m_timbre[23].algorithm = 2;
-	m_timbre[23].feedback  = 7;
-	m_timbre[23].opMask    = MASK_ALL;
-	m_timbre[23].setAR(13, 15, 21, 18);
-	m_timbre[23].setDR( 6,  8,  7,  4);
-	m_timbre[23].setSR( 0,  0,  0,  0);
-	m_timbre[23].setRR( 8,  8,  8,  8);
-	m_timbre[23].setSL( 1,  1,  2,  2);
-	m_timbre[23].setTL(25, 32, 42,  0);
-	m_timbre[23].setKS( 2,  1,  0,  1);
-	m_timbre[23].setML( 2,  6,  2,  2);
-	m_timbre[23].setDT( 3,  7,  3,  0);
-	
-	// Strings1
-	m_timbre[24].algorithm = 2;
-	m_timbre[24].feedback  = 7;
-	m_timbre[24].opMask    = MASK_ALL;
-	m_timbre[24].setAR(25, 25, 28, 14);
-	m_timbre[24].setDR(10, 11, 13,  4);
-	m_timbre[24].setSR( 0,  0,  0,  0);
-	m_timbre[24].setRR( 5,  8,  6,  6);
-	m_timbre[24].setSL( 1,  5,  2,  0);
-	m_timbre[24].setTL(29, 15, 45,  0);
-	m_timbre[24].setKS( 1,  1,  1,  1);
-	m_timbre[24].setML( 1,  5,  1,  1);
-	m_timbre[24].setDT( 1,  1,  0,  0);
-	
-	// Strings2
-	m_timbre[25].algorithm = 2;
-	m_timbre[25].feedback  = 0;
-	m_timbre[25].opMask    = MASK_ALL;
-	m_timbre[25].setAR(21, 20, 16, 14);
-	m_timbre[25].setDR( 7, 11,  8,  5);
-	m_timbre[25].setSR( 0,  0,  0,  0);
-	m_timbre[25].setRR( 7, 12, 12, 12);
-	m_timbre[25].setSL( 3,  3,  3,  1);
-	m_timbre[25].setTL(37, 15, 45,  0);
-	m_timbre[25].setKS( 1,  1,  1,  1);
-	m_timbre[25].setML( 1,  5,  1,  1);
-	m_timbre[25].setDT( 3,  7,  0,  0);
-	
-	// E.Piano
-	m_timbre[27].algorithm = 4;
-	m_timbre[27].feedback  = 6;
-	m_timbre[27].opMask    = MASK_ALL;
-	m_timbre[27].setAR(22, 16, 20, 17);
-	m_timbre[27].setDR( 5,  8,  5,  8);
-	m_timbre[27].setSR( 0,  8,  0,  7);
-	m_timbre[27].setRR( 3,  7,  3,  7);
-	m_timbre[27].setSL( 5,  2,  5,  2);
-	m_timbre[27].setTL(30,  0, 34,  0);
-	m_timbre[27].setKS( 0,  1,  0,  1);
-	m_timbre[27].setML( 2,  2,  4,  2);
-	m_timbre[27].setDT( 3,  3,  7,  7);
-	
-	// E.BASS1
-	m_timbre[30].algorithm = 2;
-	m_timbre[30].feedback  = 5;
-	m_timbre[30].opMask    = MASK_ALL;
-	m_timbre[30].setAR(31, 31, 31, 31);
-	m_timbre[30].setDR( 8, 14, 16, 12);
-	m_timbre[30].setSR( 0,  6,  3,  5);
-	m_timbre[30].setRR( 0,  9,  0,  8);
-	m_timbre[30].setSL( 3,  2,  2,  2);
-	m_timbre[30].setTL(34, 42, 20,  0);
-	m_timbre[30].setKS( 0,  0,  0,  0);
-	m_timbre[30].setML( 0,  8,  0,  1);
-	m_timbre[30].setDT( 3,  0,  7,  0);
-	
-	// E.BASS2
-	m_timbre[31].algorithm = 0;
-	m_timbre[31].feedback  = 7;
-	m_timbre[31].opMask    = MASK_ALL;
-	m_timbre[31].setAR(31, 28, 31, 28);
-	m_timbre[31].setDR( 8, 18,  7,  9);
-	m_timbre[31].setSR( 0,  5,  7,  6);
-	m_timbre[31].setRR( 6,  6,  6,  6);
-	m_timbre[31].setSL(10, 13,  8,  1);
-	m_timbre[31].setTL(38, 47, 23,  0);
-	m_timbre[31].setKS( 1,  1,  2,  2);
-	m_timbre[31].setML( 1, 10,  0,  0);
-	m_timbre[31].setDT( 3,  7,  2,  0);
-	
-	// Clarinet
-	m_timbre[39].algorithm = 3;
-	m_timbre[39].feedback  = 7;
-	m_timbre[39].opMask    = MASK_ALL;
-	m_timbre[39].setAR(31, 20, 20, 20);
-	m_timbre[39].setDR( 7, 10, 10, 15);
-	m_timbre[39].setSR( 0,  0,  0,  0);
-	m_timbre[39].setRR( 5, 11,  6,  7);
-	m_timbre[39].setSL( 0,  5, 10,  0);
-	m_timbre[39].setTL(40, 50, 40,  0);
-	m_timbre[39].setKS( 1,  1,  1,  1);
-	m_timbre[39].setML( 2,  3,  4,  1);
-	m_timbre[39].setDT( 0,  0,  0,  0);
-	
-	// Zitar
-	m_timbre[44].algorithm = 0;
-	m_timbre[44].feedback  = 6;
-	m_timbre[44].opMask    = MASK_ALL;
-	m_timbre[44].setAR(18, 31, 31, 31);
-	m_timbre[44].setDR( 5,  5,  5, 10);
-	m_timbre[44].setSR( 3,  4,  3,  2);
-	m_timbre[44].setRR( 1,  1,  3,  5);
-	m_timbre[44].setSL( 2,  1,  2,  4);
-	m_timbre[44].setTL(30, 28, 35,  0);
-	m_timbre[44].setKS( 1,  1,  1,  0);
-	m_timbre[44].setML( 3,  2,  1,  1);
-	m_timbre[44].setDT( 7,  0,  0,  3);
-	
-	// Clav
-	m_timbre[45].algorithm = 2;
-	m_timbre[45].feedback  = 6;
-	m_timbre[45].opMask    = MASK_ALL;
-	m_timbre[45].setAR(31, 31, 31, 31);
-	m_timbre[45].setDR(15,  6,  6,  6);
-	m_timbre[45].setSR( 8,  2,  2,  6);
-	m_timbre[45].setRR( 6,  6,  6,  7);
-	m_timbre[45].setSL( 2,  2,  1,  4);
-	m_timbre[45].setTL(35, 32, 32,  0);
-	m_timbre[45].setKS( 0,  0,  0,  0);
-	m_timbre[45].setML(12,  3,  1,  2);
-	m_timbre[45].setDT( 3,  0,  7,  0);
-	
-	// Harpsic
-	m_timbre[46].algorithm = 2;
-	m_timbre[46].feedback  = 5;
-	m_timbre[46].opMask    = MASK_ALL;
-	m_timbre[46].setAR(31, 31, 31, 31);
-	m_timbre[46].setDR(13, 11,  2,  6);
-	m_timbre[46].setSR( 0,  2,  0,  6);
-	m_timbre[46].setRR(15,  0,  0,  7);
-	m_timbre[46].setSL(10,  3,  1,  1);
-	m_timbre[46].setTL(30, 32, 30,  0);
-	m_timbre[46].setKS( 1,  1,  0,  1);
-	m_timbre[46].setML( 0,  7,  0,  4);
-	m_timbre[46].setDT( 3,  3,  7,  7);
+ * take over the TMR0 interrupt. (e.g. by the VGM player)
+ * the handler is called instead of MMLplayer.onTimer().
+ *
+ * @param func procedure of the interrupt. NULL to give it back to MMLplayer.
+ * @param context argument for the procedure
+ */
+void YM2203_setTimerHandler(YM2203_TimerHandler func, void* context)
+{
+#ifndef PC_DEBUG
+	uint8_t ien = IEN(TMR0, CMIA0);
+	IEN(TMR0, CMIA0) = 0;			// disable compare match A interrupt
+#endif
+	s_timerHandler = func;
+	s_timerContext = context;
+#ifndef PC_DEBUG
+	IEN(TMR0, CMIA0) = ien;			// restore compare match A interrupt
+#endif
 }
 
 #ifndef PC_DEBUG
@@ -860,7 +2068,11 @@ extern "C" void Excep_TMR0_CMIA0(void)
 	
 	i = 100;
     // interval procedure for playing music
-    MMLplayer.onTimer();
+    if(s_timerHandler != NULL){
+        s_timerHandler(s_timerContext);
+    }else{
+        MMLplayer.onTimer();
+    }
     
 	tgl = 1- tgl;
 	digitalWrite(0, tgl);
@@ -18,12 +18,172 @@
  * limitations under the License.
  */
 
-#include "YM2203.h"
+#include "YM2203_Chips.h"
+#include "YM2203_TimbreBank.h"
 
 #define TIMBRE_MAX	64		//!< tibmre table size
+#define TIMBRE_CACHE_NUM	(FM_CH_NUM * YM2203_CHIP_NUM + 1)	//!< voices of the timbre bank kept in RAM (more than the FM channels)
+#define MML_CH_NUM	(ALL_CH_NUM * YM2203_CHIP_NUM)	//!< channels of the player (6 channels of each YM2203)
+#define MML_LOOP_NEST	4	//!< maximum nesting of the loops [ ]
+#define MML_LOOP_TIMES	2	//!< repeat count of a loop without the number
+
+// MML event operation codes (MML_Event#op)
+#define MML_EV_NOP		0x00	//!< no operation (never stored)
+#define MML_EV_END		0x01	//!< end of note string
+#define MML_EV_NOTE		0x02	//!< note (arg1:note number = octave*12+key, arg2:length, arg3:gate time rate)
+#define MML_EV_REST		0x03	//!< rest (arg2:length, arg3:gate time rate)
+#define MML_EV_TIMBRE	0x04	//!< set timbre (arg1:timbre number)
+#define MML_EV_VOLUME	0x05	//!< set volume (arg1:volume)
+#define MML_EV_BEND		0x06	//!< set pitch bend (arg1,arg2:cents, 16bit signed little endian)
+#define MML_EV_PORTAMENTO	0x07	//!< set portamento (arg1:glide time)
+#define MML_EV_VIBRATO	0x08	//!< set vibrato (arg1:depth|wave<<7, arg2:speed, arg3:delay)
+#define MML_EV_ENVELOPE	0x09	//!< set envelope macro (arg1:macro number, 0:off)
+#define MML_EV_OP_MASK	0x3F	//!< mask of operation code
+
+// MML event flags (MML_Event#op)
+#define MML_EV_LEGATO	0x40	//!< tied from the previous note (don't note on again)
+#define MML_EV_TIE		0x80	//!< tie or slur to the next note (don't note off)
+
+//! whether the event takes step time (note, rest or end)
+#define MML_IS_NOTE_EVENT(op)	(((op) & MML_EV_OP_MASK) == MML_EV_NOTE || \
+								 ((op) & MML_EV_OP_MASK) == MML_EV_REST || \
+								 ((op) & MML_EV_OP_MASK) == MML_EV_END)
+
+// Pitch modulation (see YM2203_MMLplayer::setVibrato)
+#define MML_BEND_MAX		1200	//!< limit of the pitch bend [cent]
+#define MML_MOD_TICKS		2		//!< interval of the pitch modulation [tick]
+#define VIBRATO_TRIANGLE	0		//!< triangle wave vibrato
+#define VIBRATO_SINE		1		//!< sine wave vibrato
+
+// Software envelope of SSG channels (see MML_EnvelopeMacro)
+#define ENV_MACRO_HOLD		0xFF	//!< MML_EnvelopeMacro#loop: hold the last step of the key-on part
+
+//! procedure of the TMR0 interrupt. (see YM2203_setTimerHandler)
+typedef void (*YM2203_TimerHandler)(void* context);
+void YM2203_setTimerHandler(YM2203_TimerHandler func, void* context);	//!< take over the TMR0 interrupt.
+
+// just for algorithm debug on PC
+#ifdef PC_DEBUG
+//! host timer callback. (interval: elapsed time [ns])
+typedef void (*YM2203_HostTimer)(void* context, uint32_t interval);
+#endif
+
+// ISR profiling (define MML_PROFILE to enable. compiled out if not defined)
+#ifdef MML_PROFILE
+#define MML_PROFILE_BINS	16		//!< histogram bins (bin n: 2^n <= count < 2^(n+1))
+#ifdef PC_DEBUG
+#define MML_PROFILE_CLOCK	1000000000UL	//!< profile clock [Hz] (host monotonic clock)
+#else
+#define MML_PROFILE_CLOCK	750000UL		//!< profile clock [Hz] (TMR0,1 counter, PCLK/64)
+#endif
+
+/**
+ * statistics of the timer procedure (onTimer). times are in MML_PROFILE_CLOCK counts.
+ */
+struct MML_Profile
+{
+	uint32_t calls;			//!< number of calls
+	uint32_t minTime;		//!< minimum time of a call
+	uint32_t maxTime;		//!< maximum time of a call
+	uint64_t totalTime;		//!< total time of all calls (average = totalTime / calls)
+	uint32_t histogram[MML_PROFILE_BINS];	//!< number of calls by time
+	uint32_t maxWrites;		//!< maximum register writes issued in a call
+	uint32_t totalWrites;	//!< total register writes issued
+	uint32_t maxCommands;	//!< maximum MML commands executed in a call
+	uint32_t totalCommands;	//!< total MML commands executed
+	uint32_t overruns;		//!< number of calls longer than the timer interval
+};
+#endif
+
+/**
+ * compiled MML event. (fixed size, can be stored as const data)
+ * length is in 96th notes, so step time is length*8 ticks
+ * and gate time is length*(gate time rate) ticks.
+ */
+struct MML_Event
+{
+	uint8_t op;		//!< operation code and flags
+	uint8_t arg1;	//!< argument 1
+	uint8_t arg2;	//!< argument 2
+	uint8_t arg3;	//!< argument 3
+};
+
+/**
+ * pitch modulation of a channel. (pitch bend, portamento and vibrato)
+ * advanced by the ticks elapsed in fixed point, so no division in the interrupt.
+ */
+struct MML_Modulation
+{
+	int16_t bend;			//!< pitch bend [cent]
+	uint8_t portamento;		//!< portamento glide time [96th note] (0: off)
+	uint8_t vibDepth;		//!< vibrato depth [cent]
+	uint8_t vibSpeed;		//!< vibrato speed [1/4096 cycle per tick]
+	uint8_t vibDelay;		//!< vibrato delay from note-on [96th note]
+	uint8_t vibWave;		//!< vibrato wave (VIBRATO_TRIANGLE, VIBRATO_SINE)
+	uint8_t note;			//!< note number of the current note
+	bool hasNote;			//!< whether the note is valid (the start of the next portamento)
+	int16_t cents;			//!< detune from the note written last [cent]
+	int16_t vibWait;		//!< ticks until the vibrato starts
+	uint16_t vibPhase;		//!< vibrato phase [1/65536 cycle]
+	int32_t glide;			//!< portamento offset from the note [1/256 cent] (goes to 0)
+	int32_t glideStep;		//!< portamento step [1/256 cent per tick]
+};
+
+/**
+ * loop [ ] of a channel, on the loop stack.
+ * it points into the MML string, so nothing is copied.
+ */
+struct MML_Loop
+{
+	const char* top;		//!< next of '['
+	const char* end;		//!< next of ']n' (NULL: not reached yet)
+	uint8_t times;			//!< repeat count (valid if end is not NULL)
+	uint8_t count;			//!< repeats done
+};
+
+/**
+ * section of a song for the sequencer. (can be stored as const data)
+ * a section is a pattern (MML string) of each channel.
+ * the patterns of a section should be of the same length.
+ */
+struct MML_Section
+{
+	const char* note[MML_CH_NUM];	//!< pattern of each channel (NULL: the channel is over)
+};
+
+/**
+ * software envelope macro of a SSG channel. (can be stored as const data)
+ * the steps before the release are played from note-on, and loop or hold
+ * the last one. the steps from the release are played from note-off,
+ * then the channel is keyed off.
+ */
+struct MML_EnvelopeMacro
+{
+	const uint8_t *level;	//!< level of each step (0-15, attenuated by 15 - volume)
+	uint8_t length;			//!< number of steps (1-255)
+	uint8_t loop;			//!< step to go back to at the release (ENV_MACRO_HOLD: hold the last step)
+	uint8_t release;		//!< first step of the release part (1 - length. length: no release part)
+	uint8_t speed;			//!< ticks of a step (1-255)
+};
 
 /**
- * YM2203 class
+ * software envelope state of a channel.
+ */
+struct MML_Envelope
+{
+	const MML_EnvelopeMacro *macro;	//!< envelope macro (NULL: off, the volume is static)
+	uint8_t step;			//!< current step
+	uint8_t volume;			//!< volume of the channel (0-15)
+	uint8_t level;			//!< level written last (0xFF: not written)
+	bool released;			//!< in the release part (or no note to release)
+	int16_t wait;			//!< ticks until the next step
+};
+
+/**
+ * YM2203 MML player class
+ * (on GR-SAKURA, the global object MMLplayer is driven by the TMR0 interrupt.
+ *  on PC, any number of players can be made, each with its own simulated bus.)
+ * with YM2203_CHIP_NUM devices, channel n is the channel (n % 6) of the device (n / 6).
  */
 class YM2203_MMLplayer
 {
@@ -36,34 +196,113 @@ public:
 	void setVolume(int ch, int volume);				//!< set volume to a channel.
 	void setEnvelope(int ch, int type, int interval);//!< set envelope to a channel. (SSG)
 	void setToneNoise(int ch, int mode);			//!< set tone/noise mode to a chennel. (SSG)
-	void setTimbre(int ch, YM2203_Timbre *timbre);	//!< set timbre to a channel. (FM)
+	void setTimbre(int ch, const YM2203_Timbre *timbre);	//!< set timbre to a channel. (FM)
 	void setGateTime(int ch, int gateTime);			//!< set gate time rate.
+	void setPitchBend(int ch, int cents);			//!< set pitch bend to a channel.
+	void setPortamento(int ch, int length);			//!< set portamento glide time to a channel.
+	void setVibrato(int ch, int depth, int speed, int delay, int wave);	//!< set vibrato to a channel.
+	void setEnvelopeMacro(int ch, const MML_EnvelopeMacro *macro);	//!< set a software envelope macro to a channel. (SSG)
+	void setEnvelopeMacroTable(const MML_EnvelopeMacro *table, int num);	//!< set the envelope macros of the S command.
 	void setNote(int ch, const char* note);				//!< set note to a channel.
+	int  compile(int ch, const char* note, MML_Event *events, int size);	//!< compile a MML string into events.
+	void setEvents(int ch, const MML_Event* events);	//!< set compiled events to a channel.
+	void setSequence(const MML_Section *sections, int num, int loop = -1);	//!< set the sections of a song to play in order.
 	void play(void);		//!< start to play note.
 	void playAndWait(void);	//!< start to play note, and wait for end of note.
 	void stop(void);		//!< stop playing note, and clear note.
 	bool isPlaying(void);	//!< whether playing now or not.
 	void onTimer(void);		//!< interval procedure for playing music.
+	uint32_t getTimerInterval(void);	//!< get the interval of the timer interrupt. [ns]
+	void setRecordBuffer(YM2203_RecordEntry *entries, uint32_t size);	//!< start or stop recording the register writes.
+	int  readRecord(YM2203_RecordEntry *entries, int max);	//!< take out the recorded register writes.
+	uint32_t getRecordTime(void);		//!< get the time of the record.
+	uint32_t getRecordDropped(void);	//!< number of register writes lost by the full ring buffer.
+	YM2203* getDevice(int chip = 0);	//!< get a YM2203 device. (to share it with another player)
+	bool setTimbreBank(const uint8_t *data, uint32_t size);	//!< set the timbre bank of the timbre table.
+	const YM2203_Timbre* getTimbre(int num);	//!< get a timbre of the timbre table.
+	const YM2203_Timbre* getPresetTable(void);	//!< get the table of the preset timbres.
+#ifdef MML_PROFILE
+	void getProfile(MML_Profile *profile);	//!< get the statistics of the timer procedure.
+	void clearProfile(void);				//!< clear the statistics of the timer procedure.
+#endif
+#ifdef PC_DEBUG
+	void setHostTimer(YM2203_HostTimer func, void* context);	//!< set the host timer callback.
+	void setSimBus(YM2203_SimBus *bus, int chip = 0);	//!< set the simulated bus of a YM2203 device.
+#endif
 	
 private:
-	YM2203 m_ym2203;				//!< YM2203 device.
-	const char* m_noteTop [ALL_CH_NUM];	//!< pointer to top of notes for each channel.
-	const char* m_note    [ALL_CH_NUM];	//!< pointer to playing note for each channel.
-	int   m_stepCnt [ALL_CH_NUM];	//!< step time counter for each channel.
-	int   m_gateCnt [ALL_CH_NUM];	//!< gate time counter for each channel.
-	int   m_octave  [ALL_CH_NUM];	//!< current octave of each channel.
-	int   m_length  [ALL_CH_NUM];	//!< default note length of each channel.
-	int   m_gateTime[ALL_CH_NUM];	//!< date time rate of each channel.
-	bool  m_isEnd   [ALL_CH_NUM];	//!< whether each channel part is over or not.
-	bool  m_isTied	[ALL_CH_NUM];	//!< tie or slur flag.
-	int   m_tiedKey	[ALL_CH_NUM];	//!< tie or slur key.
+	YM2203_ChipSet m_ym2203;		//!< YM2203 devices.
+	const char* m_noteTop [MML_CH_NUM];	//!< pointer to top of notes for each channel.
+	const char* m_note    [MML_CH_NUM];	//!< pointer to playing note for each channel.
+	const MML_Event* m_eventTop[MML_CH_NUM];	//!< pointer to top of compiled events for each channel.
+	const MML_Event* m_event   [MML_CH_NUM];	//!< pointer to playing event for each channel.
+	int   m_stepCnt [MML_CH_NUM];	//!< step time counter for each channel.
+	int   m_gateCnt [MML_CH_NUM];	//!< gate time counter for each channel.
+	int   m_octave  [MML_CH_NUM];	//!< current octave of each channel.
+	int   m_length  [MML_CH_NUM];	//!< default note length of each channel.
+	int   m_gateTime[MML_CH_NUM];	//!< date time rate of each channel.
+	bool  m_isEnd   [MML_CH_NUM];	//!< whether each channel part is over or not.
+	bool  m_isTied	[MML_CH_NUM];	//!< tie or slur flag.
+	int   m_tiedNote[MML_CH_NUM];	//!< tie or slur note number.
+	MML_Loop m_loop[MML_CH_NUM][MML_LOOP_NEST];	//!< loop stack of each channel.
+	const MML_Section *m_sequence;	//!< sections of the song (NULL: no sequence)
+	int   m_sequenceNum;			//!< number of the sections
+	int   m_sequenceLoop;			//!< section to go back to after the last one (-1: no loop)
+	int   m_section [MML_CH_NUM];	//!< section of the pattern playing on each channel.
+	int   m_loopDepth[MML_CH_NUM];	//!< depth of the loop stack of each channel.
+	MML_Modulation m_mod[MML_CH_NUM];	//!< pitch modulation of each channel.
+	uint32_t m_modActive;			//!< channels whose pitch is moving (1bit each channel)
+	MML_Envelope m_env[MML_CH_NUM];	//!< software envelope of each channel.
+	uint32_t m_envActive;			//!< channels whose envelope is moving (1bit each channel)
+	const MML_EnvelopeMacro *m_envTable;	//!< envelope macros of the S command (S1 is the first)
+	int m_envTableNum;				//!< number of the envelope macros
 	bool m_isPlaying;				//!< whether playing now or not.
-	YM2203_Timbre m_timbre[TIMBRE_MAX];		//!< timbre table
+	uint16_t m_tmrCompare;			//!< compare match value of TMR0,1 for 1 tick of the current interval
+	uint16_t m_tmrTempo;			//!< compare match value for 1 tick of the tempo (from the next interval)
+	uint16_t m_tmrTicks;			//!< ticks until the next timer interrupt
+	uint16_t m_recordRest;			//!< remainder of the record time
+#ifdef PC_DEBUG
+	YM2203_HostTimer m_hostTimer;	//!< host timer callback
+	void* m_hostContext;			//!< argument for the host timer callback
+#endif
+#ifdef MML_PROFILE
+	MML_Profile m_profile;			//!< statistics of the timer procedure
+	uint32_t m_profCommands;		//!< MML commands executed in the current call
+#endif
+	YM2203_TimbreBank m_bank;		//!< timbre bank of the timbre table (not open: the preset timbres)
+	YM2203_Timbre m_timbreCache[TIMBRE_CACHE_NUM];	//!< voices loaded from the bank on use
+	int8_t m_cacheNum[TIMBRE_CACHE_NUM];	//!< timbre number of each cache entry (-1: empty)
+	uint8_t m_cacheOrder[TIMBRE_CACHE_NUM];	//!< cache entries from the most recently used
+	int8_t m_cacheEntry[MML_CH_NUM];	//!< cache entry set to each channel (-1: none)
 	
 	void initTMR(void);						//!< initialize TMR0,1 timers.
+	void setTimerTicks(int ticks);			//!< set ticks until the next timer interrupt.
+	int  nextEventTicks(void);				//!< ticks until the next gate or step boundary.
+	void advanceRecordTime(void);			//!< advance the record time to the next timer interrupt.
 	void MMLparser(int ch);					//!< MML parser.
-	void commandCDEFGABR(int ch, char key);	//!< MML parser sub routine.
-	void setPresetTimbre(void);				//!< set preset timbres to the table.
+	void eventPlayer(int ch);				//!< compiled event player.
+	void parseCommand(int ch, MML_Event *ev);	//!< parse one MML command into an event.
+	void commandCDEFGABR(int ch, char key, MML_Event *ev);	//!< MML parser sub routine.
+	bool parseNumber(int ch, int *value);		//!< parse a decimal number of a MML command.
+	bool nextPattern(int ch);					//!< go on to the pattern of the next section.
+	void commandLoop(int ch, char mml);			//!< MML parser sub routine. (Command [, ] and :)
+	bool parseLoopEnd(int ch, MML_Loop *loop);	//!< parse the repeat count of a loop.
+	bool findLoopEnd(int ch, MML_Loop *loop);	//!< find the end of a loop ahead.
+	void startPitch(int ch, int note);		//!< set the pitch of a new note, and start the modulation.
+	void modulate(int ch, int ticks);		//!< advance the pitch modulation of a channel.
+	void changeVolume(int ch, int volume);	//!< set volume to a channel, through the envelope.
+	void selectEnvelope(int ch, const MML_EnvelopeMacro *macro);	//!< select the envelope macro of a channel.
+	void startEnvelope(int ch);				//!< start the envelope macro at note-on.
+	bool releaseEnvelope(int ch);			//!< start the release part of the envelope macro at note-off.
+	void stepEnvelope(int ch, int ticks);	//!< advance the envelope macro of a channel.
+	void writeEnvelope(int ch);				//!< write the level of the envelope step if changed.
+	void execEvent(int ch, const MML_Event *ev);	//!< execute an event.
+	void clearTimbreCache(void);				//!< empty the cache of the bank voices.
+	int  loadTimbre(int num);					//!< load a timbre from the bank into the cache.
+	const YM2203_Timbre* findTimbre(int num);	//!< get a timbre from ROM or the cache.
+#ifdef MML_PROFILE
+	void profileCall(uint32_t start, uint32_t interval, uint32_t writes);	//!< add a call to the statistics.
+#endif
 };
 
 #ifdef _YM2203_MML_PLAYER_C_
@@ -0,0 +1,732 @@
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+// just for algorithm debug on PC
+#ifdef PC_DEBUG
+#include <stdint.h>
+#include <stdio.h>
+#define delay(i)				;
+
+// for real machine
+#else
+#include <rxduino.h>
+#include <iodefine_gcc63n.h>
+#include <intvect.h>
+#endif
+
+#include "YM2203_SMFplayer.h"
+
+//! clock of TMR0,1 counter [Hz] (48MHz / 64)
+#define TMR_CLOCK			750000UL
+
+// SMF chunks
+#define SMF_CHUNK_HEADER	8			//!< bytes of a chunk header (type and length)
+#define SMF_HEADER_SIZE		6			//!< length of the MThd chunk
+#define SMF_DIVISION_SMPTE	0x8000		//!< division in SMPTE time code (not supported)
+
+// SMF events other than MIDI channel messages
+#define SMF_SYSEX			0xF0		//!< system exclusive (len data)
+#define SMF_SYSEX_ESCAPE	0xF7		//!< escaped data (len data)
+#define SMF_META			0xFF		//!< meta event (type len data)
+#define SMF_META_END		0x2F		//!< meta event: end of track
+#define SMF_META_TEMPO		0x51		//!< meta event: set tempo (tttttt us per quarter note)
+
+#define SMF_TEMPO_DEFAULT	500000UL	//!< tempo until the first tempo event [us per quarter note] (120 BPM)
+
+/**
+ * read a 32bit big endian value.
+ */
+static uint32_t loadBE32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+/**
+ * read a 16bit big endian value.
+ */
+static uint16_t loadBE16(const uint8_t *p)
+{
+	return (uint16_t)(((uint16_t)p[0] << 8) | p[1]);
+}
+
+/**
+ * constructor.
+ */
+YM2203_SMFplayer::YM2203_SMFplayer()
+{
+	m_reader = NULL;
+	m_readerContext = NULL;
+	m_memory = NULL;
+	m_memorySize = 0;
+	m_division = 0;
+	m_trackNum = 0;
+	m_heapNum = 0;
+	m_mergedTick = 0;
+	m_events = m_eventBuffer;
+	m_eventMask = SMF_EVENT_BUFFER - 1;
+	m_head = 0;
+	m_tail = 0;
+	m_merged = false;
+	m_rewind = false;
+	m_deltaDone = false;
+	m_wait = 0;
+	m_underruns = 0;
+	m_isPlaying = false;
+	m_tmrCompare = tempoToCompare(SMF_TEMPO_DEFAULT);
+	m_tmrTicks = 1;
+#ifdef PC_DEBUG
+	m_hostTimer = NULL;
+	m_hostContext = NULL;
+#endif
+}
+
+/**
+ * initialize this player.
+ *
+ * @param bank timbre table for the program change.
+ *             NULL for the preset timbres of MMLplayer.
+ * @param num size of the timbre table (program n selects the timbre n % num)
+ */
+void YM2203_SMFplayer::begin(const YM2203_Timbre *bank, int num)
+{
+	// initialize the devices and the MIDI state
+	m_midi.begin(bank, num);
+
+	// initialize timers
+	this->initTMR();
+}
+
+/**
+ * initialize TMR0,1 timers. (the same setting as the MML player)
+ */
+void YM2203_SMFplayer::initTMR(void)
+{
+	m_tmrCompare = tempoToCompare(SMF_TEMPO_DEFAULT);
+	m_tmrTicks = 1;
+
+#ifndef PC_DEBUG
+	// TMR0(8bit) + TMR1(8bit) cascaded 16bit timer mode
+	// TMR1 is clocked at PCLKB(48MHz) / 64
+	// (see YM2203_MMLplayer::initTMR)
+	SYSTEM.PRCR.WORD = 0xA50B;		// enable writing to proteced registers
+	MSTP(TMR01) = 0;				// turn on TMR0,1
+
+	TMR0.TCCR.BIT.CSS = 0x03;		// TMR0 clocked by TMR1 overflow
+	TMR1.TCCR.BIT.CSS = 0x01;		// TMR1 clocked by PCLKB / prescaler
+	TMR1.TCCR.BIT.CKS = 0x04;		// 1/64  prescaler for TMR1
+
+	TMR0.TCR.BIT.CCLR = 0x01;		// set counter clear by compare match A
+	TMR0.TCR.BIT.CMIEA = 0x01;		// enable compare match A interrupt
+
+	IPR(TMR0, CMIA0) = 1;			// set interrupt priority level
+#endif
+}
+
+/**
+ * set the buffer of the timeline. (call it before open)
+ * a larger buffer needs fill() less often. if the whole file fits in it,
+ * the file is merged only once, even if it is played many times.
+ *
+ * @param events buffer. NULL for the default buffer (SMF_EVENT_BUFFER events).
+ * @param size number of events (power of 2)
+ */
+void YM2203_SMFplayer::setEventBuffer(SMF_Event *events, uint32_t size)
+{
+	this->stop();
+	if( (events == NULL) || (size == 0) || ((size & (size - 1)) != 0) ){
+		events = m_eventBuffer;
+		size = SMF_EVENT_BUFFER;
+	}
+	m_events = events;
+	m_eventMask = size - 1;
+	m_merged = false;
+	m_rewind = true;
+}
+
+/**
+ * open a SMF stream, and merge the tracks.
+ * the chunks are walked to find the tracks, and the timeline is filled
+ * from the top. the rest is merged by fill() while playing.
+ *
+ * @param reader reader of the stream
+ * @param context argument for the reader
+ * @return true if the stream is a SMF (format 0 or 1) with a track at least
+ */
+bool YM2203_SMFplayer::open(SMF_Reader reader, void* context)
+{
+	uint8_t header[SMF_CHUNK_HEADER + SMF_HEADER_SIZE];
+	uint32_t pos, len;
+	int size;
+
+	this->stop();
+	m_reader = reader;
+	m_readerContext = context;
+	m_trackNum = 0;
+
+	// header chunk
+	size = m_reader(m_readerContext, 0, header, sizeof(header));
+	if( (size < (int)sizeof(header)) || (memcmp(header, "MThd", 4) != 0) ) return false;
+	len = loadBE32(&header[4]);
+	if(len < SMF_HEADER_SIZE) return false;
+	if(loadBE16(&header[8]) > 1) return false;		// format 2 is not supported
+	m_division = loadBE16(&header[12]);
+	if( (m_division == 0) || (m_division & SMF_DIVISION_SMPTE) ) return false;
+
+	// track chunks (the other chunks are skipped)
+	pos = SMF_CHUNK_HEADER + len;
+	while(m_trackNum < SMF_TRACK_MAX)
+	{
+		size = m_reader(m_readerContext, pos, header, SMF_CHUNK_HEADER);
+		if(size < SMF_CHUNK_HEADER) break;
+		len = loadBE32(&header[4]);
+		if(memcmp(header, "MTrk", 4) == 0){
+			m_trackTop[m_trackNum] = pos + SMF_CHUNK_HEADER;
+			m_trackEnd[m_trackNum] = pos + SMF_CHUNK_HEADER + len;
+			m_trackNum++;
+		}
+		pos += SMF_CHUNK_HEADER + len;
+	}
+	if(m_trackNum == 0) return false;
+
+	this->rewind();
+	this->fill();
+	return true;
+}
+
+/**
+ * open a SMF image in memory. (e.g. const data in ROM)
+ *
+ * @param data SMF image
+ * @param size size of the image [byte]
+ * @return true if the image is a SMF (format 0 or 1) with a track at least
+ */
+bool YM2203_SMFplayer::open(const uint8_t *data, uint32_t size)
+{
+	m_memory = data;
+	m_memorySize = size;
+	return this->open(readMemory, this);
+}
+
+/**
+ * merge the tracks into the timeline while it has room.
+ * call it from loop() while playing, out of the interrupt.
+ * (playAndWait() calls it)
+ *
+ * @return true if all the events are in the timeline
+ */
+bool YM2203_SMFplayer::fill(void)
+{
+	if(m_trackNum == 0) return true;
+	while( this->mergeEvent() ){
+		;
+	}
+	return m_merged;
+}
+
+/**
+ * start to play the file.
+ */
+void YM2203_SMFplayer::play(void)
+{
+	if(m_trackNum == 0) return;
+	this->stop();
+
+	// the timeline was walked by the last play.
+	// if the whole file is still in it, walk it again from the top.
+	if(m_rewind){
+		if( m_merged && (m_tail <= m_eventMask + 1) ){
+			m_head = 0;
+		}else{
+			this->rewind();
+			this->fill();
+		}
+	}
+	m_rewind = true;
+
+	m_wait = 0;
+	m_deltaDone = false;
+	m_underruns = 0;
+	m_isPlaying = true;
+	this->setTimerTicks(1);
+
+	// take over the TMR0 interrupt
+	YM2203_setTimerHandler(timerHandler, this);
+#ifndef PC_DEBUG
+	TMR01.TCNT = 0x0000;			// clear the counter
+	IR (TMR0, CMIA0) = 0;			// clear interrupt
+	IEN(TMR0, CMIA0) = 1;			// enable compare match A interrupt
+#endif
+}
+
+/**
+ * start to play the file, and wait for the end.
+ * the tracks are merged into the timeline while waiting.
+ */
+void YM2203_SMFplayer::playAndWait(void)
+{
+	this->play();
+
+	while(m_isPlaying)
+	{
+		this->fill();
+#ifdef PC_DEBUG
+		// no timer interrupt on PC. run the timer procedure here.
+		this->onTimer();
+		if(m_hostTimer != NULL){
+			m_hostTimer(m_hostContext, this->getTimerInterval());
+		}
+#else
+		delay(1);
+#endif
+	}
+}
+
+/**
+ * stop playing, and note off all channels.
+ */
+void YM2203_SMFplayer::stop(void)
+{
+	if(!m_isPlaying) return;
+	m_isPlaying = false;
+
+	m_midi.allNotesOff();
+
+	// give the TMR0 interrupt back to the MML player
+	YM2203_setTimerHandler(NULL, NULL);
+}
+
+/**
+ * whether playing now or not.
+ *
+ * @return true if playing now
+ */
+bool YM2203_SMFplayer::isPlaying(void)
+{
+	return m_isPlaying;
+}
+
+/**
+ * interval procedure for playing the timeline.
+ * executes the events whose time has come, and sleeps until the next one.
+ * the events are already merged and in the player tick base,
+ * so it only walks the timeline.
+ * if the timeline runs out before the end (fill() wasn't called in time),
+ * the time of the file is kept, and the late events are caught up later.
+ */
+void YM2203_SMFplayer::onTimer(void)
+{
+	const SMF_Event *ev;
+	int ticks;
+
+	if(!m_isPlaying) return;
+
+	m_wait -= m_tmrTicks;
+	for(;;)
+	{
+		if(!m_deltaDone){
+			if(m_head == m_tail){
+				if(m_merged){
+					this->stop();
+					return;
+				}
+				// underrun: check again at the next tick
+				m_underruns++;
+				this->setTimerTicks(1);
+				return;
+			}
+			m_wait += m_events[m_head & m_eventMask].delta;
+			m_deltaDone = true;
+		}
+		if(m_wait > 0) break;
+
+		ev = &m_events[m_head & m_eventMask];
+		if(ev->status == SMF_EV_TEMPO){
+			m_tmrCompare = (uint16_t)(ev->data1 | ((uint16_t)ev->data2 << 8));
+		}else if(ev->status != SMF_EV_NOP){
+			m_midi.execute(ev->status, ev->data1, ev->data2);
+		}
+		m_head++;
+		m_deltaDone = false;
+	}
+
+	// sleep until the next event
+	ticks = 0xFFFF / m_tmrCompare;
+	if(m_wait < ticks) ticks = (int)m_wait;
+	this->setTimerTicks(ticks);
+}
+
+/**
+ * get the interval of the timer interrupt.
+ * (until the next interrupt, which is set by onTimer())
+ *
+ * @return interval [ns]
+ */
+uint32_t YM2203_SMFplayer::getTimerInterval(void)
+{
+	// TMR1 is clocked at 48MHz / 64
+	return (uint32_t)m_tmrCompare * m_tmrTicks * 4000 / 3;
+}
+
+/**
+ * number of timer procedures which found the timeline empty
+ * before the end of the file. (fill() should be called more often)
+ *
+ * @return number of procedures (cleared by play)
+ */
+uint32_t YM2203_SMFplayer::getUnderruns(void)
+{
+	return m_underruns;
+}
+
+/**
+ * get the MIDI input which plays the events.
+ * (e.g. to set the SSG setting or the pitch bend range of the MIDI channels)
+ *
+ * @return MIDI input of this player
+ */
+YM2203_MIDIin* YM2203_SMFplayer::getMIDI(void)
+{
+	return &m_midi;
+}
+
+#ifdef PC_DEBUG
+/**
+ * set the host timer callback. (for algorithm debug on PC)
+ * playAndWait() calls it after each timer procedure,
+ * so the host can render the elapsed interval.
+ *
+ * @param func callback function. NULL to remove.
+ * @param context argument for the callback
+ */
+void YM2203_SMFplayer::setHostTimer(YM2203_HostTimer func, void* context)
+{
+	m_hostTimer = func;
+	m_hostContext = context;
+}
+
+/**
+ * set the simulated bus of a YM2203 device. (for algorithm debug on PC)
+ *
+ * @param bus simulated bus (NULL: the global YM2203_simBus)
+ * @param chip device number (0 - YM2203_CHIP_NUM-1)
+ */
+void YM2203_SMFplayer::setSimBus(YM2203_SimBus *bus, int chip)
+{
+	m_midi.setSimBus(bus, chip);
+}
+#endif
+
+/**
+ * set ticks until the next timer interrupt.
+ *
+ * @param ticks ticks (clipped to 1 - 0xFFFF / m_tmrCompare)
+ */
+void YM2203_SMFplayer::setTimerTicks(int ticks)
+{
+	if(ticks < 1) ticks = 1;
+	m_tmrTicks = (uint16_t)ticks;
+
+#ifndef PC_DEBUG
+	TMR01.TCORA = m_tmrCompare * m_tmrTicks;
+#endif
+}
+
+/**
+ * start to merge the tracks from the top.
+ * the timeline starts with the default tempo.
+ */
+void YM2203_SMFplayer::rewind(void)
+{
+	SMF_Track *track;
+	uint16_t compare = tempoToCompare(SMF_TEMPO_DEFAULT);
+	int i;
+
+	m_head = 0;
+	m_tail = 0;
+	m_mergedTick = 0;
+	m_merged = false;
+	m_rewind = false;
+	m_heapNum = 0;
+	for(i=0; i<m_trackNum; i++)
+	{
+		track = &m_track[i];
+		track->pos = m_trackTop[i];
+		track->end = m_trackEnd[i];
+		track->time = 0;
+		track->status = 0;
+		track->bufferLen = 0;
+		track->bufferTop = 0;
+		if( this->readDelta(track) ) this->heapPush(i);
+	}
+	this->pushEvent(0, SMF_EV_TEMPO, (uint8_t)compare, (uint8_t)(compare >> 8));
+}
+
+/**
+ * merge the next event of the tracks into the timeline.
+ * the event of the earliest time is taken out of the tracks,
+ * and its time is converted to the player tick base.
+ *
+ * @return false if the timeline is full or all the events are merged
+ */
+bool YM2203_SMFplayer::mergeEvent(void)
+{
+	SMF_Track *track;
+	uint32_t tick, len;
+	uint16_t compare;
+	int i, status, data1 = 0, data2, type;
+	bool end = false;
+
+	if(m_heapNum == 0){
+		m_merged = true;
+		return false;
+	}
+	if(m_tail - m_head > m_eventMask) return false;
+
+	// a delta longer than 16bit is split by NOP events
+	i = m_heap[0];
+	tick = (uint32_t)((uint64_t)m_track[i].time * SMF_TICKS / m_division);
+	if(tick - m_mergedTick > 0xFFFF){
+		return this->pushEvent(m_mergedTick + 0xFFFF, SMF_EV_NOP, 0, 0);
+	}
+
+	i = this->heapPop();
+	track = &m_track[i];
+	status = this->readByte(track);
+	if(status < 0) return true;		// the track is broken. (ended)
+
+	if(status < 0x80){
+		// running status
+		data1 = status;
+		status = track->status;
+		if(status == 0) return true;		// the track is broken.
+	}else if(status < 0xF0){
+		track->status = (uint8_t)status;
+		data1 = this->readByte(track);
+	}
+
+	if(status < 0xF0){
+		// MIDI channel message
+		data2 = 0;
+		if( ((status & 0xE0) != 0xC0) ){	// except program change and channel pressure
+			data2 = this->readByte(track);
+		}
+		if( (data1 < 0) || (data2 < 0) ) return true;
+		this->pushEvent(tick, (uint8_t)status, (uint8_t)data1, (uint8_t)data2);
+	}else if(status == SMF_META){
+		type = this->readByte(track);
+		len = this->readVarLen(track);
+		if( (type == SMF_META_TEMPO) && (len == 3) ){
+			len  = (uint32_t)this->readByte(track) << 16;
+			len |= (uint32_t)this->readByte(track) << 8;
+			len |= (uint32_t)this->readByte(track);
+			compare = tempoToCompare(len);
+			this->pushEvent(tick, SMF_EV_TEMPO, (uint8_t)compare, (uint8_t)(compare >> 8));
+		}else{
+			this->skip(track, len);
+		}
+		end = (type == SMF_META_END) || (type < 0);
+	}else if( (status == SMF_SYSEX) || (status == SMF_SYSEX_ESCAPE) ){
+		this->skip(track, this->readVarLen(track));
+	}else{
+		return true;		// the track is broken.
+	}
+
+	// the next event of the track
+	if( !end && this->readDelta(track) ) this->heapPush(i);
+	return true;
+}
+
+/**
+ * append an event to the timeline. (the timeline must have room)
+ *
+ * @param time time of the event [player ticks from the top]
+ * @param status MIDI status, SMF_EV_NOP or SMF_EV_TEMPO
+ * @param data1 first data byte
+ * @param data2 second data byte
+ * @return true
+ */
+bool YM2203_SMFplayer::pushEvent(uint32_t time, uint8_t status, uint8_t data1, uint8_t data2)
+{
+	SMF_Event *ev = &m_events[m_tail & m_eventMask];
+
+	ev->delta = (uint16_t)(time - m_mergedTick);
+	ev->status = status;
+	ev->data1 = data1;
+	ev->data2 = data2;
+	m_mergedTick = time;
+
+	// the event is written before it is shown to onTimer
+	m_tail = m_tail + 1;
+	return true;
+}
+
+/**
+ * read the delta time of the next event of a track.
+ *
+ * @param track track
+ * @return false at the end of the track
+ */
+bool YM2203_SMFplayer::readDelta(SMF_Track *track)
+{
+	if(track->pos >= track->end) return false;
+	track->time += this->readVarLen(track);
+	return (track->pos < track->end);
+}
+
+/**
+ * read a byte of a track. (refills the read-ahead buffer if needed)
+ *
+ * @param track track
+ * @return byte (-1 at the end of the track)
+ */
+int YM2203_SMFplayer::readByte(SMF_Track *track)
+{
+	int size;
+
+	if(track->pos >= track->end) return -1;
+	if( (track->pos < track->bufferTop) || (track->pos - track->bufferTop >= track->bufferLen) ){
+		size = m_reader(m_readerContext, track->pos, track->buffer, SMF_TRACK_BUFFER);
+		if(size <= 0){
+			track->pos = track->end;
+			return -1;
+		}
+		track->bufferTop = track->pos;
+		track->bufferLen = (uint8_t)size;
+	}
+	return track->buffer[track->pos++ - track->bufferTop];
+}
+
+/**
+ * read a variable length quantity of a track. (up to 4 bytes)
+ *
+ * @param track track
+ * @return value (0 at the end of the track)
+ */
+uint32_t YM2203_SMFplayer::readVarLen(SMF_Track *track)
+{
+	uint32_t value = 0;
+	int i, c;
+
+	for(i=0; i<4; i++){
+		c = this->readByte(track);
+		if(c < 0) return 0;
+		value = (value << 7) | (c & 0x7F);
+		if( (c & 0x80) == 0 ) break;
+	}
+	return value;
+}
+
+/**
+ * skip bytes of a track. (e.g. the data of a meta event)
+ *
+ * @param track track
+ * @param len bytes to skip (stops at the end of the track)
+ */
+void YM2203_SMFplayer::skip(SMF_Track *track, uint32_t len)
+{
+	if(len > track->end - track->pos) len = track->end - track->pos;
+	track->pos += len;
+}
+
+/**
+ * add a track to the heap. (by the time of the next event, then the track number)
+ *
+ * @param track track number
+ */
+void YM2203_SMFplayer::heapPush(int track)
+{
+	int i = m_heapNum++;
+	int parent;
+
+	while(i > 0){
+		parent = (i - 1) / 2;
+		if( (m_track[m_heap[parent]].time < m_track[track].time) ||
+		    ((m_track[m_heap[parent]].time == m_track[track].time) && (m_heap[parent] < track)) ) break;
+		m_heap[i] = m_heap[parent];
+		i = parent;
+	}
+	m_heap[i] = (uint8_t)track;
+}
+
+/**
+ * take out the track of the earliest event.
+ *
+ * @return track number
+ */
+int YM2203_SMFplayer::heapPop(void)
+{
+	int top = m_heap[0];
+	int last = m_heap[--m_heapNum];
+	int i = 0;
+	int child;
+
+	for(;;){
+		child = i * 2 + 1;
+		if(child >= m_heapNum) break;
+		if( (child + 1 < m_heapNum) &&
+		    ((m_track[m_heap[child + 1]].time < m_track[m_heap[child]].time) ||
+		     ((m_track[m_heap[child + 1]].time == m_track[m_heap[child]].time) && (m_heap[child + 1] < m_heap[child]))) ){
+			child++;
+		}
+		if( (m_track[last].time < m_track[m_heap[child]].time) ||
+		    ((m_track[last].time == m_track[m_heap[child]].time) && (last < m_heap[child])) ) break;
+		m_heap[i] = m_heap[child];
+		i = child;
+	}
+	m_heap[i] = (uint8_t)last;
+	return top;
+}
+
+/**
+ * compare match value of TMR0,1 for a tick at a tempo.
+ * compare match = (us per quarter note) / SMF_TICKS * (48MHz / 64)
+ * (a 24bit tempo always fits in the 16bit compare match)
+ *
+ * @param usPerQuarter tempo [us per quarter note] (24bit)
+ * @return compare match value (1 - 0xFFFF)
+ */
+uint16_t YM2203_SMFplayer::tempoToCompare(uint32_t usPerQuarter)
+{
+	uint32_t compare = (uint32_t)(((uint64_t)usPerQuarter * TMR_CLOCK + 500000UL * SMF_TICKS) / (1000000UL * SMF_TICKS));
+
+	if(compare < 1) compare = 1;
+	if(compare > 0xFFFF) compare = 0xFFFF;
+	return (uint16_t)compare;
+}
+
+/**
+ * reader of a SMF image in memory.
+ */
+int YM2203_SMFplayer::readMemory(void* context, uint32_t offset, uint8_t *buffer, int size)
+{
+	YM2203_SMFplayer *player = (YM2203_SMFplayer*)context;
+
+	if(offset >= player->m_memorySize) return 0;
+	if((uint32_t)size > player->m_memorySize - offset) size = (int)(player->m_memorySize - offset);
+	memcpy(buffer, player->m_memory + offset, size);
+	return size;
+}
+
+/**
+ * TMR0 interrupt handler. (while playing)
+ */
+void YM2203_SMFplayer::timerHandler(void* context)
+{
+	((YM2203_SMFplayer*)context)->onTimer();
+}
@@ -0,0 +1,145 @@
+#ifndef __YM2203_SMF_PLAYER_H_
+#define __YM2203_SMF_PLAYER_H_
+
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "YM2203_MIDIin.h"
+
+#define SMF_TRACK_MAX		16		//!< maximum tracks merged (the other tracks are ignored)
+#define SMF_TRACK_BUFFER	32		//!< read-ahead buffer of each track [byte]
+#define SMF_EVENT_BUFFER	256		//!< events of the timeline in RAM (power of 2)
+#define SMF_TICKS			192		//!< ticks of the player in a quarter note (same as the MML player)
+
+// SMF_Event#status other than MIDI channel messages
+#define SMF_EV_NOP			0x00	//!< only waits (for a delta longer than 0xFFFF ticks)
+#define SMF_EV_TEMPO		0xFF	//!< set tempo (data1, data2: TMR0,1 compare value of a tick)
+
+/**
+ * reader of a SMF stream. (the same as VGM_Reader)
+ * reads up to size bytes at the offset of the stream.
+ *
+ * @return bytes read (0 at the end of the stream)
+ */
+typedef int (*SMF_Reader)(void* context, uint32_t offset, uint8_t *buffer, int size);
+
+/**
+ * event of the merged timeline.
+ */
+struct SMF_Event
+{
+	uint16_t delta;			//!< ticks from the previous event
+	uint8_t  status;		//!< MIDI status, SMF_EV_NOP or SMF_EV_TEMPO
+	uint8_t  data1;			//!< first data byte (compare value low for SMF_EV_TEMPO)
+	uint8_t  data2;			//!< second data byte (compare value high for SMF_EV_TEMPO)
+};
+
+/**
+ * read state of a track.
+ */
+struct SMF_Track
+{
+	uint32_t pos;			//!< stream offset of the next byte
+	uint32_t end;			//!< stream offset of the end of the track
+	uint32_t time;			//!< time of the next event [SMF ticks from the top]
+	uint8_t  status;		//!< running status
+	uint8_t  bufferLen;		//!< valid bytes in buffer
+	uint32_t bufferTop;		//!< stream offset of buffer[0]
+	uint8_t  buffer[SMF_TRACK_BUFFER];	//!< read-ahead buffer
+};
+
+/**
+ * YM2203 Standard MIDI File player class
+ * the tracks are merged into one timeline of events in the player tick base
+ * by fill(), out of the interrupt. the timer procedure only walks the timeline.
+ * the timeline is a ring buffer, so a file larger than the buffer is merged
+ * little by little while playing (playAndWait() calls fill(), or call it
+ * from loop()). the RAM used doesn't depend on the file size.
+ * (on GR-SAKURA, it takes over the TMR0 interrupt from the MML player while playing.)
+ */
+class YM2203_SMFplayer
+{
+public:
+	YM2203_SMFplayer();			//!< constructor.
+
+	void begin(const YM2203_Timbre *bank = NULL, int num = TIMBRE_MAX);	//!< initialize this player.
+	void setEventBuffer(SMF_Event *events, uint32_t size);	//!< set the buffer of the timeline.
+	bool open(SMF_Reader reader, void* context);		//!< open a SMF stream, and merge the tracks.
+	bool open(const uint8_t *data, uint32_t size);		//!< open a SMF image in memory.
+	bool fill(void);		//!< merge the tracks into the timeline while it has room.
+	void play(void);		//!< start to play the file.
+	void playAndWait(void);	//!< start to play the file, and wait for the end.
+	void stop(void);		//!< stop playing, and note off all channels.
+	bool isPlaying(void);	//!< whether playing now or not.
+	void onTimer(void);		//!< interval procedure for playing the timeline.
+	uint32_t getTimerInterval(void);	//!< get the interval of the timer interrupt. [ns]
+	uint32_t getUnderruns(void);		//!< number of timer procedures which found the timeline empty.
+	YM2203_MIDIin* getMIDI(void);		//!< get the MIDI input which plays the events.
+#ifdef PC_DEBUG
+	void setHostTimer(YM2203_HostTimer func, void* context);	//!< set the host timer callback.
+	void setSimBus(YM2203_SimBus *bus, int chip = 0);	//!< set the simulated bus of a YM2203 device.
+#endif
+
+private:
+	YM2203_MIDIin m_midi;			//!< MIDI input (devices, voice allocator and channel state)
+	SMF_Reader m_reader;			//!< reader of the stream
+	void* m_readerContext;			//!< argument for the reader
+	const uint8_t *m_memory;		//!< SMF image (for open() in memory)
+	uint32_t m_memorySize;			//!< size of the SMF image
+	uint16_t m_division;			//!< SMF ticks in a quarter note
+	int  m_trackNum;				//!< number of tracks
+	uint32_t m_trackTop[SMF_TRACK_MAX];	//!< stream offset of the events of each track
+	uint32_t m_trackEnd[SMF_TRACK_MAX];	//!< stream offset of the end of each track
+	SMF_Track m_track[SMF_TRACK_MAX];	//!< read state of each track
+	uint8_t m_heap[SMF_TRACK_MAX];	//!< tracks not ended, in a min-heap by the time of the next event
+	int  m_heapNum;					//!< number of tracks in m_heap
+	uint32_t m_mergedTick;			//!< player tick of the last event merged
+	SMF_Event m_eventBuffer[SMF_EVENT_BUFFER];	//!< default buffer of the timeline
+	SMF_Event *m_events;			//!< buffer of the timeline (ring buffer)
+	uint32_t m_eventMask;			//!< size of the timeline buffer - 1
+	volatile uint32_t m_head;		//!< index of the next event to play (by onTimer)
+	volatile uint32_t m_tail;		//!< index of the next event to merge (by fill)
+	volatile bool m_merged;			//!< all events are in the timeline
+	bool m_rewind;					//!< the timeline must be merged again to play
+	bool m_deltaDone;				//!< the delta of the event at m_head is in m_wait
+	int32_t m_wait;					//!< ticks until the event at m_head
+	uint32_t m_underruns;			//!< timer procedures which found the timeline empty
+	bool m_isPlaying;				//!< whether playing now or not.
+	uint16_t m_tmrCompare;			//!< compare match value of TMR0,1 for 1 tick
+	uint16_t m_tmrTicks;			//!< ticks until the next timer interrupt
+#ifdef PC_DEBUG
+	YM2203_HostTimer m_hostTimer;	//!< host timer callback
+	void* m_hostContext;			//!< argument for the host timer callback
+#endif
+
+	void initTMR(void);						//!< initialize TMR0,1 timers.
+	void setTimerTicks(int ticks);			//!< set ticks until the next timer interrupt.
+	void rewind(void);						//!< start to merge the tracks from the top.
+	bool mergeEvent(void);					//!< merge the next event of the tracks into the timeline.
+	bool pushEvent(uint32_t time, uint8_t status, uint8_t data1, uint8_t data2);	//!< append an event to the timeline.
+	bool readDelta(SMF_Track *track);		//!< read the delta time of the next event of a track.
+	int  readByte(SMF_Track *track);		//!< read a byte of a track. (-1 at the end)
+	uint32_t readVarLen(SMF_Track *track);	//!< read a variable length quantity of a track.
+	void skip(SMF_Track *track, uint32_t len);	//!< skip bytes of a track.
+	void heapPush(int track);				//!< add a track to the heap.
+	int  heapPop(void);						//!< take out the track of the earliest event.
+	static uint16_t tempoToCompare(uint32_t usPerQuarter);	//!< compare match value of a tick at a tempo.
+	static int readMemory(void* context, uint32_t offset, uint8_t *buffer, int size);	//!< reader of a SMF image in memory.
+	static void timerHandler(void* context);	//!< TMR0 interrupt handler.
+};
+
+#endif
@@ -18,35 +18,48 @@
 #include "YM2203_Timbre.h"
 
 /**
- * constructor.
+ * carrier operators of each algorithm.
+ * operator4 is carrier at any algorithm, operator2 at 4-7, operator3 at 5-7, operator1 at 7.
+ */
+const uint8_t YM2203_Timbre::CARRIER_MASK[8] = {
+	MASK_OP4, MASK_OP4, MASK_OP4, MASK_OP4,
+	MASK_OP2 | MASK_OP4,
+	MASK_OP2 | MASK_OP3 | MASK_OP4, MASK_OP2 | MASK_OP3 | MASK_OP4,
+	MASK_ALL
+};
+
+/**
+ * set Algorithm.
  *
+ * @param al algorithm (ALGORITHM_0 to ALGORITHM_7)
  */
-YM2203_Timbre::YM2203_Timbre()
+void YM2203_Timbre::setAlgorithm(uint8_t al)
 {
+	algorithm = al;
+	this->update();
 }
 
 /**
- * constructor. initialize with integer array
+ * set Feedback.
  *
- * @param array integer array (N88-BASIC format)
+ * @param fb feedback (0 to 7)
  */
-YM2203_Timbre::YM2203_Timbre(const int16_t array[5][10])
+void YM2203_Timbre::setFeedback(uint8_t fb)
 {
-	algorithm =  array[0][0]       & 0x07;
-	feedback  = (array[0][0] >> 3) & 0x07;
-	opMask    =  array[0][1] & 0x0F;
-	// [0][2-7] : ru[gAg֌W̐ݒ͖Ή
-	// [0][8,9] : gp
-	// [1-4][9] : ru[g֌W̐ݒ͖Ή
-	setAR((uint8_t)array[1][0], (uint8_t)array[2][0], (uint8_t)array[3][0], (uint8_t)array[4][0]);
-	setDR((uint8_t)array[1][1], (uint8_t)array[2][1], (uint8_t)array[3][1], (uint8_t)array[4][1]);
-	setSR((uint8_t)array[1][2], (uint8_t)array[2][2], (uint8_t)array[3][2], (uint8_t)array[4][2]);
-	setRR((uint8_t)array[1][3], (uint8_t)array[2][3], (uint8_t)array[3][3], (uint8_t)array[4][3]);
-	setSL((uint8_t)array[1][4], (uint8_t)array[2][4], (uint8_t)array[3][4], (uint8_t)array[4][4]);
-	setTL((uint8_t)array[1][5], (uint8_t)array[2][5], (uint8_t)array[3][5], (uint8_t)array[4][5]);
-	setKS((uint8_t)array[1][6], (uint8_t)array[2][6], (uint8_t)array[3][6], (uint8_t)array[4][6]);
-	setML((uint8_t)array[1][7], (uint8_t)array[2][7], (uint8_t)array[3][7], (uint8_t)array[4][7]);
-	setDT( (int8_t)array[1][8],  (int8_t)array[2][8],  (int8_t)array[3][8],  (int8_t)array[4][8]);
+	feedback = fb;
+	this->update();
+}
+
+/**
+ * set Operator Mask.
+ * (it is used at key on, and not a part of the register image)
+ *
+ * @param mask operator mask (MASK_OP1 to MASK_OP4 or MASK_ALL)
+ */
+void YM2203_Timbre::setOpMask(uint8_t mask)
+{
+	opMask = mask & MASK_ALL;
+	this->update();
 }
 
 /**
@@ -63,6 +76,7 @@ void YM2203_Timbre::setTL(uint8_t op1, uint8_t op2, uint8_t op3, uint8_t op4)
 	tl[OPERATOR_2] = op2;
 	tl[OPERATOR_3] = op3;
 	tl[OPERATOR_4] = op4;
+	this->update();
 }
 
 /**
@@ -79,6 +93,7 @@ void YM2203_Timbre::setAR(uint8_t op1, uint8_t op2, uint8_t op3, uint8_t op4)
 	ar[OPERATOR_2] = op2;
 	ar[OPERATOR_3] = op3;
 	ar[OPERATOR_4] = op4;
+	this->update();
 }
 
 /**
@@ -95,6 +110,7 @@ void YM2203_Timbre::setDR(uint8_t op1, uint8_t op2, uint8_t op3, uint8_t op4)
 	dr[OPERATOR_2] = op2;
 	dr[OPERATOR_3] = op3;
 	dr[OPERATOR_4] = op4;
+	this->update();
 }
 
 /**
@@ -111,6 +127,7 @@ void YM2203_Timbre::setSR(uint8_t op1, uint8_t op2, uint8_t op3, uint8_t op4)
 	sr[OPERATOR_2] = op2;
 	sr[OPERATOR_3] = op3;
 	sr[OPERATOR_4] = op4;
+	this->update();
 }
 
 /**
@@ -127,6 +144,7 @@ void YM2203_Timbre::setSL(uint8_t op1, uint8_t op2, uint8_t op3, uint8_t op4)
 	sl[OPERATOR_2] = op2;
 	sl[OPERATOR_3] = op3;
 	sl[OPERATOR_4] = op4;
+	this->update();
 }
 
 /**
@@ -143,6 +161,7 @@ void YM2203_Timbre::setRR(uint8_t op1, uint8_t op2, uint8_t op3, uint8_t op4)
 	rr[OPERATOR_2] = op2;
 	rr[OPERATOR_3] = op3;
 	rr[OPERATOR_4] = op4;
+	this->update();
 }
 
 /**
@@ -159,6 +178,7 @@ void YM2203_Timbre::setDT(int8_t op1, int8_t op2, int8_t op3, int8_t op4)
 	detune[OPERATOR_2] = op2;
 	detune[OPERATOR_3] = op3;
 	detune[OPERATOR_4] = op4;
+	this->update();
 }
 
 /**
@@ -175,6 +195,7 @@ void YM2203_Timbre::setML(uint8_t op1, uint8_t op2, uint8_t op3, uint8_t op4)
 	multiple[OPERATOR_2] = op2;
 	multiple[OPERATOR_3] = op3;
 	multiple[OPERATOR_4] = op4;
+	this->update();
 }
 
 /**
@@ -191,4 +212,74 @@ void YM2203_Timbre::setKS(uint8_t op1, uint8_t op2, uint8_t op3, uint8_t op4)
 	keyScale[OPERATOR_2] = op2;
 	keyScale[OPERATOR_3] = op3;
 	keyScale[OPERATOR_4] = op4;
+	this->update();
+}
+
+/**
+ * pack the timbre into register values.
+ * (operator 1 to 4, each in the order of DT/ML, TL, KS/AR, DR, SR, SL/RR, then FB/ALGORITHM)
+ *
+ * @param image register values (TIMBRE_REG_NUM bytes)
+ */
+void YM2203_Timbre::pack(uint8_t *image) const
+{
+	int op;
+	
+	for(op=OPERATOR_1; op<=OPERATOR_4; op++)
+	{
+		image[0] = packDTML(detune[op], multiple[op]);	// Multiple and Detune
+		image[1] = packTL(tl[op]);						// Total Level
+		image[2] = packKSAR(keyScale[op], ar[op]);		// Key Scale and Attack Rate
+		image[3] = packDR(dr[op]);						// Decay Rate
+		image[4] = packSR(sr[op]);						// Sustain Rate
+		image[5] = packSLRR(sl[op], rr[op]);			// Sustain Level and Release Rate
+		image += TIMBRE_OP_REG_NUM;
+	}
+	
+	// algorithm and feedback
+	image[0] = packFBAL(feedback, algorithm);
+}
+
+/**
+ * unpack register values into the timbre. (the reverse of pack)
+ * the detune 5-7 is unpacked as -1 to -3, which is packed back to the same value.
+ *
+ * @param image register values (TIMBRE_REG_NUM bytes)
+ * @param mask operator mask
+ */
+void YM2203_Timbre::unpack(const uint8_t *image, uint8_t mask)
+{
+	int op;
+	uint8_t dt;
+	
+	for(op=OPERATOR_1; op<=OPERATOR_4; op++)
+	{
+		dt = (image[0] >> 4) & 0x07;
+		detune  [op] = (dt < 4) ? (int8_t)dt : (int8_t)(4 - dt);
+		multiple[op] =  image[0] & 0x0F;
+		tl      [op] =  image[1] & 0x7F;
+		keyScale[op] = (image[2] >> 6) & 0x03;
+		ar      [op] =  image[2] & 0x1F;
+		dr      [op] =  image[3] & 0x1F;
+		sr      [op] =  image[4] & 0x1F;
+		sl      [op] = (image[5] >> 4) & 0x0F;
+		rr      [op] =  image[5] & 0x0F;
+		image += TIMBRE_OP_REG_NUM;
+	}
+	
+	feedback  = (image[0] >> 3) & 0x07;
+	algorithm =  image[0] & 0x07;
+	opMask    = mask & MASK_ALL;
+	this->update();
+}
+
+/**
+ * pack the register image again from the parameter members.
+ * (called by the setters and unpack. call it after writing the members directly,
+ *  or getImage() packs them on each use)
+ */
+void YM2203_Timbre::update(void)
+{
+	this->pack(m_regImage);
+	memcpy(m_packed, &algorithm, TIMBRE_FIELD_SIZE);
 }
@@ -18,6 +18,8 @@
  * limitations under the License.
  */
 
+#include <string.h>
+
 // just for algorithm debug on PC
 #ifdef PC_DEBUG
 #include <stdint.h>
@@ -34,13 +36,18 @@
 #define OPERATOR_4		3
 #define OPERATOR_NUM	4
 
-// Bit mask for YM2203_Timbre#opMask
+// Bit mask for YM2203_Timbre#setOpMask
 #define MASK_OP1		0x01
 #define MASK_OP2		0x02
 #define MASK_OP3		0x04
 #define MASK_OP4		0x08
 #define MASK_ALL		0x0F
 
+// Register image of a timbre (see YM2203_Timbre::pack)
+#define TIMBRE_OP_REG_NUM	6	//!< registers per operator (DT/ML, TL, KS/AR, DR, SR, SL/RR)
+#define TIMBRE_REG_NUM		(TIMBRE_OP_REG_NUM * 4 + 1)	//!< 4 operators + FB/ALGORITHM
+#define TIMBRE_FIELD_SIZE	(3 + OPERATOR_NUM * 9)		//!< bytes of the parameter members (algorithm to detune)
+
 // Algorism number
 #define ALGORITHM_0		0
 #define ALGORITHM_1		1
@@ -53,6 +60,10 @@
 
 /**
  * YM2203 FM synthesizer timble structure.
+ * the register image is packed when the timbre is constructed or changed by the setters,
+ * so setting a timbre to a channel just copies it.
+ * the parameter members can still be written directly: getImage() finds them changed
+ * and packs them again on each use, until update() or a setter packs the image again.
  */
 struct YM2203_Timbre
 {
@@ -69,9 +80,122 @@ struct YM2203_Timbre
 	uint8_t multiple[OPERATOR_NUM];	//!< Multiple
 	int8_t detune[OPERATOR_NUM];	//!< Detune
 	
+	/**
+	 * constructor. (all parameters 0)
+	 */
+	constexpr YM2203_Timbre() :
+		algorithm(0), feedback(0), opMask(0),
+		ar{0, 0, 0, 0}, dr{0, 0, 0, 0}, sr{0, 0, 0, 0}, rr{0, 0, 0, 0}, sl{0, 0, 0, 0},
+		tl{0, 0, 0, 0}, keyScale{0, 0, 0, 0}, multiple{0, 0, 0, 0}, detune{0, 0, 0, 0},
+		m_packed{0}, m_regImage{0}
+	{
+	}
+	
+	/**
+	 * constructor. initialize with the parameters of 4 operators.
+	 * (can be constexpr data in ROM)
+	 *
+	 * @param al Algorithm
+	 * @param fb Feedback
+	 * @param mask Operator Mask
+	 * @param AR,DR,SR,RR,SL,TL,KS,ML,DT parameters for operator1 to operator4
+	 */
+	constexpr YM2203_Timbre(uint8_t al, uint8_t fb, uint8_t mask,
+		const uint8_t (&AR)[OPERATOR_NUM], const uint8_t (&DR)[OPERATOR_NUM], const uint8_t (&SR)[OPERATOR_NUM],
+		const uint8_t (&RR)[OPERATOR_NUM], const uint8_t (&SL)[OPERATOR_NUM], const uint8_t (&TL)[OPERATOR_NUM],
+		const uint8_t (&KS)[OPERATOR_NUM], const uint8_t (&ML)[OPERATOR_NUM], const int8_t (&DT)[OPERATOR_NUM]) :
+		algorithm(al), feedback(fb), opMask(mask),
+		ar{AR[0], AR[1], AR[2], AR[3]}, dr{DR[0], DR[1], DR[2], DR[3]}, sr{SR[0], SR[1], SR[2], SR[3]},
+		rr{RR[0], RR[1], RR[2], RR[3]}, sl{SL[0], SL[1], SL[2], SL[3]}, tl{TL[0], TL[1], TL[2], TL[3]},
+		keyScale{KS[0], KS[1], KS[2], KS[3]}, multiple{ML[0], ML[1], ML[2], ML[3]}, detune{DT[0], DT[1], DT[2], DT[3]},
+		m_packed{
+			(uint8_t)al, (uint8_t)fb, (uint8_t)mask,
+			(uint8_t)AR[0], (uint8_t)AR[1], (uint8_t)AR[2], (uint8_t)AR[3],
+			(uint8_t)DR[0], (uint8_t)DR[1], (uint8_t)DR[2], (uint8_t)DR[3],
+			(uint8_t)SR[0], (uint8_t)SR[1], (uint8_t)SR[2], (uint8_t)SR[3],
+			(uint8_t)RR[0], (uint8_t)RR[1], (uint8_t)RR[2], (uint8_t)RR[3],
+			(uint8_t)SL[0], (uint8_t)SL[1], (uint8_t)SL[2], (uint8_t)SL[3],
+			(uint8_t)TL[0], (uint8_t)TL[1], (uint8_t)TL[2], (uint8_t)TL[3],
+			(uint8_t)KS[0], (uint8_t)KS[1], (uint8_t)KS[2], (uint8_t)KS[3],
+			(uint8_t)ML[0], (uint8_t)ML[1], (uint8_t)ML[2], (uint8_t)ML[3],
+			(uint8_t)DT[0], (uint8_t)DT[1], (uint8_t)DT[2], (uint8_t)DT[3]},
+		m_regImage{
+			packDTML(DT[0], ML[0]), packTL(TL[0]), packKSAR(KS[0], AR[0]), packDR(DR[0]), packSR(SR[0]), packSLRR(SL[0], RR[0]),
+			packDTML(DT[1], ML[1]), packTL(TL[1]), packKSAR(KS[1], AR[1]), packDR(DR[1]), packSR(SR[1]), packSLRR(SL[1], RR[1]),
+			packDTML(DT[2], ML[2]), packTL(TL[2]), packKSAR(KS[2], AR[2]), packDR(DR[2]), packSR(SR[2]), packSLRR(SL[2], RR[2]),
+			packDTML(DT[3], ML[3]), packTL(TL[3]), packKSAR(KS[3], AR[3]), packDR(DR[3]), packSR(SR[3]), packSLRR(SL[3], RR[3]),
+			packFBAL(fb, al)}
+	{
+	}
+	
+	/**
+	 * constructor. initialize with integer array (N88-BASIC format)
+	 * (can be constexpr data in ROM, if the array is constexpr)
+	 * [0][2-7] : the settings of vibrato and tremolo are not supported
+	 * [0][8,9] : not used
+	 * [1-4][9] : the settings of vibrato are not supported
+	 *
+	 * @param array integer array (N88-BASIC format)
+	 */
+	constexpr YM2203_Timbre(const int16_t array[5][10]) :
+		algorithm((uint8_t)( array[0][0]       & 0x07)),
+		feedback ((uint8_t)((array[0][0] >> 3) & 0x07)),
+		opMask   ((uint8_t)( array[0][1]       & 0x0F)),
+		ar      {(uint8_t)array[1][0], (uint8_t)array[2][0], (uint8_t)array[3][0], (uint8_t)array[4][0]},
+		dr      {(uint8_t)array[1][1], (uint8_t)array[2][1], (uint8_t)array[3][1], (uint8_t)array[4][1]},
+		sr      {(uint8_t)array[1][2], (uint8_t)array[2][2], (uint8_t)array[3][2], (uint8_t)array[4][2]},
+		rr      {(uint8_t)array[1][3], (uint8_t)array[2][3], (uint8_t)array[3][3], (uint8_t)array[4][3]},
+		sl      {(uint8_t)array[1][4], (uint8_t)array[2][4], (uint8_t)array[3][4], (uint8_t)array[4][4]},
+		tl      {(uint8_t)array[1][5], (uint8_t)array[2][5], (uint8_t)array[3][5], (uint8_t)array[4][5]},
+		keyScale{(uint8_t)array[1][6], (uint8_t)array[2][6], (uint8_t)array[3][6], (uint8_t)array[4][6]},
+		multiple{(uint8_t)array[1][7], (uint8_t)array[2][7], (uint8_t)array[3][7], (uint8_t)array[4][7]},
+		detune  { (int8_t)array[1][8],  (int8_t)array[2][8],  (int8_t)array[3][8],  (int8_t)array[4][8]},
+		m_packed{
+			(uint8_t)( array[0][0]       & 0x07), (uint8_t)((array[0][0] >> 3) & 0x07), (uint8_t)(array[0][1] & 0x0F),
+			(uint8_t)array[1][0], (uint8_t)array[2][0], (uint8_t)array[3][0], (uint8_t)array[4][0],
+			(uint8_t)array[1][1], (uint8_t)array[2][1], (uint8_t)array[3][1], (uint8_t)array[4][1],
+			(uint8_t)array[1][2], (uint8_t)array[2][2], (uint8_t)array[3][2], (uint8_t)array[4][2],
+			(uint8_t)array[1][3], (uint8_t)array[2][3], (uint8_t)array[3][3], (uint8_t)array[4][3],
+			(uint8_t)array[1][4], (uint8_t)array[2][4], (uint8_t)array[3][4], (uint8_t)array[4][4],
+			(uint8_t)array[1][5], (uint8_t)array[2][5], (uint8_t)array[3][5], (uint8_t)array[4][5],
+			(uint8_t)array[1][6], (uint8_t)array[2][6], (uint8_t)array[3][6], (uint8_t)array[4][6],
+			(uint8_t)array[1][7], (uint8_t)array[2][7], (uint8_t)array[3][7], (uint8_t)array[4][7],
+			(uint8_t)array[1][8], (uint8_t)array[2][8], (uint8_t)array[3][8], (uint8_t)array[4][8]},
+		m_regImage{
+			packDTML((int8_t)array[1][8], (uint8_t)array[1][7]),
+			packTL((uint8_t)array[1][5]),
+			packKSAR((uint8_t)array[1][6], (uint8_t)array[1][0]),
+			packDR((uint8_t)array[1][1]),
+			packSR((uint8_t)array[1][2]),
+			packSLRR((uint8_t)array[1][4], (uint8_t)array[1][3]),
+			packDTML((int8_t)array[2][8], (uint8_t)array[2][7]),
+			packTL((uint8_t)array[2][5]),
+			packKSAR((uint8_t)array[2][6], (uint8_t)array[2][0]),
+			packDR((uint8_t)array[2][1]),
+			packSR((uint8_t)array[2][2]),
+			packSLRR((uint8_t)array[2][4], (uint8_t)array[2][3]),
+			packDTML((int8_t)array[3][8], (uint8_t)array[3][7]),
+			packTL((uint8_t)array[3][5]),
+			packKSAR((uint8_t)array[3][6], (uint8_t)array[3][0]),
+			packDR((uint8_t)array[3][1]),
+			packSR((uint8_t)array[3][2]),
+			packSLRR((uint8_t)array[3][4], (uint8_t)array[3][3]),
+			packDTML((int8_t)array[4][8], (uint8_t)array[4][7]),
+			packTL((uint8_t)array[4][5]),
+			packKSAR((uint8_t)array[4][6], (uint8_t)array[4][0]),
+			packDR((uint8_t)array[4][1]),
+			packSR((uint8_t)array[4][2]),
+			packSLRR((uint8_t)array[4][4], (uint8_t)array[4][3]),
+			packFBAL((uint8_t)((array[0][0] >> 3) & 0x07), (uint8_t)(array[0][0] & 0x07))}
+	{
+	}
+	
+	// Setters of the parameters. (they pack the register image again)
+	void setAlgorithm(uint8_t al);
+	void setFeedback(uint8_t fb);
+	void setOpMask(uint8_t mask);
+	
 	// Utility functions to set 4 operators' parameters.
-	YM2203_Timbre(const int16_t array[5][10]);
-	YM2203_Timbre();
 	void setAR(uint8_t op1, uint8_t op2, uint8_t op3, uint8_t op4);
 	void setDR(uint8_t op1, uint8_t op2, uint8_t op3, uint8_t op4);
 	void setSR(uint8_t op1, uint8_t op2, uint8_t op3, uint8_t op4);
@@ -81,6 +205,47 @@ struct YM2203_Timbre
 	void setKS(uint8_t op1, uint8_t op2, uint8_t op3, uint8_t op4);
 	void setML(uint8_t op1, uint8_t op2, uint8_t op3, uint8_t op4);
 	void setDT( int8_t op1,  int8_t op2,  int8_t op3,  int8_t op4);
+	void pack(uint8_t *image) const;
+	void unpack(const uint8_t *image, uint8_t mask);
+	void update(void);
+	
+	/**
+	 * get the register image. (see pack)
+	 * the cached image is returned, unless the parameter members were written
+	 * directly after it was packed. then they are packed into the work buffer.
+	 *
+	 * @param work work buffer (TIMBRE_REG_NUM bytes)
+	 * @return register image
+	 */
+	const uint8_t* getImage(uint8_t *work) const {
+		if(memcmp(&algorithm, m_packed, TIMBRE_FIELD_SIZE) == 0) return m_regImage;
+		this->pack(work);
+		return work;
+	}
+	
+	/**
+	 * get the carrier operators of the algorithm.
+	 *
+	 * @return bit mask of the carriers (MASK_OP1-MASK_OP4)
+	 */
+	uint8_t getCarrier(void) const { return CARRIER_MASK[algorithm & 0x07]; }
+	
+	// Register values of the parameters. (for the constexpr constructors)
+	static constexpr uint8_t packDTML(int8_t dt, uint8_t ml){
+		return (uint8_t)(((((dt >= 0) ? dt : (4 - dt)) & 0x07) << 4) | (ml & 0x0F));
+	}
+	static constexpr uint8_t packTL(uint8_t tl){ return tl & 0x7F; }
+	static constexpr uint8_t packKSAR(uint8_t ks, uint8_t ar){ return (uint8_t)(((ks & 0x03) << 6) | (ar & 0x1F)); }
+	static constexpr uint8_t packDR(uint8_t dr){ return dr & 0x1F; }
+	static constexpr uint8_t packSR(uint8_t sr){ return sr & 0x1F; }
+	static constexpr uint8_t packSLRR(uint8_t sl, uint8_t rr){ return (uint8_t)(((sl & 0x0F) << 4) | (rr & 0x0F)); }
+	static constexpr uint8_t packFBAL(uint8_t fb, uint8_t al){ return (uint8_t)(((fb & 0x07) << 3) | (al & 0x07)); }
+	
+	static const uint8_t CARRIER_MASK[8];	//!< carrier operators of each algorithm (bit mask as opMask)
+
+private:
+	uint8_t m_packed[TIMBRE_FIELD_SIZE];	//!< parameter members which m_regImage was packed from
+	uint8_t m_regImage[TIMBRE_REG_NUM];	//!< register image packed from the parameters (see pack)
 };
 
 #endif
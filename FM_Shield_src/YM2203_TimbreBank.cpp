@@ -0,0 +1,206 @@
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "YM2203_TimbreBank.h"
+
+#define TIMBRE_BANK_VERSION_OFFSET	4	//!< offset of the version
+#define TIMBRE_BANK_VOICES_OFFSET	6	//!< offset of the number of voices
+
+/**
+ * read a 16bit little endian value.
+ */
+static uint16_t loadLE16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | ((uint16_t)p[1] << 8));
+}
+
+/**
+ * write a 16bit little endian value.
+ */
+static void storeLE16(uint8_t *p, uint16_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+}
+
+/**
+ * constructor.
+ */
+YM2203_TimbreBank::YM2203_TimbreBank()
+{
+	m_data = NULL;
+	m_voiceNum = 0;
+	m_recordNum = 0;
+}
+
+/**
+ * open a bank image.
+ * the image is read in place, so it must stay while the bank is open.
+ *
+ * @param data bank image (const data in ROM, or a mapped file on PC)
+ * @param size size of the image [byte]
+ * @return true if the image is a timbre bank
+ */
+bool YM2203_TimbreBank::open(const uint8_t *data, uint32_t size)
+{
+	uint32_t voiceNum, indexEnd;
+
+	this->close();
+	if( (data == NULL) || (size < TIMBRE_BANK_HEADER) ) return false;
+	if( memcmp(data, "YMTB", 4) != 0 ) return false;
+	if( loadLE16(&data[TIMBRE_BANK_VERSION_OFFSET]) != TIMBRE_BANK_VERSION ) return false;
+
+	voiceNum = loadLE16(&data[TIMBRE_BANK_VOICES_OFFSET]);
+	indexEnd = TIMBRE_BANK_HEADER + voiceNum * 2;
+	if(size < indexEnd) return false;
+
+	m_data = data;
+	m_voiceNum = (uint16_t)voiceNum;
+	// the voices of the records out of the image are empty (see getRecord)
+	m_recordNum = (uint16_t)((size - indexEnd) / TIMBRE_BANK_RECORD);
+	return true;
+}
+
+/**
+ * close the bank image. (all the voices are empty)
+ */
+void YM2203_TimbreBank::close(void)
+{
+	m_data = NULL;
+	m_voiceNum = 0;
+	m_recordNum = 0;
+}
+
+/**
+ * whether a bank image is open.
+ *
+ * @return true if open
+ */
+bool YM2203_TimbreBank::isOpen(void)
+{
+	return (m_data != NULL);
+}
+
+/**
+ * number of voices. (including empty ones)
+ *
+ * @return number of voices
+ */
+int YM2203_TimbreBank::getVoiceNum(void)
+{
+	return m_voiceNum;
+}
+
+/**
+ * whether the bank has a voice.
+ *
+ * @param num voice number
+ * @return true if the voice is not empty
+ */
+bool YM2203_TimbreBank::hasVoice(int num)
+{
+	return (this->getRecord(num) != NULL);
+}
+
+/**
+ * load a voice into a timbre.
+ * an empty voice is loaded as a silent timbre. (all parameters 0)
+ *
+ * @param num voice number
+ * @param timbre timbre (out)
+ * @return true if the voice is not empty
+ */
+bool YM2203_TimbreBank::load(int num, YM2203_Timbre *timbre)
+{
+	static const uint8_t EMPTY_RECORD[TIMBRE_BANK_RECORD] = { 0 };
+	const uint8_t *record = this->getRecord(num);
+
+	if(record == NULL){
+		timbre->unpack(EMPTY_RECORD, 0);
+		return false;
+	}
+	timbre->unpack(record, record[TIMBRE_REG_NUM]);
+	return true;
+}
+
+/**
+ * get the record of a voice.
+ * (the register image for YM2203_Timbre::unpack, and the operator mask)
+ *
+ * @param num voice number
+ * @return record (TIMBRE_BANK_RECORD bytes). NULL if the voice is empty.
+ */
+const uint8_t* YM2203_TimbreBank::getRecord(int num)
+{
+	uint16_t record;
+
+	if( (num < 0) || (num >= m_voiceNum) ) return NULL;
+	record = loadLE16(&m_data[TIMBRE_BANK_HEADER + num * 2]);
+	if(record >= m_recordNum) return NULL;
+	return &m_data[TIMBRE_BANK_HEADER + m_voiceNum * 2 + record * TIMBRE_BANK_RECORD];
+}
+
+/**
+ * size of a bank image.
+ *
+ * @param voiceNum number of voices
+ * @param recordNum number of voices which are not empty
+ * @return size [byte]
+ */
+uint32_t YM2203_TimbreBank::getImageSize(int voiceNum, int recordNum)
+{
+	return TIMBRE_BANK_HEADER + (uint32_t)voiceNum * 2 + (uint32_t)recordNum * TIMBRE_BANK_RECORD;
+}
+
+/**
+ * make a bank image. (e.g. by a tool on PC)
+ *
+ * @param timbres timbre of each voice (NULL: empty voice)
+ * @param num number of voices (up to 0xFFFE)
+ * @param data bank image (out)
+ * @param size size of the buffer [byte]
+ * @return size of the image [byte]. 0 if the buffer is too small.
+ */
+uint32_t YM2203_TimbreBank::make(const YM2203_Timbre *const *timbres, int num, uint8_t *data, uint32_t size)
+{
+	uint8_t *record;
+	int i, records = 0;
+
+	if( (num < 0) || (num >= TIMBRE_BANK_EMPTY) ) return 0;
+	for(i=0; i<num; i++){
+		if(timbres[i] != NULL) records++;
+	}
+	if(size < getImageSize(num, records)) return 0;
+
+	memcpy(data, "YMTB", 4);
+	storeLE16(&data[TIMBRE_BANK_VERSION_OFFSET], TIMBRE_BANK_VERSION);
+	storeLE16(&data[TIMBRE_BANK_VOICES_OFFSET], (uint16_t)num);
+	record = &data[getImageSize(num, 0)];
+	records = 0;
+	for(i=0; i<num; i++){
+		if(timbres[i] == NULL){
+			storeLE16(&data[TIMBRE_BANK_HEADER + i * 2], TIMBRE_BANK_EMPTY);
+			continue;
+		}
+		storeLE16(&data[TIMBRE_BANK_HEADER + i * 2], (uint16_t)records++);
+		timbres[i]->pack(record);
+		record[TIMBRE_REG_NUM] = timbres[i]->opMask & MASK_ALL;
+		record += TIMBRE_BANK_RECORD;
+	}
+	return getImageSize(num, records);
+}
@@ -0,0 +1,60 @@
+#ifndef __YM2203_TIMBRE_BANK_H_
+#define __YM2203_TIMBRE_BANK_H_
+
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "YM2203_Timbre.h"
+
+// Timbre bank image (all values are little endian)
+//   header : "YMTB", version (16bit), number of voices N (16bit)
+//   index  : record number of each voice (16bit x N, TIMBRE_BANK_EMPTY: no voice)
+//   records: register image (TIMBRE_REG_NUM bytes, see YM2203_Timbre::pack) and operator mask
+#define TIMBRE_BANK_VERSION		0x0001	//!< version of the bank format
+#define TIMBRE_BANK_HEADER		8		//!< bytes of the header
+#define TIMBRE_BANK_RECORD		(TIMBRE_REG_NUM + 1)	//!< bytes of a record
+#define TIMBRE_BANK_EMPTY		0xFFFF	//!< index of an empty voice
+
+/**
+ * YM2203 timbre bank class
+ * reads the voices of a bank image in place. the image can be const data
+ * in ROM on GR-SAKURA, or a file mapped to the memory on PC,
+ * so a bank of hundreds of voices doesn't take RAM.
+ * a voice is unpacked into a YM2203_Timbre only when it is loaded.
+ */
+class YM2203_TimbreBank
+{
+public:
+	YM2203_TimbreBank();			//!< constructor.
+
+	bool open(const uint8_t *data, uint32_t size);	//!< open a bank image.
+	void close(void);								//!< close the bank image.
+	bool isOpen(void);								//!< whether a bank image is open.
+	int  getVoiceNum(void);							//!< number of voices. (including empty ones)
+	bool hasVoice(int num);							//!< whether the bank has a voice.
+	bool load(int num, YM2203_Timbre *timbre);		//!< load a voice into a timbre.
+	const uint8_t* getRecord(int num);				//!< get the record of a voice.
+	static uint32_t getImageSize(int voiceNum, int recordNum);	//!< size of a bank image.
+	static uint32_t make(const YM2203_Timbre *const *timbres, int num, uint8_t *data, uint32_t size);	//!< make a bank image.
+
+private:
+	const uint8_t *m_data;			//!< bank image
+	uint16_t m_voiceNum;			//!< number of voices
+	uint16_t m_recordNum;			//!< number of records
+};
+
+#endif
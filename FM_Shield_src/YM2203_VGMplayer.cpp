@@ -0,0 +1,600 @@
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+// just for algorithm debug on PC
+#ifdef PC_DEBUG
+#include <stdint.h>
+#include <stdio.h>
+#define delay(i)				;
+
+// for real machine
+#else
+#include <rxduino.h>
+#include <iodefine_gcc63n.h>
+#include <intvect.h>
+#endif
+
+#include "YM2203_VGMplayer.h"
+
+//! clock of TMR0,1 counter [Hz] (48MHz / 64)
+#define TMR_CLOCK			750000UL
+//! common divisor of TMR_CLOCK and VGM_SAMPLE_RATE
+#define TMR_SAMPLE_GCD		300
+
+// VGM header
+#define VGM_HEADER_SIZE		0x48		//!< header bytes used by this player (up to the YM2203 clock)
+#define VGM_EOF_OFFSET		0x04		//!< offset of (file size - 4)
+#define VGM_VERSION_OFFSET	0x08		//!< offset of version
+#define VGM_TOTAL_SAMPLES	0x18		//!< offset of total samples
+#define VGM_LOOP_OFFSET		0x1C		//!< offset of (loop offset - 0x1C)
+#define VGM_DATA_OFFSET		0x34		//!< offset of (data offset - 0x34) (version 1.50 -)
+#define VGM_YM2203_CLOCK	0x44		//!< offset of YM2203 clock (version 1.51 -)
+
+// VGM commands
+#define VGM_CMD_YM2203		0x55		//!< write a YM2203 register (aa dd)
+#define VGM_CMD_WAIT		0x61		//!< wait n samples (nnnn)
+#define VGM_CMD_WAIT_60HZ	0x62		//!< wait 735 samples
+#define VGM_CMD_WAIT_50HZ	0x63		//!< wait 882 samples
+#define VGM_CMD_END			0x66		//!< end of data
+#define VGM_CMD_DATA_BLOCK	0x67		//!< data block (0x66 tt ssssssss data)
+
+/**
+ * read a 32bit little endian value.
+ */
+static uint32_t loadLE(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * operand bytes of the commands for the other chips. (-1: unknown command)
+ */
+static int operandBytes(uint8_t cmd)
+{
+	if( (0x30 <= cmd) && (cmd <= 0x3F) ) return 1;
+	if( (0x40 <= cmd) && (cmd <= 0x4E) ) return 2;
+	if( (cmd == 0x4F) || (cmd == 0x50) ) return 1;
+	if( (0x51 <= cmd) && (cmd <= 0x5F) ) return 2;
+	if( (0xA0 <= cmd) && (cmd <= 0xBF) ) return 2;
+	if( (0xC0 <= cmd) && (cmd <= 0xDF) ) return 3;
+	if(  0xE0 <= cmd )                   return 4;
+	switch(cmd){
+	case 0x68: return 11;	// PCM RAM write
+	case 0x90: return 4;	// DAC stream control
+	case 0x91: return 4;
+	case 0x92: return 5;
+	case 0x93: return 10;
+	case 0x94: return 1;
+	case 0x95: return 4;
+	default:   return -1;
+	}
+}
+
+/**
+ * constructor.
+ */
+YM2203_VGMplayer::YM2203_VGMplayer()
+{
+	m_ym2203 = &m_device;
+	m_reader = NULL;
+	m_readerContext = NULL;
+	m_memory = NULL;
+	m_memorySize = 0;
+	m_bufferTop = 0;
+	m_bufferEnd = 0;
+	m_pos = 0;
+	m_starved = false;
+	m_underruns = 0;
+	m_dataOffset = 0;
+	m_loopOffset = 0;
+	m_endOffset = 0;
+	m_totalSamples = 0;
+	m_loopCount = 0;
+	m_loopRest = 0;
+	m_wait = 0;
+	m_isPlaying = false;
+	m_tmrSamples = 1;
+	m_tmrCompare = 0;
+	m_tmrRest = 0;
+#ifdef PC_DEBUG
+	m_hostTimer = NULL;
+	m_hostContext = NULL;
+#endif
+}
+
+/**
+ * destructor.
+ */
+YM2203_VGMplayer::~YM2203_VGMplayer()
+{
+	// nothing to do
+}
+
+/**
+ * initialize this player.
+ * to play VGM and MML on the same FM-Shield, pass MMLplayer.getDevice(),
+ * so that both players write through the same YM2203 object.
+ *
+ * @param ym2203 YM2203 device shared with another player (already initialized).
+ *               NULL to initialize and use the own device.
+ */
+void YM2203_VGMplayer::begin(YM2203 *ym2203)
+{
+	if(ym2203 != NULL){
+		m_ym2203 = ym2203;
+	}else{
+		m_ym2203 = &m_device;
+		m_ym2203->begin();
+	}
+
+	// initialize timers
+	this->initTMR();
+}
+
+/**
+ * initialize TMR0,1 timers. (the same setting as the MML player)
+ */
+void YM2203_VGMplayer::initTMR(void)
+{
+	m_tmrSamples = VGM_WAIT_MIN;
+	m_tmrRest = 0;
+	m_tmrCompare = (uint16_t)(VGM_WAIT_MIN * (TMR_CLOCK / TMR_SAMPLE_GCD) / (VGM_SAMPLE_RATE / TMR_SAMPLE_GCD));
+
+#ifndef PC_DEBUG
+	// TMR0(8bit) + TMR1(8bit) cascaded 16bit timer mode
+	// TMR1 is clocked at PCLKB(48MHz) / 64
+	// (see YM2203_MMLplayer::initTMR)
+	SYSTEM.PRCR.WORD = 0xA50B;		// enable writing to proteced registers
+	MSTP(TMR01) = 0;				// turn on TMR0,1
+
+	TMR0.TCCR.BIT.CSS = 0x03;		// TMR0 clocked by TMR1 overflow
+	TMR1.TCCR.BIT.CSS = 0x01;		// TMR1 clocked by PCLKB / prescaler
+	TMR1.TCCR.BIT.CKS = 0x04;		// 1/64  prescaler for TMR1
+
+	TMR0.TCR.BIT.CCLR = 0x01;		// set counter clear by compare match A
+	TMR0.TCR.BIT.CMIEA = 0x01;		// enable compare match A interrupt
+
+	IPR(TMR0, CMIA0) = 1;			// set interrupt priority level
+#endif
+}
+
+/**
+ * open a VGM stream.
+ * only the header is read here. the commands are read while playing.
+ *
+ * @param reader reader of the stream
+ * @param context argument for the reader
+ * @return true if the stream is a VGM for YM2203
+ */
+bool YM2203_VGMplayer::open(VGM_Reader reader, void* context)
+{
+	uint8_t header[VGM_HEADER_SIZE];
+	uint32_t version;
+	int size;
+
+	this->stop();
+	m_reader = reader;
+	m_readerContext = context;
+	m_bufferTop = 0;
+	m_bufferEnd = 0;
+
+	memset(header, 0, sizeof(header));
+	size = m_reader(m_readerContext, 0, header, VGM_HEADER_SIZE);
+	if( (size < 0x40) || (memcmp(header, "Vgm ", 4) != 0) ) return false;
+
+	version = loadLE(&header[VGM_VERSION_OFFSET]);
+	m_endOffset = loadLE(&header[VGM_EOF_OFFSET]) + VGM_EOF_OFFSET;
+	m_totalSamples = loadLE(&header[VGM_TOTAL_SAMPLES]);
+	m_loopOffset = loadLE(&header[VGM_LOOP_OFFSET]);
+	if(m_loopOffset != 0) m_loopOffset += VGM_LOOP_OFFSET;
+	m_dataOffset = 0x40;
+	if( (version >= 0x150) && (loadLE(&header[VGM_DATA_OFFSET]) != 0) ){
+		m_dataOffset = loadLE(&header[VGM_DATA_OFFSET]) + VGM_DATA_OFFSET;
+	}
+
+	// the header field of YM2203 clock must be there, and not 0
+	if( (version < 0x151) || (m_dataOffset < VGM_HEADER_SIZE) ) return false;
+	if( (loadLE(&header[VGM_YM2203_CLOCK]) & 0x3FFFFFFF) == 0 ) return false;
+
+	m_pos = m_dataOffset;
+	this->fill();
+	return true;
+}
+
+/**
+ * open a VGM image in memory. (e.g. const data in ROM)
+ *
+ * @param data VGM image
+ * @param size size of the image [byte]
+ * @return true if the image is a VGM for YM2203
+ */
+bool YM2203_VGMplayer::open(const uint8_t *data, uint32_t size)
+{
+	m_memory = data;
+	m_memorySize = size;
+	return this->open(readMemory, this);
+}
+
+/**
+ * set how many times the loop is repeated.
+ * (the stream is played to the end at first, and then the loop is repeated)
+ *
+ * @param count repeat count. 0: no repeat, VGM_LOOP_INFINITE: forever
+ */
+void YM2203_VGMplayer::setLoopCount(int count)
+{
+	m_loopCount = count;
+}
+
+/**
+ * read the stream into the double buffer while it has room.
+ * a half of the buffer is read when the timer procedure has left it.
+ * call it from loop() while playing, out of the interrupt.
+ * (playAndWait() calls it)
+ *
+ * @return true if the buffer has the stream up to the end
+ */
+bool YM2203_VGMplayer::fill(void)
+{
+	uint32_t pos, end, half;
+	int size;
+
+	if(m_reader == NULL) return true;
+
+	// the stream jumped out of the buffer (loop or data block). read from there
+	pos = m_pos;
+	end = m_bufferEnd;
+	if( (pos < m_bufferTop) || (pos > end) ){
+		m_bufferEnd = end = pos;
+		m_bufferTop = pos;
+	}
+
+	// read up to the end of the next half, if the timer procedure is out of it
+	while(end < m_endOffset)
+	{
+		half = (end | (VGM_BUFFER_SIZE - 1)) + 1;
+		if(half - pos > VGM_BUFFER_SIZE * 2) break;
+		if(half - m_bufferTop > VGM_BUFFER_SIZE * 2) m_bufferTop = half - VGM_BUFFER_SIZE * 2;
+
+		size = m_reader(m_readerContext, end, &m_buffer[end & (VGM_BUFFER_SIZE * 2 - 1)], (int)(half - end));
+		if(size <= 0){
+			m_endOffset = end;		// the stream is shorter than the header says
+			break;
+		}
+		end += (uint32_t)size;
+		m_bufferEnd = end;
+	}
+	return end >= m_endOffset;
+}
+
+/**
+ * start to play the stream.
+ */
+void YM2203_VGMplayer::play(void)
+{
+	if(m_reader == NULL) return;
+
+	// the registers are written by the stream
+	m_ym2203->invalidateShadow();
+
+	m_pos = m_dataOffset;
+	this->fill();
+	m_loopRest = m_loopCount;
+	m_wait = 0;
+	m_underruns = 0;
+	m_isPlaying = true;
+	this->setTimerSamples(VGM_WAIT_MIN);
+
+	// take over the TMR0 interrupt
+	YM2203_setTimerHandler(timerHandler, this);
+#ifndef PC_DEBUG
+	TMR01.TCNT = 0x0000;			// clear the counter
+	IR (TMR0, CMIA0) = 0;			// clear interrupt
+	IEN(TMR0, CMIA0) = 1;			// enable compare match A interrupt
+#endif
+}
+
+/**
+ * start to play the stream, and wait for the end.
+ * the stream is read into the buffer while waiting.
+ */
+void YM2203_VGMplayer::playAndWait(void)
+{
+	this->play();
+
+	while(m_isPlaying)
+	{
+		this->fill();
+#ifdef PC_DEBUG
+		// no timer interrupt on PC. run the timer procedure here.
+		this->onTimer();
+		if(m_hostTimer != NULL){
+			m_hostTimer(m_hostContext, this->getTimerInterval());
+		}
+#else
+		delay(1);
+#endif
+	}
+}
+
+/**
+ * stop playing, and note off all channels.
+ */
+void YM2203_VGMplayer::stop(void)
+{
+	int ch;
+
+	if(!m_isPlaying) return;
+	m_isPlaying = false;
+
+	// note off all channels.
+	for(ch=0; ch<ALL_CH_NUM; ch++)
+	{
+		m_ym2203->noteOff(ch);
+	}
+	while( m_ym2203->issueQueued() ){
+		;
+	}
+
+	// the registers were written by the stream, not by the driver APIs
+	m_ym2203->invalidateShadow();
+
+	// give the TMR0 interrupt back to the MML player
+	YM2203_setTimerHandler(NULL, NULL);
+}
+
+/**
+ * whether playing now or not.
+ *
+ * @return true if playing now
+ */
+bool YM2203_VGMplayer::isPlaying(void)
+{
+	return m_isPlaying;
+}
+
+/**
+ * interval procedure for playing the stream.
+ * executes the commands until the next wait. the writes of waits shorter than
+ * VGM_WAIT_MIN are batched, and at most VGM_WRITE_MAX writes (VGM_COMMAND_MAX commands)
+ * are done in a call.
+ * the time of the stream is kept, so a late call is caught up later.
+ * if the buffer runs out in a command (fill() wasn't called in time),
+ * the command is read again at the next interrupt.
+ */
+void YM2203_VGMplayer::onTimer(void)
+{
+	int writes = 0;
+	int commands;
+	uint32_t pos;
+	bool done;
+
+	if(!m_isPlaying) return;
+
+	m_wait -= m_tmrSamples;
+	for(commands=0; (m_wait <= 0) && (writes < VGM_WRITE_MAX) && (commands < VGM_COMMAND_MAX); commands++)
+	{
+		pos = m_pos;
+		m_starved = false;
+		done = this->execCommand(&writes);
+		if(m_starved){
+			// underrun: check again at the next interrupt
+			m_pos = pos;
+			m_underruns++;
+			break;
+		}
+		if(!done){
+			this->stop();
+			return;
+		}
+	}
+
+	// the writes are not held (if the device is shared with interleaved devices)
+	while( m_ym2203->issueQueued() ){
+		;
+	}
+
+	// sleep until the next command
+	this->setTimerSamples(m_wait);
+}
+
+/**
+ * get the interval of the timer interrupt.
+ * (until the next interrupt, which is set by onTimer())
+ *
+ * @return interval [ns]
+ */
+uint32_t YM2203_VGMplayer::getTimerInterval(void)
+{
+	// TMR1 is clocked at 48MHz / 64
+	return (uint32_t)m_tmrCompare * 4000 / 3;
+}
+
+/**
+ * length of the stream without loop.
+ *
+ * @return samples [1/VGM_SAMPLE_RATE sec]
+ */
+uint32_t YM2203_VGMplayer::getTotalSamples(void)
+{
+	return m_totalSamples;
+}
+
+/**
+ * number of timer procedures which found the buffer empty
+ * before the end of the stream. (fill() should be called more often)
+ *
+ * @return number of procedures (cleared by play)
+ */
+uint32_t YM2203_VGMplayer::getUnderruns(void)
+{
+	return m_underruns;
+}
+
+#ifdef PC_DEBUG
+/**
+ * set the host timer callback. (for algorithm debug on PC)
+ * playAndWait() calls it after each timer procedure,
+ * so the host can render the elapsed interval.
+ *
+ * @param func callback function. NULL to remove.
+ * @param context argument for the callback
+ */
+void YM2203_VGMplayer::setHostTimer(YM2203_HostTimer func, void* context)
+{
+	m_hostTimer = func;
+	m_hostContext = context;
+}
+
+/**
+ * set the simulated bus of the YM2203 device. (for algorithm debug on PC)
+ *
+ * @param bus simulated bus (NULL: the global YM2203_simBus)
+ */
+void YM2203_VGMplayer::setSimBus(YM2203_SimBus *bus)
+{
+	m_ym2203->getBus()->attach(bus);
+}
+#endif
+
+/**
+ * set samples until the next timer interrupt.
+ * (the remainder of the compare match value is carried to the next interval)
+ *
+ * @param samples samples (clipped to VGM_WAIT_MIN - VGM_WAIT_MAX)
+ */
+void YM2203_VGMplayer::setTimerSamples(int samples)
+{
+	uint32_t counts;
+
+	if(samples < VGM_WAIT_MIN) samples = VGM_WAIT_MIN;
+	if(samples > VGM_WAIT_MAX) samples = VGM_WAIT_MAX;
+
+	counts = (uint32_t)samples * (TMR_CLOCK / TMR_SAMPLE_GCD) + m_tmrRest;
+	m_tmrSamples = (uint16_t)samples;
+	m_tmrCompare = (uint16_t)(counts / (VGM_SAMPLE_RATE / TMR_SAMPLE_GCD));
+	m_tmrRest = (uint16_t)(counts % (VGM_SAMPLE_RATE / TMR_SAMPLE_GCD));
+
+#ifndef PC_DEBUG
+	TMR01.TCORA = m_tmrCompare;
+#endif
+}
+
+/**
+ * read a byte of the stream from the buffer.
+ * (m_starved is set if the byte is not read by fill() yet)
+ *
+ * @return byte (-1 at the end of the stream, or not in the buffer)
+ */
+int YM2203_VGMplayer::readByte(void)
+{
+	if(m_pos >= m_endOffset) return -1;
+	if( (m_pos < m_bufferTop) || (m_pos >= m_bufferEnd) ){
+		m_starved = true;
+		return -1;
+	}
+	return m_buffer[m_pos++ & (VGM_BUFFER_SIZE * 2 - 1)];
+}
+
+/**
+ * execute a command of the stream.
+ *
+ * @param writes number of register writes in the call (in/out)
+ * @return false at the end of the stream
+ */
+bool YM2203_VGMplayer::execCommand(int *writes)
+{
+	int cmd, addr, data, n;
+	uint32_t size;
+
+	cmd = this->readByte();
+	switch(cmd){
+	case VGM_CMD_YM2203:
+		addr = this->readByte();
+		data = this->readByte();
+		if(data < 0) return false;
+		m_ym2203->write((uint8_t)addr, (uint8_t)data);
+		(*writes)++;
+		break;
+	case VGM_CMD_WAIT:
+		n  = this->readByte();
+		n |= this->readByte() << 8;
+		if(n < 0) return false;
+		m_wait += n;
+		break;
+	case VGM_CMD_WAIT_60HZ:
+		m_wait += 735;
+		break;
+	case VGM_CMD_WAIT_50HZ:
+		m_wait += 882;
+		break;
+	case VGM_CMD_DATA_BLOCK:
+		// skip the data block (0x66 tt ssssssss)
+		this->readByte();
+		this->readByte();
+		size = 0;
+		for(n=0; n<4; n++){
+			size |= (uint32_t)this->readByte() << (n * 8);
+		}
+		m_pos += size;
+		break;
+	case VGM_CMD_END:
+	case -1:
+		// repeat the loop, or end
+		if(m_starved) return false;
+		if( (m_loopOffset == 0) || (m_loopRest == 0) ) return false;
+		if(m_loopRest > 0) m_loopRest--;
+		m_pos = m_loopOffset;
+		break;
+	default:
+		if( (0x70 <= cmd) && (cmd <= 0x7F) ){
+			m_wait += (cmd & 0x0F) + 1;			// wait n+1 samples
+		}else if( (0x80 <= cmd) && (cmd <= 0x8F) ){
+			m_wait += (cmd & 0x0F);				// YM2612 DAC write and wait n samples
+		}else{
+			// commands for the other chips
+			n = operandBytes((uint8_t)cmd);
+			if(n < 0) return false;				// unknown command
+			m_pos += n;
+		}
+		break;
+	}
+	return true;
+}
+
+/**
+ * reader of a VGM image in memory.
+ */
+int YM2203_VGMplayer::readMemory(void* context, uint32_t offset, uint8_t *buffer, int size)
+{
+	YM2203_VGMplayer *player = (YM2203_VGMplayer*)context;
+
+	if(offset >= player->m_memorySize) return 0;
+	if((uint32_t)size > player->m_memorySize - offset) size = (int)(player->m_memorySize - offset);
+	memcpy(buffer, player->m_memory + offset, size);
+	return size;
+}
+
+/**
+ * TMR0 interrupt handler. (while playing)
+ */
+void YM2203_VGMplayer::timerHandler(void* context)
+{
+	((YM2203_VGMplayer*)context)->onTimer();
+}
@@ -0,0 +1,109 @@
+#ifndef __YM2203_VGM_PLAYER_H_
+#define __YM2203_VGM_PLAYER_H_
+
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "YM2203_MMLplayer.h"
+
+#define VGM_SAMPLE_RATE		44100	//!< time base of VGM files [Hz]
+#define VGM_BUFFER_SIZE		128		//!< each half of the read-ahead double buffer of the VGM stream [byte] (power of 2)
+#define VGM_WRITE_MAX		32		//!< maximum register writes in a timer procedure
+#define VGM_COMMAND_MAX		128		//!< maximum commands in a timer procedure
+#define VGM_WAIT_MIN		8		//!< minimum timer interval [samples] (shorter waits are batched)
+#define VGM_WAIT_MAX		3800	//!< maximum timer interval [samples] (fits in the 16bit compare match)
+#define VGM_LOOP_INFINITE	(-1)	//!< loop forever (see setLoopCount)
+
+/**
+ * reader of a VGM stream.
+ * reads up to size bytes at the offset of the stream.
+ *
+ * @return bytes read (0 at the end of the stream)
+ */
+typedef int (*VGM_Reader)(void* context, uint32_t offset, uint8_t *buffer, int size);
+
+/**
+ * YM2203 VGM player class
+ * decodes the commands of a VGM stream little by little in the timer procedure,
+ * so only VGM_BUFFER_SIZE * 2 bytes of the stream are in RAM.
+ * the stream is read into the double buffer by fill(), out of the interrupt.
+ * the timer procedure only decodes the buffered bytes. (playAndWait() calls fill(),
+ * or call it from loop())
+ * (on GR-SAKURA, it takes over the TMR0 interrupt from the MML player while playing.)
+ */
+class YM2203_VGMplayer
+{
+public:
+	YM2203_VGMplayer();			//!< constructor.
+	~YM2203_VGMplayer();		//!< destructor.
+
+	void begin(YM2203 *ym2203 = NULL);	//!< initialize this player.
+	bool open(VGM_Reader reader, void* context);		//!< open a VGM stream.
+	bool open(const uint8_t *data, uint32_t size);		//!< open a VGM image in memory.
+	void setLoopCount(int count);	//!< set how many times the loop is repeated.
+	bool fill(void);		//!< read the stream into the double buffer while it has room.
+	void play(void);		//!< start to play the stream.
+	void playAndWait(void);	//!< start to play the stream, and wait for the end.
+	void stop(void);		//!< stop playing, and note off all channels.
+	bool isPlaying(void);	//!< whether playing now or not.
+	void onTimer(void);		//!< interval procedure for playing the stream.
+	uint32_t getTimerInterval(void);	//!< get the interval of the timer interrupt. [ns]
+	uint32_t getTotalSamples(void);		//!< length of the stream without loop [samples]
+	uint32_t getUnderruns(void);		//!< number of timer procedures which found the buffer empty.
+#ifdef PC_DEBUG
+	void setHostTimer(YM2203_HostTimer func, void* context);	//!< set the host timer callback.
+	void setSimBus(YM2203_SimBus *bus);		//!< set the simulated bus of the YM2203 device.
+#endif
+
+private:
+	YM2203 m_device;				//!< YM2203 device. (if not shared)
+	YM2203 *m_ym2203;				//!< YM2203 device to write.
+	VGM_Reader m_reader;			//!< reader of the stream
+	void* m_readerContext;			//!< argument for the reader
+	const uint8_t *m_memory;		//!< VGM image (for open() in memory)
+	uint32_t m_memorySize;			//!< size of the VGM image
+	uint8_t  m_buffer[VGM_BUFFER_SIZE * 2];	//!< double buffer (stream offset n is at m_buffer[n % (VGM_BUFFER_SIZE * 2)])
+	volatile uint32_t m_bufferTop;	//!< stream offset of the oldest byte in the buffer (by fill)
+	volatile uint32_t m_bufferEnd;	//!< stream offset next to the newest byte in the buffer (by fill)
+	volatile uint32_t m_pos;		//!< stream offset of the next command (by onTimer)
+	bool m_starved;					//!< a command was not in the buffer yet
+	uint32_t m_underruns;			//!< timer procedures which found the buffer empty
+	uint32_t m_dataOffset;			//!< stream offset of the first command
+	uint32_t m_loopOffset;			//!< stream offset of the loop point (0: no loop)
+	uint32_t m_endOffset;			//!< stream offset of the end of file
+	uint32_t m_totalSamples;		//!< length of the stream without loop [samples]
+	int  m_loopCount;				//!< loop repeat count setting
+	int  m_loopRest;				//!< loops left
+	int32_t m_wait;					//!< samples until the next command (negative if late)
+	bool m_isPlaying;				//!< whether playing now or not.
+	uint16_t m_tmrSamples;			//!< samples until the next timer interrupt
+	uint16_t m_tmrCompare;			//!< compare match value of TMR0,1 for the interval
+	uint16_t m_tmrRest;				//!< remainder of the compare match value
+#ifdef PC_DEBUG
+	YM2203_HostTimer m_hostTimer;	//!< host timer callback
+	void* m_hostContext;			//!< argument for the host timer callback
+#endif
+
+	void initTMR(void);						//!< initialize TMR0,1 timers.
+	void setTimerSamples(int samples);		//!< set samples until the next timer interrupt.
+	int  readByte(void);					//!< read a byte of the stream. (-1 at the end)
+	bool execCommand(int *writes);			//!< execute a command of the stream.
+	static int readMemory(void* context, uint32_t offset, uint8_t *buffer, int size);	//!< reader of a VGM image in memory.
+	static void timerHandler(void* context);	//!< TMR0 interrupt handler.
+};
+
+#endif
@@ -0,0 +1,396 @@
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "YM2203_VoiceAllocator.h"
+
+/**
+ * constructor.
+ */
+YM2203_VoiceAllocator::YM2203_VoiceAllocator()
+{
+	m_chips = NULL;
+	memset(m_timbre, 0, sizeof(m_timbre));
+	m_policy = STEAL_OLDEST;
+	m_active = 0;
+	m_reuses = 0;
+	m_uploads = 0;
+	m_steals = 0;
+}
+
+/**
+ * start to allocate the channels of the devices.
+ * (all voices become free. the devices must be initialized)
+ *
+ * @param chips YM2203 devices
+ */
+void YM2203_VoiceAllocator::begin(YM2203_ChipSet *chips)
+{
+	int ch, kind, i;
+
+	m_chips = chips;
+	memset(m_noteHead, VOICE_NONE, sizeof(m_noteHead));
+	memset(m_in, 0, sizeof(m_in));
+	for(kind=0; kind<VOICE_KIND_NUM; kind++){
+		m_free[kind].head = m_free[kind].tail = VOICE_NONE;
+		m_busy[kind].head = m_busy[kind].tail = VOICE_NONE;
+		for(i=0; i<VOICE_VOLUME_NUM; i++){
+			m_quiet[kind][i].head = m_quiet[kind][i].tail = VOICE_NONE;
+		}
+		m_quietMask[kind] = 0;
+	}
+	for(i=0; i<VOICE_INST_MAX; i++){
+		m_instFree[i].head = m_instFree[i].tail = VOICE_NONE;
+	}
+	for(ch=0; ch<VOICE_CH_NUM; ch++){
+		m_inst[ch] = VOICE_NONE;
+		m_note[ch] = 0;
+		m_volume[ch] = 0;
+		m_loaded[ch] = VOICE_NONE;
+		m_noteNext[ch] = VOICE_NONE;
+		this->push(0, &m_free[kindOf(ch)], ch);
+	}
+	m_active = 0;
+	m_reuses = 0;
+	m_uploads = 0;
+	m_steals = 0;
+}
+
+/**
+ * set the timbre of an instrument.
+ * (the channels holding the old timbre of the instrument are forgotten)
+ *
+ * @param inst instrument (0 - VOICE_INST_MAX-1)
+ * @param timbre timbre. NULL for a SSG instrument.
+ */
+void YM2203_VoiceAllocator::setInstrument(int inst, const YM2203_Timbre *timbre)
+{
+	int ch;
+
+	if( (inst < 0) || (inst >= VOICE_INST_MAX) ) return;
+	m_timbre[inst] = timbre;
+	for(ch=0; ch<VOICE_CH_NUM; ch++){
+		if(m_loaded[ch] != inst) continue;
+		m_loaded[ch] = VOICE_NONE;
+		if(m_in[1][ch] == &m_instFree[inst]) this->remove(1, ch);
+	}
+}
+
+/**
+ * set the voice stealing policy.
+ *
+ * @param policy STEAL_OLDEST or STEAL_QUIETEST
+ */
+void YM2203_VoiceAllocator::setStealPolicy(int policy)
+{
+	if( (policy != STEAL_OLDEST) && (policy != STEAL_QUIETEST) ) return;
+	m_policy = (uint8_t)policy;
+}
+
+/**
+ * note-on a note of an instrument.
+ * a free channel holding the timbre of the instrument is used first,
+ * then the free channel released first. if all channels of the kind are
+ * busy, a voice is stolen by the policy.
+ *
+ * @param inst instrument (0 - VOICE_INST_MAX-1)
+ * @param note note (octave * 12 + key. octave 0 - 7)
+ * @param volume volume (0 - 15)
+ * @param cents detune in cents (pitch bend)
+ * @return channel assigned (VOICE_NONE if failed)
+ */
+int YM2203_VoiceAllocator::noteOn(int inst, int note, int volume, int cents)
+{
+	int kind, ch;
+
+	if( (m_chips == NULL) || (inst < 0) || (inst >= VOICE_INST_MAX) ) return VOICE_NONE;
+	if( (note < 0) || (note >= VOICE_NOTE_NUM) ) return VOICE_NONE;
+	if(volume < 0) volume = 0;
+	if(volume >= VOICE_VOLUME_NUM) volume = VOICE_VOLUME_NUM - 1;
+	kind = (m_timbre[inst] != NULL) ? VOICE_FM : VOICE_SSG;
+
+	// choose a voice
+	if( (kind == VOICE_FM) && (m_instFree[inst].head != VOICE_NONE) ){
+		ch = m_instFree[inst].head;
+	}else if( m_free[kind].head != VOICE_NONE ){
+		ch = m_free[kind].head;
+	}else{
+		ch = this->steal(kind);
+		if(ch == VOICE_NONE) return VOICE_NONE;
+		this->release(ch);
+		m_steals++;
+	}
+	this->remove(0, ch);
+	this->remove(1, ch);
+
+	// load the timbre, if the channel doesn't hold it
+	if(kind == VOICE_FM){
+		if(m_loaded[ch] != inst){
+			m_chips->setTimbre(ch, m_timbre[inst]);
+			m_loaded[ch] = (int8_t)inst;
+			m_uploads++;
+		}else{
+			m_reuses++;
+		}
+	}
+
+	// the voice is busy
+	m_inst[ch] = (int8_t)inst;
+	m_note[ch] = (int8_t)note;
+	m_volume[ch] = (int8_t)volume;
+	m_noteNext[ch] = m_noteHead[note];
+	m_noteHead[note] = (int8_t)ch;
+	this->push(0, &m_busy[kind], ch);
+	this->push(1, &m_quiet[kind][volume], ch);
+	m_quietMask[kind] |= (1 << volume);
+	m_active++;
+
+	// play
+	m_chips->setVolume(ch, volume);
+	m_chips->setNotePitch(ch, note, cents);
+	m_chips->noteOn(ch);
+
+	return ch;
+}
+
+/**
+ * note-off a note of an instrument.
+ * (the voice noted on last, if the note is played on some voices)
+ *
+ * @param inst instrument
+ * @param note note (octave * 12 + key)
+ */
+void YM2203_VoiceAllocator::noteOff(int inst, int note)
+{
+	int ch;
+
+	if( (m_chips == NULL) || (note < 0) || (note >= VOICE_NOTE_NUM) ) return;
+	for(ch=m_noteHead[note]; ch!=VOICE_NONE; ch=m_noteNext[ch]){
+		if(m_inst[ch] == inst){
+			this->release(ch);
+			return;
+		}
+	}
+}
+
+/**
+ * note-off all voices.
+ */
+void YM2203_VoiceAllocator::allNotesOff(void)
+{
+	int kind;
+
+	if(m_chips == NULL) return;
+	for(kind=0; kind<VOICE_KIND_NUM; kind++){
+		while(m_busy[kind].head != VOICE_NONE){
+			this->release(m_busy[kind].head);
+		}
+	}
+}
+
+/**
+ * change the volume of a voice playing.
+ * (the voice is kept in the order for STEAL_QUIETEST)
+ *
+ * @param ch busy voice (channel returned by noteOn)
+ * @param volume volume (0 - 15)
+ */
+void YM2203_VoiceAllocator::setVolume(int ch, int volume)
+{
+	int kind;
+
+	if( (ch < 0) || (ch >= VOICE_CH_NUM) || (m_inst[ch] == VOICE_NONE) ) return;
+	if(volume < 0) volume = 0;
+	if(volume >= VOICE_VOLUME_NUM) volume = VOICE_VOLUME_NUM - 1;
+	kind = kindOf(ch);
+	if(m_volume[ch] != volume){
+		this->remove(1, ch);
+		if(m_quiet[kind][m_volume[ch]].head == VOICE_NONE){
+			m_quietMask[kind] &= ~(1 << m_volume[ch]);
+		}
+		m_volume[ch] = (int8_t)volume;
+		this->push(1, &m_quiet[kind][volume], ch);
+		m_quietMask[kind] |= (1 << volume);
+	}
+	m_chips->setVolume(ch, volume);
+}
+
+/**
+ * instrument playing on a voice.
+ *
+ * @param ch voice
+ * @return instrument (VOICE_NONE if the voice is free)
+ */
+int YM2203_VoiceAllocator::getInstrument(int ch)
+{
+	if( (ch < 0) || (ch >= VOICE_CH_NUM) ) return VOICE_NONE;
+	return m_inst[ch];
+}
+
+/**
+ * note playing on a voice.
+ *
+ * @param ch busy voice
+ * @return note (octave * 12 + key)
+ */
+int YM2203_VoiceAllocator::getNote(int ch)
+{
+	if( (ch < 0) || (ch >= VOICE_CH_NUM) ) return 0;
+	return m_note[ch];
+}
+
+/**
+ * number of voices playing.
+ *
+ * @return number of voices
+ */
+int YM2203_VoiceAllocator::getActiveVoices(void)
+{
+	return m_active;
+}
+
+/**
+ * number of FM note-ons on a channel which already held the timbre.
+ *
+ * @return number of note-ons
+ */
+uint32_t YM2203_VoiceAllocator::getReuses(void)
+{
+	return m_reuses;
+}
+
+/**
+ * number of FM note-ons which uploaded the timbre.
+ *
+ * @return number of note-ons
+ */
+uint32_t YM2203_VoiceAllocator::getUploads(void)
+{
+	return m_uploads;
+}
+
+/**
+ * number of voices stolen.
+ *
+ * @return number of voices
+ */
+uint32_t YM2203_VoiceAllocator::getSteals(void)
+{
+	return m_steals;
+}
+
+/**
+ * append a voice to a list.
+ *
+ * @param link link of the list (0 or 1)
+ * @param list list
+ * @param ch voice
+ */
+void YM2203_VoiceAllocator::push(int link, YM2203_VoiceList *list, int ch)
+{
+	m_prev[link][ch] = list->tail;
+	m_next[link][ch] = VOICE_NONE;
+	if(list->tail != VOICE_NONE){
+		m_next[link][list->tail] = (int8_t)ch;
+	}else{
+		list->head = (int8_t)ch;
+	}
+	list->tail = (int8_t)ch;
+	m_in[link][ch] = list;
+}
+
+/**
+ * remove a voice from its list. (nothing if not in a list)
+ *
+ * @param link link of the list (0 or 1)
+ * @param ch voice
+ */
+void YM2203_VoiceAllocator::remove(int link, int ch)
+{
+	YM2203_VoiceList *list = m_in[link][ch];
+
+	if(list == NULL) return;
+	if(m_prev[link][ch] != VOICE_NONE){
+		m_next[link][m_prev[link][ch]] = m_next[link][ch];
+	}else{
+		list->head = m_next[link][ch];
+	}
+	if(m_next[link][ch] != VOICE_NONE){
+		m_prev[link][m_next[link][ch]] = m_prev[link][ch];
+	}else{
+		list->tail = m_prev[link][ch];
+	}
+	m_in[link][ch] = NULL;
+}
+
+/**
+ * note-off a voice, and make it free.
+ *
+ * @param ch busy voice
+ */
+void YM2203_VoiceAllocator::release(int ch)
+{
+	int kind = kindOf(ch);
+	int note = m_note[ch];
+	int8_t *p;
+
+	m_chips->noteOff(ch);
+
+	// out of the busy lists
+	this->remove(0, ch);
+	this->remove(1, ch);
+	if(m_quiet[kind][m_volume[ch]].head == VOICE_NONE){
+		m_quietMask[kind] &= ~(1 << m_volume[ch]);
+	}
+	for(p=&m_noteHead[note]; *p!=ch; p=&m_noteNext[*p]){
+		;
+	}
+	*p = m_noteNext[ch];
+
+	// into the free lists
+	m_inst[ch] = VOICE_NONE;
+	this->push(0, &m_free[kind], ch);
+	if(m_loaded[ch] != VOICE_NONE){
+		this->push(1, &m_instFree[m_loaded[ch]], ch);
+	}
+	m_active--;
+}
+
+/**
+ * choose a voice to steal.
+ *
+ * @param kind VOICE_FM or VOICE_SSG
+ * @return busy voice (VOICE_NONE if no voice of the kind)
+ */
+int YM2203_VoiceAllocator::steal(int kind)
+{
+	if( (m_policy == STEAL_QUIETEST) && (m_quietMask[kind] != 0) ){
+		return m_quiet[kind][__builtin_ctz(m_quietMask[kind])].head;
+	}
+	return m_busy[kind].head;
+}
+
+/**
+ * kind of a voice.
+ *
+ * @param ch voice (global channel number)
+ * @return VOICE_FM or VOICE_SSG
+ */
+int YM2203_VoiceAllocator::kindOf(int ch)
+{
+	return (YM2203_LOCAL_CH(ch) <= FM_CH3) ? VOICE_FM : VOICE_SSG;
+}
@@ -0,0 +1,105 @@
+#ifndef __YM2203_VOICE_ALLOCATOR_H_
+#define __YM2203_VOICE_ALLOCATOR_H_
+
+/*
+ * FM-Shield for GR-SAKURA
+ * Copyright (C) 2013 Bizan Nishimura (@lipoyang)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *		http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "YM2203_Chips.h"
+
+#define VOICE_CH_NUM		(ALL_CH_NUM * YM2203_CHIP_NUM)	//!< voices (all channels of the devices)
+#define VOICE_INST_MAX		128		//!< number of instruments
+#define VOICE_NOTE_NUM		(8 * KEY_NUM)	//!< number of notes (note = octave * 12 + key, octave 0 - 7)
+#define VOICE_VOLUME_NUM	16		//!< volume steps (0 - 15)
+#define VOICE_NONE			(-1)	//!< no voice
+
+// Kind of voices
+#define VOICE_FM			0		//!< FM channel
+#define VOICE_SSG			1		//!< SSG channel
+#define VOICE_KIND_NUM		2		//!< kinds of voices
+
+// Voice stealing policy (when all channels of the kind are busy)
+#define STEAL_OLDEST		0		//!< steal the voice noted on first (default)
+#define STEAL_QUIETEST		1		//!< steal the voice of the lowest volume (the oldest of them)
+
+/**
+ * doubly linked list of voices. (head: oldest)
+ */
+struct YM2203_VoiceList
+{
+	int8_t head;		//!< first voice (VOICE_NONE: empty)
+	int8_t tail;		//!< last voice (VOICE_NONE: empty)
+};
+
+/**
+ * voice allocator.
+ * assigns the channels of the YM2203 devices to notes of logical instruments.
+ * an instrument with a timbre plays on FM channels, without a timbre on SSG channels.
+ * the voices are kept in linked lists (free, busy, free by loaded timbre,
+ * busy by volume), so noteOn() and noteOff() take constant time and
+ * don't allocate memory. they can be called from an interrupt,
+ * but all calls must be made from the same context.
+ */
+class YM2203_VoiceAllocator
+{
+public:
+	YM2203_VoiceAllocator();	//!< constructor.
+
+	void begin(YM2203_ChipSet *chips);				//!< start to allocate the channels of the devices.
+	void setInstrument(int inst, const YM2203_Timbre *timbre);	//!< set the timbre of an instrument.
+	void setStealPolicy(int policy);				//!< set the voice stealing policy.
+	int  noteOn(int inst, int note, int volume, int cents = 0);	//!< note-on a note of an instrument.
+	void noteOff(int inst, int note);				//!< note-off a note of an instrument.
+	void allNotesOff(void);							//!< note-off all voices.
+	void setVolume(int ch, int volume);				//!< change the volume of a voice.
+	int  getInstrument(int ch);						//!< instrument playing on a voice.
+	int  getNote(int ch);							//!< note playing on a voice.
+	int  getActiveVoices(void);						//!< number of voices playing.
+	uint32_t getReuses(void);						//!< number of note-ons on a channel holding the timbre.
+	uint32_t getUploads(void);						//!< number of note-ons which uploaded the timbre.
+	uint32_t getSteals(void);						//!< number of voices stolen.
+
+private:
+	YM2203_ChipSet *m_chips;						//!< YM2203 devices
+	const YM2203_Timbre *m_timbre[VOICE_INST_MAX];	//!< timbre of each instrument (NULL: SSG)
+	int8_t  m_inst  [VOICE_CH_NUM];					//!< instrument playing on each voice (VOICE_NONE: free)
+	int8_t  m_note  [VOICE_CH_NUM];					//!< note playing on each voice
+	int8_t  m_volume[VOICE_CH_NUM];					//!< volume of each voice
+	int8_t  m_loaded[VOICE_CH_NUM];					//!< instrument of the timbre loaded on each voice
+	int8_t  m_noteNext[VOICE_CH_NUM];				//!< next voice playing the same note
+	int8_t  m_noteHead[VOICE_NOTE_NUM];				//!< voices playing each note
+	int8_t  m_prev[2][VOICE_CH_NUM];				//!< links of the lists (0: m_free/m_busy, 1: m_instFree/m_quiet)
+	int8_t  m_next[2][VOICE_CH_NUM];				//!< links of the lists
+	YM2203_VoiceList *m_in[2][VOICE_CH_NUM];		//!< list of each voice (NULL: none)
+	YM2203_VoiceList m_free[VOICE_KIND_NUM];		//!< free voices (in released order)
+	YM2203_VoiceList m_busy[VOICE_KIND_NUM];		//!< busy voices (in note-on order)
+	YM2203_VoiceList m_instFree[VOICE_INST_MAX];	//!< free FM voices by loaded instrument
+	YM2203_VoiceList m_quiet[VOICE_KIND_NUM][VOICE_VOLUME_NUM];	//!< busy voices by volume
+	uint16_t m_quietMask[VOICE_KIND_NUM];			//!< non-empty volumes of m_quiet (1bit each)
+	uint8_t m_policy;								//!< voice stealing policy
+	int m_active;									//!< number of voices playing
+	uint32_t m_reuses;								//!< note-ons on a channel holding the timbre
+	uint32_t m_uploads;								//!< note-ons which uploaded the timbre
+	uint32_t m_steals;								//!< voices stolen
+
+	void push(int link, YM2203_VoiceList *list, int ch);	//!< append a voice to a list.
+	void remove(int link, int ch);					//!< remove a voice from its list.
+	void release(int ch);							//!< note-off a voice, and make it free.
+	int  steal(int kind);							//!< choose a voice to steal.
+	static int kindOf(int ch);						//!< kind of a voice.
+};
+
+#endif
@@ -11,6 +11,15 @@
 // sample music "Jingle Bells"
 void music_JingleBells(void);
 
+// timbres of "Jingle Bells" (constexpr data in ROM)
+// algorithm, feedback, operator mask, AR, DR, SR, RR, SL, TL, KS, ML and DT of operator 1-4
+static constexpr YM2203_Timbre tmbEBass(2, 5, MASK_ALL,
+	{31, 31, 31, 31}, { 8, 14, 16, 12}, { 0,  6,  3,  5}, { 0,  9,  0,  8}, { 3,  2,  2,  2},
+	{34, 42, 20,  0}, { 0,  0,  0,  0}, { 0,  8,  0,  1}, { 3,  0,  7,  0});
+static constexpr YM2203_Timbre tmbBell(4, 0, MASK_ALL,
+	{31, 20, 31, 20}, {24, 23, 23, 23}, { 9,  8,  9,  8}, { 5,  5,  5,  5}, { 1,  1,  1,  1},
+	{11,  0, 11,  0}, { 0,  2,  0,  2}, { 8,  2,  4,  2}, { 1,  5,  5,  1});
+
 /**
  * initialize
  */
@@ -44,99 +53,52 @@ void loop()
  */
 void music_JingleBells(void)
 {
-	YM2203_Timbre tmbEBass, tmbZitar, tmbBell;
 	char *note1[6], *note2[6], *note3[6], *note4[6], *note5[6], *note6[6];
 
-	// E.BASS
-	tmbEBass.algorithm = 2;
-	tmbEBass.feedback  = 5;
-	tmbEBass.opMask    = MASK_ALL;
-	tmbEBass.setAR(31, 31, 31, 31);
-	tmbEBass.setDR( 8, 14, 16, 12);
-	tmbEBass.setSR( 0,  6,  3,  5);
-	tmbEBass.setRR( 0,  9,  0,  8);
-	tmbEBass.setSL( 3,  2,  2,  2);
-	tmbEBass.setTL(34, 42, 20,  0);
-	tmbEBass.setKS( 0,  0,  0,  0);
-	tmbEBass.setML( 0,  8,  0,  1);
-	tmbEBass.setDT( 3,  0,  7,  0);
-	
-	// ZITAR
-	tmbZitar.algorithm = 0;
-	tmbZitar.feedback  = 6;
-	tmbZitar.opMask    = MASK_ALL;
-	tmbZitar.setAR(18, 31, 31, 31);
-	tmbZitar.setDR( 5,  5,  5, 10);
-	tmbZitar.setSR( 3,  4,  3,  2);
-	tmbZitar.setRR( 1,  1,  3,  5);
-	tmbZitar.setSL( 2,  1,  2,  4);
-	tmbZitar.setTL(30, 28, 35,  0);
-	tmbZitar.setKS( 1,  1,  1,  0);
-	tmbZitar.setML( 3,  2,  1,  1);
-	tmbZitar.setDT( 7,  0,  0,  3);
-	
-	// BELL
-	tmbBell.algorithm = 4;
-	tmbBell.feedback  = 0;
-	tmbBell.opMask    = MASK_ALL;
-	tmbBell.setAR(31, 20, 31, 20);
-	tmbBell.setDR(24, 23, 23, 23);
-	tmbBell.setSR( 9,  8,  9,  8);
-	tmbBell.setRR( 5,  5,  5,  5);
-	tmbBell.setSL( 1,  1,  1,  1);
-	tmbBell.setTL(11,  0, 11,  0);
-	tmbBell.setKS( 0,  2,  0,  2);
-	tmbBell.setML( 8,  2,  4,  2);
-	tmbBell.setDT( 1,  5,  5,  1);
-	
-	// FM Ch-1: BELL -> ZITAR
-	note1[0] = (char*)"L8Q8O5V8DDDDV9DDV10DDV11DDDDDDDDDDDDDDDDDDDDDDDDDDDDDDDD";
-	note1[1] = (char*)"V14Q7O4DBAGD4RDDBAGE4REE>C<BAF+4R>DDDC<AB4RDDBAGD4RDDBADE4REE>C<BA>DDDDEDC<AGR>D4";
+	// FM Ch-1: BELL -> ZITAR (@44 of the preset timbres)
+	note1[0] = (char*)"L8Q8O5V8DDDDV9DDV10DDV11[D]32";
+	note1[1] = (char*)"@44V14Q7O4DBAGD4RDDBAGE4REE>C<BAF+4R>DDDC<AB4RDDBAGD4RDDBADE4REE>C<BA>DDDDEDC<AGR>D4";
 	note1[2] = (char*)"O4BBB4BBB4B>D<G.A16B4RR>CCC.C16C<BBBBAAGAR>D4<BBB4BBB4B>D<G.A16B4RR>CCC.C16C<BBB";
 	note1[3] = (char*)">DDC<AG4RR";
 	note1[4] = (char*)">DDC<AGR>D4";
 	note1[5] = (char*)">D4D4C4<A4G1.";
 
 	// FM Ch-2: BELL
-	note2[0] = (char*)"L8Q8O4V8>CCCCV9CCV10CCV11<BBBBBBBB>CCCCCCCC<BBBBBBBB>CCCCCCCC";
-	note2[1] = (char*)"V13Q4O5RRRRRD16C+16D16C+16DRRRRRE16D+16E16D+16ERRRRRF+16F16F+16F16F+RRRRR"
-	                  "D16D+16E16D+16DRRRRRD16C+16D16C+16DRRRRRE16D+16E16D+16ERRRRRF+16F16F+16F16F+RRRRRRD4";
-	note2[2] = (char*)"V13Q8O5DDDDDDDDDDDDDDDDCCCCCCCCC+C+C+C+DDDDDDDDDDDDDDDDDDDDCCCCCCCC";
+	note2[0] = (char*)"L8Q8O4V8>CCCCV9CCV10CCV11[<[B]8>[C]8]2";
+	note2[1] = (char*)"V13Q4O5[RRRRRD16C+16D16C+16DRRRRRE16D+16E16D+16ERRRRRF+16F16F+16F16F+RRRRR:D16D+16E16D+16D]2RD4";
+	note2[2] = (char*)"V13Q8O5[D]16[C]8[C+]4[D]20[C]8";
 	note2[3] = (char*)"DDDDD4RR";
 	note2[4] = (char*)"DDDDDRD4";
-	note2[5] = (char*)"DDDDDDDDDDDDDDDDDDDDRDD4";
+	note2[5] = (char*)"[D]20RDD4";
 
 	// FM Ch-3: E.BASS
-	note3[0] = (char*)"L8Q8O5V14O4Q8RRRRRRRRG4D4G4D4A4D4A4D4G4D4G4D4A4D4ADEF+";
-	note3[1] = (char*)"O4G4D4G4D4G4AB>C4<G4>C4<G4A4D4A4D4GDEF+G4D4G4D4G4AB>C4<G4>C4<G4A4D4ADEF+G4D4";
+	note3[0] = (char*)"L8Q8O5V14O4Q8[R]8[G4D4G4D4A4D4:A4D4]2ADEF+";
+	note3[1] = (char*)"O4[G4D4G4D4G4AB>C4<G4>C4<G4A4D4:A4D4GDEF+]2ADEF+G4D4";
 	note3[2] = (char*)"O4G4D4G4D4G4D4GGAB>C4C4<G4G4A4A4DDEF+G4D4G4D4G4D4GGAG>C4C4<G4G4";
 	note3[3] = (char*)"DDEF+GDEF+";
 	note3[4] = (char*)"DDEF+G4D4";
 	note3[5] = (char*)"A4D4A4D4G4D4G4D4G4D4GDG4";
 
 	// SSG Ch-A
-	note4[0] = (char*)"L8Q4O5V11RRRRRRRRRDRDRDRDRDRDRDRDRDRDRDRDRDRDRDRD";
-	note4[1] = (char*)"V11Q4O5RDRDRDRDRDRDRERFRERERDRDRDRDRDRDRDRDRDRDRDRDRERERERERDRDRDRDDV12Q6RD4";
-	note4[2] = (char*)"Q4O4RBRBRBRBRBRBRBRB>RCRC<RBRB>RC+RC+<RBRBRBRBRBRBRBRBRBRB>RCRC<RBRB";
+	note4[0] = (char*)"L8Q4O5V11[R]8[RD]16";
+	note4[1] = (char*)"V11Q4O5[RD]6RERFRERE[RD]12[RE]4[RD]4DV12Q6RD4";
+	note4[2] = (char*)"Q4O4[RB]8>[RC]2<[RB]2>[RC+]2<[RB]10>[RC]2<[RB]2";
 	note4[3] = (char*)"RARABRRR";
 	note4[4] = (char*)"RARABRA4";
 	note4[5] = (char*)"RARARARARBRBRBRBRBRBV13R>DD4";
 
 	// SSG Ch-B
-	note5[0] = (char*)"L8Q4O4V10RRRRRRRRRBRBRBRB>RCRCRCRC<RBR8RBRB>RCRCRCRC";
-	note5[1] = (char*)"V11Q4O4RBRBRBRBRBRB>RCRCRCRC<RARARARARBRBRBRBRBRBRBRB>RCRCRCRC<RARARARABV12Q6RA4";
-	note5[2] = (char*)"Q4O4RGRGRGRGRGRGRGRGRGRGRGRGRARARGRGRGRGRGRGRGRGRGRGRGRGRGRG";
+	note5[0] = (char*)"L8Q4O4V10[R]8[RB]4>[RC]4<RBR8RBRB>[RC]4R";
+	note5[1] = (char*)"V11Q4O4[RB]6>[RC]4<[RA]4[RB]8>[RC]4<[RA]4BV12Q6RA4";
+	note5[2] = (char*)"Q4O4[RG]12[RA]2[RG]14";
 	note5[3] = (char*)"RF+RF+GRRR";
 	note5[4] = (char*)"RF+RF+GR>D4";
 	note5[5] = (char*)"RF+RF+RF+RF+RGRGRGRGRGRGV13RAB4";
 
 	// SSG Ch-C
-	note6[0] = (char*)"L8Q4O4V10RRRRRRRRRARARARARARARARARARARARARARARARA";
-	note6[1] = (char*)"V11Q4O4RGRGRGRGRGRGRGRGRGRGRF+RF+RF+RF+RGRGRGRGRGRGRGRGRGRGRGRGRF+RF+RF+RF+GV12Q6RF+&F+";
-	note6[2] = (char*)"V10O6RRA+32B32A+32B32A+32B32A+32B32RRA+32B32A+32B32A32B32A+32B32RRA+32B32A+32B32A+32B32A+32B32"
-	                  "RRRRRRRRRRRRRRRRRRRRRR"
-	                  "A+32B32A+32B32A+32B32A+32B32RRA+32B32A+32B32A+32B32A+32B32RRA+32B32A+32B32A+32B32A+32B32"
-	                  "RRRRRRRRRRRR";
+	note6[0] = (char*)"L8Q4O4V10[R]8[RA]16";
+	note6[1] = (char*)"V11Q4O4[RG]10[RF+]4[RG]12[RF+]4GV12Q6RF+&F+";
+	note6[2] = (char*)"V10O6RR[A+32B32]4RRA+32B32A+32B32A32B32A+32B32RR[A+32B32]4[R]22[[A+32B32]4RR]3[R]10";
 	note6[3] = (char*)"RRRRRRRR";
 	note6[4] = (char*)"RRRRRRRR";
 	note6[5] = (char*)"V13Q6O5D4D4E4F+4G1.Q4RF+G4";
@@ -145,6 +107,7 @@ void music_JingleBells(void)
 	// Introduction(0) -> Verse&Bridge(1) -> Chorus1(2,3)
 	// -> Verse&Bridge(1) -> Chorus2(2,4) -> Chorus3(2,5)
 	const int seq_table[] ={0,1,2,3,1,2,4,2,5};
+	MML_Section song[9] = {};
 	
 	// set tempo
 	MMLplayer.setTempo(104);
@@ -154,23 +117,21 @@ void music_JingleBells(void)
 	MMLplayer.setTimbre(FM_CH2, &tmbBell);
 	MMLplayer.setTimbre(FM_CH3, &tmbEBass);
 	
+	// sections of the song
 	int i,j;
 	for(i=0;i<9;i++)
 	{
-		if(i==1){
-			// change timbre
-			MMLplayer.setTimbre(FM_CH1, &tmbZitar);
-		}
-		// set note
 		j = seq_table[i];
-		MMLplayer.setNote(FM_CH1,   note1[j]);
-		MMLplayer.setNote(FM_CH2,   note2[j]);
-		MMLplayer.setNote(FM_CH3,   note3[j]);
-		MMLplayer.setNote(SSG_CH_A, note4[j]);
-		MMLplayer.setNote(SSG_CH_B, note5[j]);
-		MMLplayer.setNote(SSG_CH_C, note6[j]);
-		
-		// start to play, and wait for the end
-		MMLplayer.playAndWait();
+		song[i].note[FM_CH1]   = note1[j];
+		song[i].note[FM_CH2]   = note2[j];
+		song[i].note[FM_CH3]   = note3[j];
+		song[i].note[SSG_CH_A] = note4[j];
+		song[i].note[SSG_CH_B] = note5[j];
+		song[i].note[SSG_CH_C] = note6[j];
 	}
+	MMLplayer.setSequence(song, 9);
+	
+	// start to play, and wait for the end
+	// (the sections go on without a gap in the timer interrupt)
+	MMLplayer.playAndWait();
 }